@@ -194,6 +194,10 @@ public:
 	/// of data, performance will suffer. Any code based on stream 
 	/// sockets that does not write excessively small chunks will 
 	/// work without any changes. 
+	///
+	/// To send a payload larger than k_cbMaxSteamNetworkingSocketsMessageSizeSend,
+	/// or one you don't want to hold in memory all at once, send it in chunks
+	/// using k_nSteamNetworkingSendFlags_StreamContinues.
 	virtual EResult SendMessageToConnection( HSteamNetConnection hConn, const void *pData, uint32 cbData, ESteamNetworkingSendType eSendType ) = 0;
 
 	/// If Nagle is enabled (it's on by default) then when calling 
@@ -329,10 +333,68 @@ public:
 #ifdef STEAMNETWORKINGSOCKETS_STANDALONELIB
 	virtual void RunCallbacks( ISteamNetworkingSocketsCallbacks *pCallbacks ) = 0;
 #endif
+
+	//
+	// Added in SteamNetworkingSockets002.  New methods always go at the end,
+	// so that the layout of the vtable stays compatible.
+	//
+
+	/// Same as SendMessageToConnection, but send the message on the specified lane.
+	/// See ConfigureConnectionLanes.  Lane 0 always exists, and is the lane used
+	/// by SendMessageToConnection.
+	virtual EResult SendMessageToConnectionOnLane( HSteamNetConnection hConn, const void *pData, uint32 cbData, ESteamNetworkingSendType eSendType, int idxLane ) = 0;
+
+	/// Configure multiple outbound messages streams ("lanes") on a connection, and
+	/// control head-of-line blocking between them.  Messages within a given lane
+	/// are always sent in the order they are queued, but messages from different
+	/// lanes may be sent out of order.  Each lane has its own reliable stream and
+	/// its own message numbers, so a large reliable transfer on one lane does not
+	/// hold up small reliable messages on another lane, either when sending or
+	/// when the receiver waits for lost data to be retransmitted.
+	///
+	/// Each lane has a priority and a weight.  Lower priority numbers are sent
+	/// first: data on a lane is only sent when all lanes with a lower priority
+	/// number have nothing queued.  Lanes with the same priority share the
+	/// bandwidth in proportion to their weights.
+	///
+	/// - nNumLanes: number of lanes, 1 .. k_nSteamNetworkingMaxLanes.  You can
+	///   add lanes, but not remove them.
+	/// - pLanePriorities: priority of each lane.  If nullptr, all lanes have priority 0.
+	/// - pLaneWeights: weight of each lane, must be >0.  If nullptr, all lanes have weight 1.
+	///
+	/// The peer must also be running code that supports lanes.  If it isn't,
+	/// and more than one lane is configured, the connection will fail.
+	virtual EResult ConfigureConnectionLanes( HSteamNetConnection hConn, int nNumLanes, const int *pLanePriorities, const uint16 *pLaneWeights ) = 0;
+
+	/// Same as GetQuickConnectionStatus, for many connections at once.  The
+	/// global lock is only taken once, so if you have lots of connections this
+	/// is much cheaper than calling GetQuickConnectionStatus in a loop.
+	///
+	/// pStats must have room for nConns entries.  If a handle is invalid, the
+	/// corresponding entry is cleared, and its m_eState will be
+	/// k_ESteamNetworkingConnectionState_None.  Returns the number of valid handles.
+	virtual int GetQuickConnectionStatusBulk( const HSteamNetConnection *pConns, int nConns, SteamNetworkingQuickConnectionStatus *pStats ) = 0;
+
+	/// Fetch the quick status of all connections accepted through a listen socket,
+	/// in a single lock acquisition.  Up to nMaxConns handles and status structs
+	/// are written to pOutConns and pOutStats, in no particular order.  Returns the
+	/// total number of connections, which might be more than nMaxConns, or -1 if
+	/// the listen socket handle is invalid.
+	virtual int GetQuickConnectionStatusOnListenSocket( HSteamListenSocket hSocket, HSteamNetConnection *pOutConns, SteamNetworkingQuickConnectionStatus *pOutStats, int nMaxConns ) = 0;
+
+	/// Fetch the stats used to produce GetDetailedConnectionStatus, in binary form,
+	/// so that you don't have to parse the text.  SteamDatagramLinkStats is defined
+	/// in <steam/steamnetworking_stats.h>.
+	virtual bool GetConnectionLinkStats( HSteamNetConnection hConn, SteamDatagramLinkStats *pStats ) = 0;
+
+	/// Fetch an estimate of the memory used by a connection, broken down by
+	/// component.  Returns false if the handle is invalid.
+	virtual bool GetConnectionMemoryUsage( HSteamNetConnection hConn, SteamNetConnectionMemoryUsage_t *pUsage ) = 0;
+
 protected:
 	~ISteamNetworkingSockets(); // Silence some warnings
 };
-#define STEAMNETWORKINGSOCKETS_VERSION "SteamNetworkingSockets001"
+#define STEAMNETWORKINGSOCKETS_VERSION "SteamNetworkingSockets002"
 
 extern "C" {
 
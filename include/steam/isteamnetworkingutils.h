@@ -19,6 +19,59 @@ extern "C" {
 // don't call this directly.  Use the ISteamnetworkingUtils interface
 STEAMNETWORKINGSOCKETS_INTERFACE SteamNetworkingMicroseconds SteamNetworkingSockets_GetLocalTimestamp();
 
+// Replace the clock used for all timestamps, including GetLocalTimestamp.
+// The function must be monotonic, and must be safe to call from any thread.
+// Pass nullptr to go back to the default clock.  Set this before initializing
+// the library, and don't change it afterwards.
+typedef SteamNetworkingMicroseconds (*FSteamNetworkingSocketsClock)();
+STEAMNETWORKINGSOCKETS_INTERFACE void SteamNetworkingSockets_SetClock( FSteamNetworkingSocketsClock pfnClock );
+
+// Run on a simulated, in-process network and clock, instead of real sockets
+// and wall clock time.  This is intended for automated tests and benchmarks.
+// Must be called before the library is initialized.
+//
+// There is no service thread.  The clock stands still until you call
+// SteamNetworkingSockets_VirtualNetwork_RunFor, which jumps directly from
+// one event to the next, so long simulations finish quickly and the same
+// sequence of API calls always produces the same results.  (Set
+// k_ESteamNetworkingConfigurationValue_FakeNetwork_Seed if you are also
+// using the fake network conditions.)
+//
+// All sockets are on a single host, 127.0.0.1.  Every packet takes
+// usecLatency to cross the network, in addition to any fake lag.
+STEAMNETWORKINGSOCKETS_INTERFACE bool SteamNetworkingSockets_VirtualNetwork_Enable( SteamNetworkingMicroseconds usecLatency );
+
+// Advance the virtual clock, delivering packets and doing all periodic
+// processing along the way.  Returns the new time.
+STEAMNETWORKINGSOCKETS_INTERFACE SteamNetworkingMicroseconds SteamNetworkingSockets_VirtualNetwork_RunFor( SteamNetworkingMicroseconds usecDuration );
+
+// Fetch a text report from the hot path profiler: call counts and time spent
+// in the service thread and API hot paths, since the library was loaded or
+// the profile was last reset.  The profiler is only compiled in if the library
+// was built with ENABLE_VPROF; otherwise the report just says so.  Same return
+// convention as ISteamNetworkingSockets::GetDetailedConnectionStatus.
+STEAMNETWORKINGSOCKETS_INTERFACE int SteamNetworkingSockets_GetProfileReport( char *pszBuf, int cbBuf );
+
+// Zero all profiler data.
+STEAMNETWORKINGSOCKETS_INTERFACE void SteamNetworkingSockets_ResetProfile();
+
+// Record a binary trace of packet level events (packets sent, received and
+// lost, with the ack, RTT and rate information at the time) into a ring of
+// nMaxEvents fixed size records, stored in a memory mapped file.  Once the
+// ring is full, the oldest events are overwritten.  If hConnFilter is
+// nonzero, only events for that connection are recorded.  Otherwise all
+// connections are traced, as well as raw UDP sends and receives.
+// The trace_decode tool converts the file to CSV or JSON.
+STEAMNETWORKINGSOCKETS_INTERFACE bool SteamNetworkingSockets_StartPacketTrace( const char *pszFilename, int nMaxEvents, HSteamNetConnection hConnFilter );
+
+// Stop recording and close the trace file.
+STEAMNETWORKINGSOCKETS_INTERFACE void SteamNetworkingSockets_StopPacketTrace();
+
+// Fetch counters for the whole process.  This does not take the global lock,
+// and is cheap enough to call every frame.  The counters are updated
+// independently, so they may be very slightly out of sync with each other.
+STEAMNETWORKINGSOCKETS_INTERFACE void SteamNetworkingSockets_GetGlobalMetrics( SteamNetworkingGlobalMetrics_t *pMetrics );
+
 }
 
 //-----------------------------------------------------------------------------
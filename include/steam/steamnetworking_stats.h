@@ -87,6 +87,12 @@ struct SteamDatagramLinkLifetimeStats
 	int64 m_nMessagesRecvReliable;
 	int64 m_nMessagesRecvUnreliable;
 
+	// SNP ack counters.  Comparing acks sent to data packets received
+	// shows how well we are coalescing acks.
+	int64 m_nPktsRecvAckEliciting; // packets received containing reliable data (or otherwise requiring an ack)
+	int64 m_nPktsSentWithAck; // packets sent containing an ack frame
+	int64 m_nPktsSentAckOnly; // packets sent only to deliver acks, with no data
+
 	//
 	// Ping distribution
 	//
@@ -328,6 +334,11 @@ struct SteamNetworkingDetailedConnectionStatus
 	/// Ping times to backup router, if any
 	int m_nBackupRouterFrontPing, m_nBackupRouterBackPing;
 
+	/// Global lock contention, indexed by ESteamNetworkingLockCaller.  This
+	/// isn't specific to the connection, but it's often the explanation
+	/// when the game thread stalls in an API call.
+	SteamNetworkingLockMetrics_t m_lock[ k_ESteamNetworkingLockCaller__Count ];
+
 	/// Clear everything to an unknown state
 	void Clear();
 
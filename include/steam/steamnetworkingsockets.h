@@ -26,6 +26,14 @@ STEAMNETWORKINGSOCKETS_INTERFACE void GameNetworkingSockets_Kill();
 // Set debug output hook
 STEAMNETWORKINGSOCKETS_INTERFACE void SteamNetworkingSockets_SetDebugOutputFunction( /* ESteamNetworkingSocketsDebugOutputType */ int eDetailLevel, FSteamNetworkingSocketsDebugOutput pfnFunc );
 
+// Route the library's allocations on the message path (messages, send queues,
+// reliability bookkeeping, connection objects) through your own allocator,
+// with a tag saying what each block is for.  Set this before initializing
+// the library.  All three hooks must be set, or all nullptr to go back to
+// malloc/realloc/free.  Returns false, and changes nothing, if any memory
+// allocated through the previous hooks is still outstanding.
+STEAMNETWORKINGSOCKETS_INTERFACE bool SteamNetworkingSockets_SetAllocator( FSteamNetworkingSocketsAlloc pfnAlloc, FSteamNetworkingSocketsRealloc pfnRealloc, FSteamNetworkingSocketsFree pfnFree );
+
 }
 
 /// Callback dispatch mechanism.  Override this and then use
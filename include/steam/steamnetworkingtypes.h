@@ -54,6 +54,7 @@ enum { k_iSteamNetworkingMessagesCallbacks = 1250 };
 struct SteamDatagramRelayAuthTicket;
 struct SteamDatagramHostedAddress;
 struct SteamNetConnectionStatusChangedCallback_t;
+struct SteamDatagramLinkStats;
 
 /// Handle used to identify a connection to a remote host.
 typedef uint32 HSteamNetConnection;
@@ -67,6 +68,33 @@ const int k_nSteamNetworkingSendFlags_NoNagle = 1;
 const int k_nSteamNetworkingSendFlags_NoDelay = 2;
 const int k_nSteamNetworkingSendFlags_Reliable = 8;
 
+/// Only meaningful with k_nSteamNetworkingSendFlags_Reliable.  The message is
+/// delivered as soon as it has been completely received, even if earlier
+/// reliable messages on the same lane are still waiting to be retransmitted.
+/// It is still delivered exactly once.  If the peer is too old to support this,
+/// then the message is delivered in order.  (Messages queued while the
+/// connection is still being established are fine; they are sent unordered
+/// once we know the peer supports it.)
+const int k_nSteamNetworkingSendFlags_Unordered = 16;
+
+/// Only meaningful with k_nSteamNetworkingSendFlags_Reliable.  The message is
+/// one chunk of a larger payload ("stream"), and more chunks follow.  Send the
+/// last chunk without this flag.  This lets you send a payload of any size,
+/// without ever having the whole thing in memory on either side: send the
+/// payload in chunks of up to k_cbMaxSteamNetworkingSocketsMessageSizeSend, and
+/// when SendMessageToConnection returns k_EResultLimitExceeded, the send buffer
+/// (k_ESteamNetworkingConfigurationValue_SendBufferSize) is full, so try that
+/// chunk again later.  The receiver gets each chunk as an ordinary message as
+/// soon as it arrives, with k_nSteamNetworkingMessageFlags_StreamContinues set
+/// on all but the last.  May not be combined with k_nSteamNetworkingSendFlags_Unordered.
+/// The peer must support it; if it turns out not to, the connection fails.
+const int k_nSteamNetworkingSendFlags_StreamContinues = 32;
+
+/// Set in SteamNetworkingMessage_t::m_nFlags when the sender used
+/// k_nSteamNetworkingSendFlags_StreamContinues.  The next reliable message on
+/// the same lane is the next chunk of the same payload.
+const int k_nSteamNetworkingMessageFlags_StreamContinues = 1;
+
 /// Different methods of describing the identity of a network host
 enum ESteamNetworkingIdentityType
 {
@@ -275,6 +303,16 @@ enum ESteamNetworkingSendType
 	//
 	// Migration note: This is equivalent to k_EP2PSendReliable
 	k_ESteamNetworkingSendType_ReliableNoNagle = k_nSteamNetworkingSendFlags_Reliable|k_nSteamNetworkingSendFlags_NoNagle,
+
+	// Send a message reliably, but let the receiver deliver it as soon as it arrives,
+	// without waiting for reliable messages that were sent before it.  Use this
+	// for messages that don't depend on each other (chat, inventory updates, etc),
+	// so that one lost packet doesn't delay all of them.
+	// See k_nSteamNetworkingSendFlags_Unordered
+	k_ESteamNetworkingSendType_ReliableUnordered = k_nSteamNetworkingSendFlags_Reliable|k_nSteamNetworkingSendFlags_Unordered,
+
+	// Send a message reliably and unordered, bypassing Nagle's algorithm.
+	k_ESteamNetworkingSendType_ReliableUnorderedNoNagle = k_nSteamNetworkingSendFlags_Reliable|k_nSteamNetworkingSendFlags_Unordered|k_nSteamNetworkingSendFlags_NoNagle,
 };
 
 /// High level connection status
@@ -440,6 +478,9 @@ typedef int64 SteamNetworkingMicroseconds;
 /// and our peer might, too.
 const int k_cbMaxSteamNetworkingSocketsMessageSizeSend = 512 * 1024;
 
+/// Max number of lanes on a connection.  See ISteamNetworkingSockets::ConfigureConnectionLanes
+const int k_nSteamNetworkingMaxLanes = 32;
+
 /// Message that has been received
 typedef struct _SteamNetworkingMessage_t
 {
@@ -485,8 +526,12 @@ typedef struct _SteamNetworkingMessage_t
 	/// (Not used for messages received on "connections")
 	int m_nChannel;
 
-	/// Pad to multiple of 8 bytes
-	int m___nPadDummy;
+	/// The lane the message was received on.  (Always 0 unless the sender
+	/// configured lanes.  See ISteamNetworkingSockets::ConfigureConnectionLanes)
+	uint16 m_idxLane;
+
+	/// Bitmask of k_nSteamNetworkingMessageFlags_xxx
+	uint16 m_nFlags;
 
 	#ifdef __cplusplus
 
@@ -505,6 +550,7 @@ typedef struct _SteamNetworkingMessage_t
 		inline int64 GetConnectionUserData() const { return m_nConnUserData; }
 		inline SteamNetworkingMicroseconds GetTimeReceived() const { return m_usecTimeReceived; }
 		inline int64 GetMessageNumber() const { return m_nMessageNumber; }
+		inline int GetLane() const { return m_idxLane; }
 	#endif
 } SteamNetworkingMessage_t;
 
@@ -830,8 +876,146 @@ struct SteamNetworkingQuickConnectionStatus
 	SteamNetworkingMicroseconds m_usecQueueTime;
 };
 
+/// Memory used by a connection, broken down by what it is used for.  All
+/// values are in bytes, and include our best guess at allocator overhead, so
+/// they are estimates.  Each field counts both the members embedded in the
+/// connection object and any memory they point to, so the fields add up
+/// to m_cbTotal.
+struct SteamNetConnectionMemoryUsage_t
+{
+	/// Total memory used by the connection
+	int m_cbTotal;
+
+	/// Connection object itself, not counting members that are broken out below
+	int m_cbConnection;
+
+	/// Messages queued to send, and reliable messages that have been sent
+	/// but not yet acked
+	int m_cbSendQueue;
+
+	/// Received reliable stream data that we cannot yet deliver (because of
+	/// gaps), gap tracking, and reassembly of fragmented unreliable messages
+	int m_cbRecvBuffer;
+
+	/// Messages that have been received but not yet retrieved by the app
+	int m_cbRecvQueue;
+
+	/// Tables of packets and reliable ranges that are in flight
+	int m_cbInFlight;
+
+	/// Link quality and ping stats
+	int m_cbStats;
+
+	/// Certs, keys, and handshake state
+	int m_cbCrypto;
+
+	/// Anything that is specific to the type of connection.  Sockets, etc
+	int m_cbTransport;
+};
+
 #pragma pack( pop )
 
+/// Reasons we discard a packet without processing it.  See
+/// SteamNetworkingGlobalMetrics_t::m_nBadPackets
+enum ESteamNetworkingBadPacketReason
+{
+	k_ESteamNetworkingBadPacket_Malformed = 0,		// Too short, bad lead byte, failed to parse, etc
+	k_ESteamNetworkingBadPacket_ConnectionID = 1,	// Connection ID is missing, unknown, or doesn't match
+	k_ESteamNetworkingBadPacket_Challenge = 2,		// Challenge is missing or incorrect
+	k_ESteamNetworkingBadPacket_Auth = 3,			// Problem with identity, certificate, or crypto
+	k_ESteamNetworkingBadPacket_Unexpected = 4,		// Valid packet, but we weren't expecting it
+	k_ESteamNetworkingBadPacket__Count
+};
+
+/// Number of buckets in the timing histograms in SteamNetworkingGlobalMetrics_t.
+/// Bucket 0 counts durations less than 1 microsecond.  Bucket N counts durations
+/// in the range [2^(N-1), 2^N) microseconds, except for the last bucket, which
+/// counts everything longer than that.
+const int k_nSteamNetworkingMetricsHistogramBuckets = 16;
+
+/// Which API (or thread) acquired the global lock.  See SteamNetworkingLockMetrics_t
+enum ESteamNetworkingLockCaller
+{
+	k_ESteamNetworkingLockCaller_Other = 0,			// Any API call not listed below
+	k_ESteamNetworkingLockCaller_Send = 1,			// SendMessageToConnection, FlushMessagesOnConnection, etc
+	k_ESteamNetworkingLockCaller_Receive = 2,		// ReceiveMessagesOnConnection, etc
+	k_ESteamNetworkingLockCaller_Callbacks = 3,		// RunCallbacks
+	k_ESteamNetworkingLockCaller_ServiceThread = 4,	// Service thread (or virtual network), processing packets and timers
+	k_ESteamNetworkingLockCaller__Count
+};
+
+/// Contention on the global lock, for one type of caller.  Recursive
+/// acquisitions are not counted, and the hold time is charged to the
+/// caller that acquired the lock first.
+struct SteamNetworkingLockMetrics_t
+{
+	int64 m_nAcquired;
+	int64 m_histWaitUsec[ k_nSteamNetworkingMetricsHistogramBuckets ];
+	int64 m_histHoldUsec[ k_nSteamNetworkingMetricsHistogramBuckets ];
+};
+
+/// What a block of memory allocated by the library is used for.  Passed to
+/// the allocator hooks (see SteamNetworkingSockets_SetAllocator) so that you
+/// can count or place allocations by purpose.
+enum ESteamNetworkingAllocTag
+{
+	k_ESteamNetworkingAllocTag_Other = 0,		// Anything not listed below
+	k_ESteamNetworkingAllocTag_Message = 1,		// Received SteamNetworkingMessage_t objects and their payload
+	k_ESteamNetworkingAllocTag_SendQueue = 2,	// Copies of messages sent by the app, kept until sent (and acked, if reliable)
+	k_ESteamNetworkingAllocTag_SNP = 3,			// Reliability bookkeeping: packets in flight, reliable ranges and gaps, reassembly buffers
+	k_ESteamNetworkingAllocTag_Connection = 4,	// Connection objects and their lazily allocated state
+	k_ESteamNetworkingAllocTag__Count
+};
+
+/// Counters for the whole process, returned by SteamNetworkingSockets_GetGlobalMetrics.
+/// Unless otherwise noted, values are totals since the library was loaded.
+struct SteamNetworkingGlobalMetrics_t
+{
+	/// Plain UDP sockets.  Packets and bytes are totals for all sockets.
+	/// Byte counts are UDP payload sizes.
+	int m_nUDPSocketsOpen; // Current value
+	int64 m_nUDPPacketsSent;
+	int64 m_nUDPBytesSent;
+	int64 m_nUDPPacketsRecv;
+	int64 m_nUDPBytesRecv;
+
+	/// Packets we discarded, by ESteamNetworkingBadPacketReason
+	int64 m_nBadPackets[ k_ESteamNetworkingBadPacket__Count ];
+
+	/// Data packets that failed to decrypt
+	int64 m_nDecryptFailures;
+
+	/// Number of connection objects that exist.  This includes connections that
+	/// have been closed by the application but are still lingering.
+	int m_nConnections; // Current value
+
+	/// Connections that entered the connecting state, and how many of those
+	/// went on to be connected, or failed before getting there.  (Connections
+	/// closed by the application while connecting aren't counted as failed.)
+	int64 m_nHandshakesStarted;
+	int64 m_nHandshakesCompleted;
+	int64 m_nHandshakesFailed;
+
+	/// Number of objects scheduled to think in the service thread
+	int m_nThinkersScheduled; // Current value
+
+	/// Global lock.  How many times it has been acquired, and histograms of
+	/// how long we waited to get it and how long it was held, indexed by
+	/// ESteamNetworkingLockCaller.
+	SteamNetworkingLockMetrics_t m_lock[ k_ESteamNetworkingLockCaller__Count ];
+
+	/// SteamNetworkingMessage_t objects.  The byte count is the total payload
+	/// size at the time the messages were allocated.
+	int64 m_nMessagesAllocated;
+	int64 m_cbMessagesAllocated;
+	int m_nMessagesOutstanding; // Current value
+
+	/// Heap blocks allocated through the allocator hooks, indexed by
+	/// ESteamNetworkingAllocTag.  See SteamNetworkingSockets_SetAllocator
+	int64 m_nAllocations[ k_ESteamNetworkingAllocTag__Count ];
+	int m_nAllocationsOutstanding[ k_ESteamNetworkingAllocTag__Count ]; // Current value
+};
+
 /// Configuration values for Steam networking. 
 ///  
 /// Most of these are for controlling extend logging or features 
@@ -948,6 +1132,103 @@ enum ESteamNetworkingConfigurationValue
 	/// Timeout value (in seconds) to use after connection is established
 	k_ESteamNetworkingConfigurationValue_Timeout_Seconds_Connected = 25,
 
+	/// Globally add a random amount of extra delay to outbound packets, in
+	/// addition to FakePacketLag_Send.  The value is the average extra delay,
+	/// in ms.  The shape is controlled by FakePacketJitter_Distribution.
+	k_ESteamNetworkingConfigurationValue_FakePacketJitter_Send = 26,
+
+	/// Globally add a random amount of extra delay to received packets.
+	k_ESteamNetworkingConfigurationValue_FakePacketJitter_Recv = 27,
+
+	/// Distribution of the fake jitter.  See ESteamNetworkingFakePacketJitterDistribution.
+	/// Default is k_ESteamNetworkingFakePacketJitter_Uniform
+	k_ESteamNetworkingConfigurationValue_FakePacketJitter_Distribution = 28,
+
+	/// 0-100 Globally send a duplicate copy of N pct of outbound packets
+	k_ESteamNetworkingConfigurationValue_FakePacketDup_Send = 29,
+
+	/// 0-100 Globally duplicate N pct of received packets
+	k_ESteamNetworkingConfigurationValue_FakePacketDup_Recv = 30,
+
+	/// 0-99 Globally discard N pct of outbound packets, in bursts.  (This
+	/// is in addition to FakePacketLoss_Send, which is uniform.)  Loss follows
+	/// a two-state Gilbert-Elliott model.  The average length of a burst
+	/// is set by FakePacketBurstLoss_Length.
+	k_ESteamNetworkingConfigurationValue_FakePacketBurstLoss_Send = 31,
+
+	/// 0-99 Globally discard N pct of received packets, in bursts.
+	k_ESteamNetworkingConfigurationValue_FakePacketBurstLoss_Recv = 32,
+
+	/// Average number of consecutive packets dropped in each loss burst.
+	/// Default is 4.
+	k_ESteamNetworkingConfigurationValue_FakePacketBurstLoss_Length = 33,
+
+	/// Simulate a bottleneck link for all outbound packets, with the given
+	/// bandwidth in bytes/sec.  Packets are queued behind the bottleneck,
+	/// and dropped if the queue is full.  0 (the default) is no limit.
+	k_ESteamNetworkingConfigurationValue_FakePacketBandwidth_Send = 34,
+
+	/// Simulate a bottleneck link for all received packets, in bytes/sec.
+	k_ESteamNetworkingConfigurationValue_FakePacketBandwidth_Recv = 35,
+
+	/// Size of the queue in front of the fake bottleneck link, in bytes.
+	/// Default is 64k.
+	k_ESteamNetworkingConfigurationValue_FakePacketQueue_Size = 36,
+
+	/// How the fake bottleneck queue decides which packets to drop.
+	/// See ESteamNetworkingFakePacketQueueDiscipline.  Default is
+	/// k_ESteamNetworkingFakePacketQueue_DropTail
+	k_ESteamNetworkingConfigurationValue_FakePacketQueue_Discipline = 37,
+
+	/// Seed for the random number generator used for all of the fake network
+	/// conditions.  Setting this value (even to the same value it already had)
+	/// restarts the sequence, and resets the state of the fake bottleneck
+	/// and burst loss, so that the same sequence of decisions will be made.
+	/// 0 (the default) means seed from a true source of entropy.
+	k_ESteamNetworkingConfigurationValue_FakeNetwork_Seed = 38,
+
+	/// Congestion control algorithm used to set the send rate of new
+	/// connections.  See ESteamNetworkingCongestionControl.  This can be
+	/// overridden per connection.  Default is k_ESteamNetworkingCongestionControl_Fixed,
+	/// which is the same as older versions.  TFRC and BBR are opt-in.
+	k_ESteamNetworkingConfigurationValue_CongestionControl = 39,
+
+	/// Largest burst (in bytes) that a connection will send at line rate
+	/// after it has been idle or its thread woke up late.  Packets beyond
+	/// this are spaced out to match the send rate.  Smaller values are
+	/// kinder to routers with shallow buffers.  Default is one packet.
+	k_ESteamNetworkingConfigurationValue_SendPacingQuantum = 40,
+
+	/// Largest UDP payload, in bytes, that path MTU discovery will try to
+	/// use.  Connections start out sending packets that will fit through
+	/// basically any path, and probe for larger sizes up to this limit.
+	/// Values of 1300 or less disable probing.  Default is 1472, which
+	/// fits in a standard 1500 byte ethernet frame.  Raise it to 8952 on
+	/// networks with jumbo frames.
+	k_ESteamNetworkingConfigurationValue_PathMTU_Max = 41,
+
+	/// Globally drop all outbound packets with a UDP payload larger than
+	/// N bytes, as if the path had a smaller MTU.  0 (the default) is no limit.
+	k_ESteamNetworkingConfigurationValue_FakePacketMTU_Send = 42,
+
+	/// Ask the peer to send an ack after it receives this many packets
+	/// containing reliable data, even if the ack delay hasn't expired.
+	/// 0 means acks are only sent on the timer.  Default is 10.
+	k_ESteamNetworkingConfigurationValue_AckPacketTolerance = 43,
+
+	/// Longest the peer should hold onto an ack, as a percentage of the
+	/// round trip time.  It's always at least 1ms and at most 50ms.
+	/// 0 (the default) means always use the max of 50ms.
+	k_ESteamNetworkingConfigurationValue_AckDelayPctRTT = 44,
+
+	/// If nonzero, debug output is queued in a lock-free ring and delivered
+	/// to the FSteamNetworkingSocketsDebugOutput callback from a separate
+	/// thread, so that verbose logging doesn't stall packet processing.  If
+	/// the ring fills up, records are dropped and a warning reports how
+	/// many.  In this mode the callback must not call into the API.
+	/// Default is 0, which calls the callback synchronously.
+	k_ESteamNetworkingConfigurationValue_LogAsync = 45,
+
 	/// Number of k_ESteamNetworkingConfigurationValue defines
 	k_ESteamNetworkingConfigurationValue_Count,
 };
@@ -986,10 +1267,71 @@ enum ESteamNetworkingConnectionConfigurationValue
 	// is allowed to reach.  Default is 0 (no-limit)
 	k_ESteamNetworkingConnectionConfigurationValue_SNP_MinRate = 1,
 
+	// Delay all outbound packets on this connection by N ms.
+	// -1 (the default) means use the global FakePacketLag_Send value.
+	k_ESteamNetworkingConnectionConfigurationValue_FakePacketLag_Send = 2,
+
+	// Average amount of random extra delay (ms) on outbound packets on this connection.
+	// -1 (the default) means use the global FakePacketJitter_Send value.
+	k_ESteamNetworkingConnectionConfigurationValue_FakePacketJitter_Send = 3,
+
+	// Distribution of fake jitter on this connection.  (ESteamNetworkingFakePacketJitterDistribution)
+	// 0 means use the global FakePacketJitter_Distribution value.
+	k_ESteamNetworkingConnectionConfigurationValue_FakePacketJitter_Distribution = 4,
+
+	// Congestion control algorithm for this connection.  (ESteamNetworkingCongestionControl)
+	// 0 means use the global CongestionControl value.  Can be changed at any time.
+	k_ESteamNetworkingConnectionConfigurationValue_CongestionControl = 5,
+
 	// Number of k_ESteamNetworkingConfigurationValue defines
 	k_ESteamNetworkingConnectionConfigurationValue_Count,
 };
 
+/// Shape of the random extra delay added by the fake jitter settings.
+/// All of them have the same mean (the configured jitter value).
+enum ESteamNetworkingFakePacketJitterDistribution
+{
+	// Uniform between 0 and twice the configured value
+	k_ESteamNetworkingFakePacketJitter_Uniform = 1,
+
+	// Normal distribution, with standard deviation half the configured
+	// value.  (Clamped at zero.)
+	k_ESteamNetworkingFakePacketJitter_Normal = 2,
+
+	// Pareto (type II), shape 2.5.  Most packets get a small amount of
+	// delay, with occasional large spikes.
+	k_ESteamNetworkingFakePacketJitter_Pareto = 3,
+};
+
+/// How the fake bottleneck link decides which packets to drop
+enum ESteamNetworkingFakePacketQueueDiscipline
+{
+	// Drop arriving packets only when the queue is full
+	k_ESteamNetworkingFakePacketQueue_DropTail = 1,
+
+	// Random early detection.  Drop arriving packets with increasing
+	// probability as the average queue depth grows, to model an AQM router.
+	k_ESteamNetworkingFakePacketQueue_RED = 2,
+};
+
+/// Algorithm used to decide how fast a connection sends.  Whatever the
+/// algorithm decides, the rate is always clamped to the min/max rate.
+enum ESteamNetworkingCongestionControl
+{
+	// Don't react to network conditions.  Start at a rate based on the
+	// ping, and stay there.
+	k_ESteamNetworkingCongestionControl_Fixed = 1,
+
+	// TCP-friendly rate control (RFC 5348).  The loss event rate is
+	// measured by the sender, based on acks.
+	k_ESteamNetworkingCongestionControl_TFRC = 2,
+
+	// Model-based, in the style of BBR.  Estimate the bottleneck bandwidth
+	// and the min RTT, and send at a rate just above the bottleneck, in
+	// order to keep the queue at the bottleneck short.
+	k_ESteamNetworkingCongestionControl_BBR = 3,
+};
+
 enum ESteamNetworkingSocketsDebugOutputType
 {
 	k_ESteamNetworkingSocketsDebugOutputType_None,
@@ -1006,6 +1348,13 @@ enum ESteamNetworkingSocketsDebugOutputType
 /// Setup callback for debug output, and the desired verbosity you want.
 typedef void (*FSteamNetworkingSocketsDebugOutput)( /* ESteamNetworkingSocketsDebugOutputType */ int nType, const char *pszMsg );
 
+/// Allocator hooks.  See SteamNetworkingSockets_SetAllocator.  The free and
+/// realloc hooks receive the same tag that the block was allocated with.
+/// Allocation must not fail.
+typedef void *(*FSteamNetworkingSocketsAlloc)( size_t cb, ESteamNetworkingAllocTag eTag );
+typedef void *(*FSteamNetworkingSocketsRealloc)( void *p, size_t cb, ESteamNetworkingAllocTag eTag );
+typedef void (*FSteamNetworkingSocketsFree)( void *p, ESteamNetworkingAllocTag eTag );
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 // Internal stuff
@@ -1,5 +1,142 @@
+//====== Copyright Valve Corporation, All rights reserved. ====================
+//
+// Lightweight hot path profiler.
+//
+// Compiled out entirely unless VPROF_ENABLED is defined.  (See the
+// ENABLE_VPROF cmake option.)  When enabled, each VPROF_BUDGET scope costs a
+// pair of timestamp counter reads and a few relaxed atomic adds.  Nodes are
+// static per call site, and register themselves the first time they are hit.
+// Time spent in nested scopes is subtracted from the parent, so the
+// "exclusive" totals add up to the total time spent inside all scopes.
+//
+//=============================================================================
+
 #ifndef VPROF_H
 #define VPROF_H
+#pragma once
+
+// Budget groups.  These are just strings; scopes in the same group are
+// totaled together in the report.
+#define VPROF_BUDGETGROUP_OTHER			"Other"
+#define VPROF_BUDGETGROUP_ENCRYPTION	"Encryption"
+#define VPROF_BUDGETGROUP_SOCKETS		"Sockets"
+#define VPROF_BUDGETGROUP_THINK			"Think"
+#define VPROF_BUDGETGROUP_SNP			"SNP"
+#define VPROF_BUDGETGROUP_HANDSHAKE		"Handshake"
+
+#ifdef VPROF_ENABLED
+
+#include <atomic>
+#include "platform.h"
+
+#if defined( _MSC_VER ) && ( defined( _M_X64 ) || defined( _M_IX86 ) )
+	#include <intrin.h>
+	#define VPROF_RDTSC() __rdtsc()
+#elif ( defined( __GNUC__ ) || defined( __clang__ ) ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+	// Use the builtin rather than <x86intrin.h>, which conflicts with the
+	// hand-rolled AES-NI intrinsics in crypto.cpp
+	#define VPROF_RDTSC() __builtin_ia32_rdtsc()
+#endif
+
+/// Raw timestamp.  Units are arbitrary, and converted to wall clock
+/// time when the report is generated.
+inline uint64 VProf_Ticks()
+{
+	#ifdef VPROF_RDTSC
+		return VPROF_RDTSC();
+	#else
+		return Plat_RelativeTicks();
+	#endif
+}
+
+/// Timing data for a single VPROF_BUDGET call site
+class CVProfNode
+{
+public:
+	CVProfNode( const char *pszName, const char *pszGroup );
+
+	const char *const m_pszName;
+	const char *const m_pszGroup;
+	std::atomic<uint64> m_nCalls;
+	std::atomic<uint64> m_nTicksInclusive;
+	std::atomic<uint64> m_nTicksExclusive;
+	std::atomic<uint64> m_nTicksMax;
+
+	/// Next node in the global list.  Nodes are never removed.
+	CVProfNode *m_pNext;
+
+	inline void Record( uint64 nTicks, uint64 nTicksChildren )
+	{
+		m_nCalls.fetch_add( 1, std::memory_order_relaxed );
+		m_nTicksInclusive.fetch_add( nTicks, std::memory_order_relaxed );
+		m_nTicksExclusive.fetch_add( nTicks - nTicksChildren, std::memory_order_relaxed );
+		uint64 nMax = m_nTicksMax.load( std::memory_order_relaxed );
+		while ( nTicks > nMax && !m_nTicksMax.compare_exchange_weak( nMax, nTicks, std::memory_order_relaxed ) ) {}
+	}
+};
+
+/// Counter for VPROF_INCREMENT_COUNTER
+class CVProfCounter
+{
+public:
+	CVProfCounter( const char *pszName, const char *pszGroup );
+
+	const char *const m_pszName;
+	const char *const m_pszGroup;
+	std::atomic<int64> m_nValue;
+	CVProfCounter *m_pNext;
+
+	inline void Add( int64 nAmount ) { m_nValue.fetch_add( nAmount, std::memory_order_relaxed ); }
+};
+
+/// Stack object that times a scope.  Scopes on the same thread form a
+/// stack, so that we can charge a child's time to the child and not the parent.
+class CVProfScope
+{
+public:
+	inline CVProfScope( CVProfNode &node ) : m_node( node ), m_nTicksChildren( 0 ), m_pParent( s_pCurrent )
+	{
+		s_pCurrent = this;
+		m_nTicksStart = VProf_Ticks();
+	}
+	inline ~CVProfScope()
+	{
+		uint64 nTicks = VProf_Ticks() - m_nTicksStart;
+		m_node.Record( nTicks, m_nTicksChildren );
+		if ( m_pParent )
+			m_pParent->m_nTicksChildren += nTicks;
+		s_pCurrent = m_pParent;
+	}
+private:
+	CVProfNode &m_node;
+	uint64 m_nTicksStart;
+	uint64 m_nTicksChildren;
+	CVProfScope *const m_pParent;
+	static thread_local CVProfScope *s_pCurrent;
+};
+
+#define VPROF_CONCAT_( a, b ) a##b
+#define VPROF_CONCAT( a, b ) VPROF_CONCAT_( a, b )
+
+#define VPROF_BUDGET( name, group ) \
+	static CVProfNode VPROF_CONCAT( s_vprofNode, __LINE__ )( name, group ); \
+	CVProfScope VPROF_CONCAT( vprofScope, __LINE__ )( VPROF_CONCAT( s_vprofNode, __LINE__ ) )
+
+#define	VPROF( name )									VPROF_BUDGET( name, VPROF_BUDGETGROUP_OTHER )
+#define	VPROF_ASSERT_ACCOUNTED( name )					VPROF_BUDGET( name, VPROF_BUDGETGROUP_OTHER )
+#define	VPROF_( name, detail, group, bAssertAccounted )	VPROF_BUDGET( name, group )
+#define VPROF_BUDGET_FLAGS( name, group, flags )		VPROF_BUDGET( name, group )
+
+#define VPROF_SCOPE_BEGIN( tag )	do { VPROF( tag );
+#define VPROF_SCOPE_END()			} while (0)
+
+#define VPROF_ONLY( expression )	expression
+
+#define VPROF_INCREMENT_GROUP_COUNTER( name, group, amount ) \
+	do { static CVProfCounter s_vprofCounter( name, group ); s_vprofCounter.Add( amount ); } while (0)
+#define VPROF_INCREMENT_COUNTER( name, amount )			VPROF_INCREMENT_GROUP_COUNTER( name, VPROF_BUDGETGROUP_OTHER, amount )
+
+#else
 
 #define	VPROF( name )									((void)0)
 #define	VPROF_ASSERT_ACCOUNTED( name )					((void)0)
@@ -15,4 +152,15 @@
 #define VPROF_INCREMENT_COUNTER(name,amount)			((void)0)
 #define VPROF_INCREMENT_GROUP_COUNTER(name,group,amount) ((void)0)
 
+#endif // #ifdef VPROF_ENABLED
+
+/// Format a report of everything measured since the last reset.  Same return
+/// convention as ISteamNetworkingSockets::GetDetailedConnectionStatus: 0 if
+/// the text fit, otherwise the size of buffer needed.  Works (and says so)
+/// even when the profiler isn't compiled in.
+int VProf_GetReport( char *pszOut, int cbOut );
+
+/// Zero all nodes and counters.
+void VProf_Reset();
+
 #endif // VPROF_H
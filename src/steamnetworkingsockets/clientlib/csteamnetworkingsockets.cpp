@@ -2,6 +2,7 @@
 
 #include "csteamnetworkingsockets.h"
 #include <steam/steamnetworkingsockets.h>
+#include <steam/isteamnetworkingutils.h>
 #include "steamnetworkingsockets_lowlevel.h"
 #include "steamnetworkingsockets_connections.h"
 #include "steamnetworkingsockets_udp.h"
@@ -64,6 +65,26 @@ static SConfigurationValueEntry sConfigurationValueEntryList[] =
 	{ k_ESteamNetworkingConfigurationValue_IP_Allow_Without_Auth,                      "IpAllowWithoutAuth",                         &steamdatagram_ip_allow_connections_without_auth },
 	{ k_ESteamNetworkingConfigurationValue_Timeout_Seconds_Initial,                    "TimeoutSecondsInitial",                      &steamdatagram_timeout_seconds_initial },
 	{ k_ESteamNetworkingConfigurationValue_Timeout_Seconds_Connected,                  "TimeoutSecondsConnected",                    &steamdatagram_timeout_seconds_connected },
+	{ k_ESteamNetworkingConfigurationValue_FakePacketJitter_Send,                      "FakePacketJitter_Send",                      &steamdatagram_fakepacketjitter_send },
+	{ k_ESteamNetworkingConfigurationValue_FakePacketJitter_Recv,                      "FakePacketJitter_Recv",                      &steamdatagram_fakepacketjitter_recv },
+	{ k_ESteamNetworkingConfigurationValue_FakePacketJitter_Distribution,              "FakePacketJitter_Distribution",              &steamdatagram_fakepacketjitter_distribution },
+	{ k_ESteamNetworkingConfigurationValue_FakePacketDup_Send,                         "FakePacketDup_Send",                         &steamdatagram_fakepacketdup_send },
+	{ k_ESteamNetworkingConfigurationValue_FakePacketDup_Recv,                         "FakePacketDup_Recv",                         &steamdatagram_fakepacketdup_recv },
+	{ k_ESteamNetworkingConfigurationValue_FakePacketBurstLoss_Send,                   "FakePacketBurstLoss_Send",                   &steamdatagram_fakepacketburstloss_send },
+	{ k_ESteamNetworkingConfigurationValue_FakePacketBurstLoss_Recv,                   "FakePacketBurstLoss_Recv",                   &steamdatagram_fakepacketburstloss_recv },
+	{ k_ESteamNetworkingConfigurationValue_FakePacketBurstLoss_Length,                 "FakePacketBurstLoss_Length",                 &steamdatagram_fakepacketburstloss_length },
+	{ k_ESteamNetworkingConfigurationValue_FakePacketBandwidth_Send,                   "FakePacketBandwidth_Send",                   &steamdatagram_fakepacketbandwidth_send },
+	{ k_ESteamNetworkingConfigurationValue_FakePacketBandwidth_Recv,                   "FakePacketBandwidth_Recv",                   &steamdatagram_fakepacketbandwidth_recv },
+	{ k_ESteamNetworkingConfigurationValue_FakePacketQueue_Size,                       "FakePacketQueue_Size",                       &steamdatagram_fakepacketqueue_size },
+	{ k_ESteamNetworkingConfigurationValue_FakePacketQueue_Discipline,                 "FakePacketQueue_Discipline",                 &steamdatagram_fakepacketqueue_discipline },
+	{ k_ESteamNetworkingConfigurationValue_FakeNetwork_Seed,                           "FakeNetwork_Seed",                           &steamdatagram_fakenetwork_seed },
+	{ k_ESteamNetworkingConfigurationValue_CongestionControl,                          "CongestionControl",                          &steamdatagram_snp_congestion_control },
+	{ k_ESteamNetworkingConfigurationValue_SendPacingQuantum,                          "SendPacingQuantum",                          &steamdatagram_snp_pacing_quantum },
+	{ k_ESteamNetworkingConfigurationValue_PathMTU_Max,                                "PathMTU_Max",                                &steamdatagram_snp_pathmtu_max },
+	{ k_ESteamNetworkingConfigurationValue_FakePacketMTU_Send,                         "FakePacketMTU_Send",                         &steamdatagram_fakepacketmtu_send },
+	{ k_ESteamNetworkingConfigurationValue_AckPacketTolerance,                         "AckPacketTolerance",                         &steamdatagram_snp_ack_packet_tolerance },
+	{ k_ESteamNetworkingConfigurationValue_AckDelayPctRTT,                             "AckDelayPctRTT",                             &steamdatagram_snp_ack_delay_pct_rtt },
+	{ k_ESteamNetworkingConfigurationValue_LogAsync,                                   "LogAsync",                                   &steamdatagram_log_async },
 };
 COMPILE_TIME_ASSERT( sizeof( sConfigurationValueEntryList ) / sizeof( SConfigurationValueEntry ) == k_ESteamNetworkingConfigurationValue_Count );
 
@@ -88,7 +109,7 @@ COMPILE_TIME_ASSERT( sizeof( sConfigurationStringEntryList ) / sizeof( SConfigur
 //
 /////////////////////////////////////////////////////////////////////////////
 
-CUtlHashMap<uint16, CSteamNetworkConnectionBase *, std::equal_to<uint16>, Identity<uint16> > g_mapConnections;
+CConnectionHandleTable g_tableConnections;
 CUtlHashMap<int, CSteamNetworkListenSocketBase *, std::equal_to<int>, Identity<int> > g_mapListenSockets;
 
 static bool BConnectionStateExistsToAPI( ESteamNetworkingConnectionState eState )
@@ -113,21 +134,105 @@ static bool BConnectionStateExistsToAPI( ESteamNetworkingConnectionState eState
 
 }
 
+HSteamNetConnection CConnectionHandleTable::Add( CSteamNetworkConnectionBase *pConn )
+{
+	Assert( pConn );
+
+	if ( m_vecSlots.empty() )
+	{
+		CCrypto::GenerateRandomBlock( &m_nIndexMask, sizeof(m_nIndexMask) );
+		m_nIndexMask &= k_nSlotMask;
+	}
+
+	int idx;
+	uint32 nPrevGeneration = 0;
+	if ( m_nFreeCount >= k_nMinFreeSlotsBeforeReuse || ( m_idxFreeHead >= 0 && (int)m_vecSlots.size() >= k_nMaxSlots ) )
+	{
+		// Reuse the slot that has been free the longest
+		idx = m_idxFreeHead;
+		Slot &slot = m_vecSlots[ idx ];
+		Assert( slot.m_pConn == nullptr );
+		m_idxFreeHead = slot.m_idxNextFree;
+		if ( m_idxFreeHead < 0 )
+			m_idxFreeTail = -1;
+		--m_nFreeCount;
+
+		// Make sure stale handles to the previous occupant don't match
+		nPrevGeneration = uint32( slot.m_hConn ) >> k_nSlotBits;
+	}
+	else
+	{
+		// Grow the table.  Skip over any index that would have the lower 16
+		// bits of the handle clear, we cannot use it.  Those slots just sit
+		// there empty.
+		for (;;)
+		{
+			idx = (int)m_vecSlots.size();
+			if ( idx >= k_nMaxSlots )
+				return k_HSteamNetConnection_Invalid;
+			Slot &slot = *push_back_get_ptr( m_vecSlots );
+			slot.m_pConn = nullptr;
+			slot.m_hConn = k_HSteamNetConnection_Invalid;
+			slot.m_idxNextFree = -1;
+			if ( ( ( uint32( idx ) ^ m_nIndexMask ) & 0xffff ) != 0 )
+				break;
+		}
+	}
+
+	// Pick a random generation, so that the handles (which are also
+	// our wire connection IDs) aren't predictable
+	uint32 nGeneration;
+	do
+	{
+		CCrypto::GenerateRandomBlock( &nGeneration, sizeof(nGeneration) );
+		nGeneration &= k_nGenerationMask;
+	} while ( nGeneration == 0 || nGeneration == nPrevGeneration );
+
+	Slot &slot = m_vecSlots[ idx ];
+	slot.m_pConn = pConn;
+	slot.m_hConn = HSteamNetConnection( ( nGeneration << k_nSlotBits ) | ( uint32( idx ) ^ m_nIndexMask ) );
+	slot.m_idxNextFree = -1;
+	++m_nCount;
+	return slot.m_hConn;
+}
+
+bool CConnectionHandleTable::Remove( HSteamNetConnection hConn )
+{
+	uint32 idx = SlotIndex( hConn );
+	if ( idx >= (uint32)m_vecSlots.size() )
+		return false;
+	Slot &slot = m_vecSlots[ idx ];
+	if ( slot.m_pConn == nullptr || slot.m_hConn != hConn )
+		return false;
+
+	// Clear the slot, but remember the handle so we know
+	// what generation to use next time
+	slot.m_pConn = nullptr;
+	--m_nCount;
+
+	// Add to tail of free list
+	slot.m_idxNextFree = -1;
+	if ( m_idxFreeTail >= 0 )
+		m_vecSlots[ m_idxFreeTail ].m_idxNextFree = (int)idx;
+	else
+		m_idxFreeHead = (int)idx;
+	m_idxFreeTail = (int)idx;
+	++m_nFreeCount;
+	return true;
+}
+
 static CSteamNetworkConnectionBase *GetConnectionByHandle( HSteamNetConnection sock )
 {
 	if ( sock == 0 )
 		return nullptr;
-	int idx = g_mapConnections.Find( uint16( sock ) );
-	if ( idx == g_mapConnections.InvalidIndex() )
+	CSteamNetworkConnectionBase *pResult = g_tableConnections.Find( sock );
+	if ( !pResult )
 		return nullptr;
-	CSteamNetworkConnectionBase *pResult = g_mapConnections[ idx ];
-	if ( !pResult || uint16( pResult->m_hConnectionSelf ) != uint16( sock ) )
+	if ( pResult->m_hConnectionSelf != sock )
 	{
-		AssertMsg( false, "g_mapConnections corruption!" );
+		AssertMsg( false, "g_tableConnections corruption!" );
 		return nullptr;
 	}
-	if ( pResult->m_hConnectionSelf != sock )
-		return nullptr;
 	if ( !BConnectionStateExistsToAPI( pResult->GetState() ) )
 		return nullptr;
 	return pResult;
@@ -210,13 +315,13 @@ void CSteamNetworkingSocketsBase::KillConnections()
 {
 
 	// Destroy all of my connections
-	FOR_EACH_HASHMAP( g_mapConnections, idx )
+	for ( int idx = 0 ; idx < g_tableConnections.NumSlots() ; ++idx )
 	{
-		CSteamNetworkConnectionBase *pConn = g_mapConnections[idx];
-		if ( pConn->m_pSteamNetworkingSocketsInterface == this )
+		CSteamNetworkConnectionBase *pConn = g_tableConnections.GetSlot( idx );
+		if ( pConn && pConn->m_pSteamNetworkingSocketsInterface == this )
 		{
 			pConn->Destroy();
-			Assert( !g_mapConnections.IsValidIndex( idx ) );
+			Assert( g_tableConnections.GetSlot( idx ) == nullptr );
 		}
 	}
 
@@ -258,9 +363,10 @@ void CSteamNetworkingSocketsBase::KillBase()
 
 bool CSteamNetworkingSocketsBase::BHasAnyConnections() const
 {
-	for ( const auto &item: g_mapConnections )
+	for ( int idx = 0 ; idx < g_tableConnections.NumSlots() ; ++idx )
 	{
-		if ( item.elem->m_pSteamNetworkingSocketsInterface == this )
+		CSteamNetworkConnectionBase *pConn = g_tableConnections.GetSlot( idx );
+		if ( pConn && pConn->m_pSteamNetworkingSocketsInterface == this )
 			return true;
 	}
 	return false;
@@ -424,17 +530,35 @@ bool CSteamNetworkingSocketsBase::GetConnectionName( HSteamNetConnection hPeer,
 }
 
 EResult CSteamNetworkingSocketsBase::SendMessageToConnection( HSteamNetConnection hConn, const void *pData, uint32 cbData, ESteamNetworkingSendType eSendType )
+{
+	SteamDatagramTransportLock scopeLock( k_ESteamNetworkingLockCaller_Send );
+	CSteamNetworkConnectionBase *pConn = GetConnectionByHandle( hConn );
+	if ( !pConn )
+		return k_EResultInvalidParam;
+	return pConn->APISendMessageToConnection( pData, cbData, eSendType, 0 );
+}
+
+EResult CSteamNetworkingSocketsBase::SendMessageToConnectionOnLane( HSteamNetConnection hConn, const void *pData, uint32 cbData, ESteamNetworkingSendType eSendType, int idxLane )
+{
+	SteamDatagramTransportLock scopeLock( k_ESteamNetworkingLockCaller_Send );
+	CSteamNetworkConnectionBase *pConn = GetConnectionByHandle( hConn );
+	if ( !pConn )
+		return k_EResultInvalidParam;
+	return pConn->APISendMessageToConnection( pData, cbData, eSendType, idxLane );
+}
+
+EResult CSteamNetworkingSocketsBase::ConfigureConnectionLanes( HSteamNetConnection hConn, int nNumLanes, const int *pLanePriorities, const uint16 *pLaneWeights )
 {
 	SteamDatagramTransportLock scopeLock;
 	CSteamNetworkConnectionBase *pConn = GetConnectionByHandle( hConn );
 	if ( !pConn )
 		return k_EResultInvalidParam;
-	return pConn->APISendMessageToConnection( pData, cbData, eSendType );
+	return pConn->APIConfigureLanes( nNumLanes, pLanePriorities, pLaneWeights );
 }
 
 EResult CSteamNetworkingSocketsBase::FlushMessagesOnConnection( HSteamNetConnection hConn )
 {
-	SteamDatagramTransportLock scopeLock;
+	SteamDatagramTransportLock scopeLock( k_ESteamNetworkingLockCaller_Send );
 	CSteamNetworkConnectionBase *pConn = GetConnectionByHandle( hConn );
 	if ( !pConn )
 		return k_EResultInvalidParam;
@@ -443,7 +567,7 @@ EResult CSteamNetworkingSocketsBase::FlushMessagesOnConnection( HSteamNetConnect
 	
 int CSteamNetworkingSocketsBase::ReceiveMessagesOnConnection( HSteamNetConnection hConn, SteamNetworkingMessage_t **ppOutMessages, int nMaxMessages )
 {
-	SteamDatagramTransportLock scopeLock;
+	SteamDatagramTransportLock scopeLock( k_ESteamNetworkingLockCaller_Receive );
 	CSteamNetworkConnectionBase *pConn = GetConnectionByHandle( hConn );
 	if ( !pConn )
 		return -1;
@@ -452,7 +576,7 @@ int CSteamNetworkingSocketsBase::ReceiveMessagesOnConnection( HSteamNetConnectio
 
 int CSteamNetworkingSocketsBase::ReceiveMessagesOnListenSocket( HSteamListenSocket hSocket, SteamNetworkingMessage_t **ppOutMessages, int nMaxMessages )
 {
-	SteamDatagramTransportLock scopeLock;
+	SteamDatagramTransportLock scopeLock( k_ESteamNetworkingLockCaller_Receive );
 	CSteamNetworkListenSocketBase *pSock = GetListenSockedByHandle( hSocket );
 	if ( !pSock )
 		return -1;
@@ -477,7 +601,80 @@ bool CSteamNetworkingSocketsBase::GetQuickConnectionStatus( HSteamNetConnection
 	if ( !pConn )
 		return false;
 	if ( pStats )
-		pConn->APIGetQuickConnectionStatus( *pStats );
+		pConn->APIGetQuickConnectionStatus( *pStats, SteamNetworkingSockets_GetLocalTimestamp() );
+	return true;
+}
+
+int CSteamNetworkingSocketsBase::GetQuickConnectionStatusBulk( const HSteamNetConnection *pConns, int nConns, SteamNetworkingQuickConnectionStatus *pStats )
+{
+	if ( !pConns || !pStats || nConns <= 0 )
+		return 0;
+
+	SteamDatagramTransportLock scopeLock;
+	SteamNetworkingMicroseconds usecNow = SteamNetworkingSockets_GetLocalTimestamp();
+	int nValid = 0;
+	for ( int i = 0 ; i < nConns ; ++i )
+	{
+		CSteamNetworkConnectionBase *pConn = GetConnectionByHandle( pConns[i] );
+		if ( pConn )
+		{
+			pConn->APIGetQuickConnectionStatus( pStats[i], usecNow );
+			++nValid;
+		}
+		else
+		{
+			memset( &pStats[i], 0, sizeof(pStats[i]) );
+			pStats[i].m_eState = k_ESteamNetworkingConnectionState_None;
+		}
+	}
+	return nValid;
+}
+
+int CSteamNetworkingSocketsBase::GetQuickConnectionStatusOnListenSocket( HSteamListenSocket hSocket, HSteamNetConnection *pOutConns, SteamNetworkingQuickConnectionStatus *pOutStats, int nMaxConns )
+{
+	SteamDatagramTransportLock scopeLock;
+	CSteamNetworkListenSocketBase *pSock = GetListenSockedByHandle( hSocket );
+	if ( !pSock )
+		return -1;
+
+	SteamNetworkingMicroseconds usecNow = SteamNetworkingSockets_GetLocalTimestamp();
+	int nConns = 0;
+	FOR_EACH_HASHMAP( pSock->m_mapChildConnections, h )
+	{
+		CSteamNetworkConnectionBase *pConn = pSock->m_mapChildConnections[ h ];
+		if ( !pConn || !BConnectionStateExistsToAPI( pConn->GetState() ) )
+			continue;
+		if ( nConns < nMaxConns )
+		{
+			if ( pOutConns )
+				pOutConns[ nConns ] = pConn->m_hConnectionSelf;
+			if ( pOutStats )
+				pConn->APIGetQuickConnectionStatus( pOutStats[ nConns ], usecNow );
+		}
+		++nConns;
+	}
+	return nConns;
+}
+
+bool CSteamNetworkingSocketsBase::GetConnectionLinkStats( HSteamNetConnection hConn, SteamDatagramLinkStats *pStats )
+{
+	SteamDatagramTransportLock scopeLock;
+	CSteamNetworkConnectionBase *pConn = GetConnectionByHandle( hConn );
+	if ( !pConn )
+		return false;
+	if ( pStats )
+		pConn->APIGetLinkStats( *pStats, SteamNetworkingSockets_GetLocalTimestamp() );
+	return true;
+}
+
+bool CSteamNetworkingSocketsBase::GetConnectionMemoryUsage( HSteamNetConnection hConn, SteamNetConnectionMemoryUsage_t *pUsage )
+{
+	SteamDatagramTransportLock scopeLock;
+	CSteamNetworkConnectionBase *pConn = GetConnectionByHandle( hConn );
+	if ( !pConn )
+		return false;
+	if ( pUsage )
+		pConn->APIGetMemoryUsage( *pUsage );
 	return true;
 }
 
@@ -495,6 +692,12 @@ int CSteamNetworkingSocketsBase::GetDetailedConnectionStatus( HSteamNetConnectio
 		pConn->APIGetDetailedConnectionStatus( stats, SteamNetworkingSockets_GetLocalTimestamp() );
 
 	} // Release lock.  We don't need it, and printing can take a while!
+
+	// Global lock stats don't need the lock
+	SteamNetworkingGlobalMetrics_t metrics;
+	SteamNetworkingSockets_GetGlobalMetrics( &metrics );
+	V_memcpy( stats.m_lock, metrics.m_lock, sizeof(stats.m_lock) );
+
 	int r = stats.Print( pszBuf, cbBuf );
 
 	/// If just asking for buffer size, pad it a bunch
@@ -664,6 +867,13 @@ bool CSteamNetworkingSocketsBase::SetConfigurationValue( ESteamNetworkingConfigu
 		if ( sConfigurationValueEntryList[ i ].eValue == eConfigValue )
 		{
 			*sConfigurationValueEntryList[ i ].pVar = nValue;
+
+			// Setting the seed restarts the fake network random sequence
+			if ( eConfigValue == k_ESteamNetworkingConfigurationValue_FakeNetwork_Seed )
+			{
+				SteamDatagramTransportLock scopeLock;
+				ResetFakeNetworkConditions();
+			}
 			return true;
 		}
 	}
@@ -735,6 +945,18 @@ int32 CSteamNetworkingSocketsBase::GetConnectionConfigurationValue( HSteamNetCon
 
 	case k_ESteamNetworkingConnectionConfigurationValue_SNP_MinRate :
 		return pConn->GetMinimumRate();
+
+	case k_ESteamNetworkingConnectionConfigurationValue_FakePacketLag_Send :
+		return pConn->m_fakeLagSend.m_msLag;
+
+	case k_ESteamNetworkingConnectionConfigurationValue_FakePacketJitter_Send :
+		return pConn->m_fakeLagSend.m_msJitter;
+
+	case k_ESteamNetworkingConnectionConfigurationValue_FakePacketJitter_Distribution :
+		return pConn->m_fakeLagSend.m_eJitterDistribution;
+
+	case k_ESteamNetworkingConnectionConfigurationValue_CongestionControl :
+		return pConn->GetCongestionControl();
 	}
 	return -1;
 }
@@ -755,6 +977,23 @@ bool CSteamNetworkingSocketsBase::SetConnectionConfigurationValue( HSteamNetConn
 	case k_ESteamNetworkingConnectionConfigurationValue_SNP_MinRate :
 		pConn->SetMinimumRate( nValue );
 		return true;
+
+	case k_ESteamNetworkingConnectionConfigurationValue_FakePacketLag_Send :
+		pConn->m_fakeLagSend.m_msLag = Max( -1, nValue );
+		return true;
+
+	case k_ESteamNetworkingConnectionConfigurationValue_FakePacketJitter_Send :
+		pConn->m_fakeLagSend.m_msJitter = Max( -1, nValue );
+		return true;
+
+	case k_ESteamNetworkingConnectionConfigurationValue_FakePacketJitter_Distribution :
+		if ( nValue < 0 || nValue > k_ESteamNetworkingFakePacketJitter_Pareto )
+			return false;
+		pConn->m_fakeLagSend.m_eJitterDistribution = nValue;
+		return true;
+
+	case k_ESteamNetworkingConnectionConfigurationValue_CongestionControl :
+		return pConn->SetCongestionControl( nValue );
 	}
 
 	return false;
@@ -772,7 +1011,7 @@ void CSteamNetworkingSocketsBase::RunCallbacks( ISteamNetworkingSocketsCallbacks
 	// Only hold lock for a brief period
 	std::vector<QueuedCallback> listTemp;
 	{
-		SteamDatagramTransportLock scopeLock;
+		SteamDatagramTransportLock scopeLock( k_ESteamNetworkingLockCaller_Callbacks );
 
 		// Swap list with the temp one
 		listTemp.swap( m_vecPendingCallbacks );
@@ -89,6 +89,13 @@ public:
 	virtual void RunCallbacks( ISteamNetworkingSocketsCallbacks *pCallbacks ) OVERRIDE;
 #endif
 
+	virtual EResult SendMessageToConnectionOnLane( HSteamNetConnection hConn, const void *pData, uint32 cbData, ESteamNetworkingSendType eSendType, int idxLane ) OVERRIDE;
+	virtual EResult ConfigureConnectionLanes( HSteamNetConnection hConn, int nNumLanes, const int *pLanePriorities, const uint16 *pLaneWeights ) OVERRIDE;
+	virtual int GetQuickConnectionStatusBulk( const HSteamNetConnection *pConns, int nConns, SteamNetworkingQuickConnectionStatus *pStats ) OVERRIDE;
+	virtual int GetQuickConnectionStatusOnListenSocket( HSteamListenSocket hSocket, HSteamNetConnection *pOutConns, SteamNetworkingQuickConnectionStatus *pOutStats, int nMaxConns ) OVERRIDE;
+	virtual bool GetConnectionLinkStats( HSteamNetConnection hConn, SteamDatagramLinkStats *pStats ) OVERRIDE;
+	virtual bool GetConnectionMemoryUsage( HSteamNetConnection hConn, SteamNetConnectionMemoryUsage_t *pUsage ) OVERRIDE;
+
 protected:
 
 	void KillBase();
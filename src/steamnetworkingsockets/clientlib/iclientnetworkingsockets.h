@@ -77,6 +77,13 @@ public:
 	virtual const char *GetConfigurationStringName( ESteamNetworkingConfigurationString eConfigString ) CLIENTNETWORKINGSOCKETS_OVERRIDE = 0;
 	virtual int32 GetConnectionConfigurationValue( HSteamNetConnection hConn, ESteamNetworkingConnectionConfigurationValue eConfigValue ) CLIENTNETWORKINGSOCKETS_OVERRIDE = 0;
 	virtual bool SetConnectionConfigurationValue( HSteamNetConnection hConn, ESteamNetworkingConnectionConfigurationValue eConfigValue, int32 nValue ) CLIENTNETWORKINGSOCKETS_OVERRIDE = 0;
+
+	virtual EResult SendMessageToConnectionOnLane( HSteamNetConnection hConn, const void *pData, uint32 cbData, ESteamNetworkingSendType eSendType, int idxLane ) CLIENTNETWORKINGSOCKETS_OVERRIDE = 0;
+	virtual EResult ConfigureConnectionLanes( HSteamNetConnection hConn, int nNumLanes, const int *pLanePriorities, const uint16 *pLaneWeights ) CLIENTNETWORKINGSOCKETS_OVERRIDE = 0;
+	virtual int GetQuickConnectionStatusBulk( const HSteamNetConnection *pConns, int nConns, SteamNetworkingQuickConnectionStatus *pStats ) CLIENTNETWORKINGSOCKETS_OVERRIDE = 0;
+	virtual int GetQuickConnectionStatusOnListenSocket( HSteamListenSocket hSocket, HSteamNetConnection *pOutConns, SteamNetworkingQuickConnectionStatus *pOutStats, int nMaxConns ) CLIENTNETWORKINGSOCKETS_OVERRIDE = 0;
+	virtual bool GetConnectionLinkStats( HSteamNetConnection hConn, SteamDatagramLinkStats *pStats ) CLIENTNETWORKINGSOCKETS_OVERRIDE = 0;
+	virtual bool GetConnectionMemoryUsage( HSteamNetConnection hConn, SteamNetConnectionMemoryUsage_t *pUsage ) CLIENTNETWORKINGSOCKETS_OVERRIDE = 0;
 };
 
 #endif // ICLIENTNETWORKINGSOCKETS_H
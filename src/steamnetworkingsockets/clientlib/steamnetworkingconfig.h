@@ -58,13 +58,38 @@ SDT_EXTERNAL int32 steamdatagram_fakepacketloss_recv SDT_DEFAULT( 0 ); // 0-100
 SDT_EXTERNAL int32 steamdatagram_fakepacketlag_send SDT_DEFAULT( 0 ); // Globally delay all outbound packets by N ms before sending
 SDT_EXTERNAL int32 steamdatagram_fakepacketlag_recv SDT_DEFAULT( 0 ); // Globally delay all received packets by N ms before processing
 
+SDT_EXTERNAL int32 steamdatagram_fakepacketjitter_send SDT_DEFAULT( 0 ); // Add random extra delay to outbound packets, averaging N ms
+SDT_EXTERNAL int32 steamdatagram_fakepacketjitter_recv SDT_DEFAULT( 0 ); // Add random extra delay to received packets, averaging N ms
+SDT_EXTERNAL int32 steamdatagram_fakepacketjitter_distribution SDT_DEFAULT( k_ESteamNetworkingFakePacketJitter_Uniform ); // Shape of the jitter.  (ESteamNetworkingFakePacketJitterDistribution)
+
 SDT_EXTERNAL int32 steamdatagram_fakepacketreorder_send SDT_DEFAULT( 0 ); // 0-100 Randomly redorder N pct of packets instead of sending
 SDT_EXTERNAL int32 steamdatagram_fakepacketreorder_recv SDT_DEFAULT( 0 ); // 0-100 Randomly redorder N pct of packets received
 SDT_EXTERNAL int32 steamdatagram_fakepacketreorder_time SDT_DEFAULT( 15 ); // How many ms to delay reordered packets.
 
+SDT_EXTERNAL int32 steamdatagram_fakepacketdup_send SDT_DEFAULT( 0 ); // 0-100 Send a duplicate copy of N pct of packets
+SDT_EXTERNAL int32 steamdatagram_fakepacketdup_recv SDT_DEFAULT( 0 ); // 0-100 Duplicate N pct of packets received
+
+SDT_EXTERNAL int32 steamdatagram_fakepacketburstloss_send SDT_DEFAULT( 0 ); // 0-99 Discard N pct of packets sent, in bursts
+SDT_EXTERNAL int32 steamdatagram_fakepacketburstloss_recv SDT_DEFAULT( 0 ); // 0-99 Discard N pct of packets received, in bursts
+SDT_EXTERNAL int32 steamdatagram_fakepacketburstloss_length SDT_DEFAULT( 4 ); // Average number of packets in each loss burst
+
+SDT_EXTERNAL int32 steamdatagram_fakepacketbandwidth_send SDT_DEFAULT( 0 ); // Bandwidth of fake outbound bottleneck, bytes/sec.  0=no limit
+SDT_EXTERNAL int32 steamdatagram_fakepacketbandwidth_recv SDT_DEFAULT( 0 ); // Bandwidth of fake inbound bottleneck, bytes/sec.  0=no limit
+SDT_EXTERNAL int32 steamdatagram_fakepacketqueue_size SDT_DEFAULT( 64*1024 ); // Size of queue in front of the fake bottleneck, in bytes
+SDT_EXTERNAL int32 steamdatagram_fakepacketqueue_discipline SDT_DEFAULT( k_ESteamNetworkingFakePacketQueue_DropTail ); // ESteamNetworkingFakePacketQueueDiscipline
+
+SDT_EXTERNAL int32 steamdatagram_fakepacketmtu_send SDT_DEFAULT( 0 ); // Drop outbound packets bigger than N bytes.  0=no limit
+
+SDT_EXTERNAL int32 steamdatagram_fakenetwork_seed SDT_DEFAULT( 0 ); // Seed for fake network conditions.  0=random
+
 SDT_EXTERNAL int32 steamdatagram_snp_send_buffer_size SDT_DEFAULT( 524288 ); // Upper limit of buffered pending bytes to be sent
 SDT_EXTERNAL int32 steamdatagram_snp_max_rate SDT_DEFAULT( 1000000 ); // Maximum send rate clamp, 0 is no limit
 SDT_EXTERNAL int32 steamdatagram_snp_min_rate SDT_DEFAULT( 128000 ); // Mininum send rate clamp, 0 is no limit
+SDT_EXTERNAL int32 steamdatagram_snp_congestion_control SDT_DEFAULT( k_ESteamNetworkingCongestionControl_Fixed ); // ESteamNetworkingCongestionControl
+SDT_EXTERNAL int32 steamdatagram_snp_pacing_quantum SDT_DEFAULT( k_cbSteamNetworkingSocketsMaxEncryptedPayloadSend ); // Max burst sent at line rate, in bytes
+SDT_EXTERNAL int32 steamdatagram_snp_pathmtu_max SDT_DEFAULT( 1472 ); // Largest UDP payload path MTU discovery will try
+SDT_EXTERNAL int32 steamdatagram_snp_ack_packet_tolerance SDT_DEFAULT( 10 ); // Ask peer to ack after N packets with reliable data.  0=timer only
+SDT_EXTERNAL int32 steamdatagram_snp_ack_delay_pct_rtt SDT_DEFAULT( 0 ); // Ask peer to delay acks at most N pct of RTT.  0=fixed max delay
 
 SDT_EXTERNAL int32 steamdatagram_snp_log_ackrtt SDT_DEFAULT( k_ESteamNetworkingSocketsDebugOutputType_Everything );
 SDT_EXTERNAL int32 steamdatagram_snp_log_packet SDT_DEFAULT( k_ESteamNetworkingSocketsDebugOutputType_Everything );
@@ -72,6 +97,7 @@ SDT_EXTERNAL int32 steamdatagram_snp_log_message SDT_DEFAULT( k_ESteamNetworking
 SDT_EXTERNAL int32 steamdatagram_snp_log_packetgaps SDT_DEFAULT( k_ESteamNetworkingSocketsDebugOutputType_Debug );
 SDT_EXTERNAL int32 steamdatagram_snp_log_p2prendezvous SDT_DEFAULT( k_ESteamNetworkingSocketsDebugOutputType_Verbose );
 SDT_EXTERNAL int32 steamdatagram_snp_log_relaypings SDT_DEFAULT( k_ESteamNetworkingSocketsDebugOutputType_Debug );
+SDT_EXTERNAL int32 steamdatagram_log_async SDT_DEFAULT( 0 ); // Deliver spew from a separate thread
 
 SDT_EXTERNAL int32 steamdatagram_snp_nagle_time SDT_DEFAULT( 5000 ); // Default Nagle delay
 
@@ -0,0 +1,88 @@
+//====== Copyright Valve Corporation, All rights reserved. ====================
+//
+// Tagged allocations, routed through the hooks installed with
+// SteamNetworkingSockets_SetAllocator.  Only the allocations on the message
+// path go through here.  Everything else just uses the regular heap.
+//
+//=============================================================================
+
+#ifndef STEAMNETWORKINGSOCKETS_ALLOC_H
+#define STEAMNETWORKINGSOCKETS_ALLOC_H
+#pragma once
+
+#include <stdlib.h>
+#include "steamnetworkingsockets_metrics.h"
+
+namespace SteamNetworkingSocketsLib {
+
+/// Current hooks.  All null if we are using the regular heap
+extern FSteamNetworkingSocketsAlloc g_pfnAlloc;
+extern FSteamNetworkingSocketsRealloc g_pfnRealloc;
+extern FSteamNetworkingSocketsFree g_pfnFree;
+
+inline void *TaggedMalloc( size_t cb, ESteamNetworkingAllocTag eTag )
+{
+	// Never ask for zero bytes, so every block is a distinct non-null
+	// pointer, and the outstanding count stays balanced when it is freed
+	if ( cb == 0 )
+		cb = 1;
+	MetricsIncrement( g_metrics.m_nAllocations[ eTag ] );
+	MetricsIncrement( g_metrics.m_nAllocationsOutstanding[ eTag ] );
+	if ( g_pfnAlloc )
+		return (*g_pfnAlloc)( cb, eTag );
+	return malloc( cb );
+}
+
+/// Resize a block.  If p is null, this is the same as TaggedMalloc.
+/// cb must not be zero.
+inline void *TaggedRealloc( void *p, size_t cb, ESteamNetworkingAllocTag eTag )
+{
+	if ( !p )
+		return TaggedMalloc( cb, eTag );
+	if ( g_pfnRealloc )
+		return (*g_pfnRealloc)( p, cb, eTag );
+	return realloc( p, cb );
+}
+
+inline void TaggedFree( void *p, ESteamNetworkingAllocTag eTag )
+{
+	if ( !p )
+		return;
+	MetricsDecrement( g_metrics.m_nAllocationsOutstanding[ eTag ] );
+	if ( g_pfnFree )
+		(*g_pfnFree)( p, eTag );
+	else
+		free( p );
+}
+
+/// Put this in a class declaration to allocate objects of that class
+/// (and any derived classes) through the hooks.
+#define STEAMNETWORKINGSOCKETS_DECLARE_TAGGED_ALLOC( eTag ) \
+	static void *operator new( size_t cb ) { return SteamNetworkingSocketsLib::TaggedMalloc( cb, eTag ); } \
+	static void *operator new[]( size_t cb ) { return SteamNetworkingSocketsLib::TaggedMalloc( cb, eTag ); } \
+	static void operator delete( void *p ) { SteamNetworkingSocketsLib::TaggedFree( p, eTag ); } \
+	static void operator delete[]( void *p ) { SteamNetworkingSocketsLib::TaggedFree( p, eTag ); }
+
+/// STL allocator that goes through the hooks, for containers that
+/// allocate a node per element.
+template <typename T, ESteamNetworkingAllocTag TAG>
+struct TaggedAllocator
+{
+	typedef T value_type;
+	template <typename U> struct rebind { typedef TaggedAllocator<U,TAG> other; };
+
+	TaggedAllocator() {}
+	template <typename U> TaggedAllocator( const TaggedAllocator<U,TAG> & ) {}
+
+	T *allocate( size_t n ) { return (T *)TaggedMalloc( n*sizeof(T), TAG ); }
+	void deallocate( T *p, size_t ) { TaggedFree( p, TAG ); }
+};
+
+template <typename T, typename U, ESteamNetworkingAllocTag TAG>
+inline bool operator==( const TaggedAllocator<T,TAG> &, const TaggedAllocator<U,TAG> & ) { return true; }
+template <typename T, typename U, ESteamNetworkingAllocTag TAG>
+inline bool operator!=( const TaggedAllocator<T,TAG> &, const TaggedAllocator<U,TAG> & ) { return false; }
+
+} // namespace SteamNetworkingSocketsLib
+
+#endif // STEAMNETWORKINGSOCKETS_ALLOC_H
@@ -0,0 +1,568 @@
+//====== Copyright Valve Corporation, All rights reserved. ====================
+//
+// Congestion control algorithms for SNP.  These decide how fast a connection
+// sends, based on the ack/loss events and RTT samples that SNP feeds them.
+//
+//=============================================================================
+
+#include "steamnetworkingsockets_snp.h"
+
+namespace SteamNetworkingSocketsLib {
+
+// Max interval between sending packets, when the loss rate is terrible (RFC 5348, 4.3)
+const SteamNetworkingMicroseconds k_usecTFRCMaxBackoffInterval = 64*k_nMillion;
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Fixed rate
+//
+/////////////////////////////////////////////////////////////////////////////
+
+/// Ignore network conditions, just send at whatever rate we were initialized with
+class CSNPCongestionControlFixed : public ISNPCongestionControl
+{
+public:
+	virtual ESteamNetworkingCongestionControl GetType() const OVERRIDE { return k_ESteamNetworkingCongestionControl_Fixed; }
+	virtual const char *GetName() const OVERRIDE { return "Fixed"; }
+	virtual int GetObjectSize() const OVERRIDE { return sizeof(*this); }
+
+	virtual void Init( int nInitialRate, SteamNetworkingMicroseconds usecRTT, SteamNetworkingMicroseconds usecNow ) OVERRIDE
+	{
+		m_nRate = nInitialRate;
+	}
+
+	virtual void OnPacketSent( int cbPkt, int cbInFlight, SteamNetworkingMicroseconds usecNow ) OVERRIDE {}
+	virtual void OnAck( const SNPRateSample_t &rs, SteamNetworkingMicroseconds usecNow ) OVERRIDE {}
+	virtual void OnPacketLost( int64 nPktNum, SteamNetworkingMicroseconds usecWhenSent, SteamNetworkingMicroseconds usecNow ) OVERRIDE {}
+	virtual void OnRTTSample( SteamNetworkingMicroseconds usecRTT, SteamNetworkingMicroseconds usecNow ) OVERRIDE {}
+
+	virtual int CalcSendRate( int nMinRate, int nMaxRate, SteamNetworkingMicroseconds usecNow ) OVERRIDE
+	{
+		m_nRate = Clamp( m_nRate, nMinRate, nMaxRate );
+		return m_nRate;
+	}
+
+private:
+	int m_nRate = 0;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// TFRC
+//
+/////////////////////////////////////////////////////////////////////////////
+
+// TFRC throughput equation (RFC 5348, 3.1)
+//
+//                                s
+//   X_Bps = ----------------------------------------------------------
+//           R*sqrt(2*b*p/3) + (t_RTO * (3*sqrt(3*b*p/8)*p*(1+32*p^2)))
+//
+// b is TCP acknowlege packet rate, assumed to be 1 for this implementation
+static int TFRCCalcX( int s, SteamNetworkingMicroseconds rtt, float p )
+{
+	float R = (float)rtt / k_nMillion;
+	float t_RTO = Max( 4 * R, 1.0f );
+
+	float flDenom = R * sqrt( 2 * p / 3 ) + ( t_RTO * ( 3 * sqrt( 3 * p / 8 ) * p * ( 1 + 32 * ( p * p ) ) ) );
+	if ( flDenom <= 0.0f )
+		return k_nSteamDatagramGlobalMaxRate;
+
+	// Don't overflow when the loss rate is tiny
+	return (int)Min( (float)s / flDenom, (float)k_nSteamDatagramGlobalMaxRate );
+}
+
+/// TCP-friendly rate control, RFC 5348.  The RFC has the receiver measure
+/// the loss event rate and the receive rate and feed them back.  We measure both
+/// on the sender, based on acks and the delivery rate samples, which gives the
+/// same information without any extra protocol.
+class CSNPCongestionControlTFRC : public ISNPCongestionControl
+{
+public:
+	virtual ESteamNetworkingCongestionControl GetType() const OVERRIDE { return k_ESteamNetworkingCongestionControl_TFRC; }
+	virtual const char *GetName() const OVERRIDE { return "TFRC"; }
+	virtual int GetObjectSize() const OVERRIDE { return sizeof(*this); }
+
+	virtual void Init( int nInitialRate, SteamNetworkingMicroseconds usecRTT, SteamNetworkingMicroseconds usecNow ) OVERRIDE
+	{
+		m_nX = nInitialRate;
+		m_nInitialRate = nInitialRate;
+		m_usecR = usecRTT;
+		m_usecTimeLastDoubled = usecNow;
+		ResetNoFeedbackTimer( usecNow );
+	}
+
+	virtual void OnPacketSent( int cbPkt, int cbInFlight, SteamNetworkingMicroseconds usecNow ) OVERRIDE
+	{
+		// Average packet size.  (RFC 5348, 4.1)
+		m_nS = ( 9*m_nS + cbPkt ) / 10;
+		m_cbInFlight = cbInFlight;
+
+		// Coming out of an idle period?  Then the nofeedback timer
+		// starts now, not whenever it was last set.
+		if ( cbInFlight == cbPkt )
+			ResetNoFeedbackTimer( usecNow );
+	}
+
+	virtual void OnAck( const SNPRateSample_t &rs, SteamNetworkingMicroseconds usecNow ) OVERRIDE
+	{
+		m_cbInFlight = rs.m_cbInFlight;
+
+		// Every packet delivered extends the open loss interval
+		m_arLossInterval[0] += rs.m_nPktsAcked;
+
+		// Update the receive rate.  The delivery rate sample covers about one
+		// RTT, which is what the RFC asks for.  If we're app limited, the sample
+		// only tells us that the path can do at least that much.
+		int nRate = rs.DeliveryRate();
+		if ( nRate > 0 )
+		{
+			if ( rs.m_bAppLimited )
+				m_nXRecv = Max( m_nXRecv, nRate );
+			else
+				m_nXRecv = nRate;
+		}
+
+		// RFC 5348, 4.3, step 4
+		int64 nRecvLimit = m_nXRecv > 0 ? (int64)m_nXRecv * k_nBurstMultiplier : INT_MAX;
+		float p = CalcLossEventRate();
+		if ( p > 0.0f )
+		{
+			m_nXCalc = TFRCCalcX( m_nS, m_usecR, p );
+			m_nX = (int)Max( Min( (int64)m_nXCalc, nRecvLimit ), MinRate() );
+		}
+		else if ( usecNow - m_usecTimeLastDoubled >= m_usecR )
+		{
+			// Slow start
+			m_nX = (int)Max( Min( (int64)m_nX*2, nRecvLimit ), (int64)m_nInitialRate );
+			m_usecTimeLastDoubled = usecNow;
+		}
+
+		ResetNoFeedbackTimer( usecNow );
+	}
+
+	virtual void OnPacketLost( int64 nPktNum, SteamNetworkingMicroseconds usecWhenSent, SteamNetworkingMicroseconds usecNow ) OVERRIDE
+	{
+		// Losses of packets sent within one RTT of the first loss
+		// all belong to the same loss event.  (RFC 5348, 5.2)
+		if ( m_nLossIntervals > 0 && usecWhenSent <= m_usecLossEventSentTime + m_usecR )
+		{
+			++m_arLossInterval[0];
+			return;
+		}
+		m_usecLossEventSentTime = usecWhenSent;
+
+		if ( m_nLossIntervals == 0 )
+		{
+			// First loss event.  We don't have a history, so synthesize an
+			// interval that would give us the rate we are currently receiving
+			// at.  (RFC 5348, 6.3.1)  X is monotonic in p, so just bisect.
+			int nXTarget = m_nXRecv > 0 ? m_nXRecv : m_nX;
+			float flLo = 1e-8f, flHi = 1.0f;
+			for ( int i = 0 ; i < 32 ; ++i )
+			{
+				float flMid = sqrt( flLo * flHi );
+				if ( TFRCCalcX( m_nS, m_usecR, flMid ) > nXTarget )
+					flLo = flMid;
+				else
+					flHi = flMid;
+			}
+			m_arLossInterval[0] = Max( 1, (int)( 1.0f / flHi ) );
+		}
+
+		// Close the open interval, and start a new one
+		for ( int i = LIH_SIZE-1 ; i > 0 ; --i )
+			m_arLossInterval[i] = m_arLossInterval[i-1];
+		m_arLossInterval[0] = 1;
+		m_nLossIntervals = Min( m_nLossIntervals+1, NINTERVAL );
+	}
+
+	virtual void OnRTTSample( SteamNetworkingMicroseconds usecRTT, SteamNetworkingMicroseconds usecNow ) OVERRIDE
+	{
+		// RFC 5348, 4.3, step 2
+		usecRTT = Max( usecRTT, (SteamNetworkingMicroseconds)500 );
+		m_usecR = ( 9*m_usecR + usecRTT ) / 10;
+	}
+
+	virtual int CalcSendRate( int nMinRate, int nMaxRate, SteamNetworkingMicroseconds usecNow ) OVERRIDE
+	{
+		// Nofeedback timer expired?  Cut the rate in half.  If nothing is
+		// in flight, we aren't expecting feedback, so that's not a sign
+		// of congestion.  (RFC 5348, 4.4)
+		if ( usecNow >= m_usecNoFeedbackTimer )
+		{
+			if ( m_cbInFlight > 0 )
+			{
+				m_nXRecv /= 2;
+				m_nX = (int)Max( (int64)m_nX/2, MinRate() );
+			}
+			ResetNoFeedbackTimer( usecNow );
+		}
+
+		m_nX = Clamp( m_nX, nMinRate, nMaxRate );
+		return m_nX;
+	}
+
+private:
+
+	/// Average loss interval, RFC 5348, 5.4
+	float CalcLossEventRate() const
+	{
+		if ( m_nLossIntervals == 0 )
+			return 0.0f;
+
+		static const float k_flWeights[ NINTERVAL ] = { 1.0f, 1.0f, 1.0f, 1.0f, 0.8f, 0.6f, 0.4f, 0.2f };
+		float flTot0 = 0.0f, flTot1 = 0.0f, flWeightTot = 0.0f;
+		for ( int i = 0 ; i < m_nLossIntervals ; ++i )
+		{
+			flTot0 += m_arLossInterval[i] * k_flWeights[i];
+			flTot1 += m_arLossInterval[i+1] * k_flWeights[i];
+			flWeightTot += k_flWeights[i];
+		}
+		float flMean = Max( flTot0, flTot1 ) / flWeightTot;
+		return flMean > 0.0f ? 1.0f / flMean : 1.0f;
+	}
+
+	/// Lowest rate we will ever back off to.  One packet per t_mbi
+	int64 MinRate() const
+	{
+		return (int64)m_nS * k_nMillion / k_usecTFRCMaxBackoffInterval;
+	}
+
+	void ResetNoFeedbackTimer( SteamNetworkingMicroseconds usecNow )
+	{
+		// Expect feedback within 4 RTTs, or 2 sent packets,
+		// whichever is greater.  (RFC 5348, 4.3, step 5)
+		SteamNetworkingMicroseconds usecInterPacket = (int64)m_nS * 2 * k_nMillion / Max( m_nX, 1 );
+		m_usecNoFeedbackTimer = usecNow + Max( 4*m_usecR, usecInterPacket );
+	}
+
+	int m_nX = 0; // Current allowed sending rate
+	int m_nXCalc = 0; // Rate from the throughput equation
+	int m_nXRecv = 0; // Rate at which the peer is receiving
+	int m_nInitialRate = 0;
+	int m_nS = k_cbSteamNetworkingSocketsMaxEncryptedPayloadSend; // Average packet size
+	int m_cbInFlight = 0;
+	SteamNetworkingMicroseconds m_usecR = 0; // Smoothed RTT
+	SteamNetworkingMicroseconds m_usecTimeLastDoubled = 0; // Time last doubled during slow start
+	SteamNetworkingMicroseconds m_usecNoFeedbackTimer = 0;
+
+	/// Loss interval history, in packets.  Slot 0 is the open interval,
+	/// since the start of the most recent loss event.
+	int m_arLossInterval[ LIH_SIZE ] = {};
+	int m_nLossIntervals = 0; // Number of closed intervals
+	SteamNetworkingMicroseconds m_usecLossEventSentTime = 0; // Send time of the first packet lost in the most recent loss event
+};
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// BBR
+//
+/////////////////////////////////////////////////////////////////////////////
+
+const float k_flBBRHighGain = 2.885f; // 2/ln(2), the smallest gain that can double the delivery rate each round
+const float k_flBBRDrainGain = 1.0f / k_flBBRHighGain;
+const float k_arflBBRPacingGainCycle[] = { 1.25f, 0.75f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f };
+const int k_nBBRPacingGainCycleLen = V_ARRAYSIZE( k_arflBBRPacingGainCycle );
+const int k_nBBRBandwidthFilterRounds = 10; // Window of the max bandwidth filter
+const SteamNetworkingMicroseconds k_usecBBRMinRTTWindow = 10*k_nMillion; // Window of the min RTT filter
+const SteamNetworkingMicroseconds k_usecBBRProbeRTTDuration = 200*1000;
+const int k_nBBRFullBandwidthRounds = 3; // Rounds without growth before we decide the pipe is full
+const float k_flBBRFullBandwidthGrowth = 1.25f;
+const int k_nBBRMinPipePackets = 4;
+const float k_flBBRInFlightCapGain = 1.25f; // Plays the role of BBR's cwnd_gain.  Lower than BBR's 2, since the cap is what bounds our standing queue
+
+/// Model-based congestion control in the style of BBR.  We estimate the
+/// bottleneck bandwidth (windowed max of the delivery rate) and the min RTT,
+/// and pace at a rate near the bandwidth, periodically probing for more and
+/// then backing off to drain whatever queue the probe built up.  Loss is not
+/// treated as a congestion signal.
+///
+/// BBR also bounds the data in flight with a congestion window.  SNP is
+/// purely rate based, so instead we scale back the pacing rate whenever
+/// the data in flight exceeds the window BBR would have used.
+class CSNPCongestionControlBBR : public ISNPCongestionControl
+{
+public:
+	virtual ESteamNetworkingCongestionControl GetType() const OVERRIDE { return k_ESteamNetworkingCongestionControl_BBR; }
+	virtual const char *GetName() const OVERRIDE { return "BBR"; }
+	virtual int GetObjectSize() const OVERRIDE { return sizeof(*this); }
+
+	virtual void Init( int nInitialRate, SteamNetworkingMicroseconds usecRTT, SteamNetworkingMicroseconds usecNow ) OVERRIDE
+	{
+		m_nInitialRate = nInitialRate;
+		m_nPacingRate = nInitialRate;
+		m_usecMinRTT = usecRTT;
+		m_usecMinRTTStamp = usecNow;
+		EnterStartup();
+	}
+
+	virtual void OnPacketSent( int cbPkt, int cbInFlight, SteamNetworkingMicroseconds usecNow ) OVERRIDE
+	{
+		m_cbInFlight = cbInFlight;
+	}
+
+	virtual void OnAck( const SNPRateSample_t &rs, SteamNetworkingMicroseconds usecNow ) OVERRIDE
+	{
+		m_cbInFlight = rs.m_cbInFlight;
+
+		// Advance round trip counter.  A round ends when a packet sent
+		// after the start of the round is acked.
+		bool bRoundStart = false;
+		if ( rs.m_nPriorDelivered >= m_nNextRoundDelivered )
+		{
+			m_nNextRoundDelivered = rs.m_nDelivered;
+			++m_nRoundCount;
+			bRoundStart = true;
+			m_arBandwidthByRound[ m_nRoundCount % k_nBBRBandwidthFilterRounds ] = 0;
+			m_arAckDelayByRound[ m_nRoundCount % k_nBBRBandwidthFilterRounds ] = 0;
+		}
+
+		// Track how long the peer is holding acks, over the same window
+		SteamNetworkingMicroseconds &usecAckDelaySlot = m_arAckDelayByRound[ m_nRoundCount % k_nBBRBandwidthFilterRounds ];
+		usecAckDelaySlot = Max( usecAckDelaySlot, rs.m_usecAckDelay );
+
+		// Update max bandwidth filter.  Samples that span less than the min RTT
+		// are unreliable, since they can be inflated by acks arriving in bunches.
+		// App limited samples can only raise the estimate, never lower it.
+		int nRate = rs.DeliveryRate();
+		if ( nRate > 0 && rs.m_usecInterval >= m_usecMinRTT && ( !rs.m_bAppLimited || nRate >= BtlBw() ) )
+		{
+			int &nSlot = m_arBandwidthByRound[ m_nRoundCount % k_nBBRBandwidthFilterRounds ];
+			nSlot = Max( nSlot, nRate );
+		}
+
+		// Check if we have filled the pipe.  If the bandwidth hasn't grown
+		// much in a few rounds, then we have found the bottleneck
+		if ( !m_bFilledPipe && bRoundStart && !rs.m_bAppLimited )
+		{
+			int nBtlBw = BtlBw();
+			if ( nBtlBw >= m_nFullBandwidth * k_flBBRFullBandwidthGrowth )
+			{
+				m_nFullBandwidth = nBtlBw;
+				m_nFullBandwidthCount = 0;
+			}
+			else if ( ++m_nFullBandwidthCount >= k_nBBRFullBandwidthRounds )
+			{
+				m_bFilledPipe = true;
+			}
+		}
+
+		switch ( m_eMode )
+		{
+			case k_EModeStartup:
+				if ( m_bFilledPipe )
+				{
+					m_eMode = k_EModeDrain;
+					m_flPacingGain = k_flBBRDrainGain;
+				}
+				break;
+
+			case k_EModeDrain:
+				if ( m_cbInFlight <= InFlightTarget( 1.0f ) )
+					EnterProbeBW( usecNow );
+				break;
+
+			case k_EModeProbeBW:
+			{
+				// Each phase of the cycle lasts about one min RTT.  When draining
+				// the queue built up by probing, we can move on as soon as it's gone
+				bool bFullLength = usecNow - m_usecCycleStamp > m_usecMinRTT;
+				if ( bFullLength || ( m_flPacingGain < 1.0f && m_cbInFlight <= InFlightTarget( 1.0f ) ) )
+				{
+					m_nCycleIndex = ( m_nCycleIndex + 1 ) % k_nBBRPacingGainCycleLen;
+					m_usecCycleStamp = usecNow;
+					m_flPacingGain = k_arflBBRPacingGainCycle[ m_nCycleIndex ];
+				}
+				break;
+			}
+
+			case k_EModeProbeRTT:
+				// Stay here for at least a fixed duration and one full round,
+				// so that we get an RTT sample with the queue drained
+				if ( bRoundStart )
+					m_bProbeRTTRoundDone = true;
+				if ( m_bProbeRTTRoundDone && usecNow >= m_usecProbeRTTDone )
+				{
+					m_usecMinRTTStamp = usecNow;
+					if ( m_bFilledPipe )
+						EnterProbeBW( usecNow );
+					else
+						EnterStartup();
+				}
+				break;
+		}
+
+		UpdatePacingRate();
+	}
+
+	virtual void OnPacketLost( int64 nPktNum, SteamNetworkingMicroseconds usecWhenSent, SteamNetworkingMicroseconds usecNow ) OVERRIDE
+	{
+	}
+
+	virtual void OnRTTSample( SteamNetworkingMicroseconds usecRTT, SteamNetworkingMicroseconds usecNow ) OVERRIDE
+	{
+		usecRTT = Max( usecRTT, (SteamNetworkingMicroseconds)500 );
+		bool bExpired = usecNow > m_usecMinRTTStamp + k_usecBBRMinRTTWindow;
+		if ( usecRTT <= m_usecMinRTT || bExpired )
+		{
+			m_usecMinRTT = usecRTT;
+			m_usecMinRTTStamp = usecNow;
+		}
+
+		// If we haven't seen a new min in a while, then maybe that's because
+		// we have been keeping a standing queue.  Back way off for a bit,
+		// so we can get a clean sample
+		if ( bExpired && m_eMode != k_EModeProbeRTT )
+		{
+			m_eMode = k_EModeProbeRTT;
+			m_flPacingGain = 1.0f;
+			m_usecProbeRTTDone = usecNow + k_usecBBRProbeRTTDuration;
+			m_bProbeRTTRoundDone = false;
+		}
+	}
+
+	virtual int CalcSendRate( int nMinRate, int nMaxRate, SteamNetworkingMicroseconds usecNow ) OVERRIDE
+	{
+		m_nPacingRate = Clamp( m_nPacingRate, nMinRate, nMaxRate );
+		return m_nPacingRate;
+	}
+
+private:
+
+	enum EMode
+	{
+		k_EModeStartup,
+		k_EModeDrain,
+		k_EModeProbeBW,
+		k_EModeProbeRTT,
+	};
+
+	/// Current estimate of the bottleneck bandwidth, bytes/sec.
+	/// 0 if we don't have any samples
+	int BtlBw() const
+	{
+		int nResult = 0;
+		for ( int nRate: m_arBandwidthByRound )
+			nResult = Max( nResult, nRate );
+		return nResult;
+	}
+
+	/// Max time the peer has recently reported holding an ack
+	SteamNetworkingMicroseconds AckDelay() const
+	{
+		SteamNetworkingMicroseconds usecResult = 0;
+		for ( SteamNetworkingMicroseconds usecDelay: m_arAckDelayByRound )
+			usecResult = Max( usecResult, usecDelay );
+		return usecResult;
+	}
+
+	/// How much data we expect to have in flight, if we are sending at the
+	/// given multiple of the bottleneck rate.  The peer may hold acks for
+	/// a bit, so allow for the data sent during that time.  Use the delay
+	/// it actually reports, not the max it is allowed.  Under load it acks
+	/// much sooner than that, and padding the BDP by the max just leaves a
+	/// standing queue at the bottleneck.
+	int InFlightTarget( float flGain ) const
+	{
+		int64 nBtlBw = BtlBw();
+		int64 cbBDP = nBtlBw * ( m_usecMinRTT + AckDelay() ) / k_nMillion;
+		return (int)Min( (int64)( cbBDP * flGain ), (int64)INT_MAX );
+	}
+
+	void EnterStartup()
+	{
+		m_eMode = k_EModeStartup;
+		m_flPacingGain = k_flBBRHighGain;
+	}
+
+	void EnterProbeBW( SteamNetworkingMicroseconds usecNow )
+	{
+		m_eMode = k_EModeProbeBW;
+
+		// Start at some phase other than the draining one.  We don't want all
+		// the connections to probe in lockstep, but we want to be deterministic
+		m_nCycleIndex = 2 + (int)( m_nRoundCount % ( k_nBBRPacingGainCycleLen - 2 ) );
+		m_usecCycleStamp = usecNow;
+		m_flPacingGain = k_arflBBRPacingGainCycle[ m_nCycleIndex ];
+	}
+
+	void UpdatePacingRate()
+	{
+		int nBtlBw = BtlBw();
+		if ( nBtlBw <= 0 )
+			nBtlBw = m_nInitialRate;
+
+		int64 nRate = (int64)( nBtlBw * m_flPacingGain );
+		if ( m_eMode == k_EModeProbeRTT )
+		{
+			// Send just enough to keep a few packets in the pipe
+			int64 nMinPipeRate = (int64)k_nBBRMinPipePackets * k_cbSteamNetworkingSocketsMaxEncryptedPayloadSend * k_nMillion / Max( m_usecMinRTT, (SteamNetworkingMicroseconds)1 );
+			nRate = Min( nRate, nMinPipeRate );
+		}
+		else if ( m_bFilledPipe )
+		{
+			// We don't have a congestion window, but we can approximate one.
+			// If there's way more in flight than the pipe can hold, slow down
+			// in proportion so the standing queue drains.
+			int cbInFlightCap = InFlightTarget( k_flBBRInFlightCapGain );
+			if ( cbInFlightCap > 0 && m_cbInFlight > cbInFlightCap )
+				nRate = nRate * cbInFlightCap / m_cbInFlight;
+		}
+		nRate = Min( nRate, (int64)k_nSteamDatagramGlobalMaxRate );
+
+		// During startup, never slow down.  The bandwidth estimate lags
+		// behind the rate we are sending at.
+		if ( m_eMode == k_EModeStartup && nRate < m_nPacingRate )
+			return;
+		m_nPacingRate = (int)nRate;
+	}
+
+	EMode m_eMode = k_EModeStartup;
+	float m_flPacingGain = k_flBBRHighGain;
+	int m_nPacingRate = 0;
+	int m_nInitialRate = 0;
+	int m_cbInFlight = 0;
+
+	// Max bandwidth filter.  Max delivery rate seen in each of the last few rounds
+	int m_arBandwidthByRound[ k_nBBRBandwidthFilterRounds ] = {};
+	SteamNetworkingMicroseconds m_arAckDelayByRound[ k_nBBRBandwidthFilterRounds ] = {};
+	int64 m_nRoundCount = 0;
+	int64 m_nNextRoundDelivered = 0;
+
+	// Min RTT filter
+	SteamNetworkingMicroseconds m_usecMinRTT = 0;
+	SteamNetworkingMicroseconds m_usecMinRTTStamp = 0;
+
+	// Startup
+	bool m_bFilledPipe = false;
+	int m_nFullBandwidth = 0;
+	int m_nFullBandwidthCount = 0;
+
+	// ProbeBW
+	int m_nCycleIndex = 0;
+	SteamNetworkingMicroseconds m_usecCycleStamp = 0;
+
+	// ProbeRTT
+	SteamNetworkingMicroseconds m_usecProbeRTTDone = 0;
+	bool m_bProbeRTTRoundDone = false;
+};
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Factory
+//
+/////////////////////////////////////////////////////////////////////////////
+
+ISNPCongestionControl *CreateSNPCongestionControl( int eType )
+{
+	switch ( eType )
+	{
+		case k_ESteamNetworkingCongestionControl_Fixed: return new CSNPCongestionControlFixed;
+		case k_ESteamNetworkingCongestionControl_TFRC: return new CSNPCongestionControlTFRC;
+		case k_ESteamNetworkingCongestionControl_BBR: return new CSNPCongestionControlBBR;
+	}
+	return nullptr;
+}
+
+} // namespace SteamNetworkingSocketsLib
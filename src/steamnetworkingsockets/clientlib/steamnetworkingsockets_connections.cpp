@@ -7,6 +7,8 @@
 #include "steamnetworkingsockets_lowlevel.h"
 #include "csteamnetworkingsockets.h"
 #include "crypto.h"
+#include <tier0/vprof.h>
+#include "steamnetworkingsockets_metrics.h"
 #ifndef STEAMNETWORKINGSOCKETS_OPENSOURCE
 #include <steam/steam_gameserver.h>
 #endif
@@ -19,9 +21,6 @@
 // Put everything in a namespace, so we don't violate the one definition rule
 namespace SteamNetworkingSocketsLib {
 
-const int k_nMaxRecentLocalConnectionIDs = 256;
-static CUtlVectorFixed<uint16,k_nMaxRecentLocalConnectionIDs> s_vecRecentLocalConnectionIDs;
-
 /// Check if we've sent a "spam reply", meaning a reply to an incoming
 /// message that could be random spoofed garbage.  Returns false if we've
 /// recently sent one and cannot send any more right now without risking
@@ -96,15 +95,21 @@ CSteamNetworkingMessage *CSteamNetworkingMessage::New( CSteamNetworkConnectionBa
 	CSteamNetworkingMessage *pMsg = new CSteamNetworkingMessage;
 
 	pMsg->m_sender = pParent->m_identityRemote;
-	pMsg->m_pData = malloc( cbSize );
+	pMsg->m_pData = TaggedMalloc( cbSize, k_ESteamNetworkingAllocTag_Message );
 	pMsg->m_cbSize = cbSize;
 	pMsg->m_nChannel = -1;
+	pMsg->m_idxLane = 0;
+	pMsg->m_nFlags = 0;
 	pMsg->m_conn = pParent->m_hConnectionSelf;
 	pMsg->m_nConnUserData = pParent->GetUserData();
 	pMsg->m_usecTimeReceived = usecNow;
 	pMsg->m_nMessageNumber = nMsgNum;
 	pMsg->m_pfnRelease = CSteamNetworkingMessage::Delete;
 
+	MetricsIncrement( g_metrics.m_nMessagesAllocated );
+	MetricsAdd( g_metrics.m_cbMessagesAllocated, cbSize );
+	MetricsIncrement( g_metrics.m_nMessagesOutstanding );
+
 	return pMsg;
 }
 
@@ -112,7 +117,7 @@ void CSteamNetworkingMessage::Delete( SteamNetworkingMessage_t *pIMsg )
 {
 	CSteamNetworkingMessage *pMsg = static_cast<CSteamNetworkingMessage *>( pIMsg );
 
-	free( pMsg->m_pData );
+	TaggedFree( pMsg->m_pData, k_ESteamNetworkingAllocTag_Message );
 
 	// We must not currently be in any queue.  In fact, our parent
 	// might have been destroyed.
@@ -126,6 +131,7 @@ void CSteamNetworkingMessage::Delete( SteamNetworkingMessage_t *pIMsg )
 	// Self destruct
 	// FIXME Should avoid this dynamic memory call with some sort of pooling
 	delete pMsg;
+	MetricsDecrement( g_metrics.m_nMessagesOutstanding );
 }
 
 void CSteamNetworkingMessage::LinkToQueueTail( Links CSteamNetworkingMessage::*pMbrLinks, SteamNetworkingMessageQueue *pQueue )
@@ -343,6 +349,7 @@ CSteamNetworkConnectionBase::CSteamNetworkConnectionBase( CSteamNetworkingSocket
 	m_unConnectionIDRemote = 0;
 	m_pParentListenSocket = nullptr;
 	m_hSelfInParentListenSocketMap = -1;
+	m_pCryptoHandshake = nullptr;
 	m_bCertHasIdentity = false;
 	m_bCryptKeysValid = false;
 	memset( m_szAppName, 0, sizeof( m_szAppName ) );
@@ -355,6 +362,7 @@ CSteamNetworkConnectionBase::~CSteamNetworkConnectionBase()
 	Assert( m_eConnectionState == k_ESteamNetworkingConnectionState_Dead );
 	Assert( m_queueRecvMessages.IsEmpty() );
 	Assert( m_pParentListenSocket == nullptr );
+	FreeCryptoHandshake();
 }
 
 void CSteamNetworkConnectionBase::Destroy()
@@ -392,21 +400,10 @@ void CSteamNetworkConnectionBase::FreeResources()
 	// Remove from global connection list
 	if ( m_hConnectionSelf != k_HSteamNetConnection_Invalid )
 	{
-		int idx = g_mapConnections.Find( uint16( m_hConnectionSelf ) );
-		if ( idx == g_mapConnections.InvalidIndex() || g_mapConnections[ idx ] != this )
-		{
-			AssertMsg( false, "Connection list bookeeping corruption" );
-			FOR_EACH_HASHMAP( g_mapConnections, i )
-			{
-				if ( g_mapConnections[i] == this )
-					g_mapConnections.RemoveAt( i );
-			}
-		}
+		if ( g_tableConnections.Remove( m_hConnectionSelf ) )
+			MetricsDecrement( g_metrics.m_nConnections );
 		else
-		{
-			g_mapConnections[ idx ] = nullptr; // Just for grins
-			g_mapConnections.RemoveAt( idx );
-		}
+			AssertMsg( false, "Connection list bookeeping corruption" );
 
 		m_hConnectionSelf = k_HSteamNetConnection_Invalid;
 	}
@@ -414,62 +411,14 @@ void CSteamNetworkConnectionBase::FreeResources()
 	// Make sure and clean out crypto keys and such now
 	ClearCrypto();
 
-	// Save connection ID so we avoid using the same thing in the very near future.
-	if ( m_unConnectionIDLocal )
-	{
-		// Trim history to max.  If we're really cycling through connections fast, this
-		// history won't be very useful, but that should be an extremely rare edge case,
-		// and the worst thing that happens is that we have a higher chance of reusing
-		// a connection ID that shares the same bottom 16 bits.
-		while ( s_vecRecentLocalConnectionIDs.Count() >= k_nMaxRecentLocalConnectionIDs )
-			s_vecRecentLocalConnectionIDs.Remove( 0 );
-		s_vecRecentLocalConnectionIDs.AddToTail( (uint16)m_unConnectionIDLocal );
-
-		// Clear it, since this function should be idempotent
-		m_unConnectionIDLocal = 0;
-	}
+	// Clear connection ID, since this function should be idempotent.
+	// The handle table takes care of not reusing the same ID in the near future.
+	m_unConnectionIDLocal = 0;
 }
 
 bool CSteamNetworkConnectionBase::BInitConnection( uint32 nPeerProtocolVersion, SteamNetworkingMicroseconds usecNow, SteamDatagramErrMsg &errMsg )
 {
-	// We make sure the lower 16 bits are unique.  Make sure we don't have too many connections.
-	// This definitely could be relaxed, but honestly we don't expect this library to be used in situations
-	// where you need that many connections.
-	if ( g_mapConnections.Count() >= 0x1fff )
-	{
-		V_strcpy_safe( errMsg, "Too many connections." );
-		return false;
-	}
-
-	// Select random connection ID, and make sure it passes certain sanity checks
 	Assert( m_unConnectionIDLocal == 0 );
-	int tries = 0;
-	for (;;) {
-		if ( ++tries > 10000 )
-		{
-			V_strcpy_safe( errMsg, "Unable to find unique connection ID" );
-			return false;
-		}
-		CCrypto::GenerateRandomBlock( &m_unConnectionIDLocal, sizeof(m_unConnectionIDLocal) );
-
-		// Make sure neither half is zero
-		if ( ( m_unConnectionIDLocal & 0xffff ) == 0 )
-			continue;
-		if ( ( m_unConnectionIDLocal & 0xffff0000 ) == 0 )
-			continue;
-
-		// Check recent connections
-		if ( s_vecRecentLocalConnectionIDs.HasElement( (uint16)m_unConnectionIDLocal ) )
-			continue;
-
-		// Check active connections
-		if ( g_mapConnections.HasElement( (uint16)m_unConnectionIDLocal ) )
-			continue;
-
-		// This one's good
-		break;
-	}
-
 	Assert( m_hConnectionSelf == k_HSteamNetConnection_Invalid );
 
 	Assert( m_pParentListenSocket == nullptr || m_pSteamNetworkingSocketsInterface == m_pParentListenSocket->m_pSteamNetworkingSocketsInterface );
@@ -489,16 +438,19 @@ bool CSteamNetworkConnectionBase::BInitConnection( uint32 nPeerProtocolVersion,
 	m_statsEndToEnd.Init( usecNow, true ); // Until we go connected don't try to send acks, etc
 	m_statsEndToEnd.m_nPeerProtocolVersion = nPeerProtocolVersion;
 
-	// Let's use the the connection ID as the connection handle.  It's random, not reused
-	// within a short time interval, and we print it in our debugging in places, and you
-	// can see it on the wire for debugging.  In the past we has a "clever" method of
-	// assigning the handle that had some cute performance tricks for lookups and
-	// guaranteeing handles wouldn't be reused.  But making it be the same as the
-	// ConnectionID is probably just more useful and less confusing.
-	m_hConnectionSelf = m_unConnectionIDLocal;
-
-	// Add it to our table of active sockets.
-	g_mapConnections.Insert( int16( m_hConnectionSelf ), this );
+	// Add it to our table of active connections.  The handle is also used as
+	// the connection ID.  It's unique among active connections, not reused within
+	// a short time interval, and we print it in our debugging in places, and you
+	// can see it on the wire for debugging.  Making it be the same as the handle
+	// is more useful and less confusing than having two different IDs.
+	m_hConnectionSelf = g_tableConnections.Add( this );
+	if ( m_hConnectionSelf == k_HSteamNetConnection_Invalid )
+	{
+		V_strcpy_safe( errMsg, "Too many connections." );
+		return false;
+	}
+	MetricsIncrement( g_metrics.m_nConnections );
+	m_unConnectionIDLocal = m_hConnectionSelf;
 
 	// Make sure a description has been set for debugging purposes
 	SetDescription();
@@ -542,14 +494,37 @@ void CSteamNetworkConnectionBase::InitConnectionCrypto( SteamNetworkingMicroseco
 	BThinkCryptoReady( usecNow );
 }
 
-void CSteamNetworkConnectionBase::ClearCrypto()
+ConnectionCryptoHandshake_t &CSteamNetworkConnectionBase::CryptoHandshake()
 {
-	m_msgCertRemote.Clear();
-	m_msgCryptRemote.Clear();
+	if ( !m_pCryptoHandshake )
+		m_pCryptoHandshake = new ConnectionCryptoHandshake_t;
+	return *m_pCryptoHandshake;
+}
 
-	m_keyExchangePrivateKeyLocal.Wipe();
-	m_msgCryptLocal.Clear();
-	m_msgSignedCryptLocal.Clear();
+void CSteamNetworkConnectionBase::FreeCryptoHandshake()
+{
+	if ( !m_pCryptoHandshake )
+		return;
+	m_pCryptoHandshake->m_keyExchangePrivateKeyLocal.Wipe();
+	delete m_pCryptoHandshake;
+	m_pCryptoHandshake = nullptr;
+}
+
+int ConnectionCryptoHandshake_t::GetMemoryUsage() const
+{
+	int cbResult = MemoryUsageOfAllocation( sizeof(*this) );
+	cbResult += int( m_msgCertRemote.SpaceUsedLong() - sizeof(m_msgCertRemote) );
+	cbResult += int( m_msgCryptRemote.SpaceUsedLong() - sizeof(m_msgCryptRemote) );
+	cbResult += MemoryUsageOfAllocation( m_keyExchangePrivateKeyLocal.GetData() ? m_keyExchangePrivateKeyLocal.GetLength() : 0 );
+	cbResult += int( m_msgCryptLocal.SpaceUsedLong() - sizeof(m_msgCryptLocal) );
+	cbResult += int( m_msgSignedCryptLocal.SpaceUsedLong() - sizeof(m_msgSignedCryptLocal) );
+	cbResult += int( m_msgSignedCertLocal.SpaceUsedLong() - sizeof(m_msgSignedCertLocal) );
+	return cbResult;
+}
+
+void CSteamNetworkConnectionBase::ClearCrypto()
+{
+	FreeCryptoHandshake();
 
 	m_bCertHasIdentity = false;
 	m_bCryptKeysValid = false;
@@ -589,7 +564,7 @@ bool CSteamNetworkConnectionBase::BThinkCryptoReady( SteamNetworkingMicroseconds
 	Assert( GetState() == k_ESteamNetworkingConnectionState_Connecting );
 
 	// Do we already have a cert?
-	if ( m_msgSignedCertLocal.has_cert() )
+	if ( BHasLocalCert() )
 		return true;
 
 	// If we are using an anonymous identity, then always use self-signed.
@@ -654,30 +629,31 @@ void CSteamNetworkConnectionBase::InitLocalCrypto( const CMsgSteamDatagramCertif
 {
 	Assert( msgSignedCert.has_cert() );
 	Assert( keyPrivate.IsValid() );
+	ConnectionCryptoHandshake_t &hs = CryptoHandshake();
 
 	// Save off the signed certificate
-	m_msgSignedCertLocal = msgSignedCert;
+	hs.m_msgSignedCertLocal = msgSignedCert;
 	m_bCertHasIdentity = bCertHasIdentity;
 
 	// Set our base protocol type
-	m_msgCryptLocal.set_is_snp( true );
+	hs.m_msgCryptLocal.set_is_snp( true );
 
 	// Generate a keypair for key exchange
 	CECKeyExchangePublicKey publicKeyLocal;
-	CCrypto::GenerateKeyExchangeKeyPair( &publicKeyLocal, &m_keyExchangePrivateKeyLocal );
-	m_msgCryptLocal.set_key_type( CMsgSteamDatagramSessionCryptInfo_EKeyType_CURVE25519 );
-	m_msgCryptLocal.set_key_data( publicKeyLocal.GetData(), publicKeyLocal.GetLength() );
+	CCrypto::GenerateKeyExchangeKeyPair( &publicKeyLocal, &hs.m_keyExchangePrivateKeyLocal );
+	hs.m_msgCryptLocal.set_key_type( CMsgSteamDatagramSessionCryptInfo_EKeyType_CURVE25519 );
+	hs.m_msgCryptLocal.set_key_data( publicKeyLocal.GetData(), publicKeyLocal.GetLength() );
 
 	// Generate some more randomness for the secret key
 	uint64 crypt_nonce;
 	CCrypto::GenerateRandomBlock( &crypt_nonce, sizeof(crypt_nonce) );
-	m_msgCryptLocal.set_nonce( crypt_nonce );
+	hs.m_msgCryptLocal.set_nonce( crypt_nonce );
 
 	// Serialize and sign the crypt key with the private key that matches this cert
-	m_msgSignedCryptLocal.set_info( m_msgCryptLocal.SerializeAsString() );
+	hs.m_msgSignedCryptLocal.set_info( hs.m_msgCryptLocal.SerializeAsString() );
 	CryptoSignature_t sig;
-	CCrypto::GenerateSignature( (const uint8 *)m_msgSignedCryptLocal.info().c_str(), (uint32)m_msgSignedCryptLocal.info().length(), keyPrivate, &sig );
-	m_msgSignedCryptLocal.set_signature( &sig, sizeof(sig) );
+	CCrypto::GenerateSignature( (const uint8 *)hs.m_msgSignedCryptLocal.info().c_str(), (uint32)hs.m_msgSignedCryptLocal.info().length(), keyPrivate, &sig );
+	hs.m_msgSignedCryptLocal.set_signature( &sig, sizeof(sig) );
 }
 
 void CSteamNetworkConnectionBase::InitLocalCryptoWithUnsignedCert()
@@ -733,6 +709,7 @@ void CSteamNetworkConnectionBase::CertRequestFailed( ESteamNetConnectionEnd nCon
 
 bool CSteamNetworkConnectionBase::BRecvCryptoHandshake( const CMsgSteamDatagramCertificateSigned &msgCert, const CMsgSteamDatagramSessionCryptInfoSigned &msgSessionInfo, bool bServer )
 {
+	VPROF_BUDGET( "BRecvCryptoHandshake", VPROF_BUDGETGROUP_HANDSHAKE );
 
 	// Have we already done key exchange?
 	if ( m_bCryptKeysValid )
@@ -749,7 +726,8 @@ bool CSteamNetworkConnectionBase::BRecvCryptoHandshake( const CMsgSteamDatagramC
 	}
 
 	// Deserialize the cert
-	if ( !m_msgCertRemote.ParseFromString( msgCert.cert() ) )
+	ConnectionCryptoHandshake_t &hs = CryptoHandshake();
+	if ( !hs.m_msgCertRemote.ParseFromString( msgCert.cert() ) )
 	{
 		ConnectionState_ProblemDetectedLocally( k_ESteamNetConnectionEnd_Remote_BadCrypt, "Cert failed protobuf decode" );
 		return false;
@@ -757,23 +735,23 @@ bool CSteamNetworkConnectionBase::BRecvCryptoHandshake( const CMsgSteamDatagramC
 
 	// Identity public key
 	CECSigningPublicKey keySigningPublicKeyRemote;
-	if ( m_msgCertRemote.key_type() != CMsgSteamDatagramCertificate_EKeyType_ED25519 )
+	if ( hs.m_msgCertRemote.key_type() != CMsgSteamDatagramCertificate_EKeyType_ED25519 )
 	{
 		ConnectionState_ProblemDetectedLocally( k_ESteamNetConnectionEnd_Remote_BadCrypt, "Unsupported identity key type" );
 		return false;
 	}
-	if ( !keySigningPublicKeyRemote.Set( m_msgCertRemote.key_data().c_str(), (uint32)m_msgCertRemote.key_data().length() ) || !keySigningPublicKeyRemote.IsValid() )
+	if ( !keySigningPublicKeyRemote.Set( hs.m_msgCertRemote.key_data().c_str(), (uint32)hs.m_msgCertRemote.key_data().length() ) || !keySigningPublicKeyRemote.IsValid() )
 	{
 		ConnectionState_ProblemDetectedLocally( k_ESteamNetConnectionEnd_Remote_BadCrypt, "Cert has invalid identity key" );
 		return false;
 	}
 
 	// We need a cert.  If we don't have one by now, then we might try generating one
-	if ( m_msgSignedCertLocal.has_cert() )
+	if ( hs.m_msgSignedCertLocal.has_cert() )
 	{
-		Assert( m_msgCryptLocal.has_nonce() );
-		Assert( m_msgCryptLocal.has_key_data() );
-		Assert( m_msgCryptLocal.has_key_type() );
+		Assert( hs.m_msgCryptLocal.has_nonce() );
+		Assert( hs.m_msgCryptLocal.has_key_data() );
+		Assert( hs.m_msgCryptLocal.has_key_type() );
 	}
 	else
 	{
@@ -791,17 +769,17 @@ bool CSteamNetworkConnectionBase::BRecvCryptoHandshake( const CMsgSteamDatagramC
 	}
 
 	// If cert has an App ID restriction, then it better match our App
-	if ( m_msgCertRemote.has_app_id() )
+	if ( hs.m_msgCertRemote.has_app_id() )
 	{
-		if ( m_msgCertRemote.app_id() != m_pSteamNetworkingSocketsInterface->m_nAppID )
+		if ( hs.m_msgCertRemote.app_id() != m_pSteamNetworkingSocketsInterface->m_nAppID )
 		{
-			ConnectionState_ProblemDetectedLocally( k_ESteamNetConnectionEnd_Remote_BadCert, "Cert is for AppID %u instead of %u", m_msgCertRemote.app_id(), m_pSteamNetworkingSocketsInterface->m_nAppID );
+			ConnectionState_ProblemDetectedLocally( k_ESteamNetConnectionEnd_Remote_BadCert, "Cert is for AppID %u instead of %u", hs.m_msgCertRemote.app_id(), m_pSteamNetworkingSocketsInterface->m_nAppID );
 			return false;
 		}
 	}
 
 	// Special cert for gameservers in our data center?
-	if ( m_msgCertRemote.gameserver_datacenter_ids_size()>0 && msgCert.has_ca_signature() )
+	if ( hs.m_msgCertRemote.gameserver_datacenter_ids_size()>0 && msgCert.has_ca_signature() )
 	{
 		if ( !m_identityRemote.GetSteamID().BAnonGameServerAccount() )
 		{
@@ -811,14 +789,14 @@ bool CSteamNetworkConnectionBase::BRecvCryptoHandshake( const CMsgSteamDatagramC
 	}
 	else
 	{
-		if ( !m_msgCertRemote.has_app_id() )
+		if ( !hs.m_msgCertRemote.has_app_id() )
 		{
 			ConnectionState_ProblemDetectedLocally( k_ESteamNetConnectionEnd_Remote_BadCert, "Cert must be bound to an AppID." );
 			return false;
 		}
 		SteamNetworkingIdentity identityCert;
 		SteamDatagramErrMsg errMsg;
-		if ( SteamNetworkingIdentityFromCert( identityCert, m_msgCertRemote, errMsg ) <= 0 )
+		if ( SteamNetworkingIdentityFromCert( identityCert, hs.m_msgCertRemote, errMsg ) <= 0 )
 		{
 			ConnectionState_ProblemDetectedLocally( k_ESteamNetConnectionEnd_Remote_BadCert, "Bad cert identity.  %s", errMsg );
 			return false;
@@ -880,7 +858,7 @@ bool CSteamNetworkConnectionBase::BRecvCryptoHandshake( const CMsgSteamDatagramC
 		// Make sure hasn't expired.  All signed certs without an expiry should be considered invalid!
 		// For unsigned certs, there's no point in checking the expiry, since anybody who wanted
 		// to do bad stuff could just change it, we have no protection against tampering.
-		long rtExpiry = m_msgCertRemote.time_expiry();
+		long rtExpiry = hs.m_msgCertRemote.time_expiry();
 		if ( rtNow > rtExpiry )
 		{
 			//ConnectionState_ProblemDetectedLocally( k_ESteamNetConnectionEnd_Remote_BadCert, msg );
@@ -917,7 +895,7 @@ bool CSteamNetworkConnectionBase::BRecvCryptoHandshake( const CMsgSteamDatagramC
 	}
 
 	// Deserialize crypt info
-	if ( !m_msgCryptRemote.ParseFromString( msgSessionInfo.info() ) )
+	if ( !hs.m_msgCryptRemote.ParseFromString( msgSessionInfo.info() ) )
 	{
 		ConnectionState_ProblemDetectedLocally( k_ESteamNetConnectionEnd_Remote_BadCrypt, "Crypt info failed protobuf decode" );
 		return false;
@@ -925,19 +903,19 @@ bool CSteamNetworkConnectionBase::BRecvCryptoHandshake( const CMsgSteamDatagramC
 
 	// Key exchange public key
 	CECKeyExchangePublicKey keyExchangePublicKeyRemote;
-	if ( m_msgCryptRemote.key_type() != CMsgSteamDatagramSessionCryptInfo_EKeyType_CURVE25519 )
+	if ( hs.m_msgCryptRemote.key_type() != CMsgSteamDatagramSessionCryptInfo_EKeyType_CURVE25519 )
 	{
 		ConnectionState_ProblemDetectedLocally( k_ESteamNetConnectionEnd_Remote_BadCrypt, "Unsupported DH key type" );
 		return false;
 	}
-	if ( !keyExchangePublicKeyRemote.Set( m_msgCryptRemote.key_data().c_str(), (uint32)m_msgCryptRemote.key_data().length() ) || !keyExchangePublicKeyRemote.IsValid() )
+	if ( !keyExchangePublicKeyRemote.Set( hs.m_msgCryptRemote.key_data().c_str(), (uint32)hs.m_msgCryptRemote.key_data().length() ) || !keyExchangePublicKeyRemote.IsValid() )
 	{
 		ConnectionState_ProblemDetectedLocally( k_ESteamNetConnectionEnd_Remote_BadCrypt, "Invalid DH key" );
 		return false;
 	}
 
 	// SNP must be same on both ends
-	if ( !m_msgCryptRemote.is_snp() )
+	if ( !hs.m_msgCryptRemote.is_snp() )
 	{
 		ConnectionState_ProblemDetectedLocally( k_ESteamNetConnectionEnd_Remote_BadCrypt, "Incompatible protocol format (SNP)" );
 		return false;
@@ -945,11 +923,11 @@ bool CSteamNetworkConnectionBase::BRecvCryptoHandshake( const CMsgSteamDatagramC
 
 	// DiffieHellman key exchange to get "premaster secret"
 	AutoWipeFixedSizeBuffer<sizeof(SHA256Digest_t)> premasterSecret;
-	CCrypto::PerformKeyExchange( m_keyExchangePrivateKeyLocal, keyExchangePublicKeyRemote, &premasterSecret.m_buf );
+	CCrypto::PerformKeyExchange( hs.m_keyExchangePrivateKeyLocal, keyExchangePublicKeyRemote, &premasterSecret.m_buf );
 	//SpewMsg( "%s premaster: %02x%02x%02x%02x\n", bServer ? "Server" : "Client", premasterSecret.m_buf[0], premasterSecret.m_buf[1], premasterSecret.m_buf[2], premasterSecret.m_buf[3] );
 
 	// We won't need this again, so go ahead and discard it now.
-	m_keyExchangePrivateKeyLocal.Wipe();
+	hs.m_keyExchangePrivateKeyLocal.Wipe();
 
 	//
 	// HMAC Key derivation function.
@@ -961,7 +939,7 @@ bool CSteamNetworkConnectionBase::BRecvCryptoHandshake( const CMsgSteamDatagramC
 	//
 	// 1. Extract: take premaster secret from key exchange and mix it so that it's evenly distributed, producing Pseudorandom key ("PRK")
 	//
-	uint64 salt[2] = { LittleQWord( m_msgCryptRemote.nonce() ), LittleQWord( m_msgCryptLocal.nonce() ) };
+	uint64 salt[2] = { LittleQWord( hs.m_msgCryptRemote.nonce() ), LittleQWord( hs.m_msgCryptLocal.nonce() ) };
 	if ( bServer )
 		std::swap( salt[0], salt[1] );
 	AutoWipeFixedSizeBuffer<sizeof(SHA256Digest_t)> prk;
@@ -979,7 +957,7 @@ bool CSteamNetworkConnectionBase::BRecvCryptoHandshake( const CMsgSteamDatagramC
 
 	uint8 *expandOrder[4] = { m_cryptKeySend.m_buf, m_cryptKeyRecv.m_buf, m_cryptIVSend.m_buf, m_cryptIVRecv.m_buf };
 	int expandSize[4] = { m_cryptKeySend.k_nSize, m_cryptKeyRecv.k_nSize, m_cryptIVSend.k_nSize, m_cryptIVRecv.k_nSize };
-	const std::string *context[4] = { &msgCert.cert(), &m_msgSignedCertLocal.cert(), &msgSessionInfo.info(), &m_msgSignedCryptLocal.info() };
+	const std::string *context[4] = { &msgCert.cert(), &hs.m_msgSignedCertLocal.cert(), &msgSessionInfo.info(), &hs.m_msgSignedCryptLocal.info() };
 	uint32 unConnectionIDContext[2] = { LittleDWord( m_unConnectionIDLocal ), LittleDWord( m_unConnectionIDRemote ) };
 
 	// Make sure that both peers do things the same, so swap "local" and "remote" on one side arbitrarily.
@@ -1088,10 +1066,8 @@ void CSteamNetworkConnectionBase::PopulateConnectionInfo( SteamNetConnectionInfo
 	V_strcpy_safe( info.m_szConnectionDescription, m_szDescription );
 }
 
-void CSteamNetworkConnectionBase::APIGetQuickConnectionStatus( SteamNetworkingQuickConnectionStatus &stats )
+void CSteamNetworkConnectionBase::APIGetQuickConnectionStatus( SteamNetworkingQuickConnectionStatus &stats, SteamNetworkingMicroseconds usecNow )
 {
-	SteamNetworkingMicroseconds usecNow = SteamNetworkingSockets_GetLocalTimestamp();
-
 	stats.m_eState = CollapseConnectionStateToAPIState( m_eConnectionState );
 	stats.m_nPing = m_statsEndToEnd.m_ping.m_nSmoothedPing;
 	if ( m_statsEndToEnd.m_flInPacketsDroppedPct >= 0.0f )
@@ -1131,15 +1107,69 @@ void CSteamNetworkConnectionBase::APIGetDetailedConnectionStatus( SteamNetworkin
 	PopulateConnectionInfo( stats.m_info );
 
 	// Copy end-to-end stats
-	m_statsEndToEnd.GetLinkStats( stats.m_statsEndToEnd, usecNow );
+	APIGetLinkStats( stats.m_statsEndToEnd, usecNow );
+}
+
+void CSteamNetworkConnectionBase::APIGetLinkStats( SteamDatagramLinkStats &stats, SteamNetworkingMicroseconds usecNow ) const
+{
+	m_statsEndToEnd.GetLinkStats( stats, usecNow );
 
 	// Congestion control and bandwidth estimation
-	SNP_PopulateDetailedStats( stats.m_statsEndToEnd );
+	SNP_PopulateDetailedStats( stats );
+}
+
+void CSteamNetworkConnectionBase::APIGetMemoryUsage( SteamNetConnectionMemoryUsage_t &usage ) const
+{
+	memset( &usage, 0, sizeof(usage) );
+
+	// Stats tracker is all inline
+	usage.m_cbStats = sizeof( m_statsEndToEnd );
+
+	// Crypto keys are inline, the handshake state is only allocated while
+	// we are connecting
+	usage.m_cbCrypto = int( sizeof( m_pCryptoHandshake ) + sizeof( m_bCertHasIdentity ) + sizeof( m_bCryptKeysValid )
+		+ sizeof( m_cryptKeySend ) + sizeof( m_cryptKeyRecv ) + sizeof( m_cryptIVSend ) + sizeof( m_cryptIVRecv ) );
+	const int cbCryptoInline = usage.m_cbCrypto;
+	if ( m_pCryptoHandshake )
+		usage.m_cbCrypto += m_pCryptoHandshake->GetMemoryUsage();
+
+	// Messages waiting for the app to receive them
+	usage.m_cbRecvQueue = sizeof( m_queueRecvMessages );
+	for ( const CSteamNetworkingMessage *pMsg = m_queueRecvMessages.m_pFirst ; pMsg ; pMsg = pMsg->m_linksSameConnection.m_pNext )
+		usage.m_cbRecvQueue += MemoryUsageOfAllocation( sizeof(*pMsg) ) + MemoryUsageOfAllocation( pMsg->m_cbSize );
+
+	// Everything else in the base object.  (Including the SNP state,
+	// which is inline.)
+	usage.m_cbConnection = int( sizeof( CSteamNetworkConnectionBase ) - sizeof( m_statsEndToEnd ) - sizeof( m_queueRecvMessages ) ) - cbCryptoInline;
+
+	// Heap memory used by SNP
+	SNP_GetMemoryUsage( usage );
+
+	// Derived class
+	usage.m_cbTransport = GetTransportMemoryUsage();
+
+	usage.m_cbTotal = usage.m_cbConnection + usage.m_cbSendQueue + usage.m_cbRecvBuffer + usage.m_cbRecvQueue
+		+ usage.m_cbInFlight + usage.m_cbStats + usage.m_cbCrypto + usage.m_cbTransport;
 }
 
-EResult CSteamNetworkConnectionBase::APISendMessageToConnection( const void *pData, uint32 cbData, ESteamNetworkingSendType eSendType )
+EResult CSteamNetworkConnectionBase::APISendMessageToConnection( const void *pData, uint32 cbData, ESteamNetworkingSendType eSendType, int idxLane )
 {
 
+	// Check lane
+	if ( idxLane < 0 || idxLane >= len( m_senderState.m_vecLanes ) )
+	{
+		SpewBug( "Invalid lane %d; connection has %d lanes\n", idxLane, len( m_senderState.m_vecLanes ) );
+		return k_EResultInvalidParam;
+	}
+
+	// Stream chunks must be reliable, and delivered in order
+	if ( ( eSendType & k_nSteamNetworkingSendFlags_StreamContinues )
+		&& ( eSendType & ( k_nSteamNetworkingSendFlags_Reliable|k_nSteamNetworkingSendFlags_Unordered ) ) != k_nSteamNetworkingSendFlags_Reliable )
+	{
+		SpewBug( "k_nSteamNetworkingSendFlags_StreamContinues requires reliable, ordered send type (got %d)\n", (int)eSendType );
+		return k_EResultInvalidParam;
+	}
+
 	// Check connection state
 	switch ( GetState() )
 	{
@@ -1158,6 +1188,14 @@ EResult CSteamNetworkConnectionBase::APISendMessageToConnection( const void *pDa
 			break;
 
 		case k_ESteamNetworkingConnectionState_Connected:
+
+			// If we already know the peer can't handle streams, don't queue anything
+			// they won't understand
+			if ( ( eSendType & k_nSteamNetworkingSendFlags_StreamContinues ) && m_statsEndToEnd.m_nPeerProtocolVersion < k_nMinPeerProtocolVersionStreams )
+			{
+				SpewWarning( "[%s] Peer is using protocol version %u, which doesn't support streams\n", GetDescription(), m_statsEndToEnd.m_nPeerProtocolVersion );
+				return k_EResultInvalidState;
+			}
 			break;
 
 		case k_ESteamNetworkingConnectionState_ClosedByPeer:
@@ -1166,10 +1204,10 @@ EResult CSteamNetworkConnectionBase::APISendMessageToConnection( const void *pDa
 	}
 
 	// Connection-type specific logic
-	return _APISendMessageToConnection( pData, cbData, eSendType );
+	return _APISendMessageToConnection( pData, cbData, eSendType, idxLane );
 }
 
-EResult CSteamNetworkConnectionBase::_APISendMessageToConnection( const void *pData, uint32 cbData, ESteamNetworkingSendType eSendType )
+EResult CSteamNetworkConnectionBase::_APISendMessageToConnection( const void *pData, uint32 cbData, ESteamNetworkingSendType eSendType, int idxLane )
 {
 
 	// Message too big?
@@ -1182,13 +1220,50 @@ EResult CSteamNetworkConnectionBase::_APISendMessageToConnection( const void *pD
 	// Fake loss?
 	if ( !( eSendType & k_nSteamNetworkingSendFlags_Reliable ) )
 	{
-		if ( WeakRandomFloat( 0, 100.0 ) < steamdatagram_fakemessageloss_send )
+		if ( steamdatagram_fakemessageloss_send > 0 && FakeNetworkRandomFloat( 0, 100.0 ) < steamdatagram_fakemessageloss_send )
 			return k_EResultOK;
 	}
 
 	// Using SNP?
 	SteamNetworkingMicroseconds usecNow = SteamNetworkingSockets_GetLocalTimestamp();
-	return SNP_SendMessage( usecNow, pData, cbData, eSendType );
+	return SNP_SendMessage( usecNow, pData, cbData, eSendType, idxLane );
+}
+
+EResult CSteamNetworkConnectionBase::APIConfigureLanes( int nNumLanes, const int *pLanePriorities, const uint16 *pLaneWeights )
+{
+
+	// Check connection state
+	switch ( GetState() )
+	{
+		case k_ESteamNetworkingConnectionState_None:
+		case k_ESteamNetworkingConnectionState_FinWait:
+		case k_ESteamNetworkingConnectionState_Linger:
+		case k_ESteamNetworkingConnectionState_Dead:
+		default:
+			AssertMsg( false, "Why are making API calls on this connection?" );
+			return k_EResultInvalidState;
+
+		case k_ESteamNetworkingConnectionState_Connecting:
+		case k_ESteamNetworkingConnectionState_FindingRoute:
+			break;
+
+		case k_ESteamNetworkingConnectionState_Connected:
+
+			// If we already know the peer can't handle lanes, then don't
+			// let them configure any.
+			if ( nNumLanes > 1 && m_statsEndToEnd.m_nPeerProtocolVersion < k_nMinPeerProtocolVersionLanes )
+			{
+				SpewWarning( "[%s] Peer is using protocol version %u, which doesn't support lanes\n", GetDescription(), m_statsEndToEnd.m_nPeerProtocolVersion );
+				return k_EResultInvalidState;
+			}
+			break;
+
+		case k_ESteamNetworkingConnectionState_ClosedByPeer:
+		case k_ESteamNetworkingConnectionState_ProblemDetectedLocally:
+			return k_EResultNoConnection;
+	}
+
+	return SNP_ConfigureLanes( nNumLanes, pLanePriorities, pLaneWeights );
 }
 
 
@@ -1227,6 +1302,7 @@ int CSteamNetworkConnectionBase::APIReceiveMessages( SteamNetworkingMessage_t **
 
 int64 CSteamNetworkConnectionBase::DecryptDataChunk( uint16 nWireSeqNum, const void *pChunk, int cbChunk, void *pDecrypted, uint32 &cbDecrypted, SteamNetworkingMicroseconds usecNow )
 {
+	VPROF_BUDGET( "DecryptDataChunk", VPROF_BUDGETGROUP_ENCRYPTION );
 	Assert( m_bCryptKeysValid );
 	Assert( cbDecrypted >= k_cbSteamNetworkingSocketsMaxPlaintextPayloadRecv );
 
@@ -1257,6 +1333,7 @@ int64 CSteamNetworkConnectionBase::DecryptDataChunk( uint16 nWireSeqNum, const v
 		// The assumption is that we either have a bug or some weird thing,
 		// or that somebody is spoofing / tampering.  If it's the latter
 		// we don't want to magnify the impact of their efforts
+		MetricsIncrement( g_metrics.m_nDecryptFailures );
 		SpewWarningRateLimited( usecNow, "[%s] Packet data chunk failed to decrypt!  Could be tampering/spoofing or a bug.", GetDescription() );
 		return 0;
 	}
@@ -1286,6 +1363,11 @@ int64 CSteamNetworkConnectionBase::DecryptDataChunk( uint16 nWireSeqNum, const v
 		return 0;
 	}
 
+	// Peer could only have encrypted this if it got our cert and session info,
+	// so we won't need to send them again
+	if ( m_pCryptoHandshake )
+		FreeCryptoHandshake();
+
 	// Decrypted ok
 	return nFullSequenceNumber;
 }
@@ -1398,11 +1480,41 @@ void CSteamNetworkConnectionBase::SetState( ESteamNetworkingConnectionState eNew
 	// Remember when we entered this state
 	m_usecWhenEnteredConnectionState = usecNow;
 
+	// Track handshakes for the global metrics
+	if ( eNewState == k_ESteamNetworkingConnectionState_Connecting )
+	{
+		MetricsIncrement( g_metrics.m_nHandshakesStarted );
+	}
+	else if ( eOldState == k_ESteamNetworkingConnectionState_Connecting || eOldState == k_ESteamNetworkingConnectionState_FindingRoute )
+	{
+		if ( eNewState == k_ESteamNetworkingConnectionState_Connected )
+			MetricsIncrement( g_metrics.m_nHandshakesCompleted );
+		else if ( eNewState == k_ESteamNetworkingConnectionState_ClosedByPeer || eNewState == k_ESteamNetworkingConnectionState_ProblemDetectedLocally )
+			MetricsIncrement( g_metrics.m_nHandshakesFailed );
+	}
+
 	// Give derived classes get a chance to take action on state changes
 	ConnectionStateChanged( eOldState );
 }
 
-void CSteamNetworkConnectionBase::ReceivedMessage( const void *pData, int cbData, int64 nMsgNum, SteamNetworkingMicroseconds usecNow )
+bool CSteamNetworkConnectionBase::BSetTransportPacingRate( int nBytesPerSec )
+{
+	// By default, we don't know how to ask for help
+	return false;
+}
+
+int CSteamNetworkConnectionBase::GetTransportMemoryUsage() const
+{
+	return 0;
+}
+
+int CSteamNetworkConnectionBase::GetMaxEncryptedPayloadSendToProbe() const
+{
+	// By default, don't probe
+	return k_cbSteamNetworkingSocketsMaxEncryptedPayloadSend;
+}
+
+void CSteamNetworkConnectionBase::ReceivedMessage( const void *pData, int cbData, int idxLane, int64 nMsgNum, SteamNetworkingMicroseconds usecNow )
 {
 //	// !TEST! Enable this during connection test to trap bogus messages earlier
 //	#if 1
@@ -1419,13 +1531,23 @@ void CSteamNetworkConnectionBase::ReceivedMessage( const void *pData, int cbData
 //		Assert( sizeof(*pTestMsg) - sizeof(pTestMsg->m_data) + pTestMsg->m_cbSize == cbData );
 //	#endif
 
-	SpewType( steamdatagram_snp_log_message, "[%s] RecvMessage MsgNum=%lld sz=%d\n",
-		GetDescription(),
-		(long long)nMsgNum,
-		cbData );
-
 	// Create a message
 	CSteamNetworkingMessage *pMsg = CSteamNetworkingMessage::New( this, cbData, nMsgNum, usecNow );
+	pMsg->m_idxLane = uint16( idxLane );
+
+	// Copy the data
+	memcpy( const_cast<void*>( pMsg->GetData() ), pData, cbData );
+
+	// Queue it
+	ReceivedMessage( pMsg );
+}
+
+void CSteamNetworkConnectionBase::ReceivedMessage( CSteamNetworkingMessage *pMsg )
+{
+	SpewType( steamdatagram_snp_log_message, "[%s] RecvMessage MsgNum=%lld sz=%d\n",
+		GetDescription(),
+		(long long)pMsg->m_nMessageNumber,
+		pMsg->m_cbSize );
 
 	// Add to end of my queue.
 	pMsg->LinkToQueueTail( &CSteamNetworkingMessage::m_linksSameConnection, &m_queueRecvMessages );
@@ -1433,9 +1555,6 @@ void CSteamNetworkConnectionBase::ReceivedMessage( const void *pData, int cbData
 	// If we are an inbound, accepted connection, link into the listen socket's queue
 	if ( m_pParentListenSocket )
 		pMsg->LinkToQueueTail( &CSteamNetworkingMessage::m_linksSecondaryQueue, &m_pParentListenSocket->m_queueRecvMessages );
-
-	// Copy the data
-	memcpy( const_cast<void*>( pMsg->GetData() ), pData, cbData );
 }
 
 void CSteamNetworkConnectionBase::ConnectionStateChanged( ESteamNetworkingConnectionState eOldState )
@@ -2039,7 +2158,7 @@ failed:
 		CSteamNetworkConnectionPipe *q = pConn[1-i];
 		p->m_identityRemote = q->m_identityLocal;
 		p->m_unConnectionIDRemote = q->m_unConnectionIDLocal;
-		if ( !p->BRecvCryptoHandshake( q->m_msgSignedCertLocal, q->m_msgSignedCryptLocal, i==0 ) )
+		if ( !p->BRecvCryptoHandshake( q->CryptoHandshake().m_msgSignedCertLocal, q->CryptoHandshake().m_msgSignedCryptLocal, i==0 ) )
 		{
 			AssertMsg( false, "BRecvCryptoHandshake failed creating localhost socket pair" );
 			goto failed;
@@ -2047,6 +2166,10 @@ failed:
 		p->ConnectionState_Connected( usecNow );
 	}
 
+	// Both sides have their keys, we won't need the handshake state again
+	pConn[0]->FreeCryptoHandshake();
+	pConn[1]->FreeCryptoHandshake();
+
 	return true;
 }
 
@@ -2067,6 +2190,11 @@ void CSteamNetworkConnectionPipe::GetConnectionTypeDescription( ConnectionTypeDe
 	V_strcpy_safe( szDescription, "pipe" );
 }
 
+int CSteamNetworkConnectionPipe::GetTransportMemoryUsage() const
+{
+	return int( sizeof(*this) - sizeof(CSteamNetworkConnectionBase) );
+}
+
 CSteamNetworkConnectionBase::ERemoteUnsignedCert CSteamNetworkConnectionPipe::AllowRemoteUnsignedCert()
 {
 	// It's definitely us, and we trust ourselves, right?
@@ -2078,7 +2206,7 @@ void CSteamNetworkConnectionPipe::InitConnectionCrypto( SteamNetworkingMicroseco
 	InitLocalCryptoWithUnsignedCert();
 }
 
-EResult CSteamNetworkConnectionPipe::_APISendMessageToConnection( const void *pData, uint32 cbData, ESteamNetworkingSendType eSendType )
+EResult CSteamNetworkConnectionPipe::_APISendMessageToConnection( const void *pData, uint32 cbData, ESteamNetworkingSendType eSendType, int idxLane )
 {
 	if ( !m_pPartner )
 	{
@@ -2091,10 +2219,15 @@ EResult CSteamNetworkConnectionPipe::_APISendMessageToConnection( const void *pD
 	// Fake a bunch of stats
 	FakeSendStats( usecNow, cbData );
 
-	int64 nMsgNum = ++m_senderState.m_nLastSentMsgNum;
+	int64 nMsgNum = ++m_senderState.m_vecLanes[ idxLane ].m_nLastSentMsgNum;
 
 	// Pass directly to our partner
-	m_pPartner->ReceivedMessage( pData, cbData, nMsgNum, usecNow );
+	CSteamNetworkingMessage *pMsg = CSteamNetworkingMessage::New( m_pPartner, cbData, nMsgNum, usecNow );
+	pMsg->m_idxLane = uint16( idxLane );
+	if ( eSendType & k_nSteamNetworkingSendFlags_StreamContinues )
+		pMsg->m_nFlags = k_nSteamNetworkingMessageFlags_StreamContinues;
+	memcpy( pMsg->m_pData, pData, cbData );
+	m_pPartner->ReceivedMessage( pMsg );
 
 	return k_EResultOK;
 }
@@ -56,6 +56,29 @@ public:
 	inline ~AutoWipeFixedSizeBuffer() { Wipe(); }
 };
 
+/// Crypto state that we only need while we are doing the handshake.  This is
+/// allocated when the connection starts, and freed as soon as the peer proves
+/// that it has our session keys, by sending us data we can decrypt.
+/// (Or when the connection is closed.)  The certs and signatures are a big
+/// chunk of the memory used by an idle connection.
+struct ConnectionCryptoHandshake_t
+{
+	STEAMNETWORKINGSOCKETS_DECLARE_TAGGED_ALLOC( k_ESteamNetworkingAllocTag_Connection )
+
+	// Remote crypt info
+	CMsgSteamDatagramCertificate m_msgCertRemote;
+	CMsgSteamDatagramSessionCryptInfo m_msgCryptRemote;
+
+	// Local crypto info for this connection
+	CECKeyExchangePrivateKey m_keyExchangePrivateKeyLocal;
+	CMsgSteamDatagramSessionCryptInfo m_msgCryptLocal;
+	CMsgSteamDatagramSessionCryptInfoSigned m_msgSignedCryptLocal;
+	CMsgSteamDatagramCertificateSigned m_msgSignedCertLocal;
+
+	/// Estimate of memory used, including this object
+	int GetMemoryUsage() const;
+};
+
 /// In various places, we need a key in a map of remote connections.
 struct RemoteConnectionKey_t
 {
@@ -84,6 +107,8 @@ struct RemoteConnectionKey_t
 class CSteamNetworkingMessage : public SteamNetworkingMessage_t
 {
 public:
+	STEAMNETWORKINGSOCKETS_DECLARE_TAGGED_ALLOC( k_ESteamNetworkingAllocTag_Message )
+
 	static CSteamNetworkingMessage *New( CSteamNetworkConnectionBase *pParent, uint32 cbSize, int64 nMsgNum, SteamNetworkingMicroseconds usecNow );
 	static void Delete( SteamNetworkingMessage_t *piMsg );
 
@@ -192,6 +217,8 @@ protected:
 class CSteamNetworkConnectionBase : protected IThinker
 {
 public:
+	STEAMNETWORKINGSOCKETS_DECLARE_TAGGED_ALLOC( k_ESteamNetworkingAllocTag_Connection )
+
 
 //
 // API entry points
@@ -201,7 +228,10 @@ public:
 	void APICloseConnection( int nReason, const char *pszDebug, bool bEnableLinger );
 
 	/// Send a message
-	EResult APISendMessageToConnection( const void *pData, uint32 cbData, ESteamNetworkingSendType eSendType );
+	EResult APISendMessageToConnection( const void *pData, uint32 cbData, ESteamNetworkingSendType eSendType, int idxLane );
+
+	/// Set the number of lanes, and their priorities and weights
+	EResult APIConfigureLanes( int nNumLanes, const int *pLanePriorities, const uint16 *pLaneWeights );
 
 	/// Flush any messages queued for Nagle
 	EResult APIFlushMessageOnConnection();
@@ -215,11 +245,17 @@ public:
 	virtual EResult APIAcceptConnection() = 0;
 
 	/// Fill in quick connection stats
-	void APIGetQuickConnectionStatus( SteamNetworkingQuickConnectionStatus &stats );
+	void APIGetQuickConnectionStatus( SteamNetworkingQuickConnectionStatus &stats, SteamNetworkingMicroseconds usecNow );
 
 	/// Fill in detailed connection stats
 	virtual void APIGetDetailedConnectionStatus( SteamNetworkingDetailedConnectionStatus &stats, SteamNetworkingMicroseconds usecNow ) const;
 
+	/// Fill in end-to-end link stats.  (Part of the detailed stats)
+	void APIGetLinkStats( SteamDatagramLinkStats &stats, SteamNetworkingMicroseconds usecNow ) const;
+
+	/// Estimate memory used by this connection
+	void APIGetMemoryUsage( SteamNetConnectionMemoryUsage_t &usage ) const;
+
 //
 // Accessor
 //
@@ -342,18 +378,29 @@ public:
 	void SetMaximumRate( int nRate );
 	inline int GetMinimumRate() const { return m_senderState.m_n_minRate; }
 	inline int GetMaximumRate() const { return m_senderState.m_n_maxRate; }
+	int GetCongestionControl() const;
+	bool SetCongestionControl( int eType );
+
+	/// Fake lag settings for outbound packets on this connection.
+	/// (Only honored by connection types that actually send packets.)
+	FakeLagSettings_t m_fakeLagSend;
 
 
 	/// Called when the async process to request a cert has failed.
 	void CertRequestFailed( ESteamNetConnectionEnd nConnectionEndReason, const char *pszMsg );
-	bool BHasLocalCert() const { return m_msgSignedCertLocal.has_cert(); }
+	bool BHasLocalCert() const { return m_pCryptoHandshake && m_pCryptoHandshake->m_msgSignedCertLocal.has_cert(); }
 	void InitLocalCrypto( const CMsgSteamDatagramCertificateSigned &msgSignedCert, const CECSigningPrivateKey &keyPrivate, bool bCertHasIdentity );
 	void InterfaceGotCert();
 
 	void SNP_PopulateP2PSessionStateStats( P2PSessionState_t &info ) const;
 	bool SNP_BHasAnyBufferedRecvData() const
 	{
-		return !m_receiverState.m_bufReliableStream.empty();
+		for ( const SSNPRecvLane &lane: m_receiverState.m_vecLanes )
+		{
+			if ( !lane.m_bufReliableStream.empty() )
+				return true;
+		}
+		return false;
 	}
 	bool SNP_BHasAnyUnackedSentReliableData() const
 	{
@@ -367,8 +414,9 @@ public:
 		return m_receiverState.m_usecWhenFlushAck < INT64_MAX || m_senderState.TimeWhenWantToSendNextPacket() < INT64_MAX;
 	}
 
-	/// Send a data packet now, even if we don't have the bandwidth available
-	int SNP_SendPacket( SteamNetworkingMicroseconds usecNow, int cbMaxEncryptedPayload, void *pConnectionData );
+	/// Send a data packet now, even if we don't have the bandwidth available.
+	/// A path MTU probe carries no data, and is padded out to the full size.
+	int SNP_SendPacket( SteamNetworkingMicroseconds usecNow, int cbMaxEncryptedPayload, void *pConnectionData, bool bPMTUProbe = false );
 
 protected:
 	CSteamNetworkConnectionBase( CSteamNetworkingSockets *pSteamNetworkingSocketsInterface );
@@ -424,7 +472,7 @@ protected:
 
 	/// Hook to allow connections to customize message sending.
 	/// (E.g. loopback.)
-	virtual EResult _APISendMessageToConnection( const void *pData, uint32 cbData, ESteamNetworkingSendType eSendType );
+	virtual EResult _APISendMessageToConnection( const void *pData, uint32 cbData, ESteamNetworkingSendType eSendType, int idxLane );
 
 	/// Base class calls this to ask derived class to surround the 
 	/// "chunk" with the appropriate framing, and route it to the 
@@ -439,8 +487,27 @@ protected:
 	/// of the packet
 	virtual int SendEncryptedDataChunk( const void *pChunk, int cbChunk, SteamNetworkingMicroseconds usecNow, void *pConnectionContext ) = 0;
 
+	/// Ask the transport to have the OS pace our packets at no more than the
+	/// specified rate, in bytes/sec.  Returns false if the transport can't
+	/// do this, in which case our own pacing is all there is.
+	virtual bool BSetTransportPacingRate( int nBytesPerSec );
+
+	/// Memory used by the connection type.  Derived classes should count
+	/// their own members, and anything they own.
+	virtual int GetTransportMemoryUsage() const;
+
+	/// Largest encrypted payload that path MTU discovery should try to
+	/// send over this transport.  The default is to not probe at all, and
+	/// stick with a size that should work on any path.
+	virtual int GetMaxEncryptedPayloadSendToProbe() const;
+
 	/// Called when we receive a complete message.  Should allocate a message object and put it into the proper queues
-	virtual void ReceivedMessage( const void *pData, int cbData, int64 nMsgNum, SteamNetworkingMicroseconds usecNow );
+	virtual void ReceivedMessage( const void *pData, int cbData, int idxLane, int64 nMsgNum, SteamNetworkingMicroseconds usecNow );
+
+	/// Called when we have a complete message that has already been assembled into a
+	/// message object (allocated by CSteamNetworkingMessage::New with us as the parent).
+	/// Takes ownership of the message and puts it into the proper queues
+	void ReceivedMessage( CSteamNetworkingMessage *pMsg );
 
 	/// Called when the state changes
 	virtual void ConnectionStateChanged( ESteamNetworkingConnectionState eOldState );
@@ -482,15 +549,12 @@ protected:
 	bool BThinkCryptoReady( SteamNetworkingMicroseconds usecNow );
 	void InitLocalCryptoWithUnsignedCert();
 
-	// Remote crypt info
-	CMsgSteamDatagramCertificate m_msgCertRemote;
-	CMsgSteamDatagramSessionCryptInfo m_msgCryptRemote;
+	// Handshake state.  nullptr if we haven't started the handshake, or
+	// we don't need it anymore.  Use CryptoHandshake() to allocate it.
+	ConnectionCryptoHandshake_t *m_pCryptoHandshake;
+	ConnectionCryptoHandshake_t &CryptoHandshake();
+	void FreeCryptoHandshake();
 
-	// Local crypto info for this connection
-	CECKeyExchangePrivateKey m_keyExchangePrivateKeyLocal;
-	CMsgSteamDatagramSessionCryptInfo m_msgCryptLocal;
-	CMsgSteamDatagramSessionCryptInfoSigned m_msgSignedCryptLocal;
-	CMsgSteamDatagramCertificateSigned m_msgSignedCertLocal;
 	bool m_bCertHasIdentity; // Does the cert contain the identity we will use for this connection?
 
 	// AES keys and used in each direction
@@ -531,29 +595,37 @@ protected:
 	//
 
 	void SNP_InitializeConnection( SteamNetworkingMicroseconds usecNow );
-	EResult SNP_SendMessage( SteamNetworkingMicroseconds usecNow, const void *pData, int cbData, ESteamNetworkingSendType eSendType );
+	EResult SNP_SendMessage( SteamNetworkingMicroseconds usecNow, const void *pData, int cbData, ESteamNetworkingSendType eSendType, int idxLane );
+	EResult SNP_ConfigureLanes( int nNumLanes, const int *pLanePriorities, const uint16 *pLaneWeights );
 	SteamNetworkingMicroseconds SNP_ThinkSendState( SteamNetworkingMicroseconds usecNow );
 	SteamNetworkingMicroseconds SNP_GetNextThinkTime( SteamNetworkingMicroseconds usecNow );
 	void SNP_PrepareFeedback( SteamNetworkingMicroseconds usecNow );
 	bool SNP_RecvDataChunk( int64 nPktNum, const void *pChunk, int cbChunk, int cbPacketSize, SteamNetworkingMicroseconds usecNow );
-	void SNP_ReceiveUnreliableSegment( int64 nMsgNum, int nOffset, const void *pSegmentData, int cbSegmentSize, bool bLastSegmentInMessage, SteamNetworkingMicroseconds usecNow );
-	bool SNP_ReceiveReliableSegment( int64 nPktNum, int64 nSegBegin, const uint8 *pSegmentData, int cbSegmentSize, SteamNetworkingMicroseconds usecNow );
+	void SNP_ReceiveUnreliableSegment( int idxLane, int64 nMsgNum, int nOffset, const void *pSegmentData, int cbSegmentSize, bool bLastSegmentInMessage, SteamNetworkingMicroseconds usecNow );
+	bool SNP_ReceiveReliableSegment( int64 nPktNum, int idxLane, int64 nSegBegin, const uint8 *pSegmentData, int cbSegmentSize, bool bUnorderedMsgStart, SteamNetworkingMicroseconds usecNow );
+	bool SNP_DispatchUnorderedReliableMessages( int idxLane, int64 nSegBegin, int64 nSegEnd, int64 nUnorderedMsgBegin, SteamNetworkingMicroseconds usecNow );
+	int SNP_DecodeReliableMessage( int idxLane, int64 nStreamPos, const uint8 *pData, int cbData, const uint8 *pData2, int cbData2, SteamNetworkingMicroseconds usecNow, int *pcbMsgTotal = nullptr ); // Returns bytes consumed, 0 if incomplete, -1 if bad data
+	int SNP_DecodeReliableMessageFromBuffer( int idxLane, int nBufOffset, int cbData, SteamNetworkingMicroseconds usecNow, int *pcbMsgTotal = nullptr );
 	//void SNP_MoveSentToSend( SteamNetworkingMicroseconds usecNow );
 	//void SNP_CheckForReliable( SteamNetworkingMicroseconds usecNow );
 	void SNP_UpdateX( SteamNetworkingMicroseconds usecNow );
 	std::string SNP_GetDebugText();
 	void SNP_PopulateDetailedStats( SteamDatagramLinkStats &info ) const;
 	void SNP_PopulateQuickStats( SteamNetworkingQuickConnectionStatus &info, SteamNetworkingMicroseconds usecNow );
+	void SNP_GetMemoryUsage( SteamNetConnectionMemoryUsage_t &usage ) const;
 	//bool SNP_UpdateIMean( uint16 unSeqNum, SteamNetworkingMicroseconds usecNow );
 	//bool SNP_AddLossEvent( uint16 unSeqNum, SteamNetworkingMicroseconds usecNow );
 	bool SNP_CalcIMean( SteamNetworkingMicroseconds usecNow );
 	void SNP_NoFeedbackTimer( SteamNetworkingMicroseconds usecNow );
 	//int SNP_CheckForLoss( uint16 unSeqNum, SteamNetworkingMicroseconds usecNow );
 	bool SNP_RecordReceivedPktNum( int64 nPktNum, SteamNetworkingMicroseconds usecNow );
+	void SNP_FlushAcksSoon( SteamNetworkingMicroseconds usecNow );
 	EResult SNP_FlushMessage( SteamNetworkingMicroseconds usecNow );
 
 	/// Mark a packet as dropped
-	void SNP_SenderProcessPacketNack( int64 nPktNum, SNPInFlightPacket_t &pkt, const char *pszDebug );
+	void SNP_PMTUStartSearch( SteamNetworkingMicroseconds usecNow );
+	void SNP_PMTUProbeResult( bool bAcked, SteamNetworkingMicroseconds usecNow );
+	void SNP_SenderProcessPacketNack( int64 nPktNum, SNPInFlightPacket_t &pkt, const char *pszDebug, SteamNetworkingMicroseconds usecNow );
 
 	/// Check in flight packets.  Expire any that need to be, and return the time when the
 	/// next one that is not yet expired will be expired.
@@ -570,6 +642,7 @@ private:
 	void SNP_GatherAckBlocks( SNPAckSerializerHelper &helper, SteamNetworkingMicroseconds usecNow );
 	uint8 *SNP_SerializeAckBlocks( const SNPAckSerializerHelper &helper, uint8 *pOut, const uint8 *pOutEnd, SteamNetworkingMicroseconds usecNow );
 	uint8 *SNP_SerializeStopWaitingFrame( uint8 *pOut, const uint8 *pOutEnd, SteamNetworkingMicroseconds usecNow );
+	uint8 *SNP_SerializeAckFrequencyFrame( uint8 *pOut, const uint8 *pOutEnd, SteamNetworkingMicroseconds usecNow );
 
 	void SetState( ESteamNetworkingConnectionState eNewState, SteamNetworkingMicroseconds usecNow );
 	ESteamNetworkingConnectionState m_eConnectionState;
@@ -596,12 +669,13 @@ public:
 	virtual void SendEndToEndPing( bool bUrgent, SteamNetworkingMicroseconds usecNow ) OVERRIDE;
 	virtual EResult APIAcceptConnection() OVERRIDE;
 	virtual int SendEncryptedDataChunk( const void *pChunk, int cbChunk, SteamNetworkingMicroseconds usecNow, void *pConnectionContext ) OVERRIDE;
-	virtual EResult _APISendMessageToConnection( const void *pData, uint32 cbData, ESteamNetworkingSendType eSendType ) OVERRIDE;
+	virtual EResult _APISendMessageToConnection( const void *pData, uint32 cbData, ESteamNetworkingSendType eSendType, int idxLane ) OVERRIDE;
 	virtual void ConnectionStateChanged( ESteamNetworkingConnectionState eOldState ) OVERRIDE;
 	virtual void PostConnectionStateChangedCallback( ESteamNetworkingConnectionState eOldAPIState, ESteamNetworkingConnectionState eNewAPIState ) OVERRIDE;
 	virtual ERemoteUnsignedCert AllowRemoteUnsignedCert() OVERRIDE;
 	virtual void InitConnectionCrypto( SteamNetworkingMicroseconds usecNow ) OVERRIDE;
 	virtual void GetConnectionTypeDescription( ConnectionTypeDescription_t &szDescription ) const OVERRIDE;
+	virtual int GetTransportMemoryUsage() const OVERRIDE;
 
 private:
 
@@ -619,7 +693,90 @@ private:
 //
 /////////////////////////////////////////////////////////////////////////////
 
-extern CUtlHashMap<uint16, CSteamNetworkConnectionBase *, std::equal_to<uint16>, Identity<uint16> > g_mapConnections;
+/// Table of active connections, indexed by handle.
+///
+/// The low k_nSlotBits of a handle index into a dense array of slots, and the
+/// upper bits are a generation number that changes each time the slot is
+/// reused.  So lookup is just an array index and a compare, and a stale handle
+/// to a connection that has been destroyed will not match whatever connection
+/// is occupying the slot now.
+///
+/// We also use the handle as the local connection ID on the wire, so it should
+/// be hard to guess.  The slot index is XORed with a random mask chosen once per
+/// process, and each time a slot is used it gets a new random generation.
+/// Older peers reject connection IDs where either 16-bit half is zero, so we
+/// never hand out a slot whose scrambled index has the lower 16 bits clear,
+/// and the generation is never zero.
+class CConnectionHandleTable
+{
+public:
+	enum { k_nSlotBits = 20 };
+	enum { k_nMaxSlots = 1 << k_nSlotBits };
+	enum : uint32 { k_nSlotMask = k_nMaxSlots-1 };
+	enum : uint32 { k_nGenerationMask = 0xffffffffu >> k_nSlotBits };
+
+	/// Don't reuse a freed slot until at least this many slots are free.
+	/// (Instead, grow the table.)  This keeps handles from cycling back
+	/// around quickly when connections are rapidly created and destroyed.
+	enum { k_nMinFreeSlotsBeforeReuse = 256 };
+
+	/// Allocate a slot for the connection and return its handle.  Returns
+	/// k_HSteamNetConnection_Invalid if the table is full.
+	HSteamNetConnection Add( CSteamNetworkConnectionBase *pConn );
+
+	/// Free the slot used by the handle.  Returns false if the handle
+	/// didn't refer to an active slot.
+	bool Remove( HSteamNetConnection hConn );
+
+	/// Locate connection by handle.  Returns null if the handle is stale
+	/// or invalid.
+	inline CSteamNetworkConnectionBase *Find( HSteamNetConnection hConn ) const
+	{
+		uint32 idx = SlotIndex( hConn );
+		if ( idx >= (uint32)m_vecSlots.size() )
+			return nullptr;
+		const Slot &slot = m_vecSlots[ idx ];
+		if ( slot.m_hConn != hConn )
+			return nullptr;
+		return slot.m_pConn;
+	}
+
+	/// Number of active connections
+	inline int Count() const { return m_nCount; }
+
+	/// Iteration.  Slots that are not in use return null.  It's OK
+	/// to remove the current entry while iterating.
+	inline int NumSlots() const { return (int)m_vecSlots.size(); }
+	inline CSteamNetworkConnectionBase *GetSlot( int idx ) const { return m_vecSlots[ idx ].m_pConn; }
+
+private:
+	inline uint32 SlotIndex( HSteamNetConnection hConn ) const { return ( uint32( hConn ) ^ m_nIndexMask ) & k_nSlotMask; }
+
+	/// Random mask XORed with the slot index in the handle.  Chosen when
+	/// the first slot is allocated
+	uint32 m_nIndexMask = 0;
+
+	struct Slot
+	{
+		CSteamNetworkConnectionBase *m_pConn;
+
+		/// Handle currently (or most recently) assigned to this slot.
+		HSteamNetConnection m_hConn;
+
+		/// Next slot in the free list, or -1
+		int m_idxNextFree;
+	};
+	std::vector<Slot> m_vecSlots;
+
+	/// FIFO list of free slots.  We take from the head and free to the
+	/// tail, so that the slot we reuse is the one that has been idle longest.
+	int m_idxFreeHead = -1;
+	int m_idxFreeTail = -1;
+	int m_nFreeCount = 0;
+	int m_nCount = 0;
+};
+
+extern CConnectionHandleTable g_tableConnections;
 extern CUtlHashMap<int, CSteamNetworkListenSocketBase *, std::equal_to<int>, Identity<int> > g_mapListenSockets;
 
 extern std::string g_sLauncherPartner;
@@ -67,6 +67,16 @@ STEAMNETWORKINGSOCKETS_INTERFACE EResult SteamAPI_ISteamNetworkingSockets_SendMe
 	return ((ISteamNetworkingSockets*)instancePtr)->SendMessageToConnection( hConn, pData, cbData, eSendType );
 }
 
+STEAMNETWORKINGSOCKETS_INTERFACE EResult SteamAPI_ISteamNetworkingSockets_SendMessageToConnectionOnLane( intptr_t instancePtr, HSteamNetConnection hConn, const void *pData, uint32 cbData, ESteamNetworkingSendType eSendType, int idxLane )
+{
+	return ((ISteamNetworkingSockets*)instancePtr)->SendMessageToConnectionOnLane( hConn, pData, cbData, eSendType, idxLane );
+}
+
+STEAMNETWORKINGSOCKETS_INTERFACE EResult SteamAPI_ISteamNetworkingSockets_ConfigureConnectionLanes( intptr_t instancePtr, HSteamNetConnection hConn, int nNumLanes, const int *pLanePriorities, const uint16 *pLaneWeights )
+{
+	return ((ISteamNetworkingSockets*)instancePtr)->ConfigureConnectionLanes( hConn, nNumLanes, pLanePriorities, pLaneWeights );
+}
+
 STEAMNETWORKINGSOCKETS_INTERFACE EResult SteamAPI_ISteamNetworkingSockets_FlushMessagesOnConnection( intptr_t instancePtr, HSteamNetConnection hConn )
 {
 	return ((ISteamNetworkingSockets*)instancePtr)->FlushMessagesOnConnection( hConn );
@@ -97,6 +107,26 @@ STEAMNETWORKINGSOCKETS_INTERFACE int SteamAPI_ISteamNetworkingSockets_GetDetaile
 	return ((ISteamNetworkingSockets*)instancePtr)->GetDetailedConnectionStatus( hConn, pszBuf, cbBuf );
 }
 
+STEAMNETWORKINGSOCKETS_INTERFACE int SteamAPI_ISteamNetworkingSockets_GetQuickConnectionStatusBulk( intptr_t instancePtr, const HSteamNetConnection *pConns, int nConns, SteamNetworkingQuickConnectionStatus *pStats )
+{
+	return ((ISteamNetworkingSockets*)instancePtr)->GetQuickConnectionStatusBulk( pConns, nConns, pStats );
+}
+
+STEAMNETWORKINGSOCKETS_INTERFACE int SteamAPI_ISteamNetworkingSockets_GetQuickConnectionStatusOnListenSocket( intptr_t instancePtr, HSteamListenSocket hSocket, HSteamNetConnection *pOutConns, SteamNetworkingQuickConnectionStatus *pOutStats, int nMaxConns )
+{
+	return ((ISteamNetworkingSockets*)instancePtr)->GetQuickConnectionStatusOnListenSocket( hSocket, pOutConns, pOutStats, nMaxConns );
+}
+
+STEAMNETWORKINGSOCKETS_INTERFACE bool SteamAPI_ISteamNetworkingSockets_GetConnectionLinkStats( intptr_t instancePtr, HSteamNetConnection hConn, SteamDatagramLinkStats *pStats )
+{
+	return ((ISteamNetworkingSockets*)instancePtr)->GetConnectionLinkStats( hConn, pStats );
+}
+
+STEAMNETWORKINGSOCKETS_INTERFACE bool SteamAPI_ISteamNetworkingSockets_GetConnectionMemoryUsage( intptr_t instancePtr, HSteamNetConnection hConn, SteamNetConnectionMemoryUsage_t *pUsage )
+{
+	return ((ISteamNetworkingSockets*)instancePtr)->GetConnectionMemoryUsage( hConn, pUsage );
+}
+
 STEAMNETWORKINGSOCKETS_INTERFACE bool SteamAPI_ISteamNetworkingSockets_GetListenSocketAddress( intptr_t instancePtr, HSteamListenSocket hSocket, SteamNetworkingIPAddr *pAddress )
 {
 	return ((ISteamNetworkingSockets*)instancePtr)->GetListenSocketAddress( hSocket, pAddress );
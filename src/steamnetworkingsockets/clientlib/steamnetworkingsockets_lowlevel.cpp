@@ -8,14 +8,20 @@
 #include <thread>
 #include <mutex>
 #include <atomic>
+#include <condition_variable>
 
 #include "steamnetworkingsockets_lowlevel.h"
+#include <steam/isteamnetworkingutils.h>
 #include "../steamnetworkingsockets_internal.h"
 #include <vstdlib/random.h>
 #include <tier1/utlpriorityqueue.h>
-#include <tier1/utllinkedlist.h>
+#include <math.h>
 #include "steamnetworkingconfig.h"
 #include "crypto.h"
+#include <tier0/vprof.h>
+#include "steamnetworkingsockets_packettrace.h"
+#include "steamnetworkingsockets_metrics.h"
+#include "steamnetworkingsockets_alloc.h"
 
 // Ugggggggggg MSVC VS2013 STL bug: try_lock_for doesn't actually respect the timeout, it always ends up using an infinite timeout.
 // And even in 2015, the code is calling the timer and to convert a relative time to an absolute time, and waiting until that time,
@@ -33,6 +39,12 @@ namespace SteamNetworkingSocketsLib {
 
 int g_nSteamDatagramSocketBufferSize = 128*1024;
 
+GlobalMetrics_t g_metrics;
+
+FSteamNetworkingSocketsAlloc g_pfnAlloc = nullptr;
+FSteamNetworkingSocketsRealloc g_pfnRealloc = nullptr;
+FSteamNetworkingSocketsFree g_pfnFree = nullptr;
+
 /// Global lock for all local data structures
 #ifdef MSVC_STL_MUTEX_WORKAROUND
 	HANDLE s_hSteamDatagramTransportMutex = INVALID_HANDLE_VALUE; 
@@ -40,30 +52,55 @@ int g_nSteamDatagramSocketBufferSize = 128*1024;
 	static std::recursive_timed_mutex s_steamDatagramTransportMutex;
 #endif
 volatile int SteamDatagramTransportLock::s_nLocked;
+
+// Lock wait and hold times are measured using the raw timer, not
+// SteamNetworkingSockets_GetLocalTimestamp, which might be a custom or
+// virtual clock that doesn't advance in real time.
 static SteamNetworkingMicroseconds s_usecWhenLocked;
 static std::thread::id s_threadIDLockOwner;
+static ESteamNetworkingLockCaller s_eLockCaller;
 
-void SteamDatagramTransportLock::OnLocked()
+void SteamDatagramTransportLock::OnLocked( ESteamNetworkingLockCaller eCaller, SteamNetworkingMicroseconds usecWait )
 {
 	++s_nLocked;
 	if ( s_nLocked == 1 )
 	{
-		s_usecWhenLocked = SteamNetworkingSockets_GetLocalTimestamp();
+		s_usecWhenLocked = (SteamNetworkingMicroseconds)Plat_USTime();
 		s_threadIDLockOwner = std::this_thread::get_id();
+
+		// Recursive locks don't count.  The hold time is charged
+		// to whoever locked it first
+		s_eLockCaller = eCaller;
+		LockMetrics_t &lockMetrics = g_metrics.m_lock[ eCaller ];
+		MetricsIncrement( lockMetrics.m_nAcquired );
+		MetricsHistogramAdd( lockMetrics.m_histWaitUsec, usecWait );
 	}
 }
 
-void SteamDatagramTransportLock::Lock()
+void SteamDatagramTransportLock::Lock( ESteamNetworkingLockCaller eCaller )
 {
+	// Only check the clock if we actually have to wait
+	SteamNetworkingMicroseconds usecWait = 0;
 	#ifdef MSVC_STL_MUTEX_WORKAROUND
 		if ( s_hSteamDatagramTransportMutex == INVALID_HANDLE_VALUE ) // This is not actually threadsafe, but we assume that client code will call (and wait for the return of) some Init() call before invoking any API calls.
 			s_hSteamDatagramTransportMutex = ::CreateMutex( NULL, FALSE, NULL );
-		DWORD res = ::WaitForSingleObject( s_hSteamDatagramTransportMutex, INFINITE );
-		Assert( res == WAIT_OBJECT_0 );
+		if ( ::WaitForSingleObject( s_hSteamDatagramTransportMutex, 0 ) != WAIT_OBJECT_0 )
+		{
+			SteamNetworkingMicroseconds usecStartedLocking = (SteamNetworkingMicroseconds)Plat_USTime();
+			DWORD res = ::WaitForSingleObject( s_hSteamDatagramTransportMutex, INFINITE );
+			Assert( res == WAIT_OBJECT_0 );
+			usecWait = (SteamNetworkingMicroseconds)Plat_USTime() - usecStartedLocking;
+		}
 	#else
-		s_steamDatagramTransportMutex.lock();
+		if ( !s_steamDatagramTransportMutex.try_lock() )
+		{
+			SteamNetworkingMicroseconds usecStartedLocking = (SteamNetworkingMicroseconds)Plat_USTime();
+			s_steamDatagramTransportMutex.lock();
+			usecWait = (SteamNetworkingMicroseconds)Plat_USTime() - usecStartedLocking;
+		}
 	#endif
-	OnLocked();
+
+	OnLocked( eCaller, usecWait );
 }
 
 void SteamDatagramTransportLock::Unlock()
@@ -72,7 +109,8 @@ void SteamDatagramTransportLock::Unlock()
 	SteamNetworkingMicroseconds usecElapsed = 0;
 	if ( s_nLocked == 1 )
 	{
-		usecElapsed = SteamNetworkingSockets_GetLocalTimestamp() - s_usecWhenLocked;
+		usecElapsed = (SteamNetworkingMicroseconds)Plat_USTime() - s_usecWhenLocked;
+		MetricsHistogramAdd( g_metrics.m_lock[ s_eLockCaller ].m_histHoldUsec, usecElapsed );
 	}
 	--s_nLocked;
 	#ifdef MSVC_STL_MUTEX_WORKAROUND
@@ -101,6 +139,7 @@ static void SeedWeakRandomGenerator()
 }
 
 static std::atomic<long long> s_usecTimeLastReturned;
+static std::atomic<FSteamNetworkingSocketsClock> s_pfnClock( nullptr );
 static std::atomic<long long> s_usecTimeOffset( (long long)( k_nMillion*24*3600*30 ) ); // Start with an offset so that a timestamp of zero is always pretty far in the past
 
 /////////////////////////////////////////////////////////////////////////////
@@ -112,19 +151,40 @@ static std::atomic<long long> s_usecTimeOffset( (long long)( k_nMillion*24*3600*
 inline IRawUDPSocket::IRawUDPSocket() {}
 inline IRawUDPSocket::~IRawUDPSocket() {}
 
+class CRawUDPSocketImpl;
+static bool VirtualNetworkSendPacket( const CRawUDPSocketImpl *pSock, int nChunks, const iovec *pChunks, const netadr_t &adrTo );
+static void VirtualNetworkUnbindPort( CRawUDPSocketImpl *pSock );
+
 class CRawUDPSocketImpl : public IRawUDPSocket
 {
 public:
+	CRawUDPSocketImpl()
+	{
+		MetricsIncrement( g_metrics.m_nUDPSocketsOpen );
+	}
+
 	~CRawUDPSocketImpl()
 	{
-		closesocket( m_socket );
+		MetricsDecrement( g_metrics.m_nUDPSocketsOpen );
+		if ( m_socket != INVALID_SOCKET )
+			closesocket( m_socket );
 		#ifdef WIN32
-			WSACloseEvent( m_event );
+			if ( m_event != INVALID_HANDLE_VALUE )
+				WSACloseEvent( m_event );
 		#endif
 	}
 
-	/// Descriptor from the OS
-	SOCKET m_socket;
+	/// Descriptor from the OS.  (INVALID_SOCKET for sockets on the virtual network)
+	SOCKET m_socket = INVALID_SOCKET;
+
+	/// Port on the virtual network, or 0 if this is a real OS socket
+	uint16 m_nVirtualPort = 0;
+
+	/// Return true if the socket is open, and not closed and pending destruction
+	inline bool BIsOpen() const
+	{
+		return ( m_socket != INVALID_SOCKET || m_nVirtualPort != 0 ) && m_callback.m_fnCallback;
+	}
 
 	/// What address families are supported by this socket?
 	int m_nAddressFamilies;
@@ -141,6 +201,15 @@ public:
 	//// Send a packet, for really realz right now.  (No checking for fake loss or lag.)
 	inline bool BReallySendRawPacket( int nChunks, const iovec *pChunks, const netadr_t &adrTo ) const
 	{
+		int cbPkt = 0;
+		for ( int i = 0 ; i < nChunks ; ++i )
+			cbPkt += (int)pChunks[i].iov_len;
+		MetricsIncrement( g_metrics.m_nUDPPacketsSent );
+		MetricsAdd( g_metrics.m_nUDPBytesSent, cbPkt );
+		PacketTraceRawPacket( k_EPacketTraceEvent_RawSend, cbPkt, adrTo.GetPort() );
+
+		if ( m_nVirtualPort )
+			return VirtualNetworkSendPacket( this, nChunks, pChunks, adrTo );
 		Assert( m_socket != INVALID_SOCKET );
 
 		// Convert address to BSD interface
@@ -202,55 +271,311 @@ static CUtlVector<CRawUDPSocketImpl *> s_vecRawSockets;
 /// List of raw sockets pending actual destruction.
 static CUtlVector<CRawUDPSocketImpl *> s_vecRawSocketsPendingDeletion;
 
-/// Track packets that have fake lag applied and are pending to be sent/received
+/////////////////////////////////////////////////////////////////////////////
+//
+// Fake network conditions
+//
+/////////////////////////////////////////////////////////////////////////////
+
+/// State of the random number generator used for all of the fake network
+/// conditions.  We don't use the weak global generator, since other code
+/// draws from it, and we want a run to be reproducible when
+/// steamdatagram_fakenetwork_seed is set.  (xorshift64*)
+static uint64 s_nFakeNetworkRandomState = 0;
+
+/// Longest we will hold onto any packet in the fake network.  Anything
+/// that would need to wait longer than this is dropped or clamped.
+const int k_msFakeNetworkMaxLag = 5000;
+
+/// State of the fake network in one direction
+struct FakeNetworkDirection_t
+{
+	/// Burst loss: are we currently in the "bad" state?
+	bool m_bBurstLossBadState;
+
+	/// Time when the fake bottleneck link will have finished
+	/// transmitting everything currently queued for it
+	SteamNetworkingMicroseconds m_usecBottleneckIdle;
+
+	/// Moving average of the queue depth, in bytes.  (For RED)
+	float m_flAvgQueueBytes;
+};
+static FakeNetworkDirection_t s_fakeNetworkSend;
+static FakeNetworkDirection_t s_fakeNetworkRecv;
+
+void ResetFakeNetworkConditions()
+{
+	uint64 nSeed = (uint32)steamdatagram_fakenetwork_seed;
+	if ( nSeed == 0 )
+		CCrypto::GenerateRandomBlock( &nSeed, sizeof(nSeed) );
+	else
+		nSeed *= 0x9E3779B97F4A7C15ull; // Spread small seeds out over all the bits
+	s_nFakeNetworkRandomState = nSeed ? nSeed : 1; // State must never be zero
+
+	memset( &s_fakeNetworkSend, 0, sizeof(s_fakeNetworkSend) );
+	memset( &s_fakeNetworkRecv, 0, sizeof(s_fakeNetworkRecv) );
+}
+
+static uint64 FakeNetworkRandom64()
+{
+	if ( s_nFakeNetworkRandomState == 0 )
+		ResetFakeNetworkConditions();
+	uint64 x = s_nFakeNetworkRandomState;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	s_nFakeNetworkRandomState = x;
+	return x * 0x2545F4914F6CDD1Dull;
+}
+
+float FakeNetworkRandomFloat( float flMin, float flMax )
+{
+	// Top 24 bits, so the result is exactly representable and < 1
+	float f = (float)( FakeNetworkRandom64() >> 40 ) * ( 1.0f / 16777216.0f );
+	return flMin + ( flMax - flMin ) * f;
+}
+
+/// Pick a random amount of fake jitter, in ms.  All of the distributions
+/// have a mean of msJitter, but they have very different shapes.
+static int SampleFakePacketJitter( int msJitter, int eDistribution )
+{
+	if ( msJitter <= 0 )
+		return 0;
+	float flJitter = (float)msJitter;
+	float flResult;
+	switch ( eDistribution )
+	{
+		default:
+			AssertMsg1( false, "Bogus fake jitter distribution %d", eDistribution );
+			// FALLTHROUGH
+		case k_ESteamNetworkingFakePacketJitter_Uniform:
+			flResult = FakeNetworkRandomFloat( 0.0f, 2.0f*flJitter );
+			break;
+
+		case k_ESteamNetworkingFakePacketJitter_Normal:
+		{
+			// Box-Muller, with stddev of half the mean.  Clamp
+			// at zero; we cannot send packets back in time.
+			float u1 = FakeNetworkRandomFloat( 1e-6f, 1.0f );
+			float u2 = FakeNetworkRandomFloat( 0.0f, 1.0f );
+			float z = sqrtf( -2.0f * logf( u1 ) ) * cosf( 6.2831853f * u2 );
+			flResult = Max( 0.0f, flJitter + z * flJitter * .5f );
+			break;
+		}
+
+		case k_ESteamNetworkingFakePacketJitter_Pareto:
+		{
+			// Pareto type II (Lomax) with shape 2.5.  Most packets get
+			// a small amount of delay, but there is a long tail.
+			const float kAlpha = 2.5f;
+			float flScale = flJitter * ( kAlpha - 1.0f );
+			float u = FakeNetworkRandomFloat( 1e-6f, 1.0f );
+			flResult = flScale * ( powf( u, -1.0f / kAlpha ) - 1.0f );
+			break;
+		}
+	}
+
+	// The lag queue will clamp the total anyway, but keep the
+	// float->int conversion sane
+	return (int)Min( flResult, 5000.0f );
+}
+
+/// Gilbert-Elliott burst loss.  Every packet is lost while we are in the
+/// "bad" state.  The transition probabilities are chosen so that the long
+/// run loss rate and the average burst length match the config.
+static bool BFakeBurstLoss( FakeNetworkDirection_t &dir, int nLossPct )
+{
+	float flLoss = Min( nLossPct, 99 ) * .01f;
+	float flLeaveBad = 1.0f / Max( steamdatagram_fakepacketburstloss_length, 1 );
+	float flEnterBad = Min( flLeaveBad * flLoss / ( 1.0f - flLoss ), 1.0f );
+
+	bool bLost = dir.m_bBurstLossBadState;
+	float r = FakeNetworkRandomFloat( 0.0f, 1.0f );
+	if ( dir.m_bBurstLossBadState )
+		dir.m_bBurstLossBadState = !( r < flLeaveBad );
+	else
+		dir.m_bBurstLossBadState = ( r < flEnterBad );
+	return bLost;
+}
+
+/// Put a packet on the fake bottleneck link.  Returns false if the queue
+/// in front of the link drops it.  Otherwise returns the time until the
+/// last bit leaves the link.
+static bool BFakeBottleneck( FakeNetworkDirection_t &dir, int nBytesPerSec, int cbPkt, SteamNetworkingMicroseconds usecNow, SteamNetworkingMicroseconds &usecDelay )
+{
+	// How many bytes are waiting for the link right now?
+	SteamNetworkingMicroseconds usecBacklog = Max( dir.m_usecBottleneckIdle - usecNow, (SteamNetworkingMicroseconds)0 );
+	float flQueueBytes = (float)( usecBacklog * 1e-6 * nBytesPerSec );
+	float flQueueLimit = (float)Max( steamdatagram_fakepacketqueue_size, k_cbSteamNetworkingSocketsMaxUDPMsgLenJumbo );
+
+	// Never exceed the hard limit
+	if ( flQueueBytes + cbPkt > flQueueLimit )
+		return false;
+
+	// Random early detection?  The drop probability ramps up linearly
+	// from 0 to 10% as the average depth goes from 1/4 to 3/4 of the limit,
+	// and beyond that everything is dropped.
+	if ( steamdatagram_fakepacketqueue_discipline == k_ESteamNetworkingFakePacketQueue_RED )
+	{
+		const float k_flWeight = .002f;
+		const float k_flMaxDropProb = .1f;
+		dir.m_flAvgQueueBytes += ( flQueueBytes - dir.m_flAvgQueueBytes ) * k_flWeight;
+
+		float flMinThresh = flQueueLimit * .25f;
+		float flMaxThresh = flQueueLimit * .75f;
+		if ( dir.m_flAvgQueueBytes >= flMaxThresh )
+			return false;
+		if ( dir.m_flAvgQueueBytes > flMinThresh )
+		{
+			float flDropProb = k_flMaxDropProb * ( dir.m_flAvgQueueBytes - flMinThresh ) / ( flMaxThresh - flMinThresh );
+			if ( FakeNetworkRandomFloat( 0.0f, 1.0f ) < flDropProb )
+				return false;
+		}
+	}
+
+	// Transmit it after everything ahead of it.  If that would make it
+	// wait longer than the lagger can hold it, the queue is effectively
+	// full, so tail-drop it.  (A huge queue limit on a slow link can get
+	// us here before the byte limit above kicks in.)
+	SteamNetworkingMicroseconds usecStart = Max( dir.m_usecBottleneckIdle, usecNow );
+	SteamNetworkingMicroseconds usecIdle = usecStart + (SteamNetworkingMicroseconds)cbPkt * k_nMillion / nBytesPerSec;
+	if ( usecIdle - usecNow > (SteamNetworkingMicroseconds)k_msFakeNetworkMaxLag * 1000 )
+		return false;
+	dir.m_usecBottleneckIdle = usecIdle;
+	usecDelay = usecIdle - usecNow;
+	return true;
+}
+
+/// Fake network settings that apply to a packet
+struct FakeNetworkParams_t
+{
+	int32 m_nLossPct;
+	int32 m_nBurstLossPct;
+	int32 m_nDupPct;
+	int32 m_nReorderPct;
+	int32 m_nBytesPerSec;
+	int32 m_msLag;
+	int32 m_msJitter;
+	int32 m_eJitterDistribution;
+
+	bool BAnyActive() const
+	{
+		return m_nLossPct > 0 || m_nBurstLossPct > 0 || m_nDupPct > 0 || m_nReorderPct > 0
+			|| m_nBytesPerSec > 0 || m_msLag > 0 || m_msJitter > 0;
+	}
+};
+
+/// Decide what happens to one copy of a packet passing through the fake
+/// network.  Returns false if it is dropped, otherwise returns the total
+/// delay to apply (which may be zero).
+static bool BFakeNetworkProcessPacket( FakeNetworkDirection_t &dir, const FakeNetworkParams_t &params, int cbPkt, SteamNetworkingMicroseconds usecNow, SteamNetworkingMicroseconds &usecDelay )
+{
+	usecDelay = 0;
+
+	// Uniform loss
+	if ( params.m_nLossPct > 0 && FakeNetworkRandomFloat( 0, 100.0f ) < params.m_nLossPct )
+		return false;
+
+	// Burst loss
+	if ( params.m_nBurstLossPct > 0 )
+	{
+		if ( BFakeBurstLoss( dir, params.m_nBurstLossPct ) )
+			return false;
+	}
+	else
+	{
+		dir.m_bBurstLossBadState = false;
+	}
+
+	// Bottleneck link
+	if ( params.m_nBytesPerSec > 0 )
+	{
+		if ( !BFakeBottleneck( dir, params.m_nBytesPerSec, cbPkt, usecNow, usecDelay ) )
+			return false;
+	}
+
+	// Lag and jitter
+	int msLag = params.m_msLag + SampleFakePacketJitter( params.m_msJitter, params.m_eJitterDistribution );
+
+	// Check for simulation random packet reordering
+	if ( params.m_nReorderPct > 0 && FakeNetworkRandomFloat( 0, 100.0f ) < params.m_nReorderPct )
+		msLag += steamdatagram_fakepacketreorder_time;
+
+	usecDelay += msLag * 1000;
+	return true;
+}
+
+/// Track packets that have fake lag applied and are pending to be sent/received.
+///
+/// Packets are kept in a timer wheel with 1ms buckets, so inserting and
+/// removing are constant time no matter how many packets are queued.  Each
+/// bucket is a FIFO, so packets with the same lag are delivered in the order
+/// they were queued.  A bitmask of non-empty buckets lets us quickly find
+/// the next time we need to wake up.
+///
+/// Packet buffers are drawn from a handful of size classes and recycled,
+/// so we don't need to reserve an MTU-sized buffer for every small packet,
+/// and we don't hit the allocator in the steady state.
 class CPacketLagger : private IThinker
 {
 public:
-	~CPacketLagger() { Clear(); }
+	CPacketLagger()
+	{
+		memset( m_arBuckets, 0, sizeof(m_arBuckets) );
+		memset( m_arBucketNonEmptyMask, 0, sizeof(m_arBucketNonEmptyMask) );
+		memset( m_arFreeLists, 0, sizeof(m_arFreeLists) );
+	}
+	~CPacketLagger() { Clear(); FreePools(); }
 
-	void LagPacket( bool bSend, const CRawUDPSocketImpl *pSock, const netadr_t &adr, int msDelay, int nChunks, const iovec *pChunks )
+	void LagPacket( bool bSend, const CRawUDPSocketImpl *pSock, const netadr_t &adr, SteamNetworkingMicroseconds usecDelay, int nChunks, const iovec *pChunks )
 	{
 		int cbPkt = 0;
 		for ( int i = 0 ; i < nChunks ; ++i )
 			cbPkt += pChunks[i].iov_len;
-		if ( cbPkt > k_cbSteamNetworkingSocketsMaxUDPMsgLen )
+		if ( cbPkt > k_cbSteamNetworkingSocketsMaxUDPMsgLenJumbo )
 		{
 			AssertMsg( false, "Tried to lag a packet that w as too big!" );
 			return;
 		}
 
 		// Make sure we never queue a packet that is queued for destruction!
-		if ( pSock->m_socket == INVALID_SOCKET || !pSock->m_callback.m_fnCallback )
+		if ( !pSock->BIsOpen() )
 		{
 			AssertMsg( false, "Tried to lag a packet on a socket that has already been closed and is pending destruction!" );
 			return;
 		}
 
-		if ( msDelay < 1 )
+		if ( usecDelay < 1 )
 		{
 			AssertMsg( false, "Packet lag time must be positive!" );
-			msDelay = 1;
+			usecDelay = 1;
 		}
 
 		// Limit to something sane
-		msDelay = Min( msDelay, 5000 );
-		const SteamNetworkingMicroseconds usecTime = SteamNetworkingSockets_GetLocalTimestamp() + msDelay * 1000;
+		usecDelay = Min( usecDelay, (SteamNetworkingMicroseconds)k_msMaxLag * 1000 );
+		const SteamNetworkingMicroseconds usecTime = SteamNetworkingSockets_GetLocalTimestamp() + usecDelay;
 
-		// Find the right place to insert the packet.
-		LaggedPacket *pkt = nullptr;
-		for ( CUtlLinkedList< LaggedPacket >::IndexType_t i = m_list.Head(); i != m_list.InvalidIndex(); i = m_list.Next( i ) )
+		// Which bucket?  Round up, so we never deliver a packet early.
+		int64 nTick = ( usecTime + k_usecBucketWidth - 1 ) / k_usecBucketWidth;
+		if ( m_nQueued == 0 )
 		{
-			if ( usecTime < m_list[ i ].m_usecTime )
-			{
-				pkt = &m_list[ m_list.InsertBefore( i ) ];
-				break;
-			}
+			// Queue is empty, so the cursor might be way out of date.
+			m_nCursorTick = nTick;
 		}
-		if ( pkt == nullptr )
+		else if ( nTick < m_nCursorTick )
 		{
-			pkt = &m_list[ m_list.AddToTail() ];
+			nTick = m_nCursorTick;
 		}
-	
+		else if ( nTick >= m_nCursorTick + k_nBuckets )
+		{
+			// This can only happen if we haven't been able to think in a long time.
+			AssertMsg( false, "Packet lag wheel overflow" );
+			nTick = m_nCursorTick + k_nBuckets - 1;
+		}
+
+		// Allocate a buffer and fill it in
+		LaggedPacket *pkt = AllocPacket( cbPkt );
+		pkt->m_pNext = nullptr;
 		pkt->m_bSend = bSend;
 		pkt->m_pSockOwner = pSock;
 		pkt->m_adrRemote = adr;
@@ -266,51 +591,60 @@ public:
 			d += cbChunk;
 		}
 
+		// Add to the tail of the bucket
+		int idxBucket = int( nTick & ( k_nBuckets-1 ) );
+		Bucket &bucket = m_arBuckets[ idxBucket ];
+		if ( bucket.m_pLast )
+		{
+			bucket.m_pLast->m_pNext = pkt;
+		}
+		else
+		{
+			bucket.m_pFirst = pkt;
+			m_arBucketNonEmptyMask[ idxBucket >> 6 ] |= ( 1ull << ( idxBucket & 63 ) );
+		}
+		bucket.m_pLast = pkt;
+		++m_nQueued;
+
 		Schedule();
 	}
 
 	/// Periodic processing
 	virtual void Think( SteamNetworkingMicroseconds usecNow ) OVERRIDE
 	{
-
-		// Just always process packets in queue order.  This means there could be some
-		// weird burst or jankiness if the delay time is changed, but that's OK.
-		while ( !m_list.IsEmpty() )
+		const int64 nTickNow = usecNow / k_usecBucketWidth;
+		while ( m_nQueued > 0 && m_nCursorTick <= nTickNow )
 		{
-			LaggedPacket &pkt = m_list[ m_list.Head() ];
-			if ( pkt.m_usecTime > usecNow )
-				break;
+			int idxBucket = int( m_nCursorTick & ( k_nBuckets-1 ) );
+			Bucket &bucket = m_arBuckets[ idxBucket ];
 
-			// Make sure socket is still in good shape.
-			const CRawUDPSocketImpl *pSock = pkt.m_pSockOwner;
-			if ( pSock->m_socket == INVALID_SOCKET || !pSock->m_callback.m_fnCallback )
+			// Nothing in this bucket?  Skip ahead to the next one that has something
+			if ( !bucket.m_pFirst )
 			{
-				AssertMsg( false, "Lagged packet remains in queue after socket destroyed or queued for destruction!" );
+				int64 nNextTick = FindNextNonEmptyTick();
+				Assert( nNextTick > m_nCursorTick );
+				m_nCursorTick = Min( nNextTick, nTickNow+1 );
+				continue;
 			}
-			else
-			{
 
-				// Sending, or receiving?
-				if ( pkt.m_bSend )
-				{
-					iovec temp;
-					temp.iov_len = pkt.m_cbPkt;
-					temp.iov_base = pkt.m_pkt;
-					pSock->BReallySendRawPacket( 1, &temp, pkt.m_adrRemote );
-				}
-				else
+			// Pop packets off the head of the bucket one at a time.  Delivering
+			// a packet could cause another packet to be queued (possibly into
+			// this same bucket), or a socket to be closed, which will remove
+			// packets from the wheel.  So don't hold on to any pointers.
+			while ( bucket.m_pFirst )
+			{
+				LaggedPacket *pkt = bucket.m_pFirst;
+				bucket.m_pFirst = pkt->m_pNext;
+				if ( !bucket.m_pFirst )
 				{
-					// Copy data out of queue into local variables, just in case a
-					// packet is queued while we're in this function.  We don't want
-					// our list to shift in memory, and the pointer we pass to the
-					// caller to dangle.
-					char temp[ k_cbSteamNetworkingSocketsMaxUDPMsgLen ];
-					memcpy( temp, pkt.m_pkt, pkt.m_cbPkt );
-					netadr_t adr( pkt.m_adrRemote );
-					pSock->m_callback( temp, pkt.m_cbPkt, adr );
+					bucket.m_pLast = nullptr;
+					m_arBucketNonEmptyMask[ idxBucket >> 6 ] &= ~( 1ull << ( idxBucket & 63 ) );
 				}
+				--m_nQueued;
+				DeliverPacket( *pkt );
+				FreePacket( pkt );
 			}
-			m_list.RemoveFromHead();
+			++m_nCursorTick;
 		}
 
 		Schedule();
@@ -319,7 +653,18 @@ public:
 	/// Nuke everything
 	void Clear()
 	{
-		m_list.RemoveAll();
+		for ( Bucket &bucket: m_arBuckets )
+		{
+			while ( bucket.m_pFirst )
+			{
+				LaggedPacket *pkt = bucket.m_pFirst;
+				bucket.m_pFirst = pkt->m_pNext;
+				FreePacket( pkt );
+			}
+			bucket.m_pLast = nullptr;
+		}
+		memset( m_arBucketNonEmptyMask, 0, sizeof(m_arBucketNonEmptyMask) );
+		m_nQueued = 0;
 		IThinker::ClearNextThinkTime();
 	}
 
@@ -329,13 +674,31 @@ public:
 		// Just do a dumb linear search.  This list should be empty in
 		// production situations, and socket destruction is relatively rare,
 		// so its not worth making this complicated.
-		int idx = m_list.Head();
-		while ( idx != m_list.InvalidIndex() )
+		if ( m_nQueued > 0 )
 		{
-			int idxNext = m_list.Next( idx );
-			if ( m_list[idx].m_pSockOwner == pSock )
-				m_list.Remove( idx );
-			idx = idxNext;
+			for ( int idxBucket = 0 ; idxBucket < k_nBuckets ; ++idxBucket )
+			{
+				Bucket &bucket = m_arBuckets[ idxBucket ];
+				LaggedPacket **ppLink = &bucket.m_pFirst;
+				bucket.m_pLast = nullptr;
+				while ( *ppLink )
+				{
+					LaggedPacket *pkt = *ppLink;
+					if ( pkt->m_pSockOwner == pSock )
+					{
+						*ppLink = pkt->m_pNext;
+						FreePacket( pkt );
+						--m_nQueued;
+					}
+					else
+					{
+						bucket.m_pLast = pkt;
+						ppLink = &pkt->m_pNext;
+					}
+				}
+				if ( !bucket.m_pFirst )
+					m_arBucketNonEmptyMask[ idxBucket >> 6 ] &= ~( 1ull << ( idxBucket & 63 ) );
+			}
 		}
 
 		Schedule();
@@ -343,30 +706,229 @@ public:
 
 private:
 
-	/// Set the next think time as appropriate
-	void Schedule()
-	{
-		if ( m_list.IsEmpty() )
-			ClearNextThinkTime();
-		else
-			SetNextThinkTime( m_list[ m_list.Head() ].m_usecTime );
-	}
+	/// Width of each bucket, and the number of buckets.  The wheel
+	/// must be able to span the max lag, with some room to spare in
+	/// case we are late to think.
+	enum { k_usecBucketWidth = 1000 };
+	enum { k_nBuckets = 8192 };
+	enum { k_msMaxLag = k_msFakeNetworkMaxLag };
+	static_assert( ( k_nBuckets & ( k_nBuckets-1 ) ) == 0, "Bucket count must be power of two" );
+	static_assert( k_nBuckets * k_usecBucketWidth > k_msMaxLag * 1000 * 3 / 2, "Wheel isn't big enough for max lag" );
 
 	struct LaggedPacket
 	{
+		LaggedPacket *m_pNext; // Next in bucket or free list
 		bool m_bSend; // true for outbound, false for inbound
+		uint8 m_nSizeClass;
 		const CRawUDPSocketImpl *m_pSockOwner;
 		netadr_t m_adrRemote;
 		SteamNetworkingMicroseconds m_usecTime; /// Time when it should be sent or received
 		int m_cbPkt;
-		char m_pkt[ k_cbSteamNetworkingSocketsMaxUDPMsgLen ];
+		char m_pkt[ 1 ]; // Actual size depends on the size class
+	};
+
+	struct Bucket
+	{
+		LaggedPacket *m_pFirst;
+		LaggedPacket *m_pLast;
 	};
-	CUtlLinkedList<LaggedPacket> m_list;
 
+	Bucket m_arBuckets[ k_nBuckets ];
+	uint64 m_arBucketNonEmptyMask[ k_nBuckets / 64 ];
+	int64 m_nCursorTick = 0; // Next tick that we need to process
+	int m_nQueued = 0;
+
+	/// Size classes for packet buffers
+	enum { k_nSizeClasses = 6 };
+	static int SizeClassBytes( int nSizeClass )
+	{
+		static const int k_arSizeClassBytes[ k_nSizeClasses ] = { 128, 256, 512, 1024, k_cbSteamNetworkingSocketsMaxUDPMsgLen, k_cbSteamNetworkingSocketsMaxUDPMsgLenJumbo };
+		return k_arSizeClassBytes[ nSizeClass ];
+	}
+	LaggedPacket *m_arFreeLists[ k_nSizeClasses ];
+
+	LaggedPacket *AllocPacket( int cbPkt )
+	{
+		int nSizeClass = 0;
+		while ( SizeClassBytes( nSizeClass ) < cbPkt )
+		{
+			++nSizeClass;
+			Assert( nSizeClass < k_nSizeClasses );
+		}
+
+		LaggedPacket *pkt = m_arFreeLists[ nSizeClass ];
+		if ( pkt )
+		{
+			m_arFreeLists[ nSizeClass ] = pkt->m_pNext;
+		}
+		else
+		{
+			void *pMem = malloc( offsetof( LaggedPacket, m_pkt ) + SizeClassBytes( nSizeClass ) );
+			pkt = new ( pMem ) LaggedPacket;
+		}
+		pkt->m_nSizeClass = (uint8)nSizeClass;
+		return pkt;
+	}
+
+	void FreePacket( LaggedPacket *pkt )
+	{
+		pkt->m_pNext = m_arFreeLists[ pkt->m_nSizeClass ];
+		m_arFreeLists[ pkt->m_nSizeClass ] = pkt;
+	}
+
+	void FreePools()
+	{
+		for ( LaggedPacket *&pFreeList: m_arFreeLists )
+		{
+			while ( pFreeList )
+			{
+				LaggedPacket *pkt = pFreeList;
+				pFreeList = pkt->m_pNext;
+				pkt->~LaggedPacket();
+				free( pkt );
+			}
+		}
+	}
+
+	void DeliverPacket( const LaggedPacket &pkt )
+	{
+		// Make sure socket is still in good shape.
+		const CRawUDPSocketImpl *pSock = pkt.m_pSockOwner;
+		if ( !pSock->BIsOpen() )
+		{
+			AssertMsg( false, "Lagged packet remains in queue after socket destroyed or queued for destruction!" );
+			return;
+		}
+
+		// Sending, or receiving?
+		if ( pkt.m_bSend )
+		{
+			iovec temp;
+			temp.iov_len = pkt.m_cbPkt;
+			temp.iov_base = const_cast<char *>( pkt.m_pkt );
+			pSock->BReallySendRawPacket( 1, &temp, pkt.m_adrRemote );
+		}
+		else
+		{
+			// The packet has already been unlinked from the wheel,
+			// and won't be freed until the callback returns, so
+			// it's safe to hand it over directly.
+			netadr_t adr( pkt.m_adrRemote );
+			pSock->m_callback( pkt.m_pkt, pkt.m_cbPkt, adr );
+		}
+	}
+
+	/// Locate the next tick after the cursor where a bucket is non-empty
+	int64 FindNextNonEmptyTick() const
+	{
+		Assert( m_nQueued > 0 );
+		int idxStart = int( m_nCursorTick & ( k_nBuckets-1 ) );
+		for ( int i = 0 ; i <= k_nBuckets/64 ; ++i )
+		{
+			int idxWord = ( ( idxStart >> 6 ) + i ) & ( k_nBuckets/64 - 1 );
+			uint64 nMask = m_arBucketNonEmptyMask[ idxWord ];
+
+			// On the first word, ignore buckets before the cursor
+			if ( i == 0 )
+				nMask &= ~0ull << ( idxStart & 63 );
+			if ( nMask )
+			{
+				int idxBucket = ( idxWord << 6 ) + FindLeastSignificantBit64( nMask );
+				int nOffset = ( idxBucket - idxStart ) & ( k_nBuckets-1 );
+				return m_nCursorTick + nOffset;
+			}
+		}
+		AssertMsg( false, "Packet lag queue count is wrong" );
+		return m_nCursorTick + k_nBuckets;
+	}
+
+	/// Set the next think time as appropriate
+	void Schedule()
+	{
+		if ( m_nQueued <= 0 )
+			ClearNextThinkTime();
+		else
+			SetNextThinkTime( FindNextNonEmptyTick() * k_usecBucketWidth );
+	}
 };
 
 static CPacketLagger s_packetLagQueue;
 
+/// Run a packet through the fake network conditions, and then send/receive
+/// it now, queue it to be sent/received later, or drop it.
+static bool FakeNetworkSendOrRecv( bool bSend, const CRawUDPSocketImpl *pSock, const netadr_t &adr, const FakeNetworkParams_t &params, int nChunks, const iovec *pChunks )
+{
+	int cbPkt = 0;
+	for ( int i = 0 ; i < nChunks ; ++i )
+		cbPkt += pChunks[i].iov_len;
+
+	// Duplicate it?  The copies take their chances independently
+	int nCopies = 1;
+	if ( params.m_nDupPct > 0 && FakeNetworkRandomFloat( 0, 100.0f ) < params.m_nDupPct )
+		nCopies = 2;
+
+	FakeNetworkDirection_t &dir = bSend ? s_fakeNetworkSend : s_fakeNetworkRecv;
+	SteamNetworkingMicroseconds usecNow = SteamNetworkingSockets_GetLocalTimestamp();
+	bool bResult = true;
+	for ( int i = 0 ; i < nCopies ; ++i )
+	{
+		SteamNetworkingMicroseconds usecDelay;
+		if ( !BFakeNetworkProcessPacket( dir, params, cbPkt, usecNow, usecDelay ) )
+			continue;
+		if ( usecDelay > 0 )
+		{
+			s_packetLagQueue.LagPacket( bSend, pSock, adr, usecDelay, nChunks, pChunks );
+		}
+		else if ( bSend )
+		{
+			bResult = pSock->BReallySendRawPacket( nChunks, pChunks, adr );
+		}
+		else
+		{
+			// The callback might close the socket
+			if ( !pSock->m_callback.m_fnCallback )
+				break;
+			Assert( nChunks == 1 );
+			pSock->m_callback( pChunks[0].iov_base, cbPkt, adr );
+		}
+	}
+	return bResult;
+}
+
+/// Deliver a packet that was received on a socket, applying
+/// any fake network conditions
+static void DispatchReceivedRawPacket( CRawUDPSocketImpl *pSock, void *pPkt, int cbPkt, const netadr_t &adrFrom )
+{
+	MetricsIncrement( g_metrics.m_nUDPPacketsRecv );
+	MetricsAdd( g_metrics.m_nUDPBytesRecv, cbPkt );
+	PacketTraceRawPacket( k_EPacketTraceEvent_RawRecv, cbPkt, adrFrom.GetPort() );
+
+	// Check for simulating bad network conditions
+	FakeNetworkParams_t params;
+	params.m_nLossPct = steamdatagram_fakepacketloss_recv;
+	params.m_nBurstLossPct = steamdatagram_fakepacketburstloss_recv;
+	params.m_nDupPct = steamdatagram_fakepacketdup_recv;
+	params.m_nReorderPct = steamdatagram_fakepacketreorder_recv;
+	params.m_nBytesPerSec = steamdatagram_fakepacketbandwidth_recv;
+	params.m_msLag = steamdatagram_fakepacketlag_recv;
+	params.m_msJitter = steamdatagram_fakepacketjitter_recv;
+	params.m_eJitterDistribution = steamdatagram_fakepacketjitter_distribution;
+	if ( params.BAnyActive() )
+	{
+		iovec temp;
+		temp.iov_len = cbPkt;
+		temp.iov_base = pPkt;
+		FakeNetworkSendOrRecv( false, pSock, adrFrom, params, 1, &temp );
+		return;
+	}
+
+	//const uint8 *pbPkt = (const uint8 *)pPkt;
+	//Log_Detailed( LOG_STEAMDATAGRAM_CLIENT, "%s -> %4db %02x %02x %02x %02x %02x ...\n",
+	//	CUtlNetAdrRender( adrFrom ).String(), cbPkt, pbPkt[0], pbPkt[1], pbPkt[2], pbPkt[3], pbPkt[4] );
+
+	pSock->m_callback( pPkt, cbPkt, adrFrom );
+}
+
 /// Object used to wake our background thread efficiently
 #ifdef WIN32
 	static HANDLE s_hEventWakeThread = INVALID_HANDLE_VALUE;
@@ -391,15 +953,15 @@ static void WakeSteamDatagramThread()
 	#endif
 }
 
-bool IRawUDPSocket::BSendRawPacket( const void *pPkt, int cbPkt, const netadr_t &adrTo ) const
+bool IRawUDPSocket::BSendRawPacket( const void *pPkt, int cbPkt, const netadr_t &adrTo, const FakeLagSettings_t *pFakeLag ) const
 {
 	iovec temp;
 	temp.iov_len = cbPkt;
 	temp.iov_base = (void *)pPkt;
-	return BSendRawPacketGather( 1, &temp, adrTo );
+	return BSendRawPacketGather( 1, &temp, adrTo, pFakeLag );
 }
 
-bool IRawUDPSocket::BSendRawPacketGather( int nChunks, const iovec *pChunks, const netadr_t &adrTo ) const
+bool IRawUDPSocket::BSendRawPacketGather( int nChunks, const iovec *pChunks, const netadr_t &adrTo, const FakeLagSettings_t *pFakeLag ) const
 {
 	SteamDatagramTransportLock::AssertHeldByCurrentThread();
 
@@ -407,29 +969,61 @@ bool IRawUDPSocket::BSendRawPacketGather( int nChunks, const iovec *pChunks, con
 	if ( !g_bWantThreadRunning )
 		return true;
 
-	// Fake loss?
-	if ( ( steamdatagram_fakepacketloss_send > 0 ) && ( WeakRandomFloat( 0, 100.0 ) < steamdatagram_fakepacketloss_send ) )
-		return true;
-
 	const CRawUDPSocketImpl *self = static_cast<const CRawUDPSocketImpl *>( this );
 
-	// Fake lag?
-	int32 nPacketFakeLagTotal = steamdatagram_fakepacketlag_send;
-
-	// Check for simulation random packet reordering
-	if ( ( steamdatagram_fakepacketreorder_send ) > 0 && WeakRandomFloat( 0, 100.0 ) < steamdatagram_fakepacketreorder_send )
+	// Gather up fake network settings, with any overrides for this connection
+	FakeNetworkParams_t params;
+	params.m_nLossPct = steamdatagram_fakepacketloss_send;
+	params.m_nBurstLossPct = steamdatagram_fakepacketburstloss_send;
+	params.m_nDupPct = steamdatagram_fakepacketdup_send;
+	params.m_nReorderPct = steamdatagram_fakepacketreorder_send;
+	params.m_nBytesPerSec = steamdatagram_fakepacketbandwidth_send;
+	params.m_msLag = steamdatagram_fakepacketlag_send;
+	params.m_msJitter = steamdatagram_fakepacketjitter_send;
+	params.m_eJitterDistribution = steamdatagram_fakepacketjitter_distribution;
+	if ( pFakeLag )
 	{
-		nPacketFakeLagTotal += steamdatagram_fakepacketreorder_time;
+		if ( pFakeLag->m_msLag >= 0 )
+			params.m_msLag = pFakeLag->m_msLag;
+		if ( pFakeLag->m_msJitter >= 0 )
+			params.m_msJitter = pFakeLag->m_msJitter;
+		if ( pFakeLag->m_eJitterDistribution > 0 )
+			params.m_eJitterDistribution = pFakeLag->m_eJitterDistribution;
 	}
 
-	if ( nPacketFakeLagTotal > 0 )
+	// Simulate a path with a small MTU?  Packets that are too big
+	// are silently dropped, just like a real router would
+	if ( steamdatagram_fakepacketmtu_send > 0 )
 	{
-		s_packetLagQueue.LagPacket( true, self, adrTo, nPacketFakeLagTotal, nChunks, pChunks );
-		return true;
+		int cbPkt = 0;
+		for ( int i = 0 ; i < nChunks ; ++i )
+			cbPkt += pChunks[i].iov_len;
+		if ( cbPkt > steamdatagram_fakepacketmtu_send )
+			return true;
 	}
 
-	// Now really send it
-	return self->BReallySendRawPacket( nChunks, pChunks, adrTo );
+	// Usual case is no fake network conditions
+	if ( !params.BAnyActive() )
+		return self->BReallySendRawPacket( nChunks, pChunks, adrTo );
+
+	return FakeNetworkSendOrRecv( true, self, adrTo, params, nChunks, pChunks );
+}
+
+bool IRawUDPSocket::BSetMaxPacingRate( int nBytesPerSec ) const
+{
+	SteamDatagramTransportLock::AssertHeldByCurrentThread();
+	const CRawUDPSocketImpl *self = static_cast<const CRawUDPSocketImpl *>( this );
+
+	// Packets on the virtual network never touch the kernel
+	if ( self->m_socket == INVALID_SOCKET )
+		return false;
+
+	#ifdef SO_MAX_PACING_RATE
+		unsigned int opt = (unsigned int)Max( nBytesPerSec, 0 );
+		return setsockopt( self->m_socket, SOL_SOCKET, SO_MAX_PACING_RATE, (char *)&opt, sizeof(opt) ) == 0;
+	#else
+		return false;
+	#endif
 }
 
 void IRawUDPSocket::Close()
@@ -439,9 +1033,8 @@ void IRawUDPSocket::Close()
 
 	/// Clear the callback, to ensure that no further callbacks will be executed.
 	/// This marks the socket as pending destruction.
-	Assert( self->m_callback.m_fnCallback );
+	Assert( self->BIsOpen() );
 	self->m_callback.m_fnCallback = nullptr;
-	Assert( self->m_socket != INVALID_SOCKET );
 
 	DbgVerify( s_vecRawSockets.FindAndFastRemove( self ) );
 	DbgVerify( !s_vecRawSocketsPendingDeletion.FindAndFastRemove( self ) );
@@ -450,6 +1043,10 @@ void IRawUDPSocket::Close()
 	// Clean up lagged packets, if any
 	s_packetLagQueue.AboutToDestroySocket( self );
 
+	// Stop routing packets to it on the virtual network
+	if ( self->m_nVirtualPort )
+		VirtualNetworkUnbindPort( self );
+
 	// Make sure we don't delay doing this too long
 	if ( s_pThreadSteamDatagram && s_pThreadSteamDatagram->get_id() != std::this_thread::get_id() )
 	{
@@ -554,6 +1151,160 @@ static SOCKET OpenUDPSocketBoundToSockAddr( const void *sockaddr, size_t len, St
 	return sock;
 }
 
+/////////////////////////////////////////////////////////////////////////////
+//
+// Virtual network
+//
+/////////////////////////////////////////////////////////////////////////////
+
+/// Are we running on the virtual network and clock?
+static bool s_bVirtualNetwork = false;
+
+/// Current time on the virtual clock.  Only advanced while holding the
+/// lock, but the clock can be read from any thread.
+static std::atomic<SteamNetworkingMicroseconds> s_usecVirtualNow( (SteamNetworkingMicroseconds)k_nMillion*24*3600*30 );
+
+/// Time it takes a packet to cross the virtual wire
+static SteamNetworkingMicroseconds s_usecVirtualLatency = 0;
+
+static SteamNetworkingMicroseconds VirtualClock()
+{
+	return s_usecVirtualNow.load( std::memory_order_relaxed );
+}
+
+/// All of the virtual sockets are on a single host, and are found by port.
+/// A packet is delivered to whichever socket is bound to the destination
+/// port, no matter what IP it was addressed to.
+static CRawUDPSocketImpl *s_arVirtualPorts[ 0x10000 ];
+static uint16 s_nVirtualNextEphemeralPort = 49152;
+
+/// A packet in flight on the virtual wire.  Every packet takes the same
+/// amount of time to cross, so the wire is just a FIFO.  (Fake lag, loss,
+/// etc has already been applied by the time it gets here.)
+struct VirtualPacket
+{
+	VirtualPacket *m_pNext;
+	SteamNetworkingMicroseconds m_usecDeliver;
+	uint16 m_nPortFrom;
+	uint16 m_nPortTo;
+	int m_cbPkt;
+	char m_pkt[ k_cbSteamNetworkingSocketsMaxUDPMsgLenJumbo ];
+};
+static VirtualPacket *s_pVirtualWireHead = nullptr;
+static VirtualPacket *s_pVirtualWireTail = nullptr;
+static VirtualPacket *s_pVirtualPacketFreeList = nullptr;
+
+static bool VirtualNetworkSendPacket( const CRawUDPSocketImpl *pSock, int nChunks, const iovec *pChunks, const netadr_t &adrTo )
+{
+	VirtualPacket *pkt = s_pVirtualPacketFreeList;
+	if ( pkt )
+		s_pVirtualPacketFreeList = pkt->m_pNext;
+	else
+		pkt = new VirtualPacket;
+
+	pkt->m_pNext = nullptr;
+	pkt->m_usecDeliver = s_usecVirtualNow + s_usecVirtualLatency;
+	pkt->m_nPortFrom = pSock->m_nVirtualPort;
+	pkt->m_nPortTo = adrTo.GetPort();
+	pkt->m_cbPkt = 0;
+	for ( int i = 0 ; i < nChunks ; ++i )
+	{
+		int cbChunk = pChunks[i].iov_len;
+		if ( pkt->m_cbPkt + cbChunk > (int)sizeof(pkt->m_pkt) )
+		{
+			AssertMsg( false, "Packet too big for virtual network" );
+			pkt->m_pNext = s_pVirtualPacketFreeList;
+			s_pVirtualPacketFreeList = pkt;
+			return false;
+		}
+		memcpy( pkt->m_pkt + pkt->m_cbPkt, pChunks[i].iov_base, cbChunk );
+		pkt->m_cbPkt += cbChunk;
+	}
+
+	if ( s_pVirtualWireTail )
+		s_pVirtualWireTail->m_pNext = pkt;
+	else
+		s_pVirtualWireHead = pkt;
+	s_pVirtualWireTail = pkt;
+	return true;
+}
+
+/// Deliver all packets that have finished crossing the wire
+static void VirtualNetworkDeliverPackets()
+{
+	while ( s_pVirtualWireHead && s_pVirtualWireHead->m_usecDeliver <= s_usecVirtualNow )
+	{
+		VirtualPacket *pkt = s_pVirtualWireHead;
+		s_pVirtualWireHead = pkt->m_pNext;
+		if ( !s_pVirtualWireHead )
+			s_pVirtualWireTail = nullptr;
+
+		// Nobody listening on that port?  Just like real life,
+		// the packet goes nowhere.
+		CRawUDPSocketImpl *pSock = s_arVirtualPorts[ pkt->m_nPortTo ];
+		if ( pSock && pSock->BIsOpen() )
+			DispatchReceivedRawPacket( pSock, pkt->m_pkt, pkt->m_cbPkt, netadr_t( 0x7f000001, pkt->m_nPortFrom ) );
+
+		pkt->m_pNext = s_pVirtualPacketFreeList;
+		s_pVirtualPacketFreeList = pkt;
+	}
+}
+
+static void VirtualNetworkFreePackets()
+{
+	while ( s_pVirtualWireHead )
+	{
+		VirtualPacket *pkt = s_pVirtualWireHead;
+		s_pVirtualWireHead = pkt->m_pNext;
+		delete pkt;
+	}
+	s_pVirtualWireTail = nullptr;
+	while ( s_pVirtualPacketFreeList )
+	{
+		VirtualPacket *pkt = s_pVirtualPacketFreeList;
+		s_pVirtualPacketFreeList = pkt->m_pNext;
+		delete pkt;
+	}
+}
+
+static bool VirtualNetworkBindPort( CRawUDPSocketImpl *pSock, SteamNetworkingIPAddr &addrLocal, SteamDatagramErrMsg &errMsg )
+{
+	uint16 nPort = addrLocal.m_port;
+	if ( nPort == 0 )
+	{
+		// Pick an ephemeral port
+		for ( int i = 0 ; ; ++i )
+		{
+			if ( i >= 0x10000 )
+			{
+				V_strcpy_safe( errMsg, "No free ports on virtual network" );
+				return false;
+			}
+			nPort = s_nVirtualNextEphemeralPort++;
+			if ( s_nVirtualNextEphemeralPort == 0 )
+				s_nVirtualNextEphemeralPort = 49152;
+			if ( nPort != 0 && !s_arVirtualPorts[ nPort ] )
+				break;
+		}
+	}
+	else if ( s_arVirtualPorts[ nPort ] )
+	{
+		V_sprintf_safe( errMsg, "Virtual port %d already in use", nPort );
+		return false;
+	}
+
+	s_arVirtualPorts[ nPort ] = pSock;
+	pSock->m_nVirtualPort = nPort;
+	addrLocal.m_port = nPort;
+	return true;
+}
+
+static void VirtualNetworkUnbindPort( CRawUDPSocketImpl *pSock )
+{
+	Assert( s_arVirtualPorts[ pSock->m_nVirtualPort ] == pSock );
+	s_arVirtualPorts[ pSock->m_nVirtualPort ] = nullptr;
+}
+
 static CRawUDPSocketImpl *OpenRawUDPSocketInternal( CRecvPacketCallback callback, SteamDatagramErrMsg &errMsg, const SteamNetworkingIPAddr *pAddrLocal, int *pnAddressFamilies )
 {
 	// We're going to need a background thread running to poll this guy
@@ -606,6 +1357,27 @@ static CRawUDPSocketImpl *OpenRawUDPSocketInternal( CRecvPacketCallback callback
 		}
 	}
 
+	// On the virtual network?
+	if ( s_bVirtualNetwork )
+	{
+		if ( nAddressFamilies == k_nAddressFamily_Auto )
+			nAddressFamilies = k_nAddressFamily_DualStack;
+
+		CRawUDPSocketImpl *pSock = new CRawUDPSocketImpl;
+		if ( !VirtualNetworkBindPort( pSock, addrLocal, errMsg ) )
+		{
+			delete pSock;
+			return nullptr;
+		}
+		pSock->m_boundAddr = addrLocal;
+		pSock->m_callback = callback;
+		pSock->m_nAddressFamilies = nAddressFamilies;
+		s_vecRawSockets.AddToTail( pSock );
+		if ( pnAddressFamilies )
+			*pnAddressFamilies = nAddressFamilies;
+		return pSock;
+	}
+
 	// Try IPv6?
 	SOCKET sock = INVALID_SOCKET;
 	if ( nAddressFamilies & k_nAddressFamily_IPv6 )
@@ -789,7 +1561,7 @@ static bool PollRawUDPSockets( int nMaxTimeoutMS )
 		poll( s_vecPollFD.Base(), s_vecPollFD.Count(), nMaxTimeoutMS );
 	#endif
 
-	SteamNetworkingMicroseconds usecStartedLocking = SteamNetworkingSockets_GetLocalTimestamp();
+	SteamNetworkingMicroseconds usecStartedLocking = (SteamNetworkingMicroseconds)Plat_USTime();
 	for (;;)
 	{
 
@@ -808,7 +1580,7 @@ static bool PollRawUDPSockets( int nMaxTimeoutMS )
 				s_steamDatagramTransportMutex.try_lock_for( std::chrono::milliseconds( 250 ) )
 			#endif
 		) {
-			SteamDatagramTransportLock::OnLocked();
+			SteamDatagramTransportLock::OnLocked( k_ESteamNetworkingLockCaller_ServiceThread, (SteamNetworkingMicroseconds)Plat_USTime() - usecStartedLocking );
 			break;
 		}
 
@@ -817,12 +1589,13 @@ static bool PollRawUDPSockets( int nMaxTimeoutMS )
 		// However, note that try_lock_for is permitted to "fail" spuriously, returning
 		// false even if no other thread holds the lock.  (For performance reasons.)
 		// So we check how long we have actually been waiting.
-		SteamNetworkingMicroseconds usecElapsed = SteamNetworkingSockets_GetLocalTimestamp() - usecStartedLocking;
+		SteamNetworkingMicroseconds usecElapsed = (SteamNetworkingMicroseconds)Plat_USTime() - usecStartedLocking;
 		AssertMsg1( usecElapsed < 50*1000 || !g_bWantThreadRunning || Plat_IsInDebugSession(), "SDR service thread gave up on lock after waiting %dms.  This directly adds to delay of processing of network packets!", int( usecElapsed/1000 ) );
 	}
 
 	// Recv socket data from any sockets that might have data, and execute the callbacks.
-	char buf[ k_cbSteamNetworkingSocketsMaxUDPMsgLen + 1024 ];
+	VPROF_BUDGET( "PollRawUDPSockets", VPROF_BUDGETGROUP_SOCKETS );
+	char buf[ k_cbSteamNetworkingSocketsMaxUDPMsgLenJumbo + 1024 ];
 #ifdef _WIN32
 	// Note that we assume we aren't polling a ton of sockets here.  We do at least skip ahead
 	// to the first socket with data, based on the return value of WaitForMultipleObjects.  But
@@ -890,10 +1663,6 @@ static bool PollRawUDPSockets( int nMaxTimeoutMS )
 			if ( ret < 0 )
 				break;
 
-			// Check for simulating random packet loss
-			if ( ( steamdatagram_fakepacketloss_recv ) > 0 && ( WeakRandomFloat( 0, 100.0 ) < steamdatagram_fakepacketloss_recv ) )
-				continue;
-
 			netadr_t adr;
 			adr.SetFromSockadr( &from );
 
@@ -901,31 +1670,7 @@ static bool PollRawUDPSockets( int nMaxTimeoutMS )
 			if ( pSock->m_nAddressFamilies == k_nAddressFamily_DualStack )
 				adr.BConvertMappedToIPv4();
 
-			int32 nPacketFakeLagTotal = steamdatagram_fakepacketlag_recv;
-
-			// Check for simulation random packet reordering
-			if ( ( steamdatagram_fakepacketreorder_recv ) > 0 && WeakRandomFloat( 0, 100.0 ) < steamdatagram_fakepacketreorder_recv )
-			{
-				nPacketFakeLagTotal += steamdatagram_fakepacketreorder_time;
-			}
-
-			// Check for simulating lag
-			if ( nPacketFakeLagTotal > 0 )
-			{
-				iovec temp;
-				temp.iov_len = ret;
-				temp.iov_base = buf;
-				s_packetLagQueue.LagPacket( false, pSock, adr, nPacketFakeLagTotal, 1, &temp );
-			}
-			else
-			{
-
-				//const uint8 *pbPkt = (const uint8 *)buf;
-				//Log_Detailed( LOG_STEAMDATAGRAM_CLIENT, "%s -> %4db %02x %02x %02x %02x %02x ...\n",
-				//	CUtlNetAdrRender( adr ).String(), ret, pbPkt[0], pbPkt[1], pbPkt[2], pbPkt[3], pbPkt[4] );
-
-				pSock->m_callback( buf, ret, adr );
-			}
+			DispatchReceivedRawPacket( pSock, buf, ret, adr );
 		}
 	}
 
@@ -996,6 +1741,7 @@ void IThinker::SetNextThinkTime( SteamNetworkingMicroseconds usecTargetThinkTime
 			Assert( s_queueThinkers.Element( m_queueIndex ) == this );
 			s_queueThinkers.RemoveAt( m_queueIndex );
 			Assert( m_queueIndex == -1 );
+			MetricsSet( g_metrics.m_nThinkersScheduled, s_queueThinkers.Count() );
 		}
 
 		m_usecNextThinkTimeTarget = k_nThinkTime_Never;
@@ -1022,6 +1768,7 @@ void IThinker::SetNextThinkTime( SteamNetworkingMicroseconds usecTargetThinkTime
 		m_usecNextThinkTimeEarliest = Min( usecTargetThinkTime, usecLimit );
 		m_usecNextThinkTimeLatest = Max( usecTargetThinkTime, usecLimit );
 		s_queueThinkers.Insert( this );
+		MetricsSet( g_metrics.m_nThinkersScheduled, s_queueThinkers.Count() );
 	}
 	else
 	{
@@ -1075,6 +1822,7 @@ void IThinker::EnsureMinThinkTime( SteamNetworkingMicroseconds usecTargetThinkTi
 		m_usecNextThinkTimeEarliest = usecNextThinkTimeEarliest;
 		m_usecNextThinkTimeLatest = usecNextThinkTimeLatest;
 		s_queueThinkers.Insert( this );
+		MetricsSet( g_metrics.m_nThinkersScheduled, s_queueThinkers.Count() );
 	}
 	else
 	{
@@ -1121,6 +1869,7 @@ void IThinker::EnsureMinThinkTime( SteamNetworkingMicroseconds usecTargetThinkTi
 
 void ProcessThinkers()
 {
+	VPROF_BUDGET( "ProcessThinkers", VPROF_BUDGETGROUP_THINK );
 
 	// Until the queue is empty
 	while ( s_queueThinkers.Count() > 0 )
@@ -1169,6 +1918,39 @@ void ProcessThinkers()
 	}
 }
 
+/// Run the virtual network until the given time.  Time jumps
+/// directly to the next event: a packet arriving, or a thinker
+/// that needs service.
+static void VirtualNetworkRunUntil( SteamNetworkingMicroseconds usecEnd )
+{
+	SteamDatagramTransportLock::AssertHeldByCurrentThread();
+	Assert( s_bVirtualNetwork );
+
+	for (;;)
+	{
+		VirtualNetworkDeliverPackets();
+		ProcessThinkers();
+		ProcessPendingDestroyClosedRawUDPSockets();
+
+		if ( s_usecVirtualNow >= usecEnd )
+			break;
+
+		// Skip ahead to the next event
+		SteamNetworkingMicroseconds usecNext = usecEnd;
+		if ( s_pVirtualWireHead )
+			usecNext = Min( usecNext, s_pVirtualWireHead->m_usecDeliver );
+		if ( s_queueThinkers.Count() > 0 )
+		{
+			// Thinkers are processed when the time is strictly after the
+			// earliest time, so make sure we go at least that far
+			const IThinker *pNextThinker = s_queueThinkers.ElementAtHead();
+			usecNext = Min( usecNext, Max( pNextThinker->GetTargetThinkTime(), pNextThinker->GetEarliestThinkTime()+1 ) );
+		}
+		Assert( usecNext > s_usecVirtualNow );
+		s_usecVirtualNow.store( Max( usecNext, s_usecVirtualNow+1 ), std::memory_order_relaxed );
+	}
+}
+
 /////////////////////////////////////////////////////////////////////////////
 //
 // Service thread
@@ -1220,7 +2002,7 @@ static void SteamDatagramThreadProc()
 	#endif
 
 	// We will hold global lock while we're awake.
-	SteamDatagramTransportLock::Lock();
+	SteamDatagramTransportLock::Lock( k_ESteamNetworkingLockCaller_ServiceThread );
 
 	// Random number generator may be per thread!  Make sure and see it for
 	// this thread, if so
@@ -1352,6 +2134,15 @@ static bool BEnsureSteamDatagramThreadRunning( SteamDatagramErrMsg &errMsg )
 		return true;
 	}
 
+	// On the virtual network, there is no service thread.  Everything
+	// happens when the app advances the clock.
+	if ( s_bVirtualNetwork )
+	{
+		Assert( !s_pThreadSteamDatagram );
+		g_bWantThreadRunning = true;
+		return true;
+	}
+
 	if ( s_pThreadSteamDatagram )
 	{
 		Assert( g_bWantThreadRunning );
@@ -1464,6 +2255,9 @@ static void StopSteamDatagramThread()
 
 	// Make sure we don't leak any sockets.
 	ProcessPendingDestroyClosedRawUDPSockets();
+
+	// Discard anything still on the virtual wire
+	VirtualNetworkFreePackets();
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -1488,6 +2282,17 @@ public:
 		m_pRawSock = nullptr;
 		delete this;
 	}
+
+	virtual bool BSetMaxPacingRate( int nBytesPerSec ) const OVERRIDE
+	{
+		return m_pRawSock->BSetMaxPacingRate( nBytesPerSec );
+	}
+
+	virtual int GetMemoryUsage() const OVERRIDE
+	{
+		// We own the raw socket
+		return MemoryUsageOfAllocation( sizeof(*this) ) + MemoryUsageOfAllocation( sizeof(CRawUDPSocketImpl) );
+	}
 };
 
 static void DedicatedBoundSocketCallback( const void *pPkt, int cbPkt, const netadr_t &adrFrom, CDedicatedBoundSocket *pSock )
@@ -1647,6 +2452,13 @@ IBoundUDPSocket *CSharedSocket::AddRemoteHost( const netadr_t &adrRemote, CRecvP
 	return pRemoteHost;
 }
 
+int CSharedSocket::RemoteHost::GetMemoryUsage() const
+{
+	// The raw socket is shared.  We just have ourselves, and our
+	// entry in the owner's table
+	return MemoryUsageOfAllocation( sizeof(*this) ) + int( sizeof(netadr_t) + sizeof(RemoteHost*) + 2*sizeof(int) );
+}
+
 void CSharedSocket::RemoteHost::Close()
 {
 	SteamDatagramTransportLock::AssertHeldByCurrentThread();
@@ -1673,6 +2485,242 @@ SteamNetworkingMicroseconds g_usecLastRateLimitSpew;
 ESteamNetworkingSocketsDebugOutputType g_eSteamDatagramDebugOutputDetailLevel;
 static FSteamNetworkingSocketsDebugOutput s_pfnDebugOutput = nullptr;
 
+//
+// Asynchronous spew.  When LogAsync is set, spew is formatted on the
+// calling thread straight into a slot of a bounded lock-free ring, and
+// handed to the app's callback from a separate thread.  We format up front
+// (rather than saving the format arguments) because %s arguments usually
+// point at buffers that won't outlive the call.  Producers never wait for
+// the consumer; if the ring is full, the record is dropped and counted.
+// (If the spew thread is asleep, they take its wake mutex for a moment.)
+//
+// The ring is the usual bounded MPMC queue with per-slot sequence numbers,
+// used here with a single consumer.  (The consumer side is serialized by
+// s_spewDeliveryMutex, so that a synchronous flush can drain it too.)
+//
+
+struct SpewRecord
+{
+	std::atomic<uint32> m_nSeq;
+	ESteamNetworkingSocketsDebugOutputType m_eType;
+	char *m_pszLongText; // Set if it didn't fit in m_szText
+	char m_szText[ 500 ];
+};
+
+const int k_nSpewRingSize = 1024; // Must be a power of two
+static SpewRecord s_spewRing[ k_nSpewRingSize ];
+static std::atomic<uint32> s_nSpewRingTail;
+static uint32 s_nSpewRingHead; // Protected by s_spewDeliveryMutex
+static std::atomic<bool> s_bSpewRingInitted;
+
+static std::atomic<int> s_nSpewDropped;
+static std::atomic<SteamNetworkingMicroseconds> s_usecFirstSpewDropped;
+
+static std::mutex s_spewDeliveryMutex;
+static std::mutex s_spewThreadMutex; // Protects starting/stopping the thread
+static std::condition_variable s_spewThreadWake;
+static std::mutex s_spewThreadWakeMutex;
+static std::atomic<bool> s_bSpewThreadSleeping;
+static std::atomic<uint32> s_nSpewPublished; // Bumped after each record is published, so the thread can tell if it missed one
+static std::thread *s_pSpewThread = nullptr;
+static std::atomic<bool> s_bWantSpewThreadRunning;
+
+// Set while we are invoking the callback from DrainSpewRing, in case
+// the callback triggers more spew
+static thread_local bool s_bDeliveringSpew;
+
+static void InitSpewRing()
+{
+	for ( uint32 i = 0 ; i < k_nSpewRingSize ; ++i )
+		s_spewRing[i].m_nSeq.store( i, std::memory_order_relaxed );
+	s_nSpewRingTail.store( 0, std::memory_order_relaxed );
+	s_nSpewRingHead = 0;
+	s_bSpewRingInitted.store( true, std::memory_order_release );
+}
+
+/// Deliver everything currently in the ring.  Returns the number of records delivered
+static int DrainSpewRing()
+{
+	std::lock_guard<std::mutex> lock( s_spewDeliveryMutex );
+	if ( !s_bSpewRingInitted.load( std::memory_order_acquire ) )
+		return 0;
+
+	s_bDeliveringSpew = true;
+	int nDelivered = 0;
+	for (;;)
+	{
+		SpewRecord &rec = s_spewRing[ s_nSpewRingHead & ( k_nSpewRingSize-1 ) ];
+		if ( rec.m_nSeq.load( std::memory_order_acquire ) != s_nSpewRingHead+1 )
+			break;
+
+		FSteamNetworkingSocketsDebugOutput pfnDebugOutput = s_pfnDebugOutput;
+		if ( pfnDebugOutput )
+			pfnDebugOutput( rec.m_eType, rec.m_pszLongText ? rec.m_pszLongText : rec.m_szText );
+		if ( rec.m_pszLongText )
+		{
+			free( rec.m_pszLongText );
+			rec.m_pszLongText = nullptr;
+		}
+
+		// Release the slot back to the producers
+		rec.m_nSeq.store( s_nSpewRingHead + k_nSpewRingSize, std::memory_order_release );
+		++s_nSpewRingHead;
+		++nDelivered;
+	}
+	s_bDeliveringSpew = false;
+
+	// Report any records we had to discard.  We do this after draining,
+	// so the notice appears roughly where the gap is
+	int nDropped = s_nSpewDropped.exchange( 0, std::memory_order_relaxed );
+	if ( nDropped > 0 )
+	{
+		FSteamNetworkingSocketsDebugOutput pfnDebugOutput = s_pfnDebugOutput;
+		if ( pfnDebugOutput )
+		{
+			char msg[ 128 ];
+			SteamNetworkingMicroseconds usecAgo = SteamNetworkingSockets_GetLocalTimestamp() - s_usecFirstSpewDropped.load( std::memory_order_relaxed );
+			V_sprintf_safe( msg, "Spew ring overflowed.  %d records dropped in the last %.1fms", nDropped, usecAgo * 1e-3 );
+			pfnDebugOutput( k_ESteamNetworkingSocketsDebugOutputType_Warning, msg );
+		}
+	}
+
+	return nDelivered;
+}
+
+static void SpewThreadProc()
+{
+	while ( s_bWantSpewThreadRunning )
+	{
+		uint32 nPublished = s_nSpewPublished.load( std::memory_order_seq_cst );
+		if ( DrainSpewRing() > 0 )
+			continue;
+
+		// Nothing to do.  Go to sleep.  Producers only bother to notify us
+		// if we've said we're sleeping.  Anything published after we said
+		// so will wake us, and anything published before that, but after
+		// we drained, changes the counter, so we won't wait.
+		std::unique_lock<std::mutex> lock( s_spewThreadWakeMutex );
+		s_bSpewThreadSleeping.store( true, std::memory_order_seq_cst );
+		s_spewThreadWake.wait( lock, [nPublished]{
+			return !s_bWantSpewThreadRunning || s_nSpewPublished.load( std::memory_order_seq_cst ) != nPublished;
+		} );
+		s_bSpewThreadSleeping.store( false, std::memory_order_relaxed );
+	}
+
+	// Deliver anything that's left
+	DrainSpewRing();
+}
+
+static void EnsureSpewThreadRunning()
+{
+	std::lock_guard<std::mutex> lock( s_spewThreadMutex );
+	if ( s_pSpewThread )
+		return;
+	if ( !s_bSpewRingInitted.load( std::memory_order_acquire ) )
+		InitSpewRing();
+	s_bWantSpewThreadRunning = true;
+	s_pSpewThread = new std::thread( SpewThreadProc );
+}
+
+static void StopSpewThread()
+{
+	std::lock_guard<std::mutex> lock( s_spewThreadMutex );
+	if ( s_pSpewThread )
+	{
+		{
+			std::lock_guard<std::mutex> lockWake( s_spewThreadWakeMutex );
+			s_bWantSpewThreadRunning = false;
+		}
+		s_spewThreadWake.notify_one();
+		s_pSpewThread->join();
+		delete s_pSpewThread;
+		s_pSpewThread = nullptr;
+	}
+
+	// If anything snuck in after the thread exited, deliver it now
+	DrainSpewRing();
+}
+
+/// Format a message into the ring, or count it as dropped if the ring is full
+static void QueueSpew( ESteamNetworkingSocketsDebugOutputType eType, const char *pMsg, va_list ap )
+{
+	// We might have seen the thread running flag without seeing the ring
+	// get initialized
+	if ( !s_bSpewRingInitted.load( std::memory_order_acquire ) )
+		EnsureSpewThreadRunning();
+
+	// Claim a slot
+	uint32 nPos = s_nSpewRingTail.load( std::memory_order_relaxed );
+	SpewRecord *pRec;
+	for (;;)
+	{
+		pRec = &s_spewRing[ nPos & ( k_nSpewRingSize-1 ) ];
+		int32 nDiff = (int32)( pRec->m_nSeq.load( std::memory_order_acquire ) - nPos );
+		if ( nDiff == 0 )
+		{
+			if ( s_nSpewRingTail.compare_exchange_weak( nPos, nPos+1, std::memory_order_relaxed ) )
+				break;
+		}
+		else if ( nDiff < 0 )
+		{
+			// Full.  Drop it
+			if ( s_nSpewDropped.fetch_add( 1, std::memory_order_relaxed ) == 0 )
+				s_usecFirstSpewDropped.store( SteamNetworkingSockets_GetLocalTimestamp(), std::memory_order_relaxed );
+			return;
+		}
+		else
+		{
+			nPos = s_nSpewRingTail.load( std::memory_order_relaxed );
+		}
+	}
+
+	// Format directly into the slot.  The consumer won't look at
+	// it until we bump the sequence number.
+	pRec->m_eType = eType;
+	va_list apCopy;
+	va_copy( apCopy, ap );
+	int cchNeeded = vsnprintf( pRec->m_szText, sizeof(pRec->m_szText), pMsg, apCopy );
+	va_end( apCopy );
+	if ( cchNeeded >= (int)sizeof(pRec->m_szText) )
+	{
+		pRec->m_pszLongText = (char *)malloc( cchNeeded+1 );
+		if ( pRec->m_pszLongText )
+		{
+			vsnprintf( pRec->m_pszLongText, cchNeeded+1, pMsg, ap );
+			V_StripTrailingWhitespaceASCII( pRec->m_pszLongText );
+		}
+	}
+	V_StripTrailingWhitespaceASCII( pRec->m_szText );
+
+	// Publish
+	pRec->m_nSeq.store( nPos+1, std::memory_order_release );
+	s_nSpewPublished.fetch_add( 1, std::memory_order_seq_cst );
+
+	// Wake the delivery thread, if it's asleep.  Grab the mutex first, so
+	// we can't sneak in between it checking the counter and waiting.
+	if ( s_bSpewThreadSleeping.load( std::memory_order_seq_cst ) )
+	{
+		{
+			std::lock_guard<std::mutex> lockWake( s_spewThreadWakeMutex );
+		}
+		s_spewThreadWake.notify_one();
+	}
+}
+
+static void DeliverSpewNow( ESteamNetworkingSocketsDebugOutputType eType, const char *pszMsg )
+{
+	FSteamNetworkingSocketsDebugOutput pfnDebugOutput = s_pfnDebugOutput;
+	if ( !pfnDebugOutput )
+		return;
+
+	// If async spew was recently turned off, or the thread hasn't gotten
+	// to everything yet, make sure we don't deliver out of order
+	if ( s_bSpewRingInitted.load( std::memory_order_relaxed ) && !s_bDeliveringSpew )
+		DrainSpewRing();
+
+	pfnDebugOutput( eType, pszMsg );
+}
+
 void ReallySpewType( ESteamNetworkingSocketsDebugOutputType eType, const char *pMsg, ... )
 {
 	// Save callback.  Paranoia for unlikely but possible race condition,
@@ -1683,11 +2731,22 @@ void ReallySpewType( ESteamNetworkingSocketsDebugOutputType eType, const char *p
 	// Filter, just in case.  (We really shouldn't get here, though.)
 	if ( !pfnDebugOutput || eType > g_eSteamDatagramDebugOutputDetailLevel )
 		return;
+
+	va_list ap;
+	va_start( ap, pMsg );
+
+	// Queue it for the spew thread?
+	if ( steamdatagram_log_async )
+	{
+		if ( !s_bWantSpewThreadRunning.load( std::memory_order_relaxed ) )
+			EnsureSpewThreadRunning();
+		QueueSpew( eType, pMsg, ap );
+		va_end( ap );
+		return;
+	}
 	
 	// Do the formatting
 	char buf[ 2048 ];
-	va_list ap;
-	va_start( ap, pMsg );
 	V_vsprintf_safe( buf, pMsg, ap );
 	va_end( ap );
 
@@ -1695,9 +2754,12 @@ void ReallySpewType( ESteamNetworkingSocketsDebugOutputType eType, const char *p
 	V_StripTrailingWhitespaceASCII( buf );
 
 	// Invoke callback
-	pfnDebugOutput( eType, buf );
+	DeliverSpewNow( eType, buf );
 }
 
+
+// Spew from the tier0 spew system (asserts, etc).  This is not a hot path, and
+// the process might be about to go down, so always deliver it synchronously.
 static SpewRetval_t SDRSpewFunc( SpewType_t type, tchar const *pMsg )
 {
 	V_StripTrailingWhitespaceASCII( const_cast<tchar*>( pMsg ) );
@@ -1711,17 +2773,17 @@ static SpewRetval_t SDRSpewFunc( SpewType_t type, tchar const *pMsg )
 			// V
 		case SPEW_MESSAGE:
 			if ( s_pfnDebugOutput && g_eSteamDatagramDebugOutputDetailLevel >= k_ESteamNetworkingSocketsDebugOutputType_Msg )
-				s_pfnDebugOutput( k_ESteamNetworkingSocketsDebugOutputType_Msg, pMsg );
+				DeliverSpewNow( k_ESteamNetworkingSocketsDebugOutputType_Msg, pMsg );
 			break;
 
 		case SPEW_WARNING:
 			if ( s_pfnDebugOutput && g_eSteamDatagramDebugOutputDetailLevel >= k_ESteamNetworkingSocketsDebugOutputType_Warning )
-				s_pfnDebugOutput( k_ESteamNetworkingSocketsDebugOutputType_Warning, pMsg );
+				DeliverSpewNow( k_ESteamNetworkingSocketsDebugOutputType_Warning, pMsg );
 			break;
 
 		case SPEW_ASSERT:
 			if ( s_pfnDebugOutput && g_eSteamDatagramDebugOutputDetailLevel >= k_ESteamNetworkingSocketsDebugOutputType_Error )
-				s_pfnDebugOutput( k_ESteamNetworkingSocketsDebugOutputType_Bug, pMsg );
+				DeliverSpewNow( k_ESteamNetworkingSocketsDebugOutputType_Bug, pMsg );
 
 			// Ug, for some reason this is crashing, because it's trying to generate a breakpoint
 			// even when it's not being run under the debugger.  Probably the best thing to do is just rely
@@ -1731,12 +2793,12 @@ static SpewRetval_t SDRSpewFunc( SpewType_t type, tchar const *pMsg )
 
 		case SPEW_ERROR:
 			if ( s_pfnDebugOutput && g_eSteamDatagramDebugOutputDetailLevel >= k_ESteamNetworkingSocketsDebugOutputType_Error )
-				s_pfnDebugOutput( k_ESteamNetworkingSocketsDebugOutputType_Error, pMsg );
+				DeliverSpewNow( k_ESteamNetworkingSocketsDebugOutputType_Error, pMsg );
 			return SPEW_ABORT;
 
 		case SPEW_BOLD_MESSAGE:
 			if ( s_pfnDebugOutput && g_eSteamDatagramDebugOutputDetailLevel >= k_ESteamNetworkingSocketsDebugOutputType_Important )
-				s_pfnDebugOutput( k_ESteamNetworkingSocketsDebugOutputType_Important, pMsg );
+				DeliverSpewNow( k_ESteamNetworkingSocketsDebugOutputType_Important, pMsg );
 	}
 	
 	return SPEW_CONTINUE;
@@ -1787,6 +2849,12 @@ void SteamNetworkingSocketsKillCommon()
 	// Shutdown the thread
 	StopSteamDatagramThread();
 
+	// Close the packet trace file, if any
+	PacketTrace_Stop();
+
+	// Make sure all spew gets delivered
+	StopSpewThread();
+
 	ProcessPendingDestroyClosedRawUDPSockets();
 	AssertMsg( s_vecRawSockets.IsEmpty(), "SteamDatagramKillCommon() called, but sockets left open!" );
 
@@ -1823,8 +2891,39 @@ STEAMNETWORKINGSOCKETS_INTERFACE void SteamNetworkingSockets_SetDebugOutputFunct
 	}
 }
 
+STEAMNETWORKINGSOCKETS_INTERFACE bool SteamNetworkingSockets_SetAllocator( FSteamNetworkingSocketsAlloc pfnAlloc, FSteamNetworkingSocketsRealloc pfnRealloc, FSteamNetworkingSocketsFree pfnFree )
+{
+	using namespace SteamNetworkingSocketsLib;
+
+	if ( !pfnAlloc != !pfnRealloc || !pfnAlloc != !pfnFree )
+	{
+		AssertMsg( false, "Must set all allocator hooks, or none of them" );
+		return false;
+	}
+
+	// Blocks must be freed by the allocator that allocated them
+	for ( const MetricsGauge_t &n: g_metrics.m_nAllocationsOutstanding )
+	{
+		if ( n.load( std::memory_order_relaxed ) != 0 )
+		{
+			AssertMsg( false, "Can't change allocator hooks while allocations are outstanding.  Set them before initializing the library." );
+			return false;
+		}
+	}
+
+	g_pfnAlloc = pfnAlloc;
+	g_pfnRealloc = pfnRealloc;
+	g_pfnFree = pfnFree;
+	return true;
+}
+
 STEAMNETWORKINGSOCKETS_INTERFACE SteamNetworkingMicroseconds SteamNetworkingSockets_GetLocalTimestamp()
 {
+	// Custom clock?
+	FSteamNetworkingSocketsClock pfnClock = SteamNetworkingSocketsLib::s_pfnClock.load( std::memory_order_acquire );
+	if ( pfnClock )
+		return pfnClock();
+
 	SteamNetworkingMicroseconds usecResult;
 	long long usecLastReturned;
 	for (;;)
@@ -1878,3 +2977,87 @@ STEAMNETWORKINGSOCKETS_INTERFACE SteamNetworkingMicroseconds SteamNetworkingSock
 	return usecResult;
 }
 
+STEAMNETWORKINGSOCKETS_INTERFACE void SteamNetworkingSockets_SetClock( FSteamNetworkingSocketsClock pfnClock )
+{
+	SteamNetworkingSocketsLib::s_pfnClock.store( pfnClock, std::memory_order_release );
+}
+
+STEAMNETWORKINGSOCKETS_INTERFACE int SteamNetworkingSockets_GetProfileReport( char *pszBuf, int cbBuf )
+{
+	return VProf_GetReport( pszBuf, cbBuf );
+}
+
+STEAMNETWORKINGSOCKETS_INTERFACE void SteamNetworkingSockets_ResetProfile()
+{
+	VProf_Reset();
+}
+
+STEAMNETWORKINGSOCKETS_INTERFACE void SteamNetworkingSockets_GetGlobalMetrics( SteamNetworkingGlobalMetrics_t *pMetrics )
+{
+	if ( !pMetrics )
+		return;
+
+	// No lock!  Just read each counter
+	const SteamNetworkingSocketsLib::GlobalMetrics_t &m = SteamNetworkingSocketsLib::g_metrics;
+	const std::memory_order r = std::memory_order_relaxed;
+	pMetrics->m_nUDPSocketsOpen = m.m_nUDPSocketsOpen.load( r );
+	pMetrics->m_nUDPPacketsSent = m.m_nUDPPacketsSent.load( r );
+	pMetrics->m_nUDPBytesSent = m.m_nUDPBytesSent.load( r );
+	pMetrics->m_nUDPPacketsRecv = m.m_nUDPPacketsRecv.load( r );
+	pMetrics->m_nUDPBytesRecv = m.m_nUDPBytesRecv.load( r );
+	for ( int i = 0 ; i < k_ESteamNetworkingBadPacket__Count ; ++i )
+		pMetrics->m_nBadPackets[i] = m.m_nBadPackets[i].load( r );
+	pMetrics->m_nDecryptFailures = m.m_nDecryptFailures.load( r );
+	pMetrics->m_nConnections = m.m_nConnections.load( r );
+	pMetrics->m_nHandshakesStarted = m.m_nHandshakesStarted.load( r );
+	pMetrics->m_nHandshakesCompleted = m.m_nHandshakesCompleted.load( r );
+	pMetrics->m_nHandshakesFailed = m.m_nHandshakesFailed.load( r );
+	pMetrics->m_nThinkersScheduled = m.m_nThinkersScheduled.load( r );
+	for ( int c = 0 ; c < k_ESteamNetworkingLockCaller__Count ; ++c )
+	{
+		pMetrics->m_lock[c].m_nAcquired = m.m_lock[c].m_nAcquired.load( r );
+		for ( int i = 0 ; i < k_nSteamNetworkingMetricsHistogramBuckets ; ++i )
+		{
+			pMetrics->m_lock[c].m_histWaitUsec[i] = m.m_lock[c].m_histWaitUsec[i].load( r );
+			pMetrics->m_lock[c].m_histHoldUsec[i] = m.m_lock[c].m_histHoldUsec[i].load( r );
+		}
+	}
+	pMetrics->m_nMessagesAllocated = m.m_nMessagesAllocated.load( r );
+	pMetrics->m_cbMessagesAllocated = m.m_cbMessagesAllocated.load( r );
+	pMetrics->m_nMessagesOutstanding = m.m_nMessagesOutstanding.load( r );
+	for ( int i = 0 ; i < k_ESteamNetworkingAllocTag__Count ; ++i )
+	{
+		pMetrics->m_nAllocations[i] = m.m_nAllocations[i].load( r );
+		pMetrics->m_nAllocationsOutstanding[i] = m.m_nAllocationsOutstanding[i].load( r );
+	}
+}
+
+STEAMNETWORKINGSOCKETS_INTERFACE bool SteamNetworkingSockets_VirtualNetwork_Enable( SteamNetworkingMicroseconds usecLatency )
+{
+	using namespace SteamNetworkingSocketsLib;
+	SteamDatagramTransportLock scopeLock;
+
+	// Too late if we've already started up with real sockets
+	if ( g_bWantThreadRunning && !s_bVirtualNetwork )
+		return false;
+
+	s_bVirtualNetwork = true;
+	s_usecVirtualLatency = Max( usecLatency, (SteamNetworkingMicroseconds)0 );
+	s_pfnClock.store( VirtualClock, std::memory_order_release );
+	return true;
+}
+
+STEAMNETWORKINGSOCKETS_INTERFACE SteamNetworkingMicroseconds SteamNetworkingSockets_VirtualNetwork_RunFor( SteamNetworkingMicroseconds usecDuration )
+{
+	using namespace SteamNetworkingSocketsLib;
+	SteamDatagramTransportLock scopeLock( k_ESteamNetworkingLockCaller_ServiceThread );
+
+	if ( !s_bVirtualNetwork )
+	{
+		AssertMsg( false, "Virtual network not enabled" );
+		return SteamNetworkingSockets_GetLocalTimestamp();
+	}
+
+	VirtualNetworkRunUntil( s_usecVirtualNow + Max( usecDuration, (SteamNetworkingMicroseconds)0 ) );
+	return s_usecVirtualNow;
+}
@@ -52,6 +52,16 @@ public:
 	}
 };
 
+/// Overrides of the global fake lag settings, for a particular
+/// connection.  Negative lag or jitter, or a distribution of zero,
+/// means "use the global setting".
+struct FakeLagSettings_t
+{
+	int32 m_msLag = -1; // Overrides steamdatagram_fakepacketlag_send
+	int32 m_msJitter = -1; // Overrides steamdatagram_fakepacketjitter_send
+	int32 m_eJitterDistribution = 0; // Overrides steamdatagram_fakepacketjitter_distribution.  (ESteamNetworkingFakePacketJitterDistribution)
+};
+
 /// Interface object for a low-level Berkeley socket.  We always use non-blocking, UDP sockets.
 class IRawUDPSocket
 {
@@ -59,11 +69,18 @@ public:
 	/// A thin wrapper around ::sendto
 	///
 	/// Packets sent through this method are subject to fake loss (steamdatagram_fakepacketloss_send)
-	/// and fake lag (steamdatagram_fakepacketlag_send)
-	bool BSendRawPacket( const void *pPkt, int cbPkt, const netadr_t &adrTo ) const;
+	/// and fake lag (steamdatagram_fakepacketlag_send, steamdatagram_fakepacketjitter_send).
+	/// The lag settings can be overridden for a particular connection.
+	bool BSendRawPacket( const void *pPkt, int cbPkt, const netadr_t &adrTo, const FakeLagSettings_t *pFakeLag = nullptr ) const;
 
 	/// Gather-based send
-	bool BSendRawPacketGather( int nChunks, const iovec *pChunks, const netadr_t &adrTo ) const;
+	bool BSendRawPacketGather( int nChunks, const iovec *pChunks, const netadr_t &adrTo, const FakeLagSettings_t *pFakeLag = nullptr ) const;
+
+	/// Ask the OS to pace packets sent on this socket so that they don't
+	/// leave faster than the specified rate, in bytes/sec.  (SO_MAX_PACING_RATE.
+	/// Only enforced if the interface is using the fq qdisc.)  Returns false
+	/// if this isn't supported on this platform or socket.
+	bool BSetMaxPacingRate( int nBytesPerSec ) const;
 
 	/// Logically close the socket.  This might not actually close the socket IMMEDIATELY,
 	/// there may be a slight delay.  (On the order of a few milliseconds.)  But you will not
@@ -113,15 +130,15 @@ class IBoundUDPSocket
 public:
 
 	/// Send a packet on this socket to the bound remote host
-	inline bool BSendRawPacket( const void *pPkt, int cbPkt ) const
+	inline bool BSendRawPacket( const void *pPkt, int cbPkt, const FakeLagSettings_t *pFakeLag = nullptr ) const
 	{
-		return m_pRawSock->BSendRawPacket( pPkt, cbPkt, m_adr );
+		return m_pRawSock->BSendRawPacket( pPkt, cbPkt, m_adr, pFakeLag );
 	}
 
 	/// Gather-based send to the bound remote host
-	inline bool BSendRawPacketGather( int nChunks, const iovec *pChunks ) const
+	inline bool BSendRawPacketGather( int nChunks, const iovec *pChunks, const FakeLagSettings_t *pFakeLag = nullptr ) const
 	{
-		return m_pRawSock->BSendRawPacketGather( nChunks, pChunks, m_adr );
+		return m_pRawSock->BSendRawPacketGather( nChunks, pChunks, m_adr, pFakeLag );
 	}
 
 	/// Close this socket and stop talking to the specified remote host
@@ -133,6 +150,15 @@ public:
 	/// Access the underlying socket we are using (which might be shared)
 	IRawUDPSocket *GetRawSock() const { return m_pRawSock; }
 
+	/// Ask the OS to pace packets sent to the remote host.  This is only
+	/// possible if we have the underlying socket to ourselves, since the
+	/// limit applies to the whole socket.  See IRawUDPSocket::BSetMaxPacingRate
+	virtual bool BSetMaxPacingRate( int nBytesPerSec ) const { return false; }
+
+	/// Approximate heap memory used by this object, and anything it owns
+	/// that isn't shared with other connections.  For memory accounting
+	virtual int GetMemoryUsage() const = 0;
+
 protected:
 	inline IBoundUDPSocket( IRawUDPSocket *pRawSock, const netadr_t &adr ) : m_adr( adr ), m_pRawSock( pRawSock ) {}
 	inline ~IBoundUDPSocket() {}
@@ -204,6 +230,7 @@ private:
 		CRecvPacketCallback m_callback;
 		CSharedSocket *m_pOwner;
 		virtual void Close() OVERRIDE;
+		virtual int GetMemoryUsage() const OVERRIDE;
 	};
 	friend class RemoteHost;
 
@@ -313,6 +340,16 @@ extern void CallDatagramThreadProc();
 /// This is when: 1.) We own the lock and 2.) we aren't polling in the service thread.
 extern void ProcessPendingDestroyClosedRawUDPSockets();
 
+/// Restart the random number sequence used by the fake network conditions
+/// (using steamdatagram_fakenetwork_seed), and reset the state of the fake
+/// bottleneck link and burst loss.  Lock must be held.
+extern void ResetFakeNetworkConditions();
+
+/// Random number in [flMin,flMax), drawn from the fake network conditions
+/// sequence.  Use this for anything that simulates bad network conditions,
+/// so that the results are reproducible when a seed is set.
+extern float FakeNetworkRandomFloat( float flMin, float flMax );
+
 /// Last time that we spewed something that was subject to rate limit 
 extern SteamNetworkingMicroseconds g_usecLastRateLimitSpew;
 
@@ -353,11 +390,12 @@ extern void SteamNetworkingSocketsKillCommon();
 /// there will be very little contention and the should be held only for a short amount of time.
 struct SteamDatagramTransportLock
 {
-	inline SteamDatagramTransportLock() { Lock(); }
+	/// The caller is only used to attribute lock contention in the global metrics
+	inline SteamDatagramTransportLock( ESteamNetworkingLockCaller eCaller = k_ESteamNetworkingLockCaller_Other ) { Lock( eCaller ); }
 	inline ~SteamDatagramTransportLock() { Unlock(); }
-	static void Lock();
+	static void Lock( ESteamNetworkingLockCaller eCaller = k_ESteamNetworkingLockCaller_Other );
 	static void Unlock();
-	static void OnLocked();
+	static void OnLocked( ESteamNetworkingLockCaller eCaller, SteamNetworkingMicroseconds usecWait );
 	static void AssertHeldByCurrentThread();
 	static volatile int s_nLocked;
 };
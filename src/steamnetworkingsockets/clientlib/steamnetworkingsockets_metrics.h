@@ -0,0 +1,91 @@
+//====== Copyright Valve Corporation, All rights reserved. ====================
+//
+// Process-wide counters, returned by SteamNetworkingSockets_GetGlobalMetrics.
+// These are updated from the hot paths, so they are just relaxed atomics,
+// and can be read without holding the global lock.
+//
+//=============================================================================
+
+#ifndef STEAMNETWORKINGSOCKETS_METRICS_H
+#define STEAMNETWORKINGSOCKETS_METRICS_H
+#pragma once
+
+#include <atomic>
+#include <steam/steamnetworkingtypes.h>
+
+namespace SteamNetworkingSocketsLib {
+
+typedef std::atomic<int64> MetricsCounter_t;
+typedef std::atomic<int> MetricsGauge_t;
+
+struct LockMetrics_t
+{
+	MetricsCounter_t m_nAcquired;
+	MetricsCounter_t m_histWaitUsec[ k_nSteamNetworkingMetricsHistogramBuckets ];
+	MetricsCounter_t m_histHoldUsec[ k_nSteamNetworkingMetricsHistogramBuckets ];
+};
+
+struct GlobalMetrics_t
+{
+	MetricsGauge_t m_nUDPSocketsOpen;
+	MetricsCounter_t m_nUDPPacketsSent;
+	MetricsCounter_t m_nUDPBytesSent;
+	MetricsCounter_t m_nUDPPacketsRecv;
+	MetricsCounter_t m_nUDPBytesRecv;
+	MetricsCounter_t m_nBadPackets[ k_ESteamNetworkingBadPacket__Count ];
+	MetricsCounter_t m_nDecryptFailures;
+	MetricsGauge_t m_nConnections;
+	MetricsCounter_t m_nHandshakesStarted;
+	MetricsCounter_t m_nHandshakesCompleted;
+	MetricsCounter_t m_nHandshakesFailed;
+	MetricsGauge_t m_nThinkersScheduled;
+	LockMetrics_t m_lock[ k_ESteamNetworkingLockCaller__Count ];
+	MetricsCounter_t m_nMessagesAllocated;
+	MetricsCounter_t m_cbMessagesAllocated;
+	MetricsGauge_t m_nMessagesOutstanding;
+	MetricsCounter_t m_nAllocations[ k_ESteamNetworkingAllocTag__Count ];
+	MetricsGauge_t m_nAllocationsOutstanding[ k_ESteamNetworkingAllocTag__Count ];
+};
+
+/// Zero initialized, since it has static storage duration
+extern GlobalMetrics_t g_metrics;
+
+template <typename T, typename N>
+inline void MetricsAdd( std::atomic<T> &x, N n )
+{
+	x.fetch_add( T( n ), std::memory_order_relaxed );
+}
+
+template <typename T>
+inline void MetricsIncrement( std::atomic<T> &x )
+{
+	x.fetch_add( 1, std::memory_order_relaxed );
+}
+
+template <typename T>
+inline void MetricsDecrement( std::atomic<T> &x )
+{
+	x.fetch_sub( 1, std::memory_order_relaxed );
+}
+
+template <typename T, typename N>
+inline void MetricsSet( std::atomic<T> &x, N n )
+{
+	x.store( T( n ), std::memory_order_relaxed );
+}
+
+/// Add a sample to a log2 timing histogram.  See k_nSteamNetworkingMetricsHistogramBuckets
+inline void MetricsHistogramAdd( MetricsCounter_t *pHist, SteamNetworkingMicroseconds usec )
+{
+	int nBucket = 0;
+	while ( usec > 0 && nBucket < k_nSteamNetworkingMetricsHistogramBuckets-1 )
+	{
+		++nBucket;
+		usec >>= 1;
+	}
+	MetricsIncrement( pHist[ nBucket ] );
+}
+
+} // namespace SteamNetworkingSocketsLib
+
+#endif // STEAMNETWORKINGSOCKETS_METRICS_H
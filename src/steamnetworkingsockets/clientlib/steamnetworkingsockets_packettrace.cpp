@@ -0,0 +1,145 @@
+//====== Copyright Valve Corporation, All rights reserved. ====================
+//
+// Binary packet trace.  See steamnetworkingsockets_packettrace.h
+//
+//=============================================================================
+
+#ifdef _WIN32
+	#include "winlite.h"
+#else
+	#include <sys/mman.h>
+	#include <sys/types.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <errno.h>
+#endif
+
+#include "steamnetworkingsockets_lowlevel.h"
+#include "steamnetworkingsockets_packettrace.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+namespace SteamNetworkingSocketsLib {
+
+PacketTrace_t *g_pPacketTrace = nullptr;
+
+// The trace currently open.  (Only one at a time.)
+static PacketTrace_t s_packetTrace;
+static size_t s_cbPacketTraceFile;
+#ifdef _WIN32
+	static HANDLE s_hPacketTraceFile = INVALID_HANDLE_VALUE;
+	static HANDLE s_hPacketTraceMapping = NULL;
+#endif
+
+bool PacketTrace_Start( const char *pszFilename, int nMaxEvents, HSteamNetConnection hConnFilter )
+{
+	SteamDatagramTransportLock::AssertHeldByCurrentThread();
+
+	PacketTrace_Stop();
+	if ( !pszFilename || !*pszFilename || nMaxEvents <= 0 )
+		return false;
+
+	size_t cbFile = sizeof(PacketTraceFileHeader_t) + size_t( nMaxEvents ) * sizeof(PacketTraceEvent_t);
+	void *pMem;
+
+	#ifdef _WIN32
+		HANDLE hFile = ::CreateFileA( pszFilename, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL );
+		if ( hFile == INVALID_HANDLE_VALUE )
+		{
+			SpewWarning( "Can't create packet trace file '%s'.  Error code 0x%08x\n", pszFilename, ::GetLastError() );
+			return false;
+		}
+		HANDLE hMapping = ::CreateFileMappingA( hFile, NULL, PAGE_READWRITE, DWORD( uint64( cbFile ) >> 32 ), DWORD( cbFile ), NULL );
+		pMem = hMapping ? ::MapViewOfFile( hMapping, FILE_MAP_WRITE, 0, 0, cbFile ) : nullptr;
+		if ( !pMem )
+		{
+			SpewWarning( "Can't map packet trace file '%s'.  Error code 0x%08x\n", pszFilename, ::GetLastError() );
+			if ( hMapping )
+				::CloseHandle( hMapping );
+			::CloseHandle( hFile );
+			return false;
+		}
+		s_hPacketTraceFile = hFile;
+		s_hPacketTraceMapping = hMapping;
+	#else
+		int fd = ::open( pszFilename, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+		if ( fd < 0 )
+		{
+			SpewWarning( "Can't create packet trace file '%s'.  Error %d\n", pszFilename, errno );
+			return false;
+		}
+		if ( ::ftruncate( fd, (off_t)cbFile ) != 0 )
+		{
+			SpewWarning( "Can't size packet trace file '%s' to %llu bytes.  Error %d\n", pszFilename, (unsigned long long)cbFile, errno );
+			::close( fd );
+			return false;
+		}
+		pMem = ::mmap( nullptr, cbFile, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+		::close( fd ); // The mapping keeps the file open
+		if ( pMem == MAP_FAILED )
+		{
+			SpewWarning( "Can't map packet trace file '%s'.  Error %d\n", pszFilename, errno );
+			return false;
+		}
+	#endif
+
+	s_cbPacketTraceFile = cbFile;
+	s_packetTrace.m_pHeader = (PacketTraceFileHeader_t *)pMem;
+	s_packetTrace.m_pEvents = (PacketTraceEvent_t *)( s_packetTrace.m_pHeader + 1 );
+	s_packetTrace.m_nCapacity = (uint64)nMaxEvents;
+	s_packetTrace.m_hConnFilter = hConnFilter;
+
+	PacketTraceFileHeader_t &hdr = *s_packetTrace.m_pHeader;
+	memset( &hdr, 0, sizeof(hdr) );
+	memcpy( hdr.m_szMagic, PACKETTRACE_FILE_MAGIC, sizeof(hdr.m_szMagic) );
+	hdr.m_nVersion = k_nPacketTraceFileVersion;
+	hdr.m_cbEvent = sizeof(PacketTraceEvent_t);
+	hdr.m_nCapacity = s_packetTrace.m_nCapacity;
+	hdr.m_nEventsWritten = 0;
+	hdr.m_usecStart = SteamNetworkingSockets_GetLocalTimestamp();
+	hdr.m_hConnFilter = hConnFilter;
+
+	g_pPacketTrace = &s_packetTrace;
+	SpewMsg( "Packet trace to '%s', %d events (%llu bytes)\n", pszFilename, nMaxEvents, (unsigned long long)cbFile );
+	return true;
+}
+
+void PacketTrace_Stop()
+{
+	SteamDatagramTransportLock::AssertHeldByCurrentThread();
+
+	if ( !g_pPacketTrace )
+		return;
+	g_pPacketTrace = nullptr;
+
+	#ifdef _WIN32
+		::FlushViewOfFile( s_packetTrace.m_pHeader, s_cbPacketTraceFile );
+		::UnmapViewOfFile( s_packetTrace.m_pHeader );
+		::CloseHandle( s_hPacketTraceMapping );
+		::CloseHandle( s_hPacketTraceFile );
+		s_hPacketTraceMapping = NULL;
+		s_hPacketTraceFile = INVALID_HANDLE_VALUE;
+	#else
+		::munmap( s_packetTrace.m_pHeader, s_cbPacketTraceFile );
+	#endif
+
+	memset( &s_packetTrace, 0, sizeof(s_packetTrace) );
+	s_cbPacketTraceFile = 0;
+}
+
+} // namespace SteamNetworkingSocketsLib
+
+using namespace SteamNetworkingSocketsLib;
+
+STEAMNETWORKINGSOCKETS_INTERFACE bool SteamNetworkingSockets_StartPacketTrace( const char *pszFilename, int nMaxEvents, HSteamNetConnection hConnFilter )
+{
+	SteamDatagramTransportLock scopeLock;
+	return PacketTrace_Start( pszFilename, nMaxEvents, hConnFilter );
+}
+
+STEAMNETWORKINGSOCKETS_INTERFACE void SteamNetworkingSockets_StopPacketTrace()
+{
+	SteamDatagramTransportLock scopeLock;
+	PacketTrace_Stop();
+}
@@ -0,0 +1,157 @@
+//====== Copyright Valve Corporation, All rights reserved. ====================
+//
+// Binary packet trace.  A structured, low overhead alternative to
+// steamdatagram_snp_log_packet spew.  Fixed size events are written into a
+// ring stored in a memory mapped file, which can be decoded offline with
+// tests/trace_decode.cpp.
+//
+// This header is also included by the decoder, so the file format part of
+// it must not depend on anything but the public types.
+//
+//=============================================================================
+
+#ifndef STEAMNETWORKINGSOCKETS_PACKETTRACE_H
+#define STEAMNETWORKINGSOCKETS_PACKETTRACE_H
+#pragma once
+
+#include <steam/steamnetworkingtypes.h>
+
+namespace SteamNetworkingSocketsLib {
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// File format
+//
+/////////////////////////////////////////////////////////////////////////////
+
+const uint32 k_nPacketTraceFileVersion = 1;
+#define PACKETTRACE_FILE_MAGIC "GNSTRACE"
+
+/// Event types
+enum EPacketTraceEvent
+{
+	/// SNP_SendPacket encoded and sent a data packet.  m_cbSize is the
+	/// encrypted size.  If acks were serialized into the packet,
+	/// m_nAckBlocks is the number of ack blocks we wanted to send and
+	/// m_nAckPktNum is the latest packet number we had received.
+	/// Otherwise m_nAckBlocks is -1.
+	k_EPacketTraceEvent_SNPSend = 1,
+
+	/// SNP_RecvDataChunk decoded a data packet.  m_cbSize is the size of the
+	/// whole packet.  If the packet contained an ack, m_nAckBlocks and
+	/// m_nAckPktNum describe it (otherwise m_nAckBlocks is -1), and
+	/// m_usecRTT is the RTT sample we took from it, if any.
+	k_EPacketTraceEvent_SNPRecv = 2,
+
+	/// We decided a packet we sent was lost.  (Nacked, or timed out.)
+	k_EPacketTraceEvent_SNPLoss = 3,
+
+	/// Raw UDP packet sent or received.  These are not associated with a
+	/// connection, and are only recorded if the trace is not filtered.
+	/// m_nRemotePort is the remote port.
+	k_EPacketTraceEvent_RawSend = 4,
+	k_EPacketTraceEvent_RawRecv = 5,
+};
+
+/// A single trace event.  Fields that don't apply to the event type are zero.
+struct PacketTraceEvent_t
+{
+	SteamNetworkingMicroseconds m_usecTime;
+	int64 m_nPktNum;
+	int64 m_nAckPktNum;
+	uint32 m_hConn;			// HSteamNetConnection
+	uint8 m_eType;			// EPacketTraceEvent
+	uint8 m_nSegments;		// Number of message segments (reliable and unreliable) in the packet
+	uint16 m_cbSize;
+	int16 m_nAckBlocks;
+	uint16 m_nRemotePort;
+	int32 m_usecRTT;
+	int32 m_nTokenBucket;	// Sender token bucket, in bytes
+	int32 m_nSendRate;		// Current send rate, bytes/sec
+};
+COMPILE_TIME_ASSERT( sizeof( PacketTraceEvent_t ) == 48 );
+
+/// Header at the start of the trace file.  The events follow immediately.
+/// Event N (counting from the start of the trace) is stored in slot
+/// N % m_nCapacity, so once the ring has wrapped, the oldest event
+/// present is m_nEventsWritten - m_nCapacity.
+struct PacketTraceFileHeader_t
+{
+	char m_szMagic[8];
+	uint32 m_nVersion;
+	uint32 m_cbEvent;
+	uint64 m_nCapacity;
+	uint64 m_nEventsWritten;
+	SteamNetworkingMicroseconds m_usecStart;
+	uint32 m_hConnFilter;	// 0 if all connections were traced
+	uint8 m_pad[20];
+};
+COMPILE_TIME_ASSERT( sizeof( PacketTraceFileHeader_t ) == 64 );
+
+#ifndef PACKETTRACE_FORMAT_ONLY
+} // namespace SteamNetworkingSocketsLib
+
+#include <string.h>
+#include <steam/isteamnetworkingutils.h>
+
+namespace SteamNetworkingSocketsLib {
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Recording.  All of this happens while holding the global lock.
+//
+/////////////////////////////////////////////////////////////////////////////
+
+struct PacketTrace_t
+{
+	PacketTraceFileHeader_t *m_pHeader;
+	PacketTraceEvent_t *m_pEvents;
+	uint64 m_nCapacity;
+	HSteamNetConnection m_hConnFilter;
+};
+
+/// Active trace, or null if we aren't tracing.  Check this before doing any
+/// work to gather up the event data.
+extern PacketTrace_t *g_pPacketTrace;
+
+/// Should we record events for the specified connection?
+inline bool BPacketTraceEnabled( HSteamNetConnection hConn )
+{
+	return g_pPacketTrace && ( g_pPacketTrace->m_hConnFilter == 0 || g_pPacketTrace->m_hConnFilter == hConn );
+}
+
+/// Claim the next slot and fill in the common fields.  Only call this if
+/// BPacketTraceEnabled returned true.  The other fields are cleared
+inline PacketTraceEvent_t &PacketTraceBeginEvent( EPacketTraceEvent eType, HSteamNetConnection hConn, SteamNetworkingMicroseconds usecNow )
+{
+	PacketTrace_t &trace = *g_pPacketTrace;
+	uint64 nEvent = trace.m_pHeader->m_nEventsWritten++;
+	PacketTraceEvent_t &e = trace.m_pEvents[ nEvent % trace.m_nCapacity ];
+	memset( &e, 0, sizeof(e) );
+	e.m_usecTime = usecNow;
+	e.m_hConn = hConn;
+	e.m_eType = (uint8)eType;
+	return e;
+}
+
+/// Record a raw socket event
+inline void PacketTraceRawPacket( EPacketTraceEvent eType, int cbPkt, uint16 nRemotePort )
+{
+	if ( !BPacketTraceEnabled( 0 ) )
+		return;
+	PacketTraceEvent_t &e = PacketTraceBeginEvent( eType, 0, SteamNetworkingSockets_GetLocalTimestamp() );
+	e.m_cbSize = (uint16)cbPkt;
+	e.m_nRemotePort = nRemotePort;
+}
+
+/// Start tracing to the specified file.  Any existing trace is stopped first.
+extern bool PacketTrace_Start( const char *pszFilename, int nMaxEvents, HSteamNetConnection hConnFilter );
+
+/// Stop tracing and close the file.
+extern void PacketTrace_Stop();
+
+#endif // #ifndef PACKETTRACE_FORMAT_ONLY
+
+} // namespace SteamNetworkingSocketsLib
+
+#endif // STEAMNETWORKINGSOCKETS_PACKETTRACE_H
@@ -3,6 +3,8 @@
 #include "steamnetworkingsockets_snp.h"
 #include "steamnetworkingsockets_connections.h"
 #include "crypto.h"
+#include <tier0/vprof.h>
+#include "steamnetworkingsockets_packettrace.h"
 
 #ifndef STEAMNETWORKINGSOCKETS_OPENSOURCE
 // FIXME For P2P stats stuff
@@ -22,8 +24,9 @@
 constexpr int k_nAckDelayPrecisionShift = 5;
 constexpr SteamNetworkingMicroseconds k_usecAckDelayPrecision = (1 << k_nAckDelayPrecisionShift );
 
-// When a receiver detects a dropped packet, schedule sending of ACKs on this interval
-constexpr SteamNetworkingMicroseconds k_usecNackFlush = 10*1000;
+// Limits on the ack frequency we will ask our peer to use
+constexpr int k_nMaxAckPacketTolerance = 255;
+constexpr SteamNetworkingMicroseconds k_usecMinAckDelay = 1000;
 
 // Max size of a message that we are wiling to *receive*.
 constexpr int k_cbMaxMessageSizeRecv = k_cbMaxSteamNetworkingSocketsMessageSizeSend*2;
@@ -35,18 +38,21 @@ constexpr int k_cbMaxBufferedReceiveReliableData = k_cbMaxMessageSizeRecv + 64*1
 constexpr int k_nMaxReliableStreamGaps_Extend = 30; // Discard reliable data past the end of the stream, if it would cause us to get too many gaps
 constexpr int k_nMaxReliableStreamGaps_Fragment = 20; // Discard reliable data that is filling in the middle of a hole, if it would cause the number of gaps to exceed this number
 constexpr int k_nMaxPacketGaps = 62; // Don't bother tracking more than N gaps.  Instead, we will end up NACKing some packets that we actually did receive.  This should not break the protocol, but it protects us from malicious sender
-
-// Hang on to at most N unreliable segments.  When packets are dropping
-// and unreliable messages being fragmented, we will accumulate old pieces
-// of unreliable messages that we retain in hopes that we will get the
-// missing piece and reassemble the whole message.  At a certain point we
-// must give up and discard them.  We use a simple strategy of just limiting
-// the max total number.  In reality large unreliable messages are just a very bad
+constexpr int k_cbSNPMaxReliableMsgHeader = 1 + 1 + 10 + 10; // Stream chunk marker, header byte, message number offset varint, size varint
+constexpr int k_nMaxUnorderedMsgsPending = 256; // Max number of out-of-order reliable messages we will track per lane.  Beyond this, they are delivered in order
+constexpr int k_cbSNPMinRecvRingBuffer = 4*1024; // Initial size of the reliable receive buffer
+constexpr int k_cbSNPMaxIdleRecvRingBuffer = 64*1024; // Free the reliable receive buffer when it empties, if it has grown bigger than this
+
+// When packets are dropping and unreliable messages being fragmented, we will
+// accumulate partial unreliable messages that we retain in hopes that we will
+// get the missing pieces and reassemble the whole message.  At a certain point
+// we must give up and discard them.  We hold at most k_nMaxUnreliableReassemblyMsgs
+// partial messages, and expire them after k_usecUnreliableReassemblyTimeout.
+// In reality large unreliable messages are just a very bad
 // idea, since the odds of the message dropping increase exponentially with the
 // number of packets.  With 20 packets, even 1% packet loss becomes ~80% message
 // loss.  (Assuming naive fragmentation and reassembly and no forward
 // error correction.)
-constexpr int k_nMaxBufferedUnreliableSegments = 20;
 
 // If app tries to send a message larger than N bytes unreliably,
 // complain about it, and automatically convert to reliable.
@@ -100,23 +106,6 @@ template< typename T > T tfrc_ewma( T avg, T newval, T weight )
 	return avg ? ( weight * avg + ( 10 - weight ) * newval ) / 10 : newval;
 }
 
-int TFRCCalcX( int s, SteamNetworkingMicroseconds rtt, float p )
-{
-	// TFRC throughput equation
-	// 
-	//                                s
-	//   X_Bps = ----------------------------------------------------------
-	//           R*sqrt(2*b*p/3) + (t_RTO * (3*sqrt(3*b*p/8)*p*(1+32*p^2)))
-	//
-	// b is TCP acknowlege packet rate, assumed to be 1 for this implementation
-
-	float R = (double)rtt / k_nMillion;
-	float t_RTO = MAX( 4 * R, 1.0f );
-
-	return static_cast< int >( static_cast<float>( s ) /
-		( R * sqrt( 2 * p / 3 ) + ( t_RTO * ( 3 * sqrt( 3 * p / 8 ) * p * ( 1 + 32 * ( p * p ) ) ) ) ) );
-}
-
 // Fetch ping, and handle two edge cases:
 // - if we don't have an estimate, just be relatively conservative
 // - clamp to minimum
@@ -148,7 +137,102 @@ static int GetInitialRate( SteamNetworkingMicroseconds usecPing )
 }
 
 //-----------------------------------------------------------------------------
-void SSNPSenderState::RemoveAckedReliableMessageFromUnackedList()
+void CSNPRecvRingBuffer::resize( int cbNewSize )
+{
+	Assert( cbNewSize >= 0 );
+	Assert( cbNewSize <= k_cbMaxBufferedReceiveReliableData + k_cbSNPMaxReliableMsgHeader );
+	if ( cbNewSize > m_cbCapacity )
+	{
+		int cbNewCapacity = std::max( m_cbCapacity, k_cbSNPMinRecvRingBuffer );
+		while ( cbNewCapacity < cbNewSize )
+			cbNewCapacity <<= 1;
+
+		// Move existing data to the front of the new buffer
+		uint8 *pNewBuf = (uint8 *)TaggedMalloc( cbNewCapacity, k_ESteamNetworkingAllocTag_SNP );
+		const uint8 *p1, *p2; int cb1, cb2;
+		GetSpans( 0, m_cbSize, p1, cb1, p2, cb2 );
+		if ( cb1 > 0 )
+			memcpy( pNewBuf, p1, cb1 );
+		if ( cb2 > 0 )
+			memcpy( pNewBuf + cb1, p2, cb2 );
+		TaggedFree( m_pBuf, k_ESteamNetworkingAllocTag_SNP );
+		m_pBuf = pNewBuf;
+		m_cbCapacity = cbNewCapacity;
+		m_nHead = 0;
+	}
+	m_cbSize = cbNewSize;
+}
+
+void CSNPRecvRingBuffer::Write( int nOffset, const void *pData, int cbData )
+{
+	Assert( nOffset >= 0 && cbData >= 0 && nOffset + cbData <= m_cbSize );
+	if ( cbData <= 0 )
+		return;
+	int idx = ( m_nHead + nOffset ) & ( m_cbCapacity-1 );
+	int cb1 = std::min( cbData, m_cbCapacity - idx );
+	memcpy( m_pBuf + idx, pData, cb1 );
+	if ( cb1 < cbData )
+		memcpy( m_pBuf, (const uint8 *)pData + cb1, cbData - cb1 );
+}
+
+void CSNPRecvRingBuffer::PopFront( int cbData )
+{
+	Assert( cbData >= 0 && cbData <= m_cbSize );
+	m_cbSize -= cbData;
+	if ( m_cbSize == 0 )
+	{
+		m_nHead = 0;
+
+		// If a burst of loss made us grow a big buffer, don't hang onto it
+		if ( m_cbCapacity > k_cbSNPMaxIdleRecvRingBuffer )
+		{
+			TaggedFree( m_pBuf, k_ESteamNetworkingAllocTag_SNP );
+			m_pBuf = nullptr;
+			m_cbCapacity = 0;
+		}
+	}
+	else
+	{
+		m_nHead = ( m_nHead + cbData ) & ( m_cbCapacity-1 );
+	}
+}
+
+void CSNPRecvRingBuffer::GetSpans( int nOffset, int cbData, const uint8 *&p1, int &cb1, const uint8 *&p2, int &cb2 ) const
+{
+	Assert( nOffset >= 0 && cbData >= 0 && nOffset + cbData <= m_cbSize );
+	int idx = m_cbCapacity > 0 ? ( m_nHead + nOffset ) & ( m_cbCapacity-1 ) : 0;
+	p1 = m_pBuf + idx;
+	cb1 = std::min( cbData, m_cbCapacity - idx );
+	p2 = m_pBuf;
+	cb2 = cbData - cb1;
+}
+
+//-----------------------------------------------------------------------------
+void SSNPRecvUnreliableMsg::Reset()
+{
+	if ( m_pMsg )
+	{
+		m_pMsg->Release();
+		m_pMsg = nullptr;
+	}
+	m_nMsgNum = 0;
+	m_cbTotal = -1;
+	m_nRanges = 0;
+}
+
+//-----------------------------------------------------------------------------
+SSNPReceiverState::~SSNPReceiverState()
+{
+	if ( m_pUnreliableReassembly )
+	{
+		for ( int i = 0 ; i < k_nMaxUnreliableReassemblyMsgs ; ++i )
+			m_pUnreliableReassembly[i].Reset();
+		delete [] m_pUnreliableReassembly;
+	}
+}
+
+//-----------------------------------------------------------------------------
+void SSNPSendLane::RemoveAckedReliableMessageFromUnackedList()
 {
 
 	// Trim messages from the head that have been acked.
@@ -195,11 +279,175 @@ void SSNPSenderState::RemoveAckedReliableMessageFromUnackedList()
 	}
 }
 
+//-----------------------------------------------------------------------------
+int SSNPSenderState::ChooseLaneToRetry() const
+{
+	int idxBest = -1;
+	for ( int idx = 0 ; idx < len( m_vecLanes ) ; ++idx )
+	{
+		const SSNPSendLane &lane = m_vecLanes[ idx ];
+		if ( !lane.m_listReadyRetryReliableRange.empty() && ( idxBest < 0 || lane.m_nPriority < m_vecLanes[ idxBest ].m_nPriority ) )
+			idxBest = idx;
+	}
+	return idxBest;
+}
+
+//-----------------------------------------------------------------------------
+int SSNPSenderState::ChooseLaneToSend() const
+{
+	// Fast path for the common case of a single lane
+	if ( m_vecLanes.size() == 1 )
+		return m_vecLanes[0].m_messagesQueued.empty() ? -1 : 0;
+
+	// Strict priority between priority classes.  Within the same class,
+	// weighted fair queueing: take the lane that is furthest behind.
+	int idxBest = -1;
+	for ( int idx = 0 ; idx < len( m_vecLanes ) ; ++idx )
+	{
+		const SSNPSendLane &lane = m_vecLanes[ idx ];
+		if ( lane.m_messagesQueued.empty() )
+			continue;
+		if ( idxBest >= 0 )
+		{
+			const SSNPSendLane &best = m_vecLanes[ idxBest ];
+			if ( lane.m_nPriority > best.m_nPriority )
+				continue;
+			if ( lane.m_nPriority == best.m_nPriority && lane.m_nVirtualTime >= best.m_nVirtualTime )
+				continue;
+		}
+		idxBest = idx;
+	}
+	return idxBest;
+}
+
+/// Serialize the header for a reliable message into hdr, which must have
+/// room for 32 bytes.  A chunk of a larger stream is marked with a prefix
+/// byte.  Returns the size of the header.
+static int SerializeReliableMsgHeader( byte *hdr, const SNPSendMessage_t *pMsg, int64 nLastSendMsgNumReliable, bool bStreamChunk, int cbData )
+{
+	byte *pHdrByte = hdr;
+	if ( bStreamChunk )
+	{
+		Assert( !pMsg->m_bUnordered );
+		*(pHdrByte++) = 0xc0;
+	}
+	*pHdrByte = 0;
+	byte *hdrEnd = pHdrByte+1;
+	if ( pMsg->m_bUnordered )
+	{
+		// The receiver might not know the previous message number,
+		// so always send the full message number
+		hdrEnd = SerializeVarInt( hdrEnd, (uint64)pMsg->m_nMsgNum );
+		*pHdrByte |= 0x80;
+	}
+	else
+	{
+		int64 nMsgNumGap = pMsg->m_nMsgNum - nLastSendMsgNumReliable;
+		Assert( nMsgNumGap >= 1 );
+		if ( nMsgNumGap > 1 )
+		{
+			hdrEnd = SerializeVarInt( hdrEnd, (uint64)nMsgNumGap );
+			*pHdrByte |= 0x40;
+		}
+	}
+	if ( cbData < 0x20 )
+	{
+		*pHdrByte |= (byte)cbData;
+	}
+	else
+	{
+		*pHdrByte |= (byte)( 0x20 | ( cbData & 0x1f ) );
+		hdrEnd = SerializeVarInt( hdrEnd, cbData>>5U );
+	}
+	return hdrEnd - hdr;
+}
+
+/// Messages that asked to be delivered out of order, but were queued
+/// before we knew the peer's protocol version, were encoded as ordinary
+/// reliable messages.  Now that we know the peer can handle them, encode
+/// them again.  Nothing has been put on the wire yet, so we can just
+/// rebuild the reliable stream for the lane from the beginning.  Returns
+/// the change in the number of reliable bytes pending.
+static int ReencodeQueuedUnorderedMessages( SSNPSendLane &lane )
+{
+	Assert( lane.m_unackedReliableMessages.empty() );
+	Assert( lane.m_cbCurrentSendMessageSent == 0 );
+
+	bool bAny = false;
+	for ( SNPSendMessage_t *pMsg = lane.m_messagesQueued.m_pFirst ; pMsg ; pMsg = pMsg->m_pNext )
+		bAny = bAny || ( pMsg->m_bWantUnordered && !pMsg->m_bUnordered );
+	if ( !bAny )
+		return 0;
+
+	int cbDelta = 0;
+	int64 nReliableStreamPos = 1;
+	int64 nLastSendMsgNumReliable = 0;
+	for ( SNPSendMessage_t *pMsg = lane.m_messagesQueued.m_pFirst ; pMsg ; pMsg = pMsg->m_pNext )
+	{
+		if ( pMsg->m_nReliableStreamPos == 0 )
+			continue;
+
+		const bool bStreamChunk = pMsg->m_pData[0] == 0xc0;
+		const int cbData = pMsg->m_cbSize - pMsg->m_cbReliableHdr;
+		pMsg->m_bUnordered = pMsg->m_bWantUnordered;
+		byte hdr[ 32 ];
+		int cbHdr = SerializeReliableMsgHeader( hdr, pMsg, nLastSendMsgNumReliable, bStreamChunk, cbData );
+		if ( cbHdr != pMsg->m_cbReliableHdr )
+		{
+			uint8 *pNewData = (uint8 *)TaggedMalloc( cbHdr+cbData, k_ESteamNetworkingAllocTag_SendQueue );
+			memcpy( pNewData+cbHdr, pMsg->m_pData+pMsg->m_cbReliableHdr, cbData );
+			TaggedFree( pMsg->m_pData, k_ESteamNetworkingAllocTag_SendQueue );
+			pMsg->m_pData = pNewData;
+			cbDelta += cbHdr - pMsg->m_cbReliableHdr;
+			pMsg->m_cbSize = cbHdr+cbData;
+			pMsg->m_cbReliableHdr = (uint8)cbHdr;
+		}
+		memcpy( pMsg->m_pData, hdr, cbHdr );
+
+		pMsg->m_nReliableStreamPos = nReliableStreamPos;
+		nReliableStreamPos += pMsg->m_cbSize;
+		nLastSendMsgNumReliable = pMsg->m_nMsgNum;
+	}
+	lane.m_nReliableStreamPos = nReliableStreamPos;
+	lane.m_nLastSendMsgNumReliable = nLastSendMsgNumReliable;
+	return cbDelta;
+}
+
 //-----------------------------------------------------------------------------
 void CSteamNetworkConnectionBase::SNP_InitializeConnection( SteamNetworkingMicroseconds usecNow )
 {
+	m_senderState.m_flPacingQuantum = (float)Clamp( steamdatagram_snp_pacing_quantum, k_cbMinPacingQuantum, k_cbMaxPacingQuantum );
 	m_senderState.TokenBucket_Init( usecNow );
 
+	// Start searching for the path MTU right away
+	m_senderState.m_usecPMTUNextProbe = usecNow;
+
+	// Old peers only know about one lane
+	if ( len( m_senderState.m_vecLanes ) > 1 && m_statsEndToEnd.m_nPeerProtocolVersion < k_nMinPeerProtocolVersionLanes )
+	{
+		ConnectionState_ProblemDetectedLocally( k_ESteamNetConnectionEnd_Misc_Generic,
+			"%d lanes configured, but peer is using protocol version %u, which doesn't support lanes",
+			len( m_senderState.m_vecLanes ), m_statsEndToEnd.m_nPeerProtocolVersion );
+		return;
+	}
+
+	// Or streams.  (We queued the chunks before we knew who we were talking to.)
+	if ( m_senderState.m_bSentStreamChunks && m_statsEndToEnd.m_nPeerProtocolVersion < k_nMinPeerProtocolVersionStreams )
+	{
+		ConnectionState_ProblemDetectedLocally( k_ESteamNetConnectionEnd_Misc_Generic,
+			"Stream chunks queued, but peer is using protocol version %u, which doesn't support them",
+			m_statsEndToEnd.m_nPeerProtocolVersion );
+		return;
+	}
+
+	// Unordered messages queued before we knew the peer could handle them
+	// were encoded in order.  Now that we know, let them be unordered.
+	if ( m_statsEndToEnd.m_nPeerProtocolVersion >= k_nMinPeerProtocolVersionUnordered )
+	{
+		for ( SSNPSendLane &lane: m_senderState.m_vecLanes )
+			m_senderState.m_cbPendingReliable += ReencodeQueuedUnorderedMessages( lane );
+	}
+
 	// Setup the table of inflight packets with a sentinel.
 	m_senderState.m_mapInFlightPacketsByPktNum.clear();
 	SNPInFlightPacket_t &sentinel = m_senderState.m_mapInFlightPacketsByPktNum[INT64_MIN];
@@ -213,6 +461,14 @@ void CSteamNetworkConnectionBase::SNP_InitializeConnection( SteamNetworkingMicro
 	SteamNetworkingMicroseconds usecPing = GetUsecPingWithFallback( this );
 	m_senderState.m_n_x = GetInitialRate( usecPing );
 
+	// Create congestion control.  If the global default is bogus, use a fixed rate
+	Assert( m_senderState.m_pCongestionControl == nullptr );
+	int eCongestionControl = m_senderState.m_eCongestionControl ? m_senderState.m_eCongestionControl : steamdatagram_snp_congestion_control;
+	m_senderState.m_pCongestionControl = CreateSNPCongestionControl( eCongestionControl );
+	if ( !m_senderState.m_pCongestionControl )
+		m_senderState.m_pCongestionControl = CreateSNPCongestionControl( k_ESteamNetworkingCongestionControl_Fixed );
+	m_senderState.m_pCongestionControl->Init( m_senderState.m_n_x, usecPing, usecNow );
+
 //	if ( steamdatagram_snp_log_x )
 //	SpewMsg( "%12llu %s: INITIAL X=%d rtt=%dms tx_s=%d\n", 
 //				 usecNow,
@@ -228,12 +484,16 @@ void CSteamNetworkConnectionBase::SNP_InitializeConnection( SteamNetworkingMicro
 }
 
 //-----------------------------------------------------------------------------
-EResult CSteamNetworkConnectionBase::SNP_SendMessage( SteamNetworkingMicroseconds usecNow, const void *pData, int cbData, ESteamNetworkingSendType eSendType )
+EResult CSteamNetworkConnectionBase::SNP_SendMessage( SteamNetworkingMicroseconds usecNow, const void *pData, int cbData, ESteamNetworkingSendType eSendType, int idxLane )
 {
-	// Check if we're full
+	Assert( idxLane >= 0 && idxLane < len( m_senderState.m_vecLanes ) );
+	SSNPSendLane &lane = m_senderState.m_vecLanes[ idxLane ];
+
+	// Check if we're full.  This is normal backpressure when streaming
+	// a large payload, so don't make a fuss about it.
 	if ( m_senderState.PendingBytesTotal() + (int)cbData > steamdatagram_snp_send_buffer_size )
 	{
-		SpewWarning( "Connection already has %u bytes pending, cannot queue any more messages\n", m_senderState.PendingBytesTotal() );
+		SpewVerbose( "[%s] Connection already has %u bytes pending, cannot queue any more messages\n", GetDescription(), m_senderState.PendingBytesTotal() );
 		return k_EResultLimitExceeded; 
 	}
 
@@ -259,43 +519,35 @@ EResult CSteamNetworkConnectionBase::SNP_SendMessage( SteamNetworkingMicrosecond
 	SNPSendMessage_t *pSendMessage = new SNPSendMessage_t();
 
 	// Assign message number
-	pSendMessage->m_nMsgNum = ++m_senderState.m_nLastSentMsgNum;
+	pSendMessage->m_nMsgNum = ++lane.m_nLastSentMsgNum;
 
 	// Reliable, or unreliable?
 	if ( eSendType & k_nSteamNetworkingSendFlags_Reliable )
 	{
-		pSendMessage->m_nReliableStreamPos = m_senderState.m_nReliableStreamPos;
+		pSendMessage->m_nReliableStreamPos = lane.m_nReliableStreamPos;
+
+		// Can the receiver deliver it out of order?  We can only do this
+		// if we know the peer understands it.
+		pSendMessage->m_bWantUnordered = ( eSendType & k_nSteamNetworkingSendFlags_Unordered ) != 0;
+		pSendMessage->m_bUnordered = pSendMessage->m_bWantUnordered
+			&& m_statsEndToEnd.m_nPeerProtocolVersion >= k_nMinPeerProtocolVersionUnordered;
 
 		// Generate the header
+		const bool bStreamChunk = ( eSendType & k_nSteamNetworkingSendFlags_StreamContinues ) != 0;
+		if ( bStreamChunk )
+			m_senderState.m_bSentStreamChunks = true;
 		byte hdr[ 32 ];
-		hdr[0] = 0;
-		byte *hdrEnd = hdr+1;
-		int64 nMsgNumGap = pSendMessage->m_nMsgNum - m_senderState.m_nLastSendMsgNumReliable;
-		Assert( nMsgNumGap >= 1 );
-		if ( nMsgNumGap > 1 )
-		{
-			hdrEnd = SerializeVarInt( hdrEnd, (uint64)nMsgNumGap );
-			hdr[0] |= 0x40;
-		}
-		if ( cbData < 0x20 )
-		{
-			hdr[0] |= (byte)cbData;
-		}
-		else
-		{
-			hdr[0] |= (byte)( 0x20 | ( cbData & 0x1f ) );
-			hdrEnd = SerializeVarInt( hdrEnd, cbData>>5U );
-		}
-		int cbHdr = hdrEnd - hdr;
+		int cbHdr = SerializeReliableMsgHeader( hdr, pSendMessage, lane.m_nLastSendMsgNumReliable, bStreamChunk, cbData );
+		pSendMessage->m_cbReliableHdr = (uint8)cbHdr;
 
 		// Copy the data into the message, with the header prepended
 		pSendMessage->m_cbSize = cbHdr+cbData;
-		pSendMessage->m_pData = new uint8[ pSendMessage->m_cbSize ];
+		pSendMessage->m_pData = (uint8 *)TaggedMalloc( pSendMessage->m_cbSize, k_ESteamNetworkingAllocTag_SendQueue );
 		memcpy( pSendMessage->m_pData, hdr, cbHdr );
 		memcpy( pSendMessage->m_pData+cbHdr, pData, cbData );
 
 		// Advance stream pointer
-		m_senderState.m_nReliableStreamPos += pSendMessage->m_cbSize;
+		lane.m_nReliableStreamPos += pSendMessage->m_cbSize;
 
 		// Update stats
 		++m_senderState.m_nMessagesSentReliable;
@@ -303,27 +555,46 @@ EResult CSteamNetworkConnectionBase::SNP_SendMessage( SteamNetworkingMicrosecond
 
 		// Remember last sent reliable message number, so we can know how to
 		// encode the next one
-		m_senderState.m_nLastSendMsgNumReliable = pSendMessage->m_nMsgNum;
+		lane.m_nLastSendMsgNumReliable = pSendMessage->m_nMsgNum;
 	}
 	else
 	{
 
 		// Just copy the data
-		pSendMessage->m_pData = new uint8[ cbData ];
+		pSendMessage->m_pData = (uint8 *)TaggedMalloc( cbData, k_ESteamNetworkingAllocTag_SendQueue );
 		pSendMessage->m_cbSize = cbData;
 		memcpy( pSendMessage->m_pData, pData, cbData );
 
 		pSendMessage->m_nReliableStreamPos = 0;
+		pSendMessage->m_bUnordered = pSendMessage->m_bWantUnordered = false;
+		pSendMessage->m_cbReliableHdr = 0;
 
 		++m_senderState.m_nMessagesSentUnreliable;
 		m_senderState.m_cbPendingUnreliable += pSendMessage->m_cbSize;
 	}
 
+	// If the lane was idle, it starts out even with the other lanes that are competing
+	// for the same bandwidth.  It doesn't get any credit for the time it was idle, and
+	// doesn't carry any debt from before.
+	if ( lane.m_messagesQueued.empty() && len( m_senderState.m_vecLanes ) > 1 )
+	{
+		bool bFoundCompetitor = false;
+		for ( const SSNPSendLane &other: m_senderState.m_vecLanes )
+		{
+			if ( &other == &lane || other.m_messagesQueued.empty() || other.m_nPriority != lane.m_nPriority )
+				continue;
+			if ( !bFoundCompetitor || other.m_nVirtualTime < lane.m_nVirtualTime )
+				lane.m_nVirtualTime = other.m_nVirtualTime;
+			bFoundCompetitor = true;
+		}
+	}
+
 	// Add to pending list
-	m_senderState.m_messagesQueued.push_back( pSendMessage );
-	SpewType( steamdatagram_snp_log_message, "[%s] SendMessage %s: MsgNum=%lld sz=%d\n",
+	lane.m_messagesQueued.push_back( pSendMessage );
+	SpewType( steamdatagram_snp_log_message, "[%s] SendMessage %s: Lane=%d MsgNum=%lld sz=%d\n",
 				 GetDescription(),
-				 ( eSendType & k_nSteamNetworkingSendFlags_Reliable ) ? "RELIABLE" : "UNRELIABLE",
+				 ( eSendType & k_nSteamNetworkingSendFlags_Reliable ) ? ( pSendMessage->m_bUnordered ? "UNORDERED" : "RELIABLE" ) : "UNRELIABLE",
+				 idxLane,
 				 (long long)pSendMessage->m_nMsgNum,
 				 pSendMessage->m_cbSize );
 
@@ -342,7 +613,7 @@ EResult CSteamNetworkConnectionBase::SNP_SendMessage( SteamNetworkingMicrosecond
 		SteamNetworkingMicroseconds usecNextThink = SNP_GetNextThinkTime( usecNow );
 
 		// If we are rate limiting, spew about it
-		if ( m_senderState.m_messagesQueued.m_pFirst->m_usecNagle == 0 && usecNextThink > usecNow )
+		if ( lane.m_messagesQueued.m_pFirst->m_usecNagle == 0 && usecNextThink > usecNow )
 		{
 			SpewVerbose( "[%s] RATELIM QueueTime is %.1fms, SendRate=%.1fk, BytesQueued=%d\n", 
 				GetDescription(),
@@ -372,12 +643,15 @@ EResult CSteamNetworkConnectionBase::SNP_FlushMessage( SteamNetworkingMicrosecon
 		return k_EResultIgnored;
 	}
 
-	if ( m_senderState.m_messagesQueued.empty() )
-		return k_EResultOK;
-
 	// If no Nagle timer was set, then there's nothing to do, we should already
 	// be properly scheduled.  Don't do work to re-discover that fact.
-	if ( m_senderState.m_messagesQueued.m_pLast->m_usecNagle == 0 )
+	bool bNagleActive = false;
+	for ( const SSNPSendLane &lane: m_senderState.m_vecLanes )
+	{
+		if ( !lane.m_messagesQueued.empty() && lane.m_messagesQueued.m_pLast->m_usecNagle != 0 )
+			bNagleActive = true;
+	}
+	if ( !bNagleActive )
 		return k_EResultOK;
 
 	// Accumulate tokens, and also limit to reasonable burst
@@ -395,8 +669,48 @@ EResult CSteamNetworkConnectionBase::SNP_FlushMessage( SteamNetworkingMicrosecon
 	return k_EResultOK;
 }
 
+EResult CSteamNetworkConnectionBase::SNP_ConfigureLanes( int nNumLanes, const int *pLanePriorities, const uint16 *pLaneWeights )
+{
+	if ( nNumLanes < 1 || nNumLanes > k_nSteamNetworkingMaxLanes )
+	{
+		SpewBug( "[%s] Invalid number of lanes %d\n", GetDescription(), nNumLanes );
+		return k_EResultInvalidParam;
+	}
+
+	// Lanes can be added, but not removed.  Messages might be
+	// queued or in flight on them.
+	if ( nNumLanes < len( m_senderState.m_vecLanes ) )
+	{
+		SpewBug( "[%s] Cannot reduce number of lanes from %d to %d\n", GetDescription(), len( m_senderState.m_vecLanes ), nNumLanes );
+		return k_EResultInvalidParam;
+	}
+	if ( pLaneWeights )
+	{
+		for ( int i = 0 ; i < nNumLanes ; ++i )
+		{
+			if ( pLaneWeights[i] == 0 )
+			{
+				SpewBug( "[%s] Lane %d weight must be >0\n", GetDescription(), i );
+				return k_EResultInvalidParam;
+			}
+		}
+	}
+
+	m_senderState.m_vecLanes.resize( nNumLanes );
+	for ( int i = 0 ; i < nNumLanes ; ++i )
+	{
+		SSNPSendLane &lane = m_senderState.m_vecLanes[i];
+		lane.m_nPriority = pLanePriorities ? pLanePriorities[i] : 0;
+		lane.m_nWeight = pLaneWeights ? pLaneWeights[i] : 1;
+	}
+
+	return k_EResultOK;
+}
+
 bool CSteamNetworkConnectionBase::SNP_RecvDataChunk( int64 nPktNum, const void *pChunk, int cbChunk, int cbPacketSize, SteamNetworkingMicroseconds usecNow )
 {
+	VPROF_BUDGET( "SNP_RecvDataChunk", VPROF_BUDGETGROUP_SNP );
+
 	#define DECODE_ERROR( ... ) do { \
 		ConnectionState_ProblemDetectedLocally( k_ESteamNetConnectionEnd_Misc_InternalError, __VA_ARGS__ ); \
 		return false; } while(false)
@@ -470,6 +784,18 @@ bool CSteamNetworkConnectionBase::SNP_RecvDataChunk( int64 nPktNum, const void *
 	const byte *pEnd = pDecode + cbChunk;
 	int64 nCurMsgNum = 0;
 	int64 nDecodeReliablePos = 0;
+	int idxDecodeLane = 0; // Each packet starts out on lane 0
+	SSNPRecvLane *pDecodeLane = &m_receiverState.m_vecLanes[0];
+	bool bUnorderedMsgStart = false;
+	bool bAckEliciting = false;
+	bool bAckImmediate = false;
+
+	// Info for the packet trace
+	int nTraceSegments = 0;
+	int nTraceAckBlocks = -1;
+	int64 nTraceAckPktNum = 0;
+	SteamNetworkingMicroseconds usecTraceRTT = 0;
+
 	while ( pDecode < pEnd )
 	{
 
@@ -482,6 +808,8 @@ bool CSteamNetworkConnectionBase::SNP_RecvDataChunk( int64 nPktNum, const void *
 			// Unreliable segment
 			//
 
+			++nTraceSegments;
+
 			// Decode message number
 			if ( nCurMsgNum == 0 )
 			{
@@ -492,26 +820,26 @@ bool CSteamNetworkConnectionBase::SNP_RecvDataChunk( int64 nPktNum, const void *
 				{
 					READ_32BITU( nLowerBits, szUnreliableMsgNumOffset );
 					nMask = 0xffffffff;
-					nCurMsgNum = NearestWithSameLowerBits( (int32)nLowerBits, m_receiverState.m_nHighestSeenMsgNum );
+					nCurMsgNum = NearestWithSameLowerBits( (int32)nLowerBits, pDecodeLane->m_nHighestSeenMsgNum );
 				}
 				else
 				{
 					READ_16BITU( nLowerBits, szUnreliableMsgNumOffset );
 					nMask = 0xffff;
-					nCurMsgNum = NearestWithSameLowerBits( (int16)nLowerBits, m_receiverState.m_nHighestSeenMsgNum );
+					nCurMsgNum = NearestWithSameLowerBits( (int16)nLowerBits, pDecodeLane->m_nHighestSeenMsgNum );
 				}
 				Assert( ( nCurMsgNum & nMask ) == nLowerBits );
 
 				if ( nCurMsgNum <= 0 )
 				{
 					DECODE_ERROR( "SNP decode unreliable msgnum underflow.  %llx mod %llx, highest seen %llx",
-						(unsigned long long)nLowerBits, (unsigned long long)( nMask+1 ), (unsigned long long)m_receiverState.m_nHighestSeenMsgNum );
+						(unsigned long long)nLowerBits, (unsigned long long)( nMask+1 ), (unsigned long long)pDecodeLane->m_nHighestSeenMsgNum );
 				}
-				if ( std::abs( nCurMsgNum - m_receiverState.m_nHighestSeenMsgNum ) > (nMask>>2) )
+				if ( std::abs( nCurMsgNum - pDecodeLane->m_nHighestSeenMsgNum ) > (nMask>>2) )
 				{
 					// We really should never get close to this boundary.
 					SpewWarningRateLimited( usecNow, "Sender sent abs unreliable message number using %llx mod %llx, highest seen %llx\n",
-						(unsigned long long)nLowerBits, (unsigned long long)( nMask+1 ), (unsigned long long)m_receiverState.m_nHighestSeenMsgNum );
+						(unsigned long long)nLowerBits, (unsigned long long)( nMask+1 ), (unsigned long long)pDecodeLane->m_nHighestSeenMsgNum );
 				}
 
 			}
@@ -528,8 +856,8 @@ bool CSteamNetworkConnectionBase::SNP_RecvDataChunk( int64 nPktNum, const void *
 					++nCurMsgNum;
 				}
 			}
-			if ( nCurMsgNum > m_receiverState.m_nHighestSeenMsgNum )
-				m_receiverState.m_nHighestSeenMsgNum = nCurMsgNum;
+			if ( nCurMsgNum > pDecodeLane->m_nHighestSeenMsgNum )
+				pDecodeLane->m_nHighestSeenMsgNum = nCurMsgNum;
 
 			//
 			// Decode segment offset in message
@@ -546,7 +874,7 @@ bool CSteamNetworkConnectionBase::SNP_RecvDataChunk( int64 nPktNum, const void *
 
 			// Receive the segment
 			bool bLastSegmentInMessage = ( nFrameType & 0x20 ) != 0;
-			SNP_ReceiveUnreliableSegment( nCurMsgNum, nOffset, pSegmentData, cbSegmentSize, bLastSegmentInMessage, usecNow );
+			SNP_ReceiveUnreliableSegment( idxDecodeLane, nCurMsgNum, nOffset, pSegmentData, cbSegmentSize, bLastSegmentInMessage, usecNow );
 		}
 		else if ( ( nFrameType & 0xe0 ) == 0x40 )
 		{
@@ -555,6 +883,8 @@ bool CSteamNetworkConnectionBase::SNP_RecvDataChunk( int64 nPktNum, const void *
 			// Reliable segment
 			//
 
+			++nTraceSegments;
+
 			// First reliable segment?
 			if ( nDecodeReliablePos == 0 )
 			{
@@ -571,7 +901,7 @@ bool CSteamNetworkConnectionBase::SNP_RecvDataChunk( int64 nPktNum, const void *
 				}
 
 				// What do we expect to receive next?
-				int64 nExpectNextStreamPos = m_receiverState.m_nReliableStreamPos + len( m_receiverState.m_bufReliableStream );
+				int64 nExpectNextStreamPos = pDecodeLane->m_nReliableStreamPos + pDecodeLane->m_bufReliableStream.size();
 
 				// Find the stream offset closest to that
 				nDecodeReliablePos = ( nExpectNextStreamPos & ~nMask ) + nOffset;
@@ -616,8 +946,13 @@ bool CSteamNetworkConnectionBase::SNP_RecvDataChunk( int64 nPktNum, const void *
 
 			// Ingest the segment.  If it seems fishy, abort processing of this packet
 			// and do not acknowledge to the sender.
-			if ( !SNP_ReceiveReliableSegment( nPktNum, nDecodeReliablePos, pSegmentData, cbSegmentSize, usecNow ) )
+			if ( !SNP_ReceiveReliableSegment( nPktNum, idxDecodeLane, nDecodeReliablePos, pSegmentData, cbSegmentSize, bUnorderedMsgStart, usecNow ) )
 				return false;
+			bUnorderedMsgStart = false;
+
+			// If they ever send us a reliable segment, then we should make sure we
+			// send them an ack of what we have.
+			bAckEliciting = true;
 
 			// Advance pointer for the next reliable segment, if any.
 			nDecodeReliablePos += cbSegmentSize;
@@ -749,6 +1084,7 @@ bool CSteamNetworkConnectionBase::SNP_RecvDataChunk( int64 nPktNum, const void *
 			Assert( inFlightPkt->first <= nLatestRecvSeqNum );
 
 			// Parse out delay, and process the ping
+			SteamNetworkingMicroseconds usecAckDelay = 0;
 			{
 				uint16 nPackedDelay;
 				READ_16BITU( nPackedDelay, "ack delay" );
@@ -787,6 +1123,10 @@ bool CSteamNetworkConnectionBase::SNP_RecvDataChunk( int64 nPktNum, const void *
 						if ( msPing < 0 )
 							msPing = 0;
 						m_statsEndToEnd.m_ping.ReceivedPing( msPing, usecNow );
+						usecTraceRTT = Max( usecElapsed - usecDelay, (SteamNetworkingMicroseconds)0 );
+						usecAckDelay = usecDelay;
+						if ( m_senderState.m_pCongestionControl )
+							m_senderState.m_pCongestionControl->OnRTTSample( usecTraceRTT, usecNow );
 
 						// Spew
 						SpewType( steamdatagram_snp_log_ackrtt, "[%s] decode pkt %lld latest recv %lld delay %.1fms ping %.1fms\n",
@@ -803,6 +1143,8 @@ bool CSteamNetworkConnectionBase::SNP_RecvDataChunk( int64 nPktNum, const void *
 			int nBlocks = nFrameType&7;
 			if ( nBlocks == 7 )
 				READ_8BITU( nBlocks, "ack num blocks" );
+			nTraceAckBlocks = nBlocks;
+			nTraceAckPktNum = nLatestRecvSeqNum;
 
 			// If they actually sent us any blocks, that means they are fragmented.
 			// We should make sure and tell them to stop sending us these nacks
@@ -821,6 +1163,21 @@ bool CSteamNetworkConnectionBase::SNP_RecvDataChunk( int64 nPktNum, const void *
 			// of the packet.
 			bool bAckedReliableRange = false;
 			int64 nPktNumAckEnd = nLatestRecvSeqNum+1;
+
+			// Gather up info for congestion control.  We take the delivery
+			// rate sample from the newest packet acked, which is the first
+			// one we will encounter
+			SNPRateSample_t rateSample;
+			rateSample.m_nPktsAcked = 0;
+			rateSample.m_cbAcked = 0;
+			struct
+			{
+				SteamNetworkingMicroseconds m_usecWhenSent;
+				int64 m_nDeliveredAtSend;
+				SteamNetworkingMicroseconds m_usecDeliveredTimeAtSend;
+				SteamNetworkingMicroseconds m_usecFirstSentTimeAtSend;
+				bool m_bAppLimited;
+			} newestAckedPkt;
 			while ( nBlocks >= 0 )
 			{
 
@@ -887,14 +1244,42 @@ bool CSteamNetworkConnectionBase::SNP_RecvDataChunk( int64 nPktNum, const void *
 				{
 					Assert( inFlightPkt->first < nPktNumAckEnd );
 
+					// Update delivery rate and in-flight accounting.  If we already
+					// declared it lost, then it was already removed from in-flight
+					if ( rateSample.m_nPktsAcked == 0 )
+					{
+						newestAckedPkt.m_usecWhenSent = inFlightPkt->second.m_usecWhenSent;
+						newestAckedPkt.m_nDeliveredAtSend = inFlightPkt->second.m_nDeliveredAtSend;
+						newestAckedPkt.m_usecDeliveredTimeAtSend = inFlightPkt->second.m_usecDeliveredTimeAtSend;
+						newestAckedPkt.m_usecFirstSentTimeAtSend = inFlightPkt->second.m_usecFirstSentTimeAtSend;
+						newestAckedPkt.m_bAppLimited = inFlightPkt->second.m_bAppLimited;
+					}
+					++rateSample.m_nPktsAcked;
+					rateSample.m_cbAcked += inFlightPkt->second.m_cbWire;
+					m_senderState.m_nDelivered += inFlightPkt->second.m_cbWire;
+					if ( !inFlightPkt->second.m_bNack )
+						m_senderState.m_cbInFlight -= inFlightPkt->second.m_cbWire;
+					Assert( m_senderState.m_cbInFlight >= 0 );
+
+					// Path MTU discovery.  A big packet got through
+					if ( inFlightPkt->second.m_bAboveBasePMTU )
+						m_senderState.m_nPMTUBlackHoleLosses = 0;
+					if ( inFlightPkt->first == m_senderState.m_nPMTUProbePktNum )
+						SNP_PMTUProbeResult( true, usecNow );
+
+					// Peer got our ack frequency request?
+					if ( inFlightPkt->first == m_senderState.m_nAckFrequencyPktNum )
+						m_senderState.m_bAckFrequencyAcked = true;
+
 					// Scan reliable segments, and see if any are marked for retry or are in flight
-					for ( const SNPRange_t &relRange: inFlightPkt->second.m_vecReliableSegments )
+					for ( const SNPRangeWithLane &relRange: inFlightPkt->second.m_vecReliableSegments )
 					{
+						SSNPSendLane &lane = m_senderState.m_vecLanes[ relRange.m_idxLane ];
 
 						// If range is present, it should be in only one of these two tables.
-						if ( m_senderState.m_listInFlightReliableRange.erase( relRange ) == 0 )
+						if ( lane.m_listInFlightReliableRange.erase( relRange ) == 0 )
 						{
-							if ( m_senderState.m_listReadyRetryReliableRange.erase( relRange ) > 0 )
+							if ( lane.m_listReadyRetryReliableRange.erase( relRange ) > 0 )
 							{
 
 								// When we put stuff into the reliable retry list, we mark it as pending again.
@@ -908,7 +1293,7 @@ bool CSteamNetworkConnectionBase::SNP_RecvDataChunk( int64 nPktNum, const void *
 						else
 						{
 							bAckedReliableRange = true;
-							Assert( m_senderState.m_listReadyRetryReliableRange.count( relRange ) == 0 );
+							Assert( lane.m_listReadyRetryReliableRange.count( relRange ) == 0 );
 						}
 					}
 
@@ -932,7 +1317,7 @@ bool CSteamNetworkConnectionBase::SNP_RecvDataChunk( int64 nPktNum, const void *
 				while ( inFlightPkt->first >= nPktNumNackBegin )
 				{
 					Assert( inFlightPkt->first < nPktNumAckEnd );
-					SNP_SenderProcessPacketNack( inFlightPkt->first, inFlightPkt->second, "NACK" );
+					SNP_SenderProcessPacketNack( inFlightPkt->first, inFlightPkt->second, "NACK", usecNow );
 
 					// We'll keep the record on hand, though, in case an ACK comes in
 					--inFlightPkt;
@@ -943,25 +1328,50 @@ bool CSteamNetworkConnectionBase::SNP_RecvDataChunk( int64 nPktNum, const void *
 				--nBlocks;
 			}
 
+			// Take a delivery rate sample, and let congestion control know
+			// how things are going
+			if ( rateSample.m_nPktsAcked > 0 && m_senderState.m_pCongestionControl )
+			{
+				m_senderState.m_usecDeliveredTime = usecNow;
+				SteamNetworkingMicroseconds usecSendElapsed = newestAckedPkt.m_usecWhenSent - newestAckedPkt.m_usecFirstSentTimeAtSend;
+				SteamNetworkingMicroseconds usecAckElapsed = usecNow - newestAckedPkt.m_usecDeliveredTimeAtSend;
+				m_senderState.m_usecFirstSentTime = newestAckedPkt.m_usecWhenSent;
+
+				rateSample.m_nDelivered = m_senderState.m_nDelivered;
+				rateSample.m_nPriorDelivered = newestAckedPkt.m_nDeliveredAtSend;
+				rateSample.m_nIntervalDelivered = m_senderState.m_nDelivered - newestAckedPkt.m_nDeliveredAtSend;
+				rateSample.m_usecInterval = Max( usecSendElapsed, usecAckElapsed );
+				rateSample.m_bAppLimited = newestAckedPkt.m_bAppLimited;
+				rateSample.m_cbInFlight = m_senderState.m_cbInFlight;
+				rateSample.m_usecAckDelay = usecAckDelay;
+
+				m_senderState.m_pCongestionControl->OnAck( rateSample, usecNow );
+				SNP_UpdateX( usecNow );
+			}
+
 			// Should we check for discarding reliable messages we are keeping around in case
 			// of retransmission, since we know now that they were delivered?
 			if ( bAckedReliableRange )
 			{
-				m_senderState.RemoveAckedReliableMessageFromUnackedList();
-
-				// Spew where we think the peer is decoding the reliable stream
-				if ( g_eSteamDatagramDebugOutputDetailLevel <= k_ESteamNetworkingSocketsDebugOutputType_Debug )
+				for ( int idxLane = 0 ; idxLane < len( m_senderState.m_vecLanes ) ; ++idxLane )
 				{
+					SSNPSendLane &lane = m_senderState.m_vecLanes[ idxLane ];
+					lane.RemoveAckedReliableMessageFromUnackedList();
 
-					int64 nPeerReliablePos = m_senderState.m_nReliableStreamPos;
-					if ( !m_senderState.m_listInFlightReliableRange.empty() )
-						nPeerReliablePos = std::min( nPeerReliablePos, m_senderState.m_listInFlightReliableRange.begin()->first.m_nBegin );
-					if ( !m_senderState.m_listReadyRetryReliableRange.empty() )
-						nPeerReliablePos = std::min( nPeerReliablePos, m_senderState.m_listReadyRetryReliableRange.begin()->first.m_nBegin );
+					// Spew where we think the peer is decoding the reliable stream
+					if ( g_eSteamDatagramDebugOutputDetailLevel <= k_ESteamNetworkingSocketsDebugOutputType_Debug )
+					{
 
-					SpewType( steamdatagram_snp_log_packet+1, "[%s]   decode pkt %lld peer reliable pos = %lld\n",
-						GetDescription(),
-						(long long)nPktNum, (long long)nPeerReliablePos );
+						int64 nPeerReliablePos = lane.m_nReliableStreamPos;
+						if ( !lane.m_listInFlightReliableRange.empty() )
+							nPeerReliablePos = std::min( nPeerReliablePos, lane.m_listInFlightReliableRange.begin()->first.m_nBegin );
+						if ( !lane.m_listReadyRetryReliableRange.empty() )
+							nPeerReliablePos = std::min( nPeerReliablePos, lane.m_listReadyRetryReliableRange.begin()->first.m_nBegin );
+
+						SpewType( steamdatagram_snp_log_packet+1, "[%s]   decode pkt %lld lane %d peer reliable pos = %lld\n",
+							GetDescription(),
+							(long long)nPktNum, idxLane, (long long)nPeerReliablePos );
+					}
 				}
 			}
 
@@ -975,6 +1385,89 @@ bool CSteamNetworkConnectionBase::SNP_RecvDataChunk( int64 nPktNum, const void *
 				//m_senderState.m_usecWhenAdvancedMinPktWaitingOnAck = usecNow;
 			}
 		}
+		else if ( ( nFrameType & 0xf8 ) == 0x88 )
+		{
+
+			//
+			// Select lane.  Subsequent segments in this packet are for this lane,
+			// and the message number and reliable stream position encodings start over.
+			//
+
+			uint64 idxLane = nFrameType & 7;
+			if ( idxLane == 7 )
+				READ_VARINT( idxLane, "lane" );
+			if ( idxLane >= (uint64)k_nSteamNetworkingMaxLanes )
+				DECODE_ERROR( "Invalid lane %llu", (unsigned long long)idxLane );
+
+			// First time peer has used this lane?
+			if ( (int)idxLane >= len( m_receiverState.m_vecLanes ) )
+				m_receiverState.m_vecLanes.resize( idxLane+1 );
+
+			idxDecodeLane = int( idxLane );
+			pDecodeLane = &m_receiverState.m_vecLanes[ idxDecodeLane ];
+			nCurMsgNum = 0;
+			nDecodeReliablePos = 0;
+		}
+		else if ( nFrameType == 0x85 )
+		{
+
+			//
+			// Unordered message start.  The reliable segment that follows
+			// begins with the header of a message that we can deliver
+			// without waiting for the reliable stream to catch up.
+			//
+
+			if ( pDecode >= pEnd || ( *pDecode & 0xe0 ) != 0x40 )
+				DECODE_ERROR( "Unordered message start not followed by reliable segment" );
+			bUnorderedMsgStart = true;
+		}
+		else if ( nFrameType == 0x84 )
+		{
+
+			//
+			// Padding.  The rest of the packet is ignored.  This is only used
+			// for path MTU probes, and the sender is waiting to find out if
+			// the probe got through, so don't sit on the ack.
+			//
+
+			SpewType( steamdatagram_snp_log_packet+1, "[%s]   decode pkt %lld padding %d bytes\n",
+				GetDescription(),
+				(long long)nPktNum, int( pEnd - pDecode ) );
+			bAckImmediate = true;
+			break;
+		}
+		else if ( nFrameType == 0x86 )
+		{
+
+			//
+			// Ack frequency.  The peer is telling us how often they want acks.
+			//
+
+			uint64 nPacketTolerance, nMaxAckDelay;
+			READ_VARINT( nPacketTolerance, "ack packet tolerance" );
+			READ_VARINT( nMaxAckDelay, "max ack delay" );
+
+			// Ignore it if we have already applied a newer request
+			if ( nPktNum > m_receiverState.m_nAckFrequencyPktNum )
+			{
+				m_receiverState.m_nAckFrequencyPktNum = nPktNum;
+				m_receiverState.m_nAckPacketTolerance = (int)std::min( nPacketTolerance, (uint64)k_nMaxAckPacketTolerance );
+				m_receiverState.m_usecMaxAckDelay = Clamp( (SteamNetworkingMicroseconds)std::min( nMaxAckDelay, (uint64)k_usecMaxDataAckDelay ) << k_nAckDelayPrecisionShift, k_usecMinAckDelay, k_usecMaxDataAckDelay );
+
+				SpewType( steamdatagram_snp_log_packet+1, "[%s]   decode pkt %lld ack frequency %d pkts, %lldusec\n",
+					GetDescription(),
+					(long long)nPktNum, m_receiverState.m_nAckPacketTolerance, (long long)m_receiverState.m_usecMaxAckDelay );
+			}
+		}
+		else if ( nFrameType == 0x87 )
+		{
+
+			//
+			// Immediate ack.  The sender is waiting on an ack for this packet
+			//
+
+			bAckImmediate = true;
+		}
 		else
 		{
 			DECODE_ERROR( "Invalid SNP frame lead byte 0x%02x", nFrameType );
@@ -982,7 +1475,34 @@ bool CSteamNetworkConnectionBase::SNP_RecvDataChunk( int64 nPktNum, const void *
 	}
 
 	// Update structures needed to populate our ACKs
-	return SNP_RecordReceivedPktNum( nPktNum, usecNow );
+	if ( !SNP_RecordReceivedPktNum( nPktNum, usecNow ) )
+		return false;
+
+	if ( BPacketTraceEnabled( m_hConnectionSelf ) )
+	{
+		PacketTraceEvent_t &e = PacketTraceBeginEvent( k_EPacketTraceEvent_SNPRecv, m_hConnectionSelf, usecNow );
+		e.m_nPktNum = nPktNum;
+		e.m_cbSize = (uint16)cbPacketSize;
+		e.m_nSegments = (uint8)Min( nTraceSegments, 255 );
+		e.m_nAckBlocks = (int16)nTraceAckBlocks;
+		e.m_nAckPktNum = nTraceAckPktNum;
+		e.m_usecRTT = (int32)Min( usecTraceRTT, (SteamNetworkingMicroseconds)INT_MAX );
+		e.m_nTokenBucket = (int32)m_senderState.m_flTokenBucket;
+		e.m_nSendRate = m_senderState.m_n_x;
+	}
+
+	// Schedule the ack, if this packet needs one
+	if ( bAckEliciting || bAckImmediate )
+	{
+		if ( m_receiverState.ReceivedAckElicitingPacket( usecNow ) || bAckImmediate )
+			SNP_FlushAcksSoon( usecNow );
+	}
+
+	// Make sure we wake up in time to flush acks.  Nothing else
+	// will schedule us to think just because we received a packet
+	if ( m_receiverState.m_usecWhenFlushAck < k_nThinkTime_Never )
+		EnsureMinThinkTime( m_receiverState.m_usecWhenFlushAck, +1 );
+	return true;
 
 	// Make sure these don't get used beyond where we intended them toget used
 	#undef DECODE_ERROR
@@ -996,7 +1516,7 @@ bool CSteamNetworkConnectionBase::SNP_RecvDataChunk( int64 nPktNum, const void *
 	#undef READ_SEGMENT_DATA_SIZE
 }
 
-void CSteamNetworkConnectionBase::SNP_SenderProcessPacketNack( int64 nPktNum, SNPInFlightPacket_t &pkt, const char *pszDebug )
+void CSteamNetworkConnectionBase::SNP_SenderProcessPacketNack( int64 nPktNum, SNPInFlightPacket_t &pkt, const char *pszDebug, SteamNetworkingMicroseconds usecNow )
 {
 
 	// Did we already treat the packet as dropped (implicitly or explicitly)?
@@ -1006,23 +1526,69 @@ void CSteamNetworkConnectionBase::SNP_SenderProcessPacketNack( int64 nPktNum, SN
 	// Mark as dropped
 	pkt.m_bNack = true;
 
+	if ( BPacketTraceEnabled( m_hConnectionSelf ) )
+	{
+		PacketTraceEvent_t &e = PacketTraceBeginEvent( k_EPacketTraceEvent_SNPLoss, m_hConnectionSelf, usecNow );
+		e.m_nPktNum = nPktNum;
+		e.m_cbSize = (uint16)pkt.m_cbWire;
+		e.m_nTokenBucket = (int32)m_senderState.m_flTokenBucket;
+		e.m_nSendRate = m_senderState.m_n_x;
+	}
+
+	// No longer in flight
+	m_senderState.m_cbInFlight -= pkt.m_cbWire;
+	Assert( m_senderState.m_cbInFlight >= 0 );
+
+	// Path MTU probes are expected to get lost sometimes, that doesn't
+	// tell us anything about congestion
+	if ( nPktNum == m_senderState.m_nPMTUProbePktNum )
+	{
+		SNP_PMTUProbeResult( false, usecNow );
+	}
+	else
+	{
+		// Lots of big packets lost in a row, and none getting through?
+		// The path probably changed.  Go back to a size that should work anywhere.
+		if ( pkt.m_bAboveBasePMTU && m_senderState.m_nPMTUBlackHoleLosses++ == 0 )
+			m_senderState.m_usecPMTUBlackHoleFirstLoss = pkt.m_usecWhenSent;
+		if ( pkt.m_bAboveBasePMTU
+			&& m_senderState.m_nPMTUBlackHoleLosses >= k_nPMTUBlackHoleLosses
+			&& pkt.m_usecWhenSent - m_senderState.m_usecPMTUBlackHoleFirstLoss >= k_usecPMTUBlackHoleTime
+			&& m_senderState.m_cbMaxEncryptedPayloadSend > k_cbSteamNetworkingSocketsMaxEncryptedPayloadSend )
+		{
+			SpewMsg( "[%s] Lost %d packets of %d bytes in a row.  Path MTU black hole?  Falling back to %d bytes\n",
+				GetDescription(), m_senderState.m_nPMTUBlackHoleLosses, m_senderState.m_cbMaxEncryptedPayloadSend, k_cbSteamNetworkingSocketsMaxEncryptedPayloadSend );
+			m_senderState.m_cbMaxEncryptedPayloadSend = k_cbSteamNetworkingSocketsMaxEncryptedPayloadSend;
+			m_senderState.m_cbPMTUProbe = 0;
+			m_senderState.m_nPMTUProbePktNum = 0;
+			m_senderState.m_nPMTUBlackHoleLosses = 0;
+			m_senderState.m_usecPMTUNextProbe = usecNow;
+		}
+
+		// Let congestion control know about it
+		if ( m_senderState.m_pCongestionControl )
+			m_senderState.m_pCongestionControl->OnPacketLost( nPktNum, pkt.m_usecWhenSent, usecNow );
+	}
+
 	// Is this in-flight stats we were expecting an ack for?
 	if ( m_statsEndToEnd.m_pktNumInFlight == nPktNum )
 		m_statsEndToEnd.InFlightPktTimeout();
 
 	// Scan reliable segments
-	for ( const SNPRange_t &relRange: pkt.m_vecReliableSegments )
+	for ( const SNPRangeWithLane &relRange: pkt.m_vecReliableSegments )
 	{
+		SSNPSendLane &lane = m_senderState.m_vecLanes[ relRange.m_idxLane ];
 
 		// Marked as in-flight?
-		auto inFlightRange = m_senderState.m_listInFlightReliableRange.find( relRange );
-		if ( inFlightRange == m_senderState.m_listInFlightReliableRange.end() )
+		auto inFlightRange = lane.m_listInFlightReliableRange.find( relRange );
+		if ( inFlightRange == lane.m_listInFlightReliableRange.end() )
 			continue;
 
-		SpewType( steamdatagram_snp_log_packet, "[%s] pkt %lld %s, queueing retry of reliable range [%lld,%lld)\n", 
+		SpewType( steamdatagram_snp_log_packet, "[%s] pkt %lld %s, queueing retry of lane %d reliable range [%lld,%lld)\n", 
 			GetDescription(),
 			nPktNum,
 			pszDebug,
+			relRange.m_idxLane,
 			relRange.m_nBegin, relRange.m_nEnd );
 
 		// The ready-to-retry list counts towards the "pending" stat
@@ -1030,9 +1596,9 @@ void CSteamNetworkConnectionBase::SNP_SenderProcessPacketNack( int64 nPktNum, SN
 
 		// Move it to the ready for retry list!
 		// if shouldn't already be there!
-		Assert( m_senderState.m_listReadyRetryReliableRange.count( relRange ) == 0 );
-		m_senderState.m_listReadyRetryReliableRange[ inFlightRange->first ] = inFlightRange->second;
-		m_senderState.m_listInFlightReliableRange.erase( inFlightRange );
+		Assert( lane.m_listReadyRetryReliableRange.count( relRange ) == 0 );
+		lane.m_listReadyRetryReliableRange[ inFlightRange->first ] = inFlightRange->second;
+		lane.m_listInFlightReliableRange.erase( inFlightRange );
 	}
 }
 
@@ -1071,7 +1637,7 @@ SteamNetworkingMicroseconds CSteamNetworkConnectionBase::SNP_SenderCheckInFlight
 
 			// Mark as dropped, and move any reliable contents into the
 			// retry list.
-			SNP_SenderProcessPacketNack( m_senderState.m_itNextInFlightPacketToTimeout->first, m_senderState.m_itNextInFlightPacketToTimeout->second, "AckTimeout" );
+			SNP_SenderProcessPacketNack( m_senderState.m_itNextInFlightPacketToTimeout->first, m_senderState.m_itNextInFlightPacketToTimeout->second, "AckTimeout", usecNow );
 		}
 
 		// Advance to next packet waiting to timeout
@@ -1113,14 +1679,28 @@ SteamNetworkingMicroseconds CSteamNetworkConnectionBase::SNP_SenderCheckInFlight
 	return usecNextRetry;
 }
 
+/// Largest segment that can have an explicit size field.  (3 bits in the
+/// lead byte plus one more byte, and the values 5 and 6 are reserved for
+/// the upper bits.)  Bigger segments must be the last one in the packet.
+const int k_cbSNPMaxExplicitSegmentSize = 0x4ff;
+
+/// Size of the frame that switches the lane for the segments that follow.
+/// Lanes 0-6 are encoded in the lead byte, others need a varint
+inline int SNPSelectLaneFrameSize( int idxLane )
+{
+	return idxLane < 7 ? 1 : 1 + VarIntSerializedSize( (uint32)idxLane );
+}
+
 struct EncodedSegment
 {
 	static constexpr int k_cbMaxHdr = 16; 
 	uint8 m_hdr[ k_cbMaxHdr ];
 	int m_cbHdr; // Doesn't include any size byte
+	int m_idxLeadByte; // Index of the segment frame lead byte in m_hdr.  (It might be preceded by an unordered message start frame.)
 	SNPSendMessage_t *m_pMsg;
 	int m_cbSize;
 	int m_nOffset;
+	int m_idxLane;
 
 	inline void SetupReliable( SNPSendMessage_t *pMsg, int64 nBegin, int64 nEnd, int64 nLastReliableStreamPosEnd )
 	{
@@ -1128,17 +1708,24 @@ struct EncodedSegment
 		Assert( nBegin + k_cbSteamNetworkingSocketsMaxReliableMessageSegment >= nEnd ); // Max sure we don't exceed max segment size
 		Assert( pMsg->m_cbSize > 0 );
 
+		// If this segment starts a message that can be delivered out of order,
+		// let the receiver know where the message begins
+		uint8 *pHdr = m_hdr;
+		if ( pMsg->m_bUnordered && nBegin == pMsg->m_nReliableStreamPos )
+			*(pHdr++) = 0x85;
+
 		// Start filling out the header with the top three bits = 010,
 		// identifying this as a reliable segment
-		uint8 *pHdr = m_hdr;
-		*(pHdr++) = 0x40;
+		m_idxLeadByte = pHdr - m_hdr;
+		uint8 &nLeadByte = *(pHdr++);
+		nLeadByte = 0x40;
 
 		// First reliable segment in the message?
 		if ( nLastReliableStreamPosEnd == 0 )
 		{
 			// Always use 48-byte offsets, to make sure we are exercising the worst case.
 			// Later we should optimize this
-			m_hdr[0] |= 0x10;
+			nLeadByte |= 0x10;
 			*(uint16*)pHdr = LittleWord( uint16( nBegin ) ); pHdr += 2;
 			*(uint32*)pHdr = LittleDWord( uint32( nBegin>>16 ) ); pHdr += 4;
 		}
@@ -1153,17 +1740,17 @@ struct EncodedSegment
 			}
 			else if ( nOffset < 0x100 )
 			{
-				m_hdr[0] |= (1<<3);
+				nLeadByte |= (1<<3);
 				*pHdr = uint8( nOffset ); pHdr += 1;
 			}
 			else if ( nOffset < 0x10000 )
 			{
-				m_hdr[0] |= (2<<3);
+				nLeadByte |= (2<<3);
 				*(uint16*)pHdr = LittleWord( uint16( nOffset ) ); pHdr += 2;
 			}
 			else
 			{
-				m_hdr[0] |= (3<<3);
+				nLeadByte |= (3<<3);
 				*(uint32*)pHdr = LittleDWord( uint32( nOffset ) ); pHdr += 4;
 			}
 		}
@@ -1189,6 +1776,7 @@ struct EncodedSegment
 		// identifying this as an unreliable segment
 		uint8 *pHdr = m_hdr;
 		*(pHdr++) = 0x00;
+		m_idxLeadByte = 0;
 
 		// Encode message number.  First unreliable message?
 		if ( nLastMsgNum == 0 )
@@ -1237,8 +1825,8 @@ struct EncodedSegment
 
 };
 
-template <typename T, typename L>
-inline bool HasOverlappingRange( const SNPRange_t &range, const std::map<SNPRange_t,T,L> &map )
+template <typename T, typename L, typename A>
+inline bool HasOverlappingRange( const SNPRange_t &range, const std::map<SNPRange_t,T,L,A> &map )
 {
 	auto l = map.lower_bound( range );
 	if ( l != map.end() )
@@ -1258,27 +1846,37 @@ inline bool HasOverlappingRange( const SNPRange_t &range, const std::map<SNPRang
 	return false;
 }
 
-int CSteamNetworkConnectionBase::SNP_SendPacket( SteamNetworkingMicroseconds usecNow, int cbMaxEncryptedPayload, void *pConnectionData )
+int CSteamNetworkConnectionBase::SNP_SendPacket( SteamNetworkingMicroseconds usecNow, int cbMaxEncryptedPayload, void *pConnectionData, bool bPMTUProbe )
 {
+	VPROF_BUDGET( "SNP_SendPacket", VPROF_BUDGETGROUP_SNP );
+
 	// If we aren't being specifically asked to send a packet, and we don't have anything to send,
 	// then don't send right now.
-	if ( pConnectionData == nullptr && usecNow < m_receiverState.m_usecWhenFlushAck && m_senderState.TimeWhenWantToSendNextPacket() > usecNow )
+	if ( pConnectionData == nullptr && !bPMTUProbe && usecNow < m_receiverState.m_usecWhenFlushAck && m_senderState.TimeWhenWantToSendNextPacket() > usecNow )
 		return 0;
 
 	// Make sure we have initialized the connection
 	Assert( BStateIsConnectedForWirePurposes() );
 	Assert( !m_senderState.m_mapInFlightPacketsByPktNum.empty() );
 
-	// Check if they are asking us to make room
-	int cbMaxPlaintextPayload = k_cbSteamNetworkingSocketsMaxPlaintextPayloadSend;
-	if ( cbMaxEncryptedPayload < k_cbSteamNetworkingSocketsMaxEncryptedPayloadSend )
+	// Figure out how much plaintext we can fit.  The sizes we use for full
+	// packets are a multiple of the key size, and leave a few bytes of pad,
+	// just like k_cbSteamNetworkingSocketsMaxPlaintextPayloadSend.
+	Assert( cbMaxEncryptedPayload <= k_cbSteamNetworkingSocketsMaxEncryptedPayloadSendJumbo );
+	COMPILE_TIME_ASSERT( ( k_cbSteamNetworkingSocketsEncryptionBlockSize & (k_cbSteamNetworkingSocketsEncryptionBlockSize-1) ) == 0 ); // key size should be power of two
+	int cbMaxPlaintextPayload;
+	if ( cbMaxEncryptedPayload >= k_cbSteamNetworkingSocketsMaxEncryptedPayloadSend && ( cbMaxEncryptedPayload & (k_cbSteamNetworkingSocketsEncryptionBlockSize-1) ) == 0 )
 	{
-		COMPILE_TIME_ASSERT( ( k_cbSteamNetworkingSocketsEncryptionBlockSize & (k_cbSteamNetworkingSocketsEncryptionBlockSize-1) ) == 0 ); // key size should be power of two
+		cbMaxPlaintextPayload = cbMaxEncryptedPayload - ( k_cbSteamNetworkingSocketsMaxEncryptedPayloadSend - k_cbSteamNetworkingSocketsMaxPlaintextPayloadSend );
+	}
+	else
+	{
+		// They are asking us to make room
 		cbMaxPlaintextPayload = ( cbMaxEncryptedPayload - 1 ) & ~(k_cbSteamNetworkingSocketsEncryptionBlockSize-1); // we need at least one byte of padding, and then round up to multiple of key size
 		cbMaxPlaintextPayload = std::max( 0, cbMaxPlaintextPayload );
 	}
 
-	uint8 payload[ k_cbSteamNetworkingSocketsMaxPlaintextPayloadSend ];
+	uint8 payload[ k_cbSteamNetworkingSocketsMaxPlaintextPayloadSendJumbo ];
 	uint8 *pPayloadEnd = payload + cbMaxPlaintextPayload;
 	uint8 *pPayloadPtr = payload;
 
@@ -1295,9 +1893,13 @@ int CSteamNetworkConnectionBase::SNP_SendPacket( SteamNetworkingMicroseconds use
 	if ( pPayloadPtr == nullptr )
 		return -1;
 
+	// Ack frequency frame
+	pPayloadPtr = SNP_SerializeAckFrequencyFrame( pPayloadPtr, pPayloadEnd, usecNow );
+
 	// Should we try to send as many acks as possible?
 	int cbReserveForAcks = 0;
 	int cbFlushedAcks = 0;
+	bool bHaveAcks = false;
 	if ( m_receiverState.m_usecWhenFlushAck <= usecNow )
 	{
 		uint8 *pAfterAck = SNP_SerializeAckBlocks( ackHelper, pPayloadPtr, pPayloadEnd, usecNow );
@@ -1307,6 +1909,7 @@ int CSteamNetworkConnectionBase::SNP_SendPacket( SteamNetworkingMicroseconds use
 		// Did anything fit?
 		if ( pAfterAck > pPayloadPtr )
 		{
+			bHaveAcks = true;
 			cbFlushedAcks = pAfterAck - pPayloadPtr;
 			pPayloadPtr = pAfterAck;
 			if ( m_receiverState.m_usecWhenFlushAck == INT64_MAX )
@@ -1349,19 +1952,39 @@ int CSteamNetworkConnectionBase::SNP_SendPacket( SteamNetworkingMicroseconds use
 		}
 	}
 
+	// Path MTU probes never carry any data, so losing one never costs us
+	// a retransmission.  Remember where the packet needs to be padded out to.
+	uint8 *pPadEnd = nullptr;
+	if ( bPMTUProbe )
+	{
+		pPadEnd = pPayloadEnd;
+		if ( cbReserveForAcks > 0 )
+		{
+			uint8 *pAfterAcks = SNP_SerializeAckBlocks( ackHelper, pPayloadPtr, std::min( pPayloadPtr+cbReserveForAcks, pPayloadEnd ), usecNow );
+			if ( pAfterAcks == nullptr )
+				return -1; // bug!  Abort
+			bHaveAcks |= pAfterAcks > pPayloadPtr;
+			pPayloadPtr = pAfterAcks;
+			cbReserveForAcks = 0;
+		}
+		pPayloadEnd = pPayloadPtr;
+	}
+
 	// Check if we don't actually have room to send any data, then don't.
 	// (This means that acks or other responsibilities are choking the pipe
 	// and should basically never happen in ordinary circumstances!)
-	if ( m_senderState.m_flTokenBucket < 0.0 )
+	else if ( m_senderState.m_flTokenBucket < 0.0 )
 	{
 		SpewWarningRateLimited( usecNow, "[%s] Exceeding rate limit just sending acks / stats!  Not sending any data!", GetDescription() );
 
 		// Serialize some acks, if we want to
 		if ( cbReserveForAcks > 0 )
 		{
-			pPayloadPtr = SNP_SerializeAckBlocks( ackHelper, pPayloadPtr, std::min( pPayloadPtr+cbReserveForAcks, pPayloadEnd ), usecNow );
-			if ( pPayloadPtr == nullptr )
+			uint8 *pAfterAcks = SNP_SerializeAckBlocks( ackHelper, pPayloadPtr, std::min( pPayloadPtr+cbReserveForAcks, pPayloadEnd ), usecNow );
+			if ( pAfterAcks == nullptr )
 				return -1; // bug!  Abort
+			bHaveAcks |= pAfterAcks > pPayloadPtr;
+			pPayloadPtr = pAfterAcks;
 			cbReserveForAcks = 0;
 		}
 
@@ -1369,19 +1992,34 @@ int CSteamNetworkConnectionBase::SNP_SendPacket( SteamNetworkingMicroseconds use
 		pPayloadEnd = pPayloadPtr;
 	}
 
+	int idxEncodeLane = 0; // The receiver assumes each packet starts on lane 0
 	int64 nLastReliableStreamPosEnd = 0;
 	int cbBytesRemainingForSegments = pPayloadEnd - pPayloadPtr - cbReserveForAcks;
 	vstd::small_vector<EncodedSegment,8> vecSegments;
 
 	// If we need to *retry* any reliable data, then try to put that in first.
 	// Bail if we only have a tiny sliver of data left
-	while ( !m_senderState.m_listReadyRetryReliableRange.empty() && cbBytesRemainingForSegments > 2 )
+	for (;;)
 	{
-		auto h = m_senderState.m_listReadyRetryReliableRange.begin();
+		int idxLane = m_senderState.ChooseLaneToRetry();
+		if ( idxLane < 0 || cbBytesRemainingForSegments <= 2 )
+			break;
+		SSNPSendLane &lane = m_senderState.m_vecLanes[ idxLane ];
+		auto h = lane.m_listReadyRetryReliableRange.begin();
+
+		// Switching lanes?  Stream positions are per lane, so the
+		// next one will be absolute
+		if ( idxLane != idxEncodeLane )
+		{
+			cbBytesRemainingForSegments -= SNPSelectLaneFrameSize( idxLane );
+			idxEncodeLane = idxLane;
+			nLastReliableStreamPosEnd = 0;
+		}
 
 		// Start a reliable segment
 		EncodedSegment &seg = *push_back_get_ptr( vecSegments );
 		seg.SetupReliable( h->second, h->first.m_nBegin, h->first.m_nEnd, nLastReliableStreamPosEnd );
+		seg.m_idxLane = idxLane;
 		int cbSegTotalWithoutSizeField = seg.m_cbHdr + seg.m_cbSize;
 		if ( cbSegTotalWithoutSizeField > cbBytesRemainingForSegments )
 		{
@@ -1402,7 +2040,7 @@ int CSteamNetworkConnectionBase::SNP_SendPacket( SteamNetworkingMicroseconds use
 			// opportunity to fill a normal packet and we fail on the first segment,
 			// we will never make progress and we are hosed!
 			AssertMsg2(
-				nLastReliableStreamPosEnd > 0
+				!vecSegments.empty()
 				|| cbMaxPlaintextPayload < k_cbSteamNetworkingSocketsMaxPlaintextPayloadSend
 				|| cbFlushedAcks > 20,
 				"We cannot fit reliable segment, need %d bytes, only %d remaining", cbSegTotalWithoutSizeField, cbBytesRemainingForSegments
@@ -1426,28 +2064,38 @@ int CSteamNetworkConnectionBase::SNP_SendPacket( SteamNetworkingMicroseconds use
 		cbBytesRemainingForSegments -= 1;
 
 		// Remove from retry list.  (We'll add to the in-flight list later)
-		m_senderState.m_listReadyRetryReliableRange.erase( h );
+		lane.m_listReadyRetryReliableRange.erase( h );
 	}
 
 	// Did we retry everything we needed to?  If not, then don't try to send new stuff,
 	// before we send those retries.
-	if ( m_senderState.m_listReadyRetryReliableRange.empty() )
+	if ( m_senderState.ChooseLaneToRetry() < 0 )
 	{
 
 		// OK, check the outgoing messages, and send as much stuff as we can cram in there
 		int64 nLastMsgNum = 0;
 		while ( cbBytesRemainingForSegments > 4 )
 		{
-			if ( m_senderState.m_messagesQueued.empty() )
-			{
-				m_senderState.m_cbCurrentSendMessageSent = 0;
+			int idxLane = m_senderState.ChooseLaneToSend();
+			if ( idxLane < 0 )
 				break;
-			}
-			SNPSendMessage_t *pSendMsg = m_senderState.m_messagesQueued.m_pFirst;
-			Assert( m_senderState.m_cbCurrentSendMessageSent < pSendMsg->m_cbSize );
+			SSNPSendLane &lane = m_senderState.m_vecLanes[ idxLane ];
+			SNPSendMessage_t *pSendMsg = lane.m_messagesQueued.m_pFirst;
+			Assert( lane.m_cbCurrentSendMessageSent < pSendMsg->m_cbSize );
+
+			// Switching lanes?  Message numbers and stream positions
+			// are per lane, so the next ones will be absolute
+			if ( idxLane != idxEncodeLane )
+			{
+				cbBytesRemainingForSegments -= SNPSelectLaneFrameSize( idxLane );
+				idxEncodeLane = idxLane;
+				nLastMsgNum = 0;
+				nLastReliableStreamPosEnd = 0;
+			}
 
 			// Start a new segment
 			EncodedSegment &seg = *push_back_get_ptr( vecSegments );
+			seg.m_idxLane = idxLane;
 
 			// Reliable?
 			bool bLastSegment = false;
@@ -1456,14 +2104,14 @@ int CSteamNetworkConnectionBase::SNP_SendPacket( SteamNetworkingMicroseconds use
 
 				// FIXME - Coalesce adjacent reliable messages ranges
 
-				int64 nBegin = pSendMsg->m_nReliableStreamPos + m_senderState.m_cbCurrentSendMessageSent;
+				int64 nBegin = pSendMsg->m_nReliableStreamPos + lane.m_cbCurrentSendMessageSent;
 
 				// How large would we like this segment to be,
 				// ignoring how much space is left in the packet.
 				// We limit the size of reliable segments, to make
 				// sure that we don't make an excessively large
 				// one and then have a hard time retrying it later.
-				int cbDesiredSegSize = pSendMsg->m_cbSize - m_senderState.m_cbCurrentSendMessageSent;
+				int cbDesiredSegSize = pSendMsg->m_cbSize - lane.m_cbCurrentSendMessageSent;
 				if ( cbDesiredSegSize > k_cbSteamNetworkingSocketsMaxReliableMessageSegment )
 				{
 					cbDesiredSegSize = k_cbSteamNetworkingSocketsMaxReliableMessageSegment;
@@ -1478,7 +2126,7 @@ int CSteamNetworkConnectionBase::SNP_SendPacket( SteamNetworkingMicroseconds use
 			}
 			else
 			{
-				seg.SetupUnreliable( pSendMsg, m_senderState.m_cbCurrentSendMessageSent, nLastMsgNum );
+				seg.SetupUnreliable( pSendMsg, lane.m_cbCurrentSendMessageSent, nLastMsgNum );
 			}
 
 			// Can't fit the whole thing?
@@ -1501,23 +2149,25 @@ int CSteamNetworkConnectionBase::SNP_SendPacket( SteamNetworkingMicroseconds use
 
 				// Truncate, and leave the message in the queue
 				seg.m_cbSize = std::min( seg.m_cbSize, cbBytesRemainingForSegments - seg.m_cbHdr );
-				m_senderState.m_cbCurrentSendMessageSent += seg.m_cbSize;
-				Assert( m_senderState.m_cbCurrentSendMessageSent < pSendMsg->m_cbSize );
+				lane.m_cbCurrentSendMessageSent += seg.m_cbSize;
+				Assert( lane.m_cbCurrentSendMessageSent < pSendMsg->m_cbSize );
 				cbBytesRemainingForSegments -= seg.m_cbHdr + seg.m_cbSize;
+				lane.AdvanceVirtualTime( seg.m_cbHdr + seg.m_cbSize );
 				break;
 			}
 
 			// The whole message fit (perhaps exactly, without the size byte)
 			// Reset send pointer for the next message
-			Assert( m_senderState.m_cbCurrentSendMessageSent + seg.m_cbSize == pSendMsg->m_cbSize );
-			m_senderState.m_cbCurrentSendMessageSent = 0;
+			Assert( lane.m_cbCurrentSendMessageSent + seg.m_cbSize == pSendMsg->m_cbSize );
+			lane.m_cbCurrentSendMessageSent = 0;
 
 			// Remove message from queue,w e have transfered ownership to the segment and will
 			// dispose of the message when we serialize the segments
-			m_senderState.m_messagesQueued.pop_front();
+			lane.m_messagesQueued.pop_front();
 
 			// Consume payload bytes
 			cbBytesRemainingForSegments -= seg.m_cbHdr + seg.m_cbSize;
+			lane.AdvanceVirtualTime( seg.m_cbHdr + seg.m_cbSize );
 
 			// Assume for now this won't be the last segment, in which case we will also need the byte for the size field.
 			// NOTE: This might cause cbPayloadBytesRemaining to go negative by one!  I know that seems weird, but it actually
@@ -1533,7 +2183,7 @@ int CSteamNetworkConnectionBase::SNP_SendPacket( SteamNetworkingMicroseconds use
 					++nLastMsgNum;
 
 				// Go ahead and add us to the end of the list of unacked messages
-				m_senderState.m_unackedReliableMessages.push_back( seg.m_pMsg );
+				lane.m_unackedReliableMessages.push_back( seg.m_pMsg );
 			}
 			else
 			{
@@ -1542,6 +2192,12 @@ int CSteamNetworkConnectionBase::SNP_SendPacket( SteamNetworkingMicroseconds use
 				// Set the "This is the last segment in this message" header bit
 				seg.m_hdr[0] |= 0x20;
 			}
+
+			// The explicit size field can't encode a segment this big.  (Only
+			// possible for an unreliable message when our packets are larger
+			// than the base MTU.)  It has to be the last segment in the packet.
+			if ( seg.m_cbSize > k_cbSNPMaxExplicitSegmentSize )
+				break;
 		}
 	}
 
@@ -1563,6 +2219,7 @@ int CSteamNetworkConnectionBase::SNP_SendPacket( SteamNetworkingMicroseconds use
 		uint8 *pAfterAcks = SNP_SerializeAckBlocks( ackHelper, pPayloadPtr, pAckEnd, usecNow );
 		if ( pAfterAcks == nullptr )
 			return -1; // bug!  Abort
+		bHaveAcks |= pAfterAcks > pPayloadPtr;
 
 		int cbAckBytesWritten = pAfterAcks - pPayloadPtr;
 		if ( cbAckBytesWritten > cbReserveForAcks )
@@ -1592,22 +2249,76 @@ int CSteamNetworkConnectionBase::SNP_SendPacket( SteamNetworkingMicroseconds use
 	// segment, which doesn't actually need to be sent
 	Assert( cbBytesRemainingForSegments >= 0 || ( cbBytesRemainingForSegments == -1 && vecSegments.size() > 0 ) );
 
+	// If this packet is the tail of a burst of reliable data, the peer might
+	// sit on the ack, and we won't send anything else to prompt it.  Ask them
+	// to ack right away.  (Packets sent at a steady trickle, which drain the
+	// queue every time, don't ask for this, so those acks can be coalesced.)
+	// Ack-only packets count against our peer's rate limit, so don't ask
+	// more often than they would send acks on the timer anyway.
+	if ( !vecSegments.empty() )
+	{
+		bool bDrained = m_senderState.ChooseLaneToRetry() < 0 && m_senderState.ChooseLaneToSend() < 0;
+		if (
+			bDrained && m_senderState.m_bBacklogged
+			&& cbBytesRemainingForSegments > 0
+			&& m_statsEndToEnd.m_nPeerProtocolVersion >= k_nMinPeerProtocolVersionAckFrequency
+			&& usecNow >= m_senderState.m_usecLastImmediateAckRequest + std::max( (SteamNetworkingMicroseconds)m_statsEndToEnd.m_ping.m_nSmoothedPing*1000, m_senderState.m_usecMaxAckDelaySent )
+		) {
+			for ( const EncodedSegment &seg: vecSegments )
+			{
+				if ( seg.m_pMsg->m_nReliableStreamPos > 0 )
+				{
+					*(pPayloadPtr++) = 0x87;
+					--cbBytesRemainingForSegments;
+					m_senderState.m_usecLastImmediateAckRequest = usecNow;
+					break;
+				}
+			}
+		}
+		m_senderState.m_bBacklogged = !bDrained;
+	}
+
+	// Ack accounting
+	if ( bHaveAcks )
+	{
+		++m_receiverState.m_nPktsSentWithAck;
+		if ( vecSegments.empty() && !bPMTUProbe )
+			++m_receiverState.m_nPktsSentAckOnly;
+	}
+
 	// OK, now go through and actually serialize the segments
 	int nSegments = len( vecSegments );
+	int idxSerializeLane = 0;
 	for ( int idx = 0 ; idx < nSegments ; ++idx )
 	{
 		EncodedSegment &seg = vecSegments[ idx ];
+		SSNPSendLane &lane = m_senderState.m_vecLanes[ seg.m_idxLane ];
+
+		// Switch lanes, if necessary.  We reserved space for this above
+		if ( seg.m_idxLane != idxSerializeLane )
+		{
+			idxSerializeLane = seg.m_idxLane;
+			if ( idxSerializeLane < 7 )
+			{
+				*(pPayloadPtr++) = uint8( 0x88 | idxSerializeLane );
+			}
+			else
+			{
+				*(pPayloadPtr++) = 0x8f;
+				pPayloadPtr = SerializeVarInt( pPayloadPtr, (uint32)idxSerializeLane );
+			}
+		}
 
 		// Check if this message is still sitting in the queue.  (If so, it has to be the first one!)
-		bool bStillInQueue = ( seg.m_pMsg == m_senderState.m_messagesQueued.m_pFirst );
+		bool bStillInQueue = ( seg.m_pMsg == lane.m_messagesQueued.m_pFirst );
 
 		// Finish the segment size byte
 		if ( idx < nSegments-1 )
 		{
 			// Stash upper 3 bits into the header
 			int nUpper3Bits = ( seg.m_cbSize>>8 );
-			Assert( nUpper3Bits <= 4 ); // The values 5 and 6 are reserved and shouldn't be needed due to the MTU we support
-			seg.m_hdr[0] |= nUpper3Bits;
+			Assert( nUpper3Bits <= 4 ); // The values 5 and 6 are reserved.  Bigger segments are always placed last
+			seg.m_hdr[ seg.m_idxLeadByte ] |= nUpper3Bits;
 
 			// And the lower 8 bits follow the other fields
 			seg.m_hdr[ seg.m_cbHdr++ ] = uint8( seg.m_cbSize );
@@ -1615,7 +2326,7 @@ int CSteamNetworkConnectionBase::SNP_SendPacket( SteamNetworkingMicroseconds use
 		else
 		{
 			// Set "no explicit size field included, segment extends to end of packet"
-			seg.m_hdr[0] |= 7;
+			seg.m_hdr[ seg.m_idxLeadByte ] |= 7;
 		}
 
 		// Double-check that we didn't overflow
@@ -1643,20 +2354,23 @@ int CSteamNetworkConnectionBase::SNP_SendPacket( SteamNetworkingMicroseconds use
 			// Ranges of the reliable stream that have not been acked should either be
 			// in flight, or queued for retry.  Make sure this range is not already in
 			// either state.
-			Assert( !HasOverlappingRange( range, m_senderState.m_listInFlightReliableRange ) );
-			Assert( !HasOverlappingRange( range, m_senderState.m_listReadyRetryReliableRange ) );
+			Assert( !HasOverlappingRange( range, lane.m_listInFlightReliableRange ) );
+			Assert( !HasOverlappingRange( range, lane.m_listReadyRetryReliableRange ) );
 
 			// Spew
-			SpewType( steamdatagram_snp_log_packet+1, "[%s]   encode pkt %lld reliable msg %lld offset %d+%d=%d range [%lld,%lld)\n",
-				GetDescription(), (long long)m_statsEndToEnd.m_nNextSendSequenceNumber, (long long)seg.m_pMsg->m_nMsgNum,
+			SpewType( steamdatagram_snp_log_packet+1, "[%s]   encode pkt %lld lane %d reliable msg %lld offset %d+%d=%d range [%lld,%lld)\n",
+				GetDescription(), (long long)m_statsEndToEnd.m_nNextSendSequenceNumber, seg.m_idxLane, (long long)seg.m_pMsg->m_nMsgNum,
 				seg.m_nOffset, seg.m_cbSize, seg.m_nOffset+seg.m_cbSize,
 				(long long)range.m_nBegin, (long long)range.m_nEnd );
 
 			// Add to table of in-flight reliable ranges
-			m_senderState.m_listInFlightReliableRange[ range ] = seg.m_pMsg;
+			lane.m_listInFlightReliableRange[ range ] = seg.m_pMsg;
 
 			// Remember that this packet contained that range
-			inFlightPkt.m_vecReliableSegments.push_back( range );
+			SNPRangeWithLane &rangeWithLane = *push_back_get_ptr( inFlightPkt.m_vecReliableSegments );
+			rangeWithLane.m_nBegin = range.m_nBegin;
+			rangeWithLane.m_nEnd = range.m_nEnd;
+			rangeWithLane.m_idxLane = seg.m_idxLane;
 
 			// Less reliable data pending
 			m_senderState.m_cbPendingReliable -= seg.m_cbSize;
@@ -1674,8 +2388,8 @@ int CSteamNetworkConnectionBase::SNP_SendPacket( SteamNetworkingMicroseconds use
 			Assert( seg.m_pMsg->m_pPrev == nullptr ); // We should either be at the head of the queue, or detached
 
 			// Spew
-			SpewType( steamdatagram_snp_log_packet+1, "[%s]   encode pkt %lld unreliable msg %lld offset %d+%d=%d\n",
-				GetDescription(), (long long)m_statsEndToEnd.m_nNextSendSequenceNumber, (long long)seg.m_pMsg->m_nMsgNum,
+			SpewType( steamdatagram_snp_log_packet+1, "[%s]   encode pkt %lld lane %d unreliable msg %lld offset %d+%d=%d\n",
+				GetDescription(), (long long)m_statsEndToEnd.m_nNextSendSequenceNumber, seg.m_idxLane, (long long)seg.m_pMsg->m_nMsgNum,
 				seg.m_nOffset, seg.m_cbSize, seg.m_nOffset+seg.m_cbSize );
 
 			// Less unreliable data pending
@@ -1690,6 +2404,16 @@ int CSteamNetworkConnectionBase::SNP_SendPacket( SteamNetworkingMicroseconds use
 
 	// One last check for overflow
 	Assert( pPayloadPtr <= pPayloadEnd );
+
+	// Pad out probes to the full size
+	if ( bPMTUProbe && pPayloadPtr < pPadEnd )
+	{
+		*(pPayloadPtr++) = 0x84;
+		memset( pPayloadPtr, 0, pPadEnd - pPayloadPtr );
+		pPayloadPtr = pPadEnd;
+		pPayloadEnd = pPadEnd;
+	}
+
 	int cbPlainText = pPayloadPtr - payload;
 	if ( cbPlainText > cbMaxPlaintextPayload )
 	{
@@ -1708,7 +2432,7 @@ int CSteamNetworkConnectionBase::SNP_SendPacket( SteamNetworkingMicroseconds use
 	COMPILE_TIME_ASSERT( k_cbSteamNetworkingSocketsMaxPlaintextPayloadSend >= k_cbSteamNetworkingSocketsMaxEncryptedPayloadSend - 4 );
 
 	// Encrypt the chunk
-	uint8 arEncryptedChunk[ k_cbSteamNetworkingSocketsMaxEncryptedPayloadSend + 64 ]; // Should not need pad
+	uint8 arEncryptedChunk[ k_cbSteamNetworkingSocketsMaxEncryptedPayloadSendJumbo + 64 ]; // Should not need pad
 	*(uint64 *)&m_cryptIVSend.m_buf = LittleQWord( m_statsEndToEnd.m_nNextSendSequenceNumber );
 	uint32 cbEncrypted = sizeof(arEncryptedChunk);
 	DbgVerify( CCrypto::SymmetricEncryptWithIV(
@@ -1718,7 +2442,7 @@ int CSteamNetworkConnectionBase::SNP_SendPacket( SteamNetworkingMicroseconds use
 		m_cryptKeySend.m_buf, m_cryptKeySend.k_nSize // Key
 	) );
 	Assert( (int)cbEncrypted >= cbPlainText );
-	Assert( (int)cbEncrypted <= k_cbSteamNetworkingSocketsMaxEncryptedPayloadSend ); // confirm that pad above was not necessary and we never exceed k_nMaxSteamDatagramTransportPayload, even after encrypting
+	Assert( (int)cbEncrypted <= std::max( cbMaxEncryptedPayload, k_cbSteamNetworkingSocketsMaxEncryptedPayloadSend ) ); // confirm that pad above was not necessary and we never exceed k_nMaxSteamDatagramTransportPayload, even after encrypting
 
 	//SpewMsg( "Send encrypt IV %llu + %02x%02x%02x%02x, key %02x%02x%02x%02x\n", *(uint64 *)&m_cryptIVSend.m_buf, m_cryptIVSend.m_buf[8], m_cryptIVSend.m_buf[9], m_cryptIVSend.m_buf[10], m_cryptIVSend.m_buf[11], m_cryptKeySend.m_buf[0], m_cryptKeySend.m_buf[1], m_cryptKeySend.m_buf[2], m_cryptKeySend.m_buf[3] );
 
@@ -1727,6 +2451,25 @@ int CSteamNetworkConnectionBase::SNP_SendPacket( SteamNetworkingMicroseconds use
 	if ( nBytesSent <= 0 )
 		return -1;
 
+	// Snapshot delivery rate state.  If nothing was in flight, we are
+	// starting a new sampling interval.
+	if ( m_senderState.m_cbInFlight == 0 )
+	{
+		m_senderState.m_usecFirstSentTime = usecNow;
+		m_senderState.m_usecDeliveredTime = usecNow;
+	}
+	inFlightPkt.m_cbWire = nBytesSent;
+	inFlightPkt.m_nDeliveredAtSend = m_senderState.m_nDelivered;
+	inFlightPkt.m_usecDeliveredTimeAtSend = m_senderState.m_usecDeliveredTime;
+	inFlightPkt.m_usecFirstSentTimeAtSend = m_senderState.m_usecFirstSentTime;
+	inFlightPkt.m_bAppLimited = m_senderState.TimeWhenWantToSendNextPacket() > usecNow;
+	inFlightPkt.m_bAboveBasePMTU = (int)cbEncrypted > k_cbSteamNetworkingSocketsMaxEncryptedPayloadSend;
+	if ( bPMTUProbe )
+		m_senderState.m_nPMTUProbePktNum = pairInsert.first;
+	m_senderState.m_cbInFlight += nBytesSent;
+	if ( m_senderState.m_pCongestionControl )
+		m_senderState.m_pCongestionControl->OnPacketSent( nBytesSent, m_senderState.m_cbInFlight, usecNow );
+
 	// We sent a packet.  Track it
 	auto pairInsertResult = m_senderState.m_mapInFlightPacketsByPktNum.insert( pairInsert );
 	Assert( pairInsertResult.second ); // We should have inserted a new element, not updated an existing element
@@ -1741,6 +2484,19 @@ int CSteamNetworkConnectionBase::SNP_SendPacket( SteamNetworkingMicroseconds use
 
 	// We spent some tokens
 	m_senderState.m_flTokenBucket -= (float)nBytesSent;
+
+	if ( BPacketTraceEnabled( m_hConnectionSelf ) )
+	{
+		PacketTraceEvent_t &e = PacketTraceBeginEvent( k_EPacketTraceEvent_SNPSend, m_hConnectionSelf, usecNow );
+		e.m_nPktNum = pairInsert.first;
+		e.m_cbSize = (uint16)nBytesSent;
+		e.m_nSegments = (uint8)Min( nSegments, 255 );
+		e.m_nAckBlocks = bHaveAcks ? (int16)ackHelper.m_nBlocks : -1;
+		e.m_nAckPktNum = bHaveAcks ? m_statsEndToEnd.m_nLastRecvSequenceNumber : 0;
+		e.m_nTokenBucket = (int32)m_senderState.m_flTokenBucket;
+		e.m_nSendRate = m_senderState.m_n_x;
+	}
+
 	return nBytesSent;
 }
 
@@ -1807,7 +2563,7 @@ uint8 *CSteamNetworkConnectionBase::SNP_SerializeAckBlocks( const SNPAckSerializ
 	// Never received anything?
 	if ( m_statsEndToEnd.m_nLastRecvSequenceNumber == 0 )
 	{
-		m_receiverState.m_usecWhenFlushAck = INT64_MAX;
+		m_receiverState.ClearNeedToSendAck();
 		return pOut;
 	}
 
@@ -1839,7 +2595,7 @@ uint8 *CSteamNetworkConnectionBase::SNP_SerializeAckBlocks( const SNPAckSerializ
 			GetDescription(),
 			(long long)m_statsEndToEnd.m_nNextSendSequenceNumber, (long long)nLastRecvPktNum
 		);
-		m_receiverState.m_usecWhenFlushAck = INT64_MAX; // Clear timer, we wrote everything we needed to
+		m_receiverState.ClearNeedToSendAck(); // Clear timer, we wrote everything we needed to
 		return pOut;
 	}
 
@@ -1982,8 +2738,70 @@ uint8 *CSteamNetworkConnectionBase::SNP_SerializeAckBlocks( const SNPAckSerializ
 	// NOTE: This assumes that helper.m_nBlocks wasn't artificially limited
 	// due to trying to fit in a special space-limited packet
 	if ( nBlocks == helper.m_nBlocks )
-		m_receiverState.m_usecWhenFlushAck = INT64_MAX;
+		m_receiverState.ClearNeedToSendAck();
+
+	return pOut;
+}
+
+void CSteamNetworkConnectionBase::SNP_FlushAcksSoon( SteamNetworkingMicroseconds usecNow )
+{
+	// If we're about to send data anyway, the acks can ride along.  Sending
+	// a separate packet just for them would eat into our rate limit, and
+	// when we are saturated, it would just delay that data.
+	// And even if we have nothing else to send, don't blow through the
+	// rate limit just for an ack.
+	SteamNetworkingMicroseconds usecFlush = m_senderState.TimeWhenWantToSendNextPacket();
+	if ( usecFlush == INT64_MAX )
+		usecFlush = usecNow;
+	usecFlush = std::max( usecFlush, usecNow + m_senderState.CalcTimeUntilNextSend() );
+	m_receiverState.m_usecWhenFlushAck = std::min( m_receiverState.m_usecWhenFlushAck, usecFlush );
+}
+
+uint8 *CSteamNetworkConnectionBase::SNP_SerializeAckFrequencyFrame( uint8 *pOut, const uint8 *pOutEnd, SteamNetworkingMicroseconds usecNow )
+{
+	if ( m_statsEndToEnd.m_nPeerProtocolVersion < k_nMinPeerProtocolVersionAckFrequency )
+		return pOut;
+
+	// What do we want?  Until we have a ping estimate, use the max delay
+	int nPacketTolerance = Clamp( steamdatagram_snp_ack_packet_tolerance, 0, k_nMaxAckPacketTolerance );
+	SteamNetworkingMicroseconds usecMaxAckDelay = k_usecMaxDataAckDelay;
+	if ( steamdatagram_snp_ack_delay_pct_rtt > 0 && m_statsEndToEnd.m_ping.m_nSmoothedPing >= 0 )
+	{
+		usecMaxAckDelay = (SteamNetworkingMicroseconds)m_statsEndToEnd.m_ping.m_nSmoothedPing * 1000 * Clamp( steamdatagram_snp_ack_delay_pct_rtt, 1, 100 ) / 100;
+		usecMaxAckDelay = Clamp( usecMaxAckDelay, k_usecMinAckDelay, k_usecMaxDataAckDelay );
+	}
+
+	// Only bother the peer if it changed by a meaningful amount.  Otherwise, keep
+	// resending the current request until it gets through
+	bool bChanged = nPacketTolerance != m_senderState.m_nAckPacketToleranceSent
+		|| std::abs( usecMaxAckDelay - m_senderState.m_usecMaxAckDelaySent ) > m_senderState.m_usecMaxAckDelaySent/4;
+	if ( !bChanged )
+	{
+		if ( m_senderState.m_bAckFrequencyAcked )
+			return pOut;
+		if ( usecNow < m_senderState.m_usecAckFrequencySent + k_usecMaxDataAckDelay + m_statsEndToEnd.m_ping.m_nSmoothedPing*2000 )
+			return pOut;
+		nPacketTolerance = m_senderState.m_nAckPacketToleranceSent;
+		usecMaxAckDelay = m_senderState.m_usecMaxAckDelaySent;
+	}
+
+	// Make sure we have room.  Each varint is at most 3 bytes
+	if ( pOut + 7 > pOutEnd )
+		return pOut;
+
+	*(pOut++) = 0x86;
+	pOut = SerializeVarInt( pOut, (uint32)nPacketTolerance );
+	pOut = SerializeVarInt( pOut, (uint32)( usecMaxAckDelay >> k_nAckDelayPrecisionShift ) );
 
+	SpewType( steamdatagram_snp_log_packet+1, "[%s]   encode pkt %lld ack frequency %d pkts, %lldusec\n",
+		GetDescription(),
+		(long long)m_statsEndToEnd.m_nNextSendSequenceNumber, nPacketTolerance, (long long)usecMaxAckDelay );
+
+	m_senderState.m_nAckPacketToleranceSent = nPacketTolerance;
+	m_senderState.m_usecMaxAckDelaySent = usecMaxAckDelay;
+	m_senderState.m_nAckFrequencyPktNum = m_statsEndToEnd.m_nNextSendSequenceNumber;
+	m_senderState.m_usecAckFrequencySent = usecNow;
+	m_senderState.m_bAckFrequencyAcked = false;
 	return pOut;
 }
 
@@ -2048,9 +2866,9 @@ uint8 *CSteamNetworkConnectionBase::SNP_SerializeStopWaitingFrame( uint8 *pOut,
 	return pOut;
 }
 
-void CSteamNetworkConnectionBase::SNP_ReceiveUnreliableSegment( int64 nMsgNum, int nOffset, const void *pSegmentData, int cbSegmentSize, bool bLastSegmentInMessage, SteamNetworkingMicroseconds usecNow )
+void CSteamNetworkConnectionBase::SNP_ReceiveUnreliableSegment( int idxLane, int64 nMsgNum, int nOffset, const void *pSegmentData, int cbSegmentSize, bool bLastSegmentInMessage, SteamNetworkingMicroseconds usecNow )
 {
-	SpewType( steamdatagram_snp_log_packet+1, "[%s] RX msg %lld offset %d+%d=%d %02x ... %02x\n", GetDescription(), nMsgNum, nOffset, cbSegmentSize, nOffset+cbSegmentSize, ((byte*)pSegmentData)[0], ((byte*)pSegmentData)[cbSegmentSize-1] );
+	SpewType( steamdatagram_snp_log_packet+1, "[%s] RX lane %d msg %lld offset %d+%d=%d %02x ... %02x\n", GetDescription(), idxLane, nMsgNum, nOffset, cbSegmentSize, nOffset+cbSegmentSize, ((byte*)pSegmentData)[0], ((byte*)pSegmentData)[cbSegmentSize-1] );
 
 	// Check for a common special case: non-fragmented message.
 	if ( nOffset == 0 && bLastSegmentInMessage )
@@ -2058,127 +2876,190 @@ void CSteamNetworkConnectionBase::SNP_ReceiveUnreliableSegment( int64 nMsgNum, i
 
 		// Deliver it immediately, don't go through the fragmentation assembly process below.
 		// (Although that would work.)
-		ReceivedMessage( pSegmentData, cbSegmentSize, nMsgNum, usecNow );
+		ReceivedMessage( pSegmentData, cbSegmentSize, idxLane, nMsgNum, usecNow );
 		return;
 	}
 
-	// Limit number of unreliable segments
-	// We store.  We just use a fixed limit, rather than
-	// trying to be smart by expiring based on time or whatever.
-	if ( len( m_receiverState.m_mapUnreliableSegments ) > k_nMaxBufferedUnreliableSegments )
+	// Sender never fragments messages larger than this.  (It sends them reliably.)
+	int nSegEnd = nOffset + cbSegmentSize;
+	if ( nOffset < 0 || nSegEnd > k_cbMaxUnreliableMsgSize )
 	{
-		auto itDelete = m_receiverState.m_mapUnreliableSegments.begin();
-
-		// If we're going to delete some, go ahead and delete all of them for this
-		// message.
-		int64 nDeleteMsgNum = itDelete->first.m_nMsgNum;
-		do {
-			itDelete = m_receiverState.m_mapUnreliableSegments.erase( itDelete );
-		} while ( itDelete != m_receiverState.m_mapUnreliableSegments.end() && itDelete->first.m_nMsgNum == nDeleteMsgNum );
-
-		// Warn if the message we are receiving is older (or the same) than the one
-		// we are deleting.  If sender is legit, then it probably means that we have
-		// something tuned badly.
-		if ( nDeleteMsgNum >= nMsgNum )
+		// Spew, but rate limit in case of malicious sender
+		SpewWarningRateLimited( usecNow, "[%s] Unreliable msg %lld segment %d+%d is out of range; ignoring\n",
+			GetDescription(), (long long)nMsgNum, nOffset, cbSegmentSize );
+		return;
+	}
+
+	// Locate the entry for this message in the reassembly table.  While we are
+	// scanning, expire any partial messages that have been sitting around
+	// for too long, and remember which slot we would take if we need one.
+	if ( !m_receiverState.m_pUnreliableReassembly )
+		m_receiverState.m_pUnreliableReassembly = new SSNPRecvUnreliableMsg[ k_nMaxUnreliableReassemblyMsgs ];
+	SSNPRecvUnreliableMsg *pEntry = nullptr;
+	SSNPRecvUnreliableMsg *pFree = nullptr;
+	SSNPRecvUnreliableMsg *pOldest = nullptr;
+	for ( int i = 0 ; i < k_nMaxUnreliableReassemblyMsgs ; ++i )
+	{
+		SSNPRecvUnreliableMsg &r = m_receiverState.m_pUnreliableReassembly[i];
+		if ( r.m_pMsg && r.m_usecFirstSegment + k_usecUnreliableReassemblyTimeout < usecNow )
+		{
+			SpewVerbose( "[%s] Expiring partial unreliable msg %lld\n", GetDescription(), (long long)r.m_nMsgNum );
+			r.Reset();
+		}
+		if ( !r.m_pMsg )
+		{
+			if ( !pFree )
+				pFree = &r;
+		}
+		else if ( r.m_nMsgNum == nMsgNum && r.m_idxLane == idxLane )
 		{
-			// Spew, but rate limit in case of malicious sender
-			SpewWarningRateLimited( usecNow, "SNP expiring unreliable segments for msg %lld, while receiving unreliable segments for msg %lld\n",
-				(long long)nDeleteMsgNum, (long long)nMsgNum );
+			pEntry = &r;
+		}
+		else if ( !pOldest || r.m_usecFirstSegment < pOldest->m_usecFirstSegment )
+		{
+			pOldest = &r;
 		}
 	}
 
-	// Message fragment.  Find/insert the entry in our reassembly queue
-	// I really hate this syntax and interface.
-	SSNPRecvUnreliableSegmentKey key;
-	key.m_nMsgNum = nMsgNum;
-	key.m_nOffset = nOffset;
-	SSNPRecvUnreliableSegmentData &data = m_receiverState.m_mapUnreliableSegments[ key ];
-	if ( data.m_cbSize >= 0 )
+	// First segment we have received for this message?
+	if ( !pEntry )
 	{
+		if ( pFree )
+		{
+			pEntry = pFree;
+		}
+		else
+		{
+			// Table is full.  Discard the oldest partial message.
+			Assert( pOldest );
+			pEntry = pOldest;
+
+			// Warn if the message we are receiving is older (or the same) than the one
+			// we are deleting.  If sender is legit, then it probably means that we have
+			// something tuned badly.
+			if ( pOldest->m_idxLane == idxLane && pOldest->m_nMsgNum >= nMsgNum )
+			{
+				// Spew, but rate limit in case of malicious sender
+				SpewWarningRateLimited( usecNow, "SNP expiring unreliable segments for msg %lld, while receiving unreliable segments for msg %lld\n",
+					(long long)pOldest->m_nMsgNum, (long long)nMsgNum );
+			}
+			pOldest->Reset();
+		}
 
-		// We got the same segment twice (weird, since they shouldn't be doing
-		// retry -- but remember that we're working on top of UDP, which could deliver packets
-		// multiple times).  Duplicate packet delivery is actually really rare, let's spew about it.
-		SpewMsg( "Received unreliable msg %lld offset %d twice.  Sizes %d,%d\n", nMsgNum, nOffset, data.m_cbSize, cbSegmentSize );
+		// Allocate the message now, and reassemble directly into it.  We don't
+		// know the final size until we get the last segment, but we do know the
+		// upper limit.  If we got the last segment first, then we know it exactly.
+		int cbCapacity = bLastSegmentInMessage ? nSegEnd : k_cbMaxUnreliableMsgSize;
+		pEntry->m_pMsg = CSteamNetworkingMessage::New( this, cbCapacity, nMsgNum, usecNow );
+		pEntry->m_pMsg->m_idxLane = uint16( idxLane );
+		pEntry->m_idxLane = idxLane;
+		pEntry->m_nMsgNum = nMsgNum;
+		pEntry->m_usecFirstSegment = usecNow;
+		pEntry->m_cbTotal = -1;
+		pEntry->m_nRanges = 0;
 	}
-
-	if ( data.m_cbSize >= cbSegmentSize )
+	SSNPRecvUnreliableMsg &entry = *pEntry;
+
+	// Check the segment against what we know about the size of the message.
+	// Only a buggy or malicious sender would violate these, so just discard
+	// the whole thing.
+	if ( ( entry.m_cbTotal >= 0 && nSegEnd > entry.m_cbTotal )
+		|| ( bLastSegmentInMessage && ( ( entry.m_cbTotal >= 0 && nSegEnd != entry.m_cbTotal ) || ( entry.m_nRanges > 0 && nSegEnd < entry.m_arRanges[ entry.m_nRanges-1 ].m_nEnd ) ) )
+		|| ( entry.m_cbTotal < 0 && nSegEnd > (int)entry.m_pMsg->m_cbSize ) )
 	{
-
-		// The data we already have is either a duplicate, or a superset.
-		// So ignore this incoming segment.
+		SpewWarningRateLimited( usecNow, "[%s] Unreliable msg %lld segment %d+%d (last=%d) is inconsistent with other segments; discarding message\n",
+			GetDescription(), (long long)nMsgNum, nOffset, cbSegmentSize, (int)bLastSegmentInMessage );
+		entry.Reset();
 		return;
 	}
 
-	// Segment in the map either just got inserted, or is a subset of the segment
-	// we just received.  Replace it.
-	data.m_cbSize = cbSegmentSize;
-	Assert( !data.m_bLast ); // sender is doing weird stuff or we have a bug
-	data.m_bLast = bLastSegmentInMessage;
-	memcpy( data.m_buf, pSegmentData, cbSegmentSize );
-
-	// Now check if that completed the message
-	key.m_nOffset = 0;
-	auto itMsgStart = m_receiverState.m_mapUnreliableSegments.lower_bound( key );
-	auto end = m_receiverState.m_mapUnreliableSegments.end();
-	Assert( itMsgStart != end );
-	auto itMsgLast = itMsgStart;
-	int cbMessageSize = 0;
-	for (;;)
+	// Merge the segment into the list of received ranges.  Ranges that overlap
+	// or touch the new segment are coalesced with it.
+	SSNPRecvUnreliableMsg::Range_t arNewRanges[ k_nMaxUnreliableReassemblyRanges+1 ];
+	int nNewRanges = 0;
+	SSNPRecvUnreliableMsg::Range_t merged = { nOffset, nSegEnd };
+	bool bInserted = false;
+	for ( int i = 0 ; i < entry.m_nRanges ; ++i )
 	{
-		// Is this the thing we expected?
-		if ( itMsgLast->first.m_nMsgNum != nMsgNum || itMsgLast->first.m_nOffset > cbMessageSize )
-			return; // We've got a gap.
-
-		// Update.  This code looks more complicated than strictly necessary, but it works
-		// if we have overlapping segments.
-		cbMessageSize = Max( cbMessageSize, itMsgLast->first.m_nOffset + itMsgLast->second.m_cbSize );
-
-		// Is that the end?
-		if ( itMsgLast->second.m_bLast )
-			break;
+		const SSNPRecvUnreliableMsg::Range_t &r = entry.m_arRanges[i];
+		if ( r.m_nBegin <= nOffset && nSegEnd <= r.m_nEnd )
+		{
 
-		// Still looking for the end
-		++itMsgLast;
-		if ( itMsgLast == end )
+			// We got the same segment twice (weird, since they shouldn't be doing
+			// retry -- but remember that we're working on top of UDP, which could deliver packets
+			// multiple times).  Duplicate packet delivery is actually really rare, let's spew about it.
+			SpewMsg( "Received unreliable msg %lld offset %d+%d twice\n", nMsgNum, nOffset, cbSegmentSize );
 			return;
+		}
+		if ( r.m_nEnd < merged.m_nBegin )
+		{
+			arNewRanges[ nNewRanges++ ] = r;
+		}
+		else if ( r.m_nBegin > merged.m_nEnd )
+		{
+			if ( !bInserted )
+			{
+				arNewRanges[ nNewRanges++ ] = merged;
+				bInserted = true;
+			}
+			arNewRanges[ nNewRanges++ ] = r;
+		}
+		else
+		{
+			merged.m_nBegin = Min( merged.m_nBegin, r.m_nBegin );
+			merged.m_nEnd = Max( merged.m_nEnd, r.m_nEnd );
+		}
 	}
-
-	// OK, we have the complete message!  Gather the
-	// segments into a contiguous buffer
-	uint8 *pMessage = new uint8[ cbMessageSize ];
-	for (;;)
+	if ( !bInserted )
+		arNewRanges[ nNewRanges++ ] = merged;
+	if ( nNewRanges > k_nMaxUnreliableReassemblyRanges )
 	{
-		Assert( itMsgStart->first.m_nMsgNum == nMsgNum );
-		memcpy( pMessage + itMsgStart->first.m_nOffset, itMsgStart->second.m_buf, itMsgStart->second.m_cbSize );
+		// Too fragmented.  Just drop this segment.  We've probably
+		// lost some pieces of this message anyway.
+		SpewWarningRateLimited( usecNow, "[%s] Unreliable msg %lld has too many gaps; dropping segment %d+%d\n",
+			GetDescription(), (long long)nMsgNum, nOffset, cbSegmentSize );
+		return;
+	}
+	memcpy( entry.m_arRanges, arNewRanges, nNewRanges * sizeof(arNewRanges[0]) );
+	entry.m_nRanges = nNewRanges;
+	if ( bLastSegmentInMessage )
+		entry.m_cbTotal = nSegEnd;
 
-		// Done?
-		if ( itMsgStart->second.m_bLast )
-			break;
+	// Write the segment directly into the message payload
+	memcpy( (uint8 *)entry.m_pMsg->m_pData + nOffset, pSegmentData, cbSegmentSize );
 
-		// Remove entry from list, and move onto the next entry
-		itMsgStart = m_receiverState.m_mapUnreliableSegments.erase( itMsgStart );
-	}
+	// Now check if that completed the message
+	if ( entry.m_cbTotal < 0 || entry.m_nRanges != 1 || entry.m_arRanges[0].m_nBegin != 0 || entry.m_arRanges[0].m_nEnd != entry.m_cbTotal )
+		return;
 
-	// Erase the last segment, and anything else we might have hanging around
-	// for this message (???)
-	do {
-		itMsgStart = m_receiverState.m_mapUnreliableSegments.erase( itMsgStart );
-	} while ( itMsgStart != end && itMsgStart->first.m_nMsgNum == nMsgNum );
+	// OK, we have the complete message!  Take it out of the table
+	CSteamNetworkingMessage *pMsg = entry.m_pMsg;
+	int cbMessageSize = entry.m_cbTotal;
+	entry.m_pMsg = nullptr;
+	entry.Reset();
 
-	// Deliver the message.
-	ReceivedMessage( pMessage, cbMessageSize, nMsgNum, usecNow );
+	// Trim the buffer to the actual size.  Shrinking a block
+	// is cheap, and we don't want the app holding onto the slack.
+	if ( (int)pMsg->m_cbSize != cbMessageSize )
+	{
+		void *pTrimmed = TaggedRealloc( pMsg->m_pData, cbMessageSize, k_ESteamNetworkingAllocTag_Message );
+		if ( pTrimmed )
+			pMsg->m_pData = pTrimmed;
+		pMsg->m_cbSize = cbMessageSize;
+	}
 
-	// Clean up
-	// !SPEED! It would be best if we could hand ownership of this buffer to
-	// ReceivedMessage, instead of having that function copy it.
-	delete[] pMessage;
+	// Deliver the message.  It was received when the last piece arrived
+	pMsg->m_usecTimeReceived = usecNow;
+	ReceivedMessage( pMsg );
 }
 
-bool CSteamNetworkConnectionBase::SNP_ReceiveReliableSegment( int64 nPktNum, int64 nSegBegin, const uint8 *pSegmentData, int cbSegmentSize, SteamNetworkingMicroseconds usecNow )
+bool CSteamNetworkConnectionBase::SNP_ReceiveReliableSegment( int64 nPktNum, int idxLane, int64 nSegBegin, const uint8 *pSegmentData, int cbSegmentSize, bool bUnorderedMsgStart, SteamNetworkingMicroseconds usecNow )
 {
+	SSNPRecvLane &lane = m_receiverState.m_vecLanes[ idxLane ];
+
 	// Calculate segment end stream position
 	int64 nSegEnd = nSegBegin + cbSegmentSize;
+	const int64 nUnorderedMsgBegin = bUnorderedMsgStart ? nSegBegin : 0;
 
 	// Spew
 	SpewType( steamdatagram_snp_log_packet, "[%s]   decode pkt %lld reliable range [%lld,%lld)\n",
@@ -2186,10 +3067,6 @@ bool CSteamNetworkConnectionBase::SNP_ReceiveReliableSegment( int64 nPktNum, int
 		(long long)nPktNum,
 		(long long)nSegBegin, (long long)nSegEnd );
 
-	// If they ever send us a reliable segment, then we should make sure we
-	// send them an ack of what we have.
-	m_receiverState.MarkNeedToSendAck( usecNow );
-
 	// No segment data?  Seems fishy, but if it happens, just skip it.
 	Assert( cbSegmentSize >= 0 );
 	if ( cbSegmentSize <= 0 )
@@ -2203,21 +3080,95 @@ bool CSteamNetworkConnectionBase::SNP_ReceiveReliableSegment( int64 nPktNum, int
 
 	// Check if the entire thing is stuff we have already received, then
 	// we can discard it
-	if ( nSegEnd <= m_receiverState.m_nReliableStreamPos )
+	if ( nSegEnd <= lane.m_nReliableStreamPos )
 		return true;
 
-	// !SPEED! Should we have a fast path here for small messages
-	// where we have nothing buffered, and avoid all the copying into the 
-	// stream buffer and decode directly.
-
 	// What do we expect to receive next?
-	const int64 nExpectNextStreamPos = m_receiverState.m_nReliableStreamPos + len( m_receiverState.m_bufReliableStream );
+	const int64 nExpectNextStreamPos = lane.m_nReliableStreamPos + lane.m_bufReliableStream.size();
+
+	// Fast path for the common case: no gaps, and this segment picks up right
+	// where the data we have left off.  Decode messages directly out of the
+	// packet.  The only thing we buffer is a partial message at the end, and
+	// when we get the rest of it, we only buffer as much as is needed to
+	// complete it.
+	if ( nSegBegin <= nExpectNextStreamPos && lane.m_mapReliableStreamGaps.empty() )
+	{
+
+		// Already have all of it?
+		if ( nSegEnd <= nExpectNextStreamPos )
+			return true;
+
+		// Skip anything we already have
+		int nSkip = int( nExpectNextStreamPos - nSegBegin );
+		pSegmentData += nSkip;
+		cbSegmentSize -= nSkip;
+		Assert( cbSegmentSize > 0 );
+
+		SpewType( steamdatagram_snp_log_packet+1, "[%s]   decode pkt %lld in place reliable bytes = %d [%lld,%lld), %d buffered\n",
+			GetDescription(),
+			(long long)nPktNum, cbSegmentSize,
+			(long long)nExpectNextStreamPos, (long long)nSegEnd,
+			lane.m_bufReliableStream.size() );
+
+		// Finish off the partial message we have buffered, if any
+		while ( !lane.m_bufReliableStream.empty() )
+		{
+			// How much more do we need?  If we haven't even got the
+			// whole header yet, we don't know, so just take enough
+			// for any header.  (We might overshoot, that's OK.)
+			int cbMsgTotal = 0;
+			int cbConsumed = SNP_DecodeReliableMessageFromBuffer( idxLane, 0, lane.m_bufReliableStream.size(), usecNow, &cbMsgTotal );
+			if ( cbConsumed < 0 )
+				return false;
+			Assert( cbConsumed == 0 ); // We should never keep a complete message in the buffer
+			int cbAppend = cbMsgTotal > 0 ? cbMsgTotal - lane.m_bufReliableStream.size() : k_cbSNPMaxReliableMsgHeader;
+			Assert( cbAppend > 0 );
+			cbAppend = std::min( cbAppend, cbSegmentSize );
+			lane.m_bufReliableStream.Append( pSegmentData, cbAppend );
+			pSegmentData += cbAppend;
+			cbSegmentSize -= cbAppend;
+
+			// Dispatch whatever we have completed
+			do
+			{
+				cbConsumed = SNP_DecodeReliableMessageFromBuffer( idxLane, 0, lane.m_bufReliableStream.size(), usecNow );
+				if ( cbConsumed < 0 )
+					return false;
+				if ( cbConsumed == 0 )
+					break;
+				lane.m_nReliableStreamPos += cbConsumed;
+				lane.m_bufReliableStream.PopFront( cbConsumed );
+			} while ( !lane.m_bufReliableStream.empty() );
+
+			if ( cbSegmentSize <= 0 )
+				return true;
+		}
+
+		// Nothing buffered.  Decode in place
+		do
+		{
+			int cbConsumed = SNP_DecodeReliableMessage( idxLane, lane.m_nReliableStreamPos, pSegmentData, cbSegmentSize, nullptr, 0, usecNow );
+			if ( cbConsumed < 0 )
+				return false;
+			if ( cbConsumed == 0 )
+			{
+				// Partial message.  Save it for later
+				lane.m_bufReliableStream.Append( pSegmentData, cbSegmentSize );
+				break;
+			}
+			pSegmentData += cbConsumed;
+			cbSegmentSize -= cbConsumed;
+			lane.m_nReliableStreamPos += cbConsumed;
+		} while ( cbSegmentSize > 0 );
+		return true;
+	}
+
 
 	// Check if we need to grow the reliable buffer to hold the data
 	if ( nSegEnd > nExpectNextStreamPos )
 	{
-		int64 cbNewSize = nSegEnd - m_receiverState.m_nReliableStreamPos;
-		Assert( cbNewSize > len( m_receiverState.m_bufReliableStream ) );
+		int64 cbNewSize = nSegEnd - lane.m_nReliableStreamPos;
+		Assert( cbNewSize > lane.m_bufReliableStream.size() );
 
 		// Check if we have too much data buffered, just stop processing
 		// this packet, and forget we ever received it.  We need to protect
@@ -2232,9 +3183,9 @@ bool CSteamNetworkConnectionBase::SNP_ReceiveReliableSegment( int64 nPktNum, int
 			SpewWarningRateLimited( usecNow, "[%s] decode pkt %lld abort.  %lld bytes reliable data buffered [%lld-%lld), new size would be %lld to %lld\n",
 				GetDescription(),
 				(long long)nPktNum,
-				(long long)m_receiverState.m_bufReliableStream.size(),
-				(long long)m_receiverState.m_nReliableStreamPos,
-				(long long)( m_receiverState.m_nReliableStreamPos + m_receiverState.m_bufReliableStream.size() ),
+				(long long)lane.m_bufReliableStream.size(),
+				(long long)lane.m_nReliableStreamPos,
+				(long long)( lane.m_nReliableStreamPos + lane.m_bufReliableStream.size() ),
 				(long long)cbNewSize, (long long)nSegEnd
 			);
 			return false; 
@@ -2243,16 +3194,16 @@ bool CSteamNetworkConnectionBase::SNP_ReceiveReliableSegment( int64 nPktNum, int
 		// Check if this is going to make a new gap
 		if ( nSegBegin > nExpectNextStreamPos )
 		{
-			if ( !m_receiverState.m_mapReliableStreamGaps.empty() )
+			if ( !lane.m_mapReliableStreamGaps.empty() )
 			{
 
 				// We should never have a gap at the very end of the buffer.
 				// (Why would we extend the buffer, unless we needed to to
 				// store some data?)
-				Assert( m_receiverState.m_mapReliableStreamGaps.rbegin()->second < nExpectNextStreamPos );
+				Assert( lane.m_mapReliableStreamGaps.rbegin()->second < nExpectNextStreamPos );
 
 				// We need to add a new gap.  See if we're already too fragmented.
-				if ( len( m_receiverState.m_mapReliableStreamGaps ) >= k_nMaxReliableStreamGaps_Extend )
+				if ( len( lane.m_mapReliableStreamGaps ) >= k_nMaxReliableStreamGaps_Extend )
 				{
 					// Stop processing the packet, and don't ack it
 					// This indicates the connection is in pretty bad shape,
@@ -2260,9 +3211,9 @@ bool CSteamNetworkConnectionBase::SNP_ReceiveReliableSegment( int64 nPktNum, int
 					SpewWarningRateLimited( usecNow, "[%s] decode pkt %lld abort.  Reliable stream already has %d fragments, first is [%lld,%lld), last is [%lld,%lld), new segment is [%lld,%lld)\n",
 						GetDescription(),
 						(long long)nPktNum,
-						len( m_receiverState.m_mapReliableStreamGaps ),
-						(long long)m_receiverState.m_mapReliableStreamGaps.begin()->first, (long long)m_receiverState.m_mapReliableStreamGaps.begin()->second,
-						(long long)m_receiverState.m_mapReliableStreamGaps.rbegin()->first, (long long)m_receiverState.m_mapReliableStreamGaps.rbegin()->second,
+						len( lane.m_mapReliableStreamGaps ),
+						(long long)lane.m_mapReliableStreamGaps.begin()->first, (long long)lane.m_mapReliableStreamGaps.begin()->second,
+						(long long)lane.m_mapReliableStreamGaps.rbegin()->first, (long long)lane.m_mapReliableStreamGaps.rbegin()->second,
 						(long long)nSegBegin, (long long)nSegEnd
 					);
 					return false; 
@@ -2270,9 +3221,9 @@ bool CSteamNetworkConnectionBase::SNP_ReceiveReliableSegment( int64 nPktNum, int
 			}
 
 			// Add a gap
-			m_receiverState.m_mapReliableStreamGaps[ nExpectNextStreamPos ] = nSegBegin;
+			lane.m_mapReliableStreamGaps[ nExpectNextStreamPos ] = nSegBegin;
 		}
-		m_receiverState.m_bufReliableStream.resize( size_t( cbNewSize ) );
+		lane.m_bufReliableStream.resize( int( cbNewSize ) );
 	}
 
 	// If segment overlapped the existing buffer, we might need to discard the front
@@ -2281,9 +3232,9 @@ bool CSteamNetworkConnectionBase::SNP_ReceiveReliableSegment( int64 nPktNum, int
 	{
 
 		// Check if the front bit has already been processed, then skip it
-		if ( nSegBegin < m_receiverState.m_nReliableStreamPos )
+		if ( nSegBegin < lane.m_nReliableStreamPos )
 		{
-			int nSkip = m_receiverState.m_nReliableStreamPos - nSegBegin;
+			int nSkip = lane.m_nReliableStreamPos - nSegBegin;
 			cbSegmentSize -= nSkip;
 			pSegmentData += nSkip;
 			nSegBegin += nSkip;
@@ -2291,10 +3242,10 @@ bool CSteamNetworkConnectionBase::SNP_ReceiveReliableSegment( int64 nPktNum, int
 		Assert( nSegBegin < nSegEnd );
 
 		// Check if this filled in one or more gaps (or made a hole in the middle!)
-		if ( !m_receiverState.m_mapReliableStreamGaps.empty() )
+		if ( !lane.m_mapReliableStreamGaps.empty() )
 		{
-			auto gapFilled = m_receiverState.m_mapReliableStreamGaps.upper_bound( nSegBegin );
-			if ( gapFilled != m_receiverState.m_mapReliableStreamGaps.begin() )
+			auto gapFilled = lane.m_mapReliableStreamGaps.upper_bound( nSegBegin );
+			if ( gapFilled != lane.m_mapReliableStreamGaps.begin() )
 			{
 				--gapFilled;
 				Assert( gapFilled->first < gapFilled->second ); // Make sure we don't have degenerate/invalid gaps in our table
@@ -2318,7 +3269,7 @@ bool CSteamNetworkConnectionBase::SNP_ReceiveReliableSegment( int64 nPktNum, int
 							// Erase, and move forward in case this also fills more gaps
 							// !SPEED! Since exactly filing the gap should be common, we might
 							// check specifically for that case and early out here.
-							gapFilled = m_receiverState.m_mapReliableStreamGaps.erase( gapFilled );
+							gapFilled = lane.m_mapReliableStreamGaps.erase( gapFilled );
 						}
 						else if ( nSegEnd >= gapFilled->second )
 						{
@@ -2338,15 +3289,15 @@ bool CSteamNetworkConnectionBase::SNP_ReceiveReliableSegment( int64 nPktNum, int
 							// Protect against malicious sender.  A good sender will
 							// fill the gaps in stream position order and not fragment
 							// like this
-							if ( len( m_receiverState.m_mapReliableStreamGaps ) >= k_nMaxReliableStreamGaps_Fragment )
+							if ( len( lane.m_mapReliableStreamGaps ) >= k_nMaxReliableStreamGaps_Fragment )
 							{
 								// Stop processing the packet, and don't ack it
 								SpewWarningRateLimited( usecNow, "[%s] decode pkt %lld abort.  Reliable stream already has %d fragments, first is [%lld,%lld), last is [%lld,%lld).  We don't want to fragment [%lld,%lld) with new segment [%lld,%lld)\n",
 									GetDescription(),
 									(long long)nPktNum,
-									len( m_receiverState.m_mapReliableStreamGaps ),
-									(long long)m_receiverState.m_mapReliableStreamGaps.begin()->first, (long long)m_receiverState.m_mapReliableStreamGaps.begin()->second,
-									(long long)m_receiverState.m_mapReliableStreamGaps.rbegin()->first, (long long)m_receiverState.m_mapReliableStreamGaps.rbegin()->second,
+									len( lane.m_mapReliableStreamGaps ),
+									(long long)lane.m_mapReliableStreamGaps.begin()->first, (long long)lane.m_mapReliableStreamGaps.begin()->second,
+									(long long)lane.m_mapReliableStreamGaps.rbegin()->first, (long long)lane.m_mapReliableStreamGaps.rbegin()->second,
 									(long long)gapFilled->first, (long long)gapFilled->second,
 									(long long)nSegBegin, (long long)nSegEnd
 								);
@@ -2361,7 +3312,7 @@ bool CSteamNetworkConnectionBase::SNP_ReceiveReliableSegment( int64 nPktNum, int
 							gapFilled->second = nSegBegin;
 
 							// Add the right hand gap
-							m_receiverState.m_mapReliableStreamGaps[ nRightHandBegin ] = nRightHandEnd;
+							lane.m_mapReliableStreamGaps[ nRightHandBegin ] = nRightHandEnd;
 
 							// And we know that we cannot possible have covered any more gaps
 							break;
@@ -2369,7 +3320,7 @@ bool CSteamNetworkConnectionBase::SNP_ReceiveReliableSegment( int64 nPktNum, int
 
 						// In some rare cases we might fill more than one gap with a single segment.
 						// So keep searching forward.
-					} while ( gapFilled != m_receiverState.m_mapReliableStreamGaps.end() && gapFilled->first < nSegEnd );
+					} while ( gapFilled != lane.m_mapReliableStreamGaps.end() && gapFilled->first < nSegEnd );
 				}
 			}
 		}
@@ -2378,34 +3329,35 @@ bool CSteamNetworkConnectionBase::SNP_ReceiveReliableSegment( int64 nPktNum, int
 	// Copy the data into the buffer.
 	// It might be redundant, but if so, we aren't going to take the
 	// time to figure that out.
-	int nBufOffset = nSegBegin - m_receiverState.m_nReliableStreamPos;
+	int nBufOffset = nSegBegin - lane.m_nReliableStreamPos;
 	Assert( nBufOffset >= 0 );
-	Assert( nBufOffset+cbSegmentSize <= len( m_receiverState.m_bufReliableStream ) );
-	memcpy( &m_receiverState.m_bufReliableStream[nBufOffset], pSegmentData, cbSegmentSize );
+	Assert( nBufOffset+cbSegmentSize <= lane.m_bufReliableStream.size() );
+	lane.m_bufReliableStream.Write( nBufOffset, pSegmentData, cbSegmentSize );
 
 	// Figure out how many valid bytes are at the head of the buffer
 	int nNumReliableBytes;
-	if ( m_receiverState.m_mapReliableStreamGaps.empty() )
+	if ( lane.m_mapReliableStreamGaps.empty() )
 	{
-		nNumReliableBytes = len( m_receiverState.m_bufReliableStream );
+		nNumReliableBytes = lane.m_bufReliableStream.size();
 	}
 	else
 	{
-		auto firstGap = m_receiverState.m_mapReliableStreamGaps.begin();
-		Assert( firstGap->first >= m_receiverState.m_nReliableStreamPos );
+		auto firstGap = lane.m_mapReliableStreamGaps.begin();
+		Assert( firstGap->first >= lane.m_nReliableStreamPos );
 		if ( firstGap->first < nSegBegin )
 		{
 			// There's gap in front of us, and therefore if we didn't have
 			// a complete reliable message before, we don't have one now.
+			// But we might have completed one we are allowed to deliver early.
 			Assert( firstGap->second <= nSegBegin );
-			return true;
+			return SNP_DispatchUnorderedReliableMessages( idxLane, nSegBegin, nSegEnd, nUnorderedMsgBegin, usecNow );
 		}
 
 		// We do have a gap, but it's somewhere after this segment.
 		Assert( firstGap->first >= nSegEnd );
-		nNumReliableBytes = firstGap->first - m_receiverState.m_nReliableStreamPos;
+		nNumReliableBytes = firstGap->first - lane.m_nReliableStreamPos;
 		Assert( nNumReliableBytes > 0 );
-		Assert( nNumReliableBytes < len( m_receiverState.m_bufReliableStream ) ); // The last byte in the buffer should always be valid!
+		Assert( nNumReliableBytes < lane.m_bufReliableStream.size() ); // The last byte in the buffer should always be valid!
 	}
 	Assert( nNumReliableBytes > 0 );
 
@@ -2418,117 +3370,281 @@ bool CSteamNetworkConnectionBase::SNP_ReceiveReliableSegment( int64 nPktNum, int
 		// each time we get a new packet.  We could cache off the result if we find out
 		// that it's worth while.  It should be pretty fast, though, so let's keep the
 		// code simple until we know that it's worthwhile.
-		uint8 *pReliableStart = &m_receiverState.m_bufReliableStream[0];
-		uint8 *pReliableDecode = pReliableStart;
-		uint8 *pReliableEnd = pReliableDecode + nNumReliableBytes;
-
 		// Spew
 		SpewType( steamdatagram_snp_log_packet+1, "[%s]   decode pkt %lld valid reliable bytes = %d [%lld,%lld)\n",
 			GetDescription(),
 			(long long)nPktNum, nNumReliableBytes,
-			(long long)m_receiverState.m_nReliableStreamPos,
-			(long long)( m_receiverState.m_nReliableStreamPos + nNumReliableBytes ) );
+			(long long)lane.m_nReliableStreamPos,
+			(long long)( lane.m_nReliableStreamPos + nNumReliableBytes ) );
+
+		int cbStreamConsumed = SNP_DecodeReliableMessageFromBuffer( idxLane, 0, nNumReliableBytes, usecNow );
+		if ( cbStreamConsumed <= 0 )
+			return cbStreamConsumed == 0; // Don't have the whole message yet, or bad data
+
+		// Advance bookkeeping
+		lane.m_nReliableStreamPos += cbStreamConsumed;
+
+		// Remove the data from the from the front of the buffer
+		lane.m_bufReliableStream.PopFront( cbStreamConsumed );
+
+		// We might have more in the stream that is ready to dispatch right now.
+		nNumReliableBytes -= cbStreamConsumed;
+	} while ( nNumReliableBytes > 0 );
 
-		// Sanity check that we have a valid header byte.
-		uint8 nHeaderByte = *(pReliableDecode++);
+	return true;
+}
+
+bool CSteamNetworkConnectionBase::SNP_DispatchUnorderedReliableMessages( int idxLane, int64 nSegBegin, int64 nSegEnd, int64 nUnorderedMsgBegin, SteamNetworkingMicroseconds usecNow )
+{
+	SSNPRecvLane &lane = m_receiverState.m_vecLanes[ idxLane ];
+
+	// Remember where the message starts, if the sender told us.  If we are
+	// already tracking too many, it will just be delivered in order.
+	if ( nUnorderedMsgBegin > lane.m_nReliableStreamPos && len( lane.m_mapUnorderedMsgs ) < k_nMaxUnorderedMsgsPending )
+		lane.m_mapUnorderedMsgs.emplace( nUnorderedMsgBegin, 0 );
+	if ( lane.m_mapUnorderedMsgs.empty() )
+		return true;
+
+	// Locate the run of valid data that contains this segment.  It's
+	// bounded by the gaps on either side, or the end of the buffer
+	auto gapAfter = lane.m_mapReliableStreamGaps.lower_bound( nSegEnd );
+	Assert( gapAfter != lane.m_mapReliableStreamGaps.begin() );
+	auto gapBefore = std::prev( gapAfter );
+	Assert( gapBefore->second <= nSegBegin );
+	int64 nRunBegin = gapBefore->second;
+	int64 nRunEnd = gapAfter != lane.m_mapReliableStreamGaps.end() ? gapAfter->first : lane.m_nReliableStreamPos + lane.m_bufReliableStream.size();
+
+	// Check messages that start in the run and might have been completed by this segment
+	for ( auto it = lane.m_mapUnorderedMsgs.lower_bound( nRunBegin ) ; it != lane.m_mapUnorderedMsgs.end() && it->first < nSegEnd ; ++it )
+	{
+		if ( it->second > 0 )
+			continue; // Already delivered
+		int cbConsumed = SNP_DecodeReliableMessageFromBuffer( idxLane, int( it->first - lane.m_nReliableStreamPos ), int( nRunEnd - it->first ), usecNow );
+		if ( cbConsumed < 0 )
+			return false;
+		if ( cbConsumed > 0 )
+			it->second = it->first + cbConsumed;
+	}
+
+	return true;
+}
+
+int CSteamNetworkConnectionBase::SNP_DecodeReliableMessageFromBuffer( int idxLane, int nBufOffset, int cbData, SteamNetworkingMicroseconds usecNow, int *pcbMsgTotal )
+{
+	SSNPRecvLane &lane = m_receiverState.m_vecLanes[ idxLane ];
+	const uint8 *p1, *p2;
+	int cb1, cb2;
+	lane.m_bufReliableStream.GetSpans( nBufOffset, cbData, p1, cb1, p2, cb2 );
+	return SNP_DecodeReliableMessage( idxLane, lane.m_nReliableStreamPos + nBufOffset, p1, cb1, p2, cb2, usecNow, pcbMsgTotal );
+}
+
+int CSteamNetworkConnectionBase::SNP_DecodeReliableMessage( int idxLane, int64 nStreamPos, const uint8 *pData, int cbData, const uint8 *pData2, int cbData2, SteamNetworkingMicroseconds usecNow, int *pcbMsgTotal )
+{
+	SSNPRecvLane &lane = m_receiverState.m_vecLanes[ idxLane ];
+	const bool bInOrder = ( nStreamPos == lane.m_nReliableStreamPos );
+	Assert( nStreamPos >= lane.m_nReliableStreamPos );
+	Assert( cbData > 0 );
+	Assert( cbData2 >= 0 );
+
+	// If the data wraps, and the header might straddle the wrap point,
+	// then gather the header into a temp buffer.  (It's tiny.)
+	// The message body we will copy directly out of both pieces.
+	uint8 header[ k_cbSNPMaxReliableMsgHeader ];
+	const uint8 *pReliableStart = pData;
+	const uint8 *pReliableEnd = pData + cbData;
+	if ( cbData2 > 0 && cbData < k_cbSNPMaxReliableMsgHeader )
+	{
+		int cbHeader2 = std::min( cbData2, k_cbSNPMaxReliableMsgHeader - cbData );
+		memcpy( header, pData, cbData );
+		memcpy( header + cbData, pData2, cbHeader2 );
+		pReliableStart = header;
+		pReliableEnd = header + cbData + cbHeader2;
+	}
+	const uint8 *pReliableDecode = pReliableStart;
+
+	// Chunk of a larger stream?  The actual header byte follows the marker.
+	// (Stream chunks are always delivered in order.)
+	uint8 nHeaderByte = *(pReliableDecode++);
+	uint16 nMsgFlags = 0;
+	if ( nHeaderByte == 0xc0 )
+	{
+		if ( pReliableDecode >= pReliableEnd )
+			return 0; // We haven't received all of the message
+		nHeaderByte = *(pReliableDecode++);
 		if ( nHeaderByte & 0x80 )
 		{
-			ConnectionState_ProblemDetectedLocally( k_ESteamNetConnectionEnd_Misc_InternalError, "Invalid reliable message header byte 0x%02x", nHeaderByte );
-			return false;
+			ConnectionState_ProblemDetectedLocally( k_ESteamNetConnectionEnd_Misc_InternalError, "Invalid reliable message header byte 0x%02x after stream marker", nHeaderByte );
+			return -1;
 		}
+		nMsgFlags |= k_nSteamNetworkingMessageFlags_StreamContinues;
+	}
+
+	// Sanity check that we have a valid header byte.
+	if ( ( nHeaderByte & 0xc0 ) == 0xc0 )
+	{
+		ConnectionState_ProblemDetectedLocally( k_ESteamNetConnectionEnd_Misc_InternalError, "Invalid reliable message header byte 0x%02x", nHeaderByte );
+		return -1;
+	}
 
-		// Parse the message number
-		int64 nMsgNum = m_receiverState.m_nLastRecvReliableMsgNum;
-		if ( nHeaderByte & 0x40 )
+	// Parse the message number
+	int64 nMsgNum = lane.m_nLastRecvReliableMsgNum;
+	if ( nHeaderByte & 0x80 )
+	{
+		// Message that can be delivered out of order.  The message number is absolute
+		uint64 nAbsMsgNum;
+		pReliableDecode = DeserializeVarInt( pReliableDecode, pReliableEnd, nAbsMsgNum );
+		if ( pReliableDecode == nullptr )
+			return 0; // We haven't received all of the message
+
+		// It must be newer than anything we have delivered in order, and
+		// the same sanity check against a huge jump as below
+		if ( nAbsMsgNum <= (uint64)lane.m_nLastRecvReliableMsgNum || nAbsMsgNum > (uint64)lane.m_nHighestSeenMsgNum+10000 )
 		{
-			uint64 nOffset;
-			pReliableDecode = DeserializeVarInt( pReliableDecode, pReliableEnd, nOffset );
-			if ( pReliableDecode == nullptr )
-				return true; // We haven't received all of the message
-
-			nMsgNum += nOffset;
-
-			// Sanity check against a HUGE jump in the message number.
-			// This is almost certainly bogus.  (OKOK, yes it is theoretically
-			// possible.  But for now while this thing is still under development,
-			// most likely it's a bug.  Eventually we can lessen these to handle
-			// the case where the app decides to send literally a million unreliable
-			// messages in between reliable messages.  The second condition is probably
-			// legit, though.)
-			if ( nOffset > 1000000 || nMsgNum > m_receiverState.m_nHighestSeenMsgNum+10000 )
-			{
-				ConnectionState_ProblemDetectedLocally( k_ESteamNetConnectionEnd_Misc_InternalError,
-					"Reliable message number lurch.  Last reliable %lld, offset %llu, highest seen %lld",
-					(long long)m_receiverState.m_nLastRecvReliableMsgNum, (unsigned long long)nOffset,
-					(long long)m_receiverState.m_nHighestSeenMsgNum );
-				return false;
-			}
+			ConnectionState_ProblemDetectedLocally( k_ESteamNetConnectionEnd_Misc_InternalError,
+				"Unordered reliable message number %llu invalid.  Last reliable %lld, highest seen %lld",
+				(unsigned long long)nAbsMsgNum, (long long)lane.m_nLastRecvReliableMsgNum,
+				(long long)lane.m_nHighestSeenMsgNum );
+			return -1;
 		}
-		else
+		nMsgNum = int64( nAbsMsgNum );
+	}
+	else if ( !bInOrder )
+	{
+		// The sender told us this was the start of a message we could deliver
+		// out of order, but it isn't.
+		ConnectionState_ProblemDetectedLocally( k_ESteamNetConnectionEnd_Misc_InternalError,
+			"Reliable message at stream pos %lld cannot be delivered out of order.  (Header byte 0x%02x)",
+			(long long)nStreamPos, nHeaderByte );
+		return -1;
+	}
+	else if ( nHeaderByte & 0x40 )
+	{
+		uint64 nOffset;
+		pReliableDecode = DeserializeVarInt( pReliableDecode, pReliableEnd, nOffset );
+		if ( pReliableDecode == nullptr )
+			return 0; // We haven't received all of the message
+
+		nMsgNum += nOffset;
+
+		// Sanity check against a HUGE jump in the message number.
+		// This is almost certainly bogus.  (OKOK, yes it is theoretically
+		// possible.  But for now while this thing is still under development,
+		// most likely it's a bug.  Eventually we can lessen these to handle
+		// the case where the app decides to send literally a million unreliable
+		// messages in between reliable messages.  The second condition is probably
+		// legit, though.)
+		if ( nOffset > 1000000 || nMsgNum > lane.m_nHighestSeenMsgNum+10000 )
 		{
-			++nMsgNum;
+			ConnectionState_ProblemDetectedLocally( k_ESteamNetConnectionEnd_Misc_InternalError,
+				"Reliable message number lurch.  Last reliable %lld, offset %llu, highest seen %lld",
+				(long long)lane.m_nLastRecvReliableMsgNum, (unsigned long long)nOffset,
+				(long long)lane.m_nHighestSeenMsgNum );
+			return -1;
 		}
+	}
+	else
+	{
+		++nMsgNum;
+	}
 
-		// Check for updating highest message number seen, so we know how to interpret
-		// message numbers from the sender with only the lowest N bits present.
-		// And yes, we want to do this even if we end up not processing the entire message
-		if ( nMsgNum > m_receiverState.m_nHighestSeenMsgNum )
-			m_receiverState.m_nHighestSeenMsgNum = nMsgNum;
+	// Check for updating highest message number seen, so we know how to interpret
+	// message numbers from the sender with only the lowest N bits present.
+	// And yes, we want to do this even if we end up not processing the entire message
+	if ( nMsgNum > lane.m_nHighestSeenMsgNum )
+		lane.m_nHighestSeenMsgNum = nMsgNum;
 
-		// Parse message size.
-		int cbMsgSize = nHeaderByte&0x1f;
-		if ( nHeaderByte & 0x20 )
+	// Parse message size.
+	int cbMsgSize = nHeaderByte&0x1f;
+	if ( nHeaderByte & 0x20 )
+	{
+		uint64 nMsgSizeUpperBits;
+		pReliableDecode = DeserializeVarInt( pReliableDecode, pReliableEnd, nMsgSizeUpperBits );
+		if ( pReliableDecode == nullptr )
+			return 0; // We haven't received all of the message
+
+		// Sanity check size.  Note that we do this check before we shift,
+		// to protect against overflow.
+		// (Although DeserializeVarInt doesn't detect overflow...)
+		if ( nMsgSizeUpperBits > (uint64)k_cbMaxMessageSizeRecv<<5 )
 		{
-			uint64 nMsgSizeUpperBits;
-			pReliableDecode = DeserializeVarInt( pReliableDecode, pReliableEnd, nMsgSizeUpperBits );
-			if ( pReliableDecode == nullptr )
-				return true; // We haven't received all of the message
-
-			// Sanity check size.  Note that we do this check before we shift,
-			// to protect against overflow.
-			// (Although DeserializeVarInt doesn't detect overflow...)
-			if ( nMsgSizeUpperBits > (uint64)k_cbMaxMessageSizeRecv<<5 )
-			{
-				ConnectionState_ProblemDetectedLocally( k_ESteamNetConnectionEnd_Misc_InternalError,
-					"Reliable message size too large.  (%llu<<5 + %d)",
-					(unsigned long long)nMsgSizeUpperBits, cbMsgSize );
-				return false;
-			}
+			ConnectionState_ProblemDetectedLocally( k_ESteamNetConnectionEnd_Misc_InternalError,
+				"Reliable message size too large.  (%llu<<5 + %d)",
+				(unsigned long long)nMsgSizeUpperBits, cbMsgSize );
+			return -1;
+		}
+
+		// Compute total size, and check it again
+		cbMsgSize += int( nMsgSizeUpperBits<<5 );
+		if ( cbMsgSize > k_cbMaxMessageSizeRecv )
+		{
+			ConnectionState_ProblemDetectedLocally( k_ESteamNetConnectionEnd_Misc_InternalError,
+				"Reliable message size %d too large.", cbMsgSize );
+			return -1;
+		}
+	}
+
+	// Let caller know how big the whole thing is, header and all
+	int cbHeader = int( pReliableDecode - pReliableStart );
+	int cbMsgTotal = cbHeader + cbMsgSize;
+	if ( pcbMsgTotal )
+		*pcbMsgTotal = cbMsgTotal;
+
+	// Do we have the full thing?
+	if ( cbMsgTotal > cbData + cbData2 )
+	{
+		// Ouch, we did all that work and still don't have the whole message.
+		return 0;
+	}
 
-			// Compute total size, and check it again
-			cbMsgSize += int( nMsgSizeUpperBits<<5 );
-			if ( cbMsgSize > k_cbMaxMessageSizeRecv )
+	// If the reliable stream has caught up to messages that we were told we could
+	// deliver out of order, we don't need to track them anymore.  And if this is
+	// one of them that we already delivered, don't deliver it again.
+	if ( bInOrder && !lane.m_mapUnorderedMsgs.empty() )
+	{
+		bool bAlreadyDelivered = false;
+		auto it = lane.m_mapUnorderedMsgs.begin();
+		while ( it != lane.m_mapUnorderedMsgs.end() && it->first < nStreamPos + cbMsgTotal )
+		{
+			if ( it->first == nStreamPos && it->second > 0 )
 			{
-				ConnectionState_ProblemDetectedLocally( k_ESteamNetConnectionEnd_Misc_InternalError,
-					"Reliable message size %d too large.", cbMsgSize );
-				return false;
+				Assert( it->second == nStreamPos + cbMsgTotal );
+				bAlreadyDelivered = true;
 			}
+			it = lane.m_mapUnorderedMsgs.erase( it );
 		}
-
-		// Do we have the full thing?
-		if ( pReliableDecode+cbMsgSize > pReliableEnd )
+		if ( bAlreadyDelivered )
 		{
-			// Ouch, we did all that work and still don't have the whole message.
-			return true;
+			lane.m_nLastRecvReliableMsgNum = nMsgNum;
+			return cbMsgTotal;
 		}
+	}
 
-		// We have a full message!  Queue it
-		ReceivedMessage( pReliableDecode, cbMsgSize, nMsgNum, usecNow );
-		pReliableDecode += cbMsgSize;
-		int cbStreamConsumed = pReliableDecode-pReliableStart;
-
-		// Advance bookkeeping
-		m_receiverState.m_nLastRecvReliableMsgNum = nMsgNum;
-		m_receiverState.m_nReliableStreamPos += cbStreamConsumed;
+	// We have a full message!  Copy the body into a message object.
+	// It might be split across the two pieces
+	CSteamNetworkingMessage *pMsg = CSteamNetworkingMessage::New( this, cbMsgSize, nMsgNum, usecNow );
+	pMsg->m_idxLane = uint16( idxLane );
+	pMsg->m_nFlags = nMsgFlags;
+	uint8 *pMsgData = (uint8 *)pMsg->m_pData;
+	if ( cbHeader < cbData )
+	{
+		int cb1 = std::min( cbMsgSize, cbData - cbHeader );
+		memcpy( pMsgData, pData + cbHeader, cb1 );
+		if ( cb1 < cbMsgSize )
+			memcpy( pMsgData + cb1, pData2, cbMsgSize - cb1 );
+	}
+	else
+	{
+		memcpy( pMsgData, pData2 + ( cbHeader - cbData ), cbMsgSize );
+	}
 
-		// Remove the data from the from the front of the buffer
-		pop_from_front( m_receiverState.m_bufReliableStream, cbStreamConsumed );
+	// Queue it
+	ReceivedMessage( pMsg );
 
-		// We might have more in the stream that is ready to dispatch right now.
-		nNumReliableBytes -= cbStreamConsumed;
-	} while ( nNumReliableBytes > 0 );
+	// Advance bookkeeping
+	if ( bInOrder )
+		lane.m_nLastRecvReliableMsgNum = nMsgNum;
 
-	return true;
+	return cbMsgTotal;
 }
 
 bool CSteamNetworkConnectionBase::SNP_RecordReceivedPktNum( int64 nPktNum, SteamNetworkingMicroseconds usecNow )
@@ -2566,25 +3682,26 @@ bool CSteamNetworkConnectionBase::SNP_RecordReceivedPktNum( int64 nPktNum, Steam
 			(int)( nPktNum - nBegin ),
 			(long long)nBegin, (long long)nPktNum );
 
-		// Schedule sending of a NACK pretty quickly.
-		// FIXME - really we should probably use two different timers.
-		// If this timer expires, we should check if the gap still exists,
-		// and if so, there's no need to do anything.  Because we want
-		// packets arriving out of order close together to basically
-		// be treated the same as arriving in order.
-		m_receiverState.m_usecWhenFlushAck = std::min( m_receiverState.m_usecWhenFlushAck, usecNow + k_usecNackFlush );
+		// Send a NACK right away, so the sender can retransmit as soon
+		// as possible.  If the packets were only reordered, the ack we
+		// send when they arrive will straighten things out.
+		SNP_FlushAcksSoon( usecNow );
 	}
 	else if ( !m_receiverState.m_mapPacketGaps.empty() )
 	{
 		// Check if this filed a gap
 		auto itGap = m_receiverState.m_mapPacketGaps.upper_bound( nPktNum );
+		if ( itGap == m_receiverState.m_mapPacketGaps.begin() )
+			return true; // Older than any gap.  We already received this packet
 		--itGap;
 		Assert( itGap->first <= nPktNum );
 		if ( itGap->second.m_nEnd <= nPktNum )
 			return true; // We already received this packet
 
 		// Packet is in a gap where we previously thought packets were lost.
-		// (Packets arriving out of order.)
+		// (Packets arriving out of order.)  Ack right away, before the
+		// sender decides it was lost and retransmits.
+		SNP_FlushAcksSoon( usecNow );
 
 		// Last packet in gap?
 		if ( itGap->second.m_nEnd-1 == nPktNum )
@@ -2667,55 +3784,32 @@ int CSteamNetworkConnectionBase::GetEffectiveMaxRate() const
 	return Clamp( nResult, k_nSteamDatagramGlobalMinRate, k_nSteamDatagramGlobalMaxRate );
 }
 
-// RFC 3448, 4.3
+// Ask congestion control what rate we should be sending at
 void CSteamNetworkConnectionBase::SNP_UpdateX( SteamNetworkingMicroseconds usecNow )
 {
-//	int configured_min_rate = m_senderState.m_n_minRate ? m_senderState.m_n_minRate : steamdatagram_snp_min_rate;
-//
-//	int min_rate = MAX( configured_min_rate, m_senderState.m_n_x_recv * k_nBurstMultiplier ); 
-//
-//	SteamNetworkingMicroseconds usecPing = GetUsecPingWithFallback( this );
-//
-//	int n_old_x = m_senderState.m_n_x;
-//	if ( m_senderState.m_un_p )
-//	{
-//		m_senderState.m_n_x = MAX( MIN( m_senderState.m_n_x_calc, min_rate ), m_senderState.m_n_tx_s );
-//		m_senderState.m_n_x = MAX( m_senderState.m_n_x, configured_min_rate );
-//	}
-//	else if ( m_statsEndToEnd.m_ping.m_nSmoothedPing >= 0 && usecNow - m_senderState.m_usec_ld >= usecPing )
-//	{   	   
-//		m_senderState.m_n_x = MAX( MIN( 2 * m_senderState.m_n_x, min_rate ), GetInitialRate( usecPing ) );
-//		m_senderState.m_usec_ld = usecNow;
-//	}
-//
-//	// For now cap at steamdatagram_snp_max_rate
-//	if ( m_senderState.m_n_maxRate )
-//	{
-//		m_senderState.m_n_x = MIN( m_senderState.m_n_x, m_senderState.m_n_maxRate );
-//	}
-//	else if ( steamdatagram_snp_max_rate )
-//	{
-//		m_senderState.m_n_x = MIN( m_senderState.m_n_x, steamdatagram_snp_max_rate );
-//	}
-//
-//	if ( m_senderState.m_n_x != n_old_x ) 
-//	{
-//		if ( steamdatagram_snp_log_x )
-//		SpewMsg( "%12llu %s: UPDATE X=%d (was %d) x_recv=%d min_rate=%d p=%u x_calc=%d tx_s=%d\n", 
-//					 usecNow,
-//					 m_sName.c_str(),
-//					 m_senderState.m_n_x,
-//					 n_old_x,
-//					 m_senderState.m_n_x_recv,
-//					 min_rate,
-//					 m_senderState.m_un_p,
-//					 m_senderState.m_n_x_calc,
-//					 m_senderState.m_n_tx_s );
-//	}
-//
-//	UpdateSpeeds( m_senderState.m_n_x, m_senderState.m_n_x_recv );
-
-	m_senderState.m_n_x = Clamp( m_senderState.m_n_x, GetEffectiveMinRate(), GetEffectiveMaxRate() );
+	int nMinRate = GetEffectiveMinRate();
+	int nMaxRate = GetEffectiveMaxRate();
+	if ( m_senderState.m_pCongestionControl )
+		m_senderState.m_n_x = m_senderState.m_pCongestionControl->CalcSendRate( nMinRate, nMaxRate, usecNow );
+	m_senderState.m_n_x = Clamp( m_senderState.m_n_x, nMinRate, nMaxRate );
+
+	// Pick up any change to the pacing quantum
+	m_senderState.m_flPacingQuantum = (float)Clamp( steamdatagram_snp_pacing_quantum, k_cbMinPacingQuantum, k_cbMaxPacingQuantum );
+
+	// If the transport can ask the OS to pace for us, keep it up to date.
+	// Don't make a system call every time the rate wiggles a bit.
+	if ( m_senderState.m_nKernelPacingRate >= 0 )
+	{
+		int nKernelRate = (int)Min( (int64)( m_senderState.m_n_x * k_flKernelPacingRateMultiplier ), (int64)INT_MAX );
+		int nOldKernelRate = m_senderState.m_nKernelPacingRate;
+		if ( nOldKernelRate == 0 || abs( nKernelRate - nOldKernelRate ) > nOldKernelRate/8 )
+		{
+			if ( BSetTransportPacingRate( nKernelRate ) )
+				m_senderState.m_nKernelPacingRate = nKernelRate;
+			else
+				m_senderState.m_nKernelPacingRate = -1; // Don't ask again
+		}
+	}
 }
 
 // Returns next think time
@@ -2724,13 +3818,38 @@ SteamNetworkingMicroseconds CSteamNetworkConnectionBase::SNP_ThinkSendState( Ste
 	// Accumulate tokens based on how long it's been since last time
 	m_senderState.TokenBucket_Accumulate( usecNow );
 
+	// Give congestion control a chance to service its timers
+	SNP_UpdateX( usecNow );
+
 	// Calculate next time we want to take action.  If it isn't right now, then we're either idle or throttled.
 	// Importantly, this will also check for retry timeout
 	SteamNetworkingMicroseconds usecNextThink = SNP_GetNextThinkTime( usecNow );
 	if ( usecNextThink > usecNow )
 		return usecNextThink;
 
-	// Keep sending packets until we run out of tokens
+	// Time to probe for a larger path MTU?
+	if ( m_senderState.m_usecPMTUNextProbe <= usecNow && m_senderState.m_flTokenBucket >= 0.0f )
+	{
+		if ( m_senderState.m_cbPMTUProbe == 0 )
+			SNP_PMTUStartSearch( usecNow );
+		if ( m_senderState.m_cbPMTUProbe > 0 )
+		{
+			// Only one probe in flight at a time.  We'll decide what to
+			// do next when it is acked or lost.
+			m_senderState.m_usecPMTUNextProbe = INT64_MAX;
+			if ( SNP_SendPacket( usecNow, m_senderState.m_cbPMTUProbe, nullptr, true ) <= 0 )
+				m_senderState.m_usecPMTUNextProbe = usecNow + k_nMillion;
+
+			// The probe spends tokens just like any other packet.  If that
+			// used them all up, the data will have to wait its turn.
+			if ( m_senderState.m_flTokenBucket < 0.0f )
+				return SNP_GetNextThinkTime( usecNow );
+		}
+	}
+
+	// Keep sending packets until we run out of tokens.  Each packet spends
+	// tokens, which pushes back the departure time of the next one.  When we
+	// run out, we ask to wake up right when the next packet is due to leave.
 	int nPacketsSent = 0;
 	for (;;)
 	{
@@ -2763,17 +3882,18 @@ SteamNetworkingMicroseconds CSteamNetworkConnectionBase::SNP_ThinkSendState( Ste
 //		if ( !bSendPacket )
 //			break;
 
-		if ( nPacketsSent > k_nMaxPacketsPerThink )
+		if ( nPacketsSent >= k_nMaxPacketsPerThink )
 		{
-			// We're sending too much at one time.  Nuke token bucket so that
-			// we'll be ready to send again very soon, but not immediately.
-			// We don't want the outer code to complain that we are requesting
-			// a wakeup call in the past
-			m_senderState.m_flTokenBucket = m_senderState.m_n_x * -0.0005f;
-			return usecNow + 1000;
+			// We woke up very late, or somebody held the lock for a long time,
+			// and we have a big reserve.  Don't try to make up all of the lost
+			// time in one burst.  Forgive the excess, and schedule the next
+			// packet one packet time from now, so we resume at the paced rate.
+			// (And don't ask the outer code for a wakeup call in the past.)
+			m_senderState.m_flTokenBucket = Min( m_senderState.m_flTokenBucket, 0.0f ) - (float)k_cbSteamNetworkingSocketsMaxEncryptedPayloadSend;
+			break;
 		}
 
-		int nBytesSent = SNP_SendPacket( usecNow, k_cbSteamNetworkingSocketsMaxEncryptedPayloadSend, nullptr );
+		int nBytesSent = SNP_SendPacket( usecNow, m_senderState.m_cbMaxEncryptedPayloadSend, nullptr );
 		if ( nBytesSent < 0 )
 		{
 			// Problem sending packet.  Nuke token bucket, but request
@@ -2793,13 +3913,13 @@ SteamNetworkingMicroseconds CSteamNetworkConnectionBase::SNP_ThinkSendState( Ste
 			break;
 		}
 
-		// We spent some tokens, do we have any left?
-		if ( m_senderState.m_flTokenBucket < 0.0f )
-			break;
-
 		// Limit number of packets sent at a time, even if the scheduler is really bad
 		// or somebody holds the lock for along time, or we wake up late for whatever reason
 		++nPacketsSent;
+
+		// We spent some tokens, do we have any left?
+		if ( m_senderState.m_flTokenBucket < 0.0f )
+			break;
 	}
 
 	// Return time when we need to check in again.
@@ -2848,12 +3968,83 @@ SteamNetworkingMicroseconds CSteamNetworkConnectionBase::SNP_GetNextThinkTime( S
 		usecNextThink = Min( usecNextThink, usecNextSend );
 	}
 
+	// Path MTU probes are subject to the same rate limit as everything else
+	if ( m_senderState.m_usecPMTUNextProbe < INT64_MAX )
+		usecNextThink = std::min( usecNextThink, std::max( m_senderState.m_usecPMTUNextProbe, usecNow + m_senderState.CalcTimeUntilNextSend() ) );
+
 	// Check if the receiver side needs to send an ack
 	usecNextThink = std::min( usecNextThink, m_receiverState.m_usecWhenFlushAck );
 
 	return usecNextThink;
 }
 
+void CSteamNetworkConnectionBase::SNP_PMTUStartSearch( SteamNetworkingMicroseconds usecNow )
+{
+	// Old peers don't understand the padding frame
+	int cbMaxProbe = k_cbSteamNetworkingSocketsMaxEncryptedPayloadSend;
+	if ( m_statsEndToEnd.m_nPeerProtocolVersion >= k_nMinPeerProtocolVersionPMTUProbe )
+		cbMaxProbe = GetMaxEncryptedPayloadSendToProbe();
+
+	// Anything to search for?  If not, check back later, in case the config changes
+	if ( cbMaxProbe <= m_senderState.m_cbMaxEncryptedPayloadSend )
+	{
+		m_senderState.m_cbPMTUProbe = 0;
+		m_senderState.m_usecPMTUNextProbe = usecNow + k_usecPMTURaiseTimer;
+		return;
+	}
+
+	// Try the biggest size first.  On most paths where it's worth
+	// searching at all, it will work and we'll be done.
+	m_senderState.m_cbPMTUSearchHigh = cbMaxProbe;
+	m_senderState.m_cbPMTUProbe = cbMaxProbe;
+	m_senderState.m_nPMTUProbeFailures = 0;
+	m_senderState.m_usecPMTUNextProbe = usecNow;
+
+	SpewType( steamdatagram_snp_log_packet, "[%s] Starting path MTU search, %d-%d bytes\n",
+		GetDescription(), m_senderState.m_cbMaxEncryptedPayloadSend, cbMaxProbe );
+}
+
+void CSteamNetworkConnectionBase::SNP_PMTUProbeResult( bool bAcked, SteamNetworkingMicroseconds usecNow )
+{
+	Assert( m_senderState.m_cbPMTUProbe > 0 );
+	m_senderState.m_nPMTUProbePktNum = 0;
+
+	if ( bAcked )
+	{
+		m_senderState.m_cbMaxEncryptedPayloadSend = std::max( m_senderState.m_cbMaxEncryptedPayloadSend, m_senderState.m_cbPMTUProbe );
+	}
+	else
+	{
+		// A single lost probe doesn't mean much.  Try again
+		if ( ++m_senderState.m_nPMTUProbeFailures < k_nPMTUMaxProbes )
+		{
+			m_senderState.m_usecPMTUNextProbe = usecNow;
+			return;
+		}
+
+		// OK, this size doesn't work
+		m_senderState.m_cbPMTUSearchHigh = m_senderState.m_cbPMTUProbe - k_cbSteamNetworkingSocketsEncryptionBlockSize;
+	}
+	m_senderState.m_nPMTUProbeFailures = 0;
+
+	// Close enough?
+	const int cbLow = m_senderState.m_cbMaxEncryptedPayloadSend;
+	const int cbHigh = m_senderState.m_cbPMTUSearchHigh;
+	if ( cbHigh - cbLow < k_cbPMTUSearchGranularity )
+	{
+		SpewVerbose( "[%s] Path MTU search complete.  Max encrypted payload is %d bytes\n",
+			GetDescription(), m_senderState.m_cbMaxEncryptedPayloadSend );
+		m_senderState.m_cbPMTUProbe = 0;
+		m_senderState.m_usecPMTUNextProbe = usecNow + k_usecPMTURaiseTimer;
+		return;
+	}
+
+	// Binary search
+	m_senderState.m_cbPMTUProbe = ( ( cbLow + cbHigh ) / 2 ) & ~( k_cbSteamNetworkingSocketsEncryptionBlockSize-1 );
+	Assert( m_senderState.m_cbPMTUProbe > cbLow && m_senderState.m_cbPMTUProbe <= cbHigh );
+	m_senderState.m_usecPMTUNextProbe = usecNow;
+}
+
 void CSteamNetworkConnectionBase::SNP_PopulateDetailedStats( SteamDatagramLinkStats &info ) const
 {
 	info.m_latest.m_nSendRate = m_senderState.m_n_x;
@@ -2862,6 +4053,9 @@ void CSteamNetworkConnectionBase::SNP_PopulateDetailedStats( SteamDatagramLinkSt
 	info.m_lifetime.m_nMessagesSentUnreliable  = m_senderState.m_nMessagesSentUnreliable;
 	info.m_lifetime.m_nMessagesRecvReliable    = m_receiverState.m_nMessagesRecvReliable;
 	info.m_lifetime.m_nMessagesRecvUnreliable  = m_receiverState.m_nMessagesRecvUnreliable;
+	info.m_lifetime.m_nPktsRecvAckEliciting    = m_receiverState.m_nPktsRecvAckEliciting;
+	info.m_lifetime.m_nPktsSentWithAck         = m_receiverState.m_nPktsSentWithAck;
+	info.m_lifetime.m_nPktsSentAckOnly         = m_receiverState.m_nPktsSentAckOnly;
 }
 
 void CSteamNetworkConnectionBase::SNP_PopulateQuickStats( SteamNetworkingQuickConnectionStatus &info, SteamNetworkingMicroseconds usecNow )
@@ -2900,15 +4094,65 @@ void CSteamNetworkConnectionBase::SNP_PopulateQuickStats( SteamNetworkingQuickCo
 	}
 }
 
+static int MemoryUsageOfSendMessageList( const SSNPSendMessageList &list )
+{
+	int cbResult = 0;
+	for ( const SNPSendMessage_t *pMsg = list.m_pFirst ; pMsg ; pMsg = pMsg->m_pNext )
+		cbResult += MemoryUsageOfAllocation( sizeof(*pMsg) ) + MemoryUsageOfAllocation( pMsg->m_cbSize );
+	return cbResult;
+}
+
+void CSteamNetworkConnectionBase::SNP_GetMemoryUsage( SteamNetConnectionMemoryUsage_t &usage ) const
+{
+	// Sender.  The state itself is embedded in the connection object, and
+	// is counted there.
+	if ( m_senderState.m_pCongestionControl )
+		usage.m_cbConnection += MemoryUsageOfAllocation( m_senderState.m_pCongestionControl->GetObjectSize() );
+	usage.m_cbSendQueue += MemoryUsageOfHeap( m_senderState.m_vecLanes );
+	for ( const SSNPSendLane &lane: m_senderState.m_vecLanes )
+	{
+		usage.m_cbSendQueue += MemoryUsageOfSendMessageList( lane.m_messagesQueued );
+		usage.m_cbSendQueue += MemoryUsageOfSendMessageList( lane.m_unackedReliableMessages );
+		usage.m_cbInFlight += MemoryUsageOfHeap( lane.m_listInFlightReliableRange );
+		usage.m_cbInFlight += MemoryUsageOfHeap( lane.m_listReadyRetryReliableRange );
+	}
+	usage.m_cbInFlight += MemoryUsageOfHeap( m_senderState.m_mapInFlightPacketsByPktNum );
+	for ( const auto &item: m_senderState.m_mapInFlightPacketsByPktNum )
+		usage.m_cbInFlight += MemoryUsageOfHeap( item.second.m_vecReliableSegments );
+
+	// Receiver
+	usage.m_cbRecvBuffer += MemoryUsageOfHeap( m_receiverState.m_vecLanes );
+	for ( const SSNPRecvLane &lane: m_receiverState.m_vecLanes )
+	{
+		usage.m_cbRecvBuffer += MemoryUsageOfAllocation( lane.m_bufReliableStream.capacity() );
+		usage.m_cbRecvBuffer += MemoryUsageOfHeap( lane.m_mapReliableStreamGaps );
+		usage.m_cbRecvBuffer += MemoryUsageOfHeap( lane.m_mapUnorderedMsgs );
+	}
+	usage.m_cbRecvBuffer += MemoryUsageOfHeap( m_receiverState.m_mapPacketGaps );
+	if ( m_receiverState.m_pUnreliableReassembly )
+	{
+		usage.m_cbRecvBuffer += MemoryUsageOfAllocation( sizeof(SSNPRecvUnreliableMsg) * k_nMaxUnreliableReassemblyMsgs );
+		for ( int i = 0 ; i < k_nMaxUnreliableReassemblyMsgs ; ++i )
+		{
+			const CSteamNetworkingMessage *pMsg = m_receiverState.m_pUnreliableReassembly[i].m_pMsg;
+			if ( pMsg )
+				usage.m_cbRecvBuffer += MemoryUsageOfAllocation( sizeof(*pMsg) ) + MemoryUsageOfAllocation( pMsg->m_cbSize );
+		}
+	}
+}
+
 #ifndef STEAMNETWORKINGSOCKETS_OPENSOURCE
 void CSteamNetworkConnectionBase::SNP_PopulateP2PSessionStateStats( P2PSessionState_t &info ) const
 {
 	info.m_nBytesQueuedForSend = 0;
 	info.m_nPacketsQueuedForSend = 0;
-	for ( SNPSendMessage_t *pMsg = m_senderState.m_messagesQueued.m_pFirst ; pMsg ; pMsg = pMsg->m_pNext )
+	for ( const SSNPSendLane &lane: m_senderState.m_vecLanes )
 	{
-		info.m_nBytesQueuedForSend += pMsg->m_cbSize;
-		info.m_nPacketsQueuedForSend += 1;
+		for ( SNPSendMessage_t *pMsg = lane.m_messagesQueued.m_pFirst ; pMsg ; pMsg = pMsg->m_pNext )
+		{
+			info.m_nBytesQueuedForSend += pMsg->m_cbSize;
+			info.m_nPacketsQueuedForSend += 1;
+		}
 	}
 }
 #endif
@@ -2922,6 +4166,38 @@ void CSteamNetworkConnectionBase::SetMinimumRate( int nRate )
 		m_senderState.m_n_x = nRate;
 }
 
+int CSteamNetworkConnectionBase::GetCongestionControl() const
+{
+	if ( m_senderState.m_pCongestionControl )
+		return m_senderState.m_pCongestionControl->GetType();
+	return m_senderState.m_eCongestionControl;
+}
+
+bool CSteamNetworkConnectionBase::SetCongestionControl( int eType )
+{
+	if ( eType == 0 )
+		eType = steamdatagram_snp_congestion_control;
+	ISNPCongestionControl *pCongestionControl = CreateSNPCongestionControl( eType );
+	if ( !pCongestionControl )
+		return false;
+	m_senderState.m_eCongestionControl = eType;
+
+	// Not connected yet?  We'll create it when we are
+	if ( !m_senderState.m_pCongestionControl )
+	{
+		delete pCongestionControl;
+		return true;
+	}
+
+	// Switch over, starting from the rate we are currently sending at
+	SteamNetworkingMicroseconds usecNow = SteamNetworkingSockets_GetLocalTimestamp();
+	pCongestionControl->Init( m_senderState.m_n_x, GetUsecPingWithFallback( this ), usecNow );
+	delete m_senderState.m_pCongestionControl;
+	m_senderState.m_pCongestionControl = pCongestionControl;
+	SNP_UpdateX( usecNow );
+	return true;
+}
+
 void CSteamNetworkConnectionBase::SetMaximumRate( int nRate )
 {
 	m_senderState.m_n_maxRate = nRate;
@@ -2936,11 +4212,10 @@ void CSteamNetworkConnectionBase::GetDebugText( char *pszOut, int nOutCCH )
 	V_snprintf( pszOut, nOutCCH, "%s\n"
 				 "SenderState\n"
 				 " x . . . . . . %d\n"
-				 //" x_recv. . . . %d\n"
-				 " x_calc. . . . %d\n"
+				 " cc. . . . . . %s\n"
+				 " pmtu. . . . . %d\n"
 				 " rtt . . . . . %dms\n"
-				 //" p . . . . . . %.8f\n"
-				 " tx_s. . . . . %d\n"
+				 " inflightB . . %d\n"
 				 //" recvSeqNum. . %d\n"
 				 " pendingB. . . %d\n"
 				 " outReliableB. %d\n"
@@ -2957,11 +4232,10 @@ void CSteamNetworkConnectionBase::GetDebugText( char *pszOut, int nOutCCH )
 				 " msgs. . . . . %lld\n",
 				 GetDescription(),
 				 m_senderState.m_n_x,
-				 //m_senderState.m_n_x_recv,
-				 m_senderState.m_n_x_calc,
+				 m_senderState.m_pCongestionControl ? m_senderState.m_pCongestionControl->GetName() : "none",
+				 m_senderState.m_cbMaxEncryptedPayloadSend,
 				 m_statsEndToEnd.m_ping.m_nSmoothedPing,
-				 //(float)m_senderState.m_un_p / (float)UINT_MAX,
-				 m_senderState.m_n_tx_s,
+				 m_senderState.m_cbInFlight,
 				 //m_senderState.m_unRecvSeqNum,
 				 m_senderState.PendingBytesTotal(),
 				 m_senderState.m_cbSentUnackedReliable,
@@ -3284,366 +4558,6 @@ void CSteamNetworkConnectionBase::GetDebugText( char *pszOut, int nOutCCH )
 //	}
 //}
 //
-//// Called when receiver wants to send feedback, sets up the next packet transmit to include feedback
-//void CSteamNetworkConnectionBase::SNP_PrepareFeedback( SteamNetworkingMicroseconds usecNow )
-//{
-//	// Update x_recv
-//	SteamNetworkingMicroseconds usec_delta = usecNow - m_receiverState.m_usec_tstamp_last_feedback;
-//	if ( usec_delta )
-//	{
-//		int n_x_recv = k_nMillion * m_receiverState.m_n_bytes_recv / usec_delta;
-//		// if higher take, otherwise smooth
-//		if ( n_x_recv > m_receiverState.m_n_x_recv )
-//		{
-//			m_receiverState.m_n_x_recv = n_x_recv;
-//		}
-//		else
-//		{
-//			m_receiverState.m_n_x_recv = tfrc_ewma( m_receiverState.m_n_x_recv, n_x_recv, 9 );
-//		}
-//
-//		if ( steamdatagram_snp_log_feedback )
-//			SpewMsg( "%12llu %s: TFRC_FBACK_PERIODIC usec_delta=%llu bytes_recv=%d n_x_recv=%d m_n_x_recv=%d\n",
-//					 usecNow,
-//					 m_sName.c_str(),
-//					 usec_delta,
-//					 m_receiverState.m_n_bytes_recv,
-//					 n_x_recv,
-//					 m_receiverState.m_n_x_recv );
-//	}
-//
-//	m_receiverState.m_usec_tstamp_last_feedback = usecNow;
-//	m_receiverState.m_usec_next_feedback = usecNow + GetUsecPingWithFallback( this );
-//	m_receiverState.m_n_bytes_recv = 0;
-//}
-//
-//bool CSteamNetworkConnectionBase::SNP_CalcIMean( SteamNetworkingMicroseconds usecNow )
-//{
-//	static const float tfrc_lh_weights[NINTERVAL] = { 1.0f, 1.0f, 1.0f, 1.0f, 0.8f, 0.6f, 0.4f, 0.2f };
-//
-//	// RFC 3448, 5.4
-//
-//	int i_i;
-//	float i_tot0 = 0, i_tot1 = 0, w_tot = 0;
-//
-//	if ( m_receiverState.m_vec_li_hist.empty() )
-//		return false;
-//
-//	int i = 0;
-//	for ( auto li_iterator = m_receiverState.m_vec_li_hist.rbegin() ; li_iterator != m_receiverState.m_vec_li_hist.rend() && i < NINTERVAL ; ++li_iterator )
-//	{
-//		i_i = li_iterator->m_un_length;
-//
-//		i_tot0 += i_i * tfrc_lh_weights[i];
-//		w_tot += tfrc_lh_weights[i];
-//
-//		if (i > 0)
-//			i_tot1 += i_i * tfrc_lh_weights[i-1];
-//
-//		++i;
-//	}
-//
-//	float f_mean = Max( i_tot0, i_tot1 ) / w_tot;
-//
-//	m_receiverState.m_li_i_mean = (uint32)( ( 1.0f / f_mean ) * (float)UINT_MAX );
-//	return true;
-//}
-//
-//bool CSteamNetworkConnectionBase::SNP_AddLossEvent( uint16 unSeqNum, SteamNetworkingMicroseconds usecNow )
-//{
-//	// See if this loss is a new loss
-//	Assert( !m_receiverState.m_queue_rx_hist.empty() );
-//	uint16 lastRecvSeqNum = m_receiverState.m_queue_rx_hist.back().m_unRecvSeqNum;
-//	uint16 firstLossSeqNum = lastRecvSeqNum + 1;
-//	uint16 lastLossSeqNum = unSeqNum - 1;
-//	Assert( SeqDist( lastLossSeqNum, firstLossSeqNum ) >= 0 );
-//
-//	if ( !m_receiverState.m_vec_li_hist.empty() )
-//	{
-//		// RFC 3448, 5.2
-//		// 
-//		// For a lost packet, we can interpolate to infer the nominal "arrival time".  Assume:
-//		// 
-//		//       S_loss is the sequence number of a lost packet.
-//		// 
-//		//       S_before is the sequence number of the last packet to arrive with
-//		//       sequence number before S_loss.
-//		// 
-//		//       S_after is the sequence number of the first packet to arrive with
-//		//       sequence number after S_loss.
-//		// 
-//		//       T_before is the reception time of S_before.
-//		// 
-//		//       T_after is the reception time of S_after.
-//		// 
-//		//    Note that T_before can either be before or after T_after due to
-//		//    reordering.
-//		// 
-//		//    For a lost packet S_loss, we can interpolate its nominal "arrival
-//		//    time" at the receiver from the arrival times of S_before and S_after.
-//		//    Thus:
-//		// 
-//		//    T_loss = T_before + ( (T_after - T_before)
-//		//                * (S_loss - S_before)/(S_after - S_before) )
-//
-//		SteamNetworkingMicroseconds before_ts = m_receiverState.m_queue_rx_hist.back().m_usec_recvTs;
-//		SteamNetworkingMicroseconds after_ts = usecNow;
-//
-//		uint16 S_before = lastRecvSeqNum;
-//		uint16 S_after = unSeqNum;
-//
-//		SteamNetworkingMicroseconds firstloss_ts = before_ts + 
-//			( (after_ts - before_ts ) * SeqDist( firstLossSeqNum, S_before ) / SeqDist( S_after, S_before ) );
-//
-//		SteamNetworkingMicroseconds usec_rtt = m_receiverState.m_queue_rx_hist.back().m_usecPing;
-//		if ( firstloss_ts - m_receiverState.m_vec_li_hist.back().m_ts <= usec_rtt )
-//		{
-//			// This is in the same loss interval
-//			return false;
-//		}
-//	}
-//
-//	// Cull if full
-//	if ( m_receiverState.m_vec_li_hist.size() == LIH_SIZE )
-//	{
-//		m_receiverState.m_vec_li_hist.pop_front();
-//	}
-//	
-//	// New loss interval
-//	SSNPReceiverState::S_lh_hist hist;
-//	hist.m_ts = usecNow;
-//	hist.m_un_seqno = firstLossSeqNum;
-//	hist.m_b_is_closed = false;
-//	m_receiverState.m_vec_li_hist.push_back( hist );
-//
-//	auto plh_hist = m_receiverState.m_vec_li_hist.rbegin();
-//
-//	// Update previous loss interval length if needed
-//	if ( m_receiverState.m_vec_li_hist.size() == 1 )
-//	{
-//		// First loss interval, we have to do some special handling to calc i_mean
-//		// via RFC 3448 6.3.1
-//
-//		// We need to find the p value that results in something close to x_recv
-//		SteamNetworkingMicroseconds usec_rtt = m_receiverState.m_queue_rx_hist.back().m_usecPing;
-//		SteamNetworkingMicroseconds usec_delta = usecNow - m_receiverState.m_usec_tstamp_last_feedback;
-//		int n_cur_x_recv = usec_delta ? k_nMillion * m_receiverState.m_n_bytes_recv / usec_delta : 0;
-//		int n_x_recv = MAX( n_cur_x_recv * k_nBurstMultiplier / 2, 
-//							m_receiverState.m_n_x_recv * k_nBurstMultiplier / 2 );
-//
-//		if ( !n_x_recv )
-//		{
-//			n_x_recv = GetInitialRate( usec_rtt );
-//		}
-//
-//		int n_s = m_receiverState.m_n_rx_s;
-//		if ( !n_s )
-//		{
-//			n_s = k_cbSteamNetworkingSocketsMaxEncryptedPayload;
-//		}
-//
-//		// Find a value of p that matches within 5% of x_recv using binary search
-//		int x_cur = 0;
-//		float cur_p = 0.5f;
-//		while ( 100llu * (uint64)x_cur / (uint64)n_x_recv < 95llu ) // 5% tolerance
-//		{
-//			x_cur = TFRCCalcX( m_receiverState.m_n_rx_s, usec_rtt, cur_p );
-//			// Too small
-//			if ( x_cur == 0 )
-//			{
-//				cur_p = 0;
-//				break;
-//			}
-//			if ( x_cur < n_x_recv )
-//			{
-//				cur_p -= cur_p / 2.0f;
-//			}
-//			else
-//			{
-//				cur_p += cur_p / 2.0f;
-//			}
-//		}
-//
-//		// Set the packet number to a value that results in this p value
-//		uint16 len = cur_p ? (uint16)( MIN( USHRT_MAX, (uint32) ( 1.0f / cur_p ) ) ) : 1;
-//
-//		uint16 firstSeqNum = unSeqNum - len;
-//		plh_hist->m_un_seqno = firstSeqNum;
-//		plh_hist->m_un_length = SeqDist( unSeqNum, firstSeqNum );
-//
-//		Assert( plh_hist->m_un_length == len );
-//
-//		if ( steamdatagram_snp_log_loss )
-//		SpewMsg( "%12llu %s: LOSS INITIAL: x_recv: %d, cur_p: %.8f len: %d\n",
-//				 usecNow,
-//				 m_sName.c_str(),
-//				 n_x_recv,
-//				 cur_p,
-//				 len );
-//	}
-//	else
-//	{
-//		plh_hist->m_un_length = SeqDist( unSeqNum, firstLossSeqNum );
-//
-//		// Back up one more to the one before this
-//		auto pprev_lh_hist = plh_hist;
-//		++pprev_lh_hist;
-//		pprev_lh_hist->m_un_length = SeqDist( firstLossSeqNum, pprev_lh_hist->m_un_seqno );
-//	}
-//
-//	SNP_CalcIMean( usecNow );
-//	return true;
-//}
-//
-//// This returns true if i_mean gets smaller and the sender should reduce rate
-//bool CSteamNetworkConnectionBase::SNP_UpdateIMean( uint16 unSeqNum, SteamNetworkingMicroseconds usecNow )
-//{
-//	if ( m_receiverState.m_vec_li_hist.empty() )
-//	{
-//		return false;
-//	}
-//
-//	SSNPReceiverState::S_lh_hist &lh_hist = m_receiverState.m_vec_li_hist.back();
-//
-//	// Cap at USHRT_MAX
-//	if ( lh_hist.m_un_length < USHRT_MAX )
-//	{
-//		uint16 len = SeqDist( unSeqNum, lh_hist.m_un_seqno ) + 1;
-//		if ( len < lh_hist.m_un_length ) // We wrapped
-//		{
-//			lh_hist.m_un_length = USHRT_MAX;
-//		}
-//		else
-//		{
-//			lh_hist.m_un_length = (uint16)len;
-//		}
-//	}
-//
-//	uint16 old_i_mean = m_receiverState.m_li_i_mean;
-//	SNP_CalcIMean( usecNow );
-//	return m_receiverState.m_li_i_mean < old_i_mean;
-//}
-
-//void CSteamNetworkConnectionBase::SNP_NoFeedbackTimer( SteamNetworkingMicroseconds usecNow )
-//{
-//	SteamNetworkingMicroseconds usecPing = GetUsecPingWithFallback( this );
-//	int recover_rate = GetInitialRate( usecPing );
-//
-//	// Reset feedback state to "no feedback received"
-//	if ( m_senderState.m_e_tx_state == SSNPSenderState::TFRC_SSTATE_FBACK)
-//	{
-//		m_senderState.m_e_tx_state = SSNPSenderState::TFRC_SSTATE_NO_FBACK;
-//	}
-//
-//	int n_old_x = m_senderState.m_n_x;
-//
-//	// Determine new allowed sending rate X as per RFC5348 4.4
-//
-//	// sender does not have an RTT sample, has not received any feedback from receiver,
-//	// and has not been idle ever since the nofeedback timer was set
-//	if ( m_statsEndToEnd.m_ping.m_nSmoothedPing < 0 && m_senderState.m_usec_rto == 0 && m_senderState.m_bSentPacketSinceNFB )
-//	{
-//		/* halve send rate directly */
-//		m_senderState.m_n_x = MAX( m_senderState.m_n_x / 2, k_cbSteamNetworkingSocketsMaxEncryptedPayload );
-//	}
-//	else if ( ( ( m_senderState.m_un_p > 0 && m_senderState.m_n_x_recv < recover_rate ) ||
-//			    ( m_senderState.m_un_p == 0 && m_senderState.m_n_x < 2 * recover_rate ) ) &&
-//			  !m_senderState.m_bSentPacketSinceNFB )
-//	{
-//		// Don't halve the allowed sending rate.
-//		// Do nothing
-//	}
-//	else if ( m_senderState.m_un_p == 0 )
-//	{
-//		// We do not have X_Bps yet.
-//		// Halve the allowed sending rate.		
-//		int configured_min_rate = m_senderState.m_n_minRate ? m_senderState.m_n_minRate : steamdatagram_snp_min_rate;
-//		m_senderState.m_n_x = MAX( configured_min_rate, MAX( m_senderState.m_n_x / 2, k_cbSteamNetworkingSocketsMaxEncryptedPayload ) );
-//	}
-//	else if ( m_senderState.m_n_x_calc > k_nBurstMultiplier * m_senderState.m_n_x_recv )
-//	{
-//		// 2*X_recv was already limiting the sending rate.
-//		// Halve the allowed sending rate.
-//		m_senderState.m_n_x_recv = m_senderState.m_n_x_recv / 2;
-//		SNP_UpdateX( usecNow );
-//	}
-//	else
-//	{
-//		// The sending rate was limited by X_Bps, not by X_recv.
-//		// Halve the allowed sending rate.
-//    	m_senderState.m_n_x_recv = m_senderState.m_n_x_calc / 2;
-//		SNP_UpdateX( usecNow );
-//	}
-//
-//	// Set new timeout for the nofeedback timer.	
-//	m_senderState.SetNoFeedbackTimer( usecNow );
-//	m_senderState.m_bSentPacketSinceNFB = false;
-//
-//	if ( steamdatagram_snp_log_feedback )
-//		SpewMsg( "%12llu %s: NO FEEDBACK TIMER X=%d, was %d, timer is %llu (rtt is %dms)\n",
-//				 usecNow,
-//				 m_sName.c_str(),
-//				 m_senderState.m_n_x,
-//				 n_old_x,
-//				 m_senderState.m_usec_nfb - usecNow,
-//				 m_statsEndToEnd.m_ping.m_nSmoothedPing );
-//}
-
-//// 0 for no loss
-//// 1 for loss
-//// -1 for discard (out of order)
-//int CSteamNetworkConnectionBase::SNP_CheckForLoss( uint16 unSeqNum, SteamNetworkingMicroseconds usecNow )
-//{
-//	if ( !m_receiverState.m_queue_rx_hist.empty() && SeqDist( unSeqNum, m_receiverState.m_queue_rx_hist.back().m_unRecvSeqNum ) > 1 )
-//	{
-//		int nSeqDelta = SeqDist( unSeqNum, m_receiverState.m_queue_rx_hist.back().m_unRecvSeqNum );
-//		if ( nSeqDelta > USHRT_MAX/2 ) // Out of order
-//		{
-//			SpewMsg( "%12llu %s: RECV OOO PACKET(S) %d (wanted %d)\n",
-//				usecNow,
-//				m_sName.c_str(),
-//				unSeqNum,
-//				( uint16 )( m_receiverState.m_queue_rx_hist.back().m_unRecvSeqNum + 1 ) );
-//
-//			// We're totally fine with out of order packets, just accept them.
-//			return 0;
-//		}
-//
-//		uint16 first = m_receiverState.m_queue_rx_hist.back().m_unRecvSeqNum + 1;
-//		uint16 second = unSeqNum - 1;
-//		if ( steamdatagram_snp_log_packet || steamdatagram_snp_log_loss )
-//		SpewMsg( "%12llu %s: RECV LOST %d PACKET(S) %d - %d\n", 
-//				 usecNow,
-//				 m_sName.c_str(),
-//				 nSeqDelta - 1,
-//				 first,
-//				 second );
-//
-//		// Add a lost event
-//		SNP_AddLossEvent( unSeqNum, usecNow );
-//
-//		// If we detect loss, we should send a packet on the next interval
-//		// This is so the sender can quickly determine if a retransmission is necesary
-//		m_senderState.m_bPendingNAK = true;
-//
-//		return 1;
-//	}
-//	return 0;
-//}
-//
-//void CSteamNetworkConnectionBase::SNP_RecordPacket( int64 nPktNum, SteamNetworkingMicroseconds usecNow )
-//{
-//	// Record the packet
-//	if ( m_receiverState.m_queue_rx_hist.size() >= TFRC_NDUPACK )
-//		m_receiverState.m_queue_rx_hist.pop_front();
-//	
-//	SSNPReceiverState::S_rx_hist rx_hist;
-//	rx_hist.m_unRecvSeqNum = unSeqNum;
-//	rx_hist.m_usecPing = unRtt;
-//	rx_hist.m_usec_recvTs = usecNow;
-//	m_receiverState.m_queue_rx_hist.push_back( rx_hist );
-//}
-//
 //int CSteamNetworkConnectionBase::SNP_SendPacket( SteamNetworkingMicroseconds usecNow )
 //{
 //	SSNPBuffer sendBuf;
@@ -3,6 +3,7 @@
 #pragma once
 
 #include "../steamnetworkingsockets_internal.h"
+#include "steamnetworkingsockets_alloc.h"
 #include <vector>
 #include <map>
 #include <set>
@@ -12,6 +13,7 @@ struct P2PSessionState_t;
 namespace SteamNetworkingSocketsLib {
 
 class CSteamNetworkConnectionBase;
+class CSteamNetworkingMessage;
 
 //
 // Constants
@@ -38,9 +40,60 @@ const int k_nSteamDatagramGlobalMaxRate = 4*k_nMillion;
 
 const int k_nBurstMultiplier = 4; // how much we should allow for burst, TFRC defaults to 2 but we need more
 
+/// std::map that allocates its nodes through the allocator hooks.  We use
+/// these for all the bookkeeping that grows and shrinks as packets are sent
+/// and acked.
+template <typename K, typename V, typename L = std::less<K> >
+using SNPMap = std::map< K, V, L, TaggedAllocator< std::pair<const K, V>, k_ESteamNetworkingAllocTag_SNP > >;
+
 const int k_nMaxPacketsPerThink = 16;
 
-const float k_flSendRateBurstOverageAllowance = k_cbSteamNetworkingSocketsMaxEncryptedPayloadSend;
+/// Limits on the pacing quantum (steamdatagram_snp_pacing_quantum), in bytes
+const int k_cbMinPacingQuantum = 0;
+const int k_cbMaxPacingQuantum = 64*1024;
+
+/// We ask the kernel to pace a little faster than we do.  It's only there
+/// to smooth out bursts when we wake up late, we don't want it to build
+/// up a queue that we don't know about.
+const float k_flKernelPacingRateMultiplier = 1.25f;
+
+/// Path MTU discovery.  (Datagram PLPMTUD, RFC 8899.)  A probe size is
+/// considered to not work after this many probes of that size are lost
+const int k_nPMTUMaxProbes = 3;
+
+/// Stop searching once we have narrowed the range down to this many bytes
+const int k_cbPMTUSearchGranularity = 32;
+
+/// How long to wait after a search completes before trying for a larger size
+const SteamNetworkingMicroseconds k_usecPMTURaiseTimer = 600*k_nMillion;
+
+/// If this many packets larger than the base size are lost in a row,
+/// over at least this long, without any of them getting through, assume
+/// that the path has changed and is now dropping them.  (The time limit
+/// is so that we don't mistake a burst of congestion loss for this.)
+/// Fall back to the base size and search again.
+const int k_nPMTUBlackHoleLosses = 6;
+const SteamNetworkingMicroseconds k_usecPMTUBlackHoleTime = k_nMillion;
+
+/// Max number of fragmented unreliable messages we will reassemble at
+/// the same time.  When we need a slot and they are all in use, the
+/// oldest partial message is discarded.
+const int k_nMaxUnreliableReassemblyMsgs = 4;
+
+/// Max number of disjoint byte ranges we track for a partial unreliable
+/// message.  Segments normally arrive in order, so this is almost always 1.
+/// A segment that would need more than this is dropped.
+const int k_nMaxUnreliableReassemblyRanges = 8;
+
+/// Partial unreliable messages older than this are discarded.  The rest of
+/// the message was sent right behind the first piece we got, so if it
+/// hasn't shown up by now, it was lost.
+const SteamNetworkingMicroseconds k_usecUnreliableReassemblyTimeout = 2*k_nMillion;
+
+/// Lanes with the same priority share bandwidth using weighted fair queueing.
+/// Each lane has a virtual clock, which advances by the number of bytes sent
+/// on the lane, times this scale factor, divided by the lane's weight.
+const int64 k_nLaneVirtualTimeScale = 0x10000;
 
 struct SNPRange_t
 {
@@ -69,6 +122,12 @@ struct SNPRange_t
 	};
 };
 
+/// A range of the reliable stream of a particular lane
+struct SNPRangeWithLane : SNPRange_t
+{
+	int m_idxLane;
+};
+
 /// A packet that has been sent but we don't yet know if was received
 /// or dropped.  These are kept in an ordered map keyed by packet number.
 /// (Hence the packet number not being a member)  When we receive an ACK,
@@ -83,12 +142,30 @@ struct SNPInFlightPacket_t
 	/// an ack for this same packet, that's OK!
 	bool m_bNack;
 
+	/// Size of the packet on the wire, for in-flight accounting
+	/// and delivery rate estimation.
+	int m_cbWire;
+
+	/// Did we run out of data to send when we sent this packet?  If so,
+	/// a delivery rate sample taken when it is acked measures the app,
+	/// not the network.
+	bool m_bAppLimited;
+
+	/// Was this packet larger than k_cbSteamNetworkingSocketsMaxEncryptedPayloadSend?
+	bool m_bAboveBasePMTU;
+
+	/// Snapshot of the delivery rate estimation state in SSNPSenderState
+	/// at the time this packet was sent.
+	int64 m_nDeliveredAtSend;
+	SteamNetworkingMicroseconds m_usecDeliveredTimeAtSend;
+	SteamNetworkingMicroseconds m_usecFirstSentTimeAtSend;
+
 	/// List of reliable segments.  Ignoring retransmission,
 	/// there really is no reason why we we would need to have
 	/// more than 1 in a packet, even if there are multiple
 	/// reliable messages.  If we need to retry, we might
 	/// be fragmented.  But usually it will only be a few.
-	vstd::small_vector<SNPRange_t,1> m_vecReliableSegments;
+	vstd::small_vector<SNPRangeWithLane,1> m_vecReliableSegments;
 };
 
 /// Track an outbound message in various states
@@ -96,10 +173,11 @@ struct SNPSendMessage_t
 {
 	// FIXME Probably should provide an optimized allocator for this,
 	// since these are small and are created and destroyed often.
+	STEAMNETWORKINGSOCKETS_DECLARE_TAGGED_ALLOC( k_ESteamNetworkingAllocTag_SendQueue )
 
 	~SNPSendMessage_t()
 	{
-		delete [] m_pData;
+		TaggedFree( m_pData, k_ESteamNetworkingAllocTag_SendQueue );
 	}
 
 	/// Message number.
@@ -123,6 +201,18 @@ struct SNPSendMessage_t
 
 	/// Offset in reliable stream of the header byte.  0 if we're not reliable.
 	int64 m_nReliableStreamPos;
+
+	/// True if this is a reliable message that the receiver can deliver
+	/// out of order.
+	bool m_bUnordered;
+
+	/// True if the app asked for k_nSteamNetworkingSendFlags_Unordered.  If
+	/// we didn't know the peer's version yet, m_bUnordered is false, and we
+	/// fix it up once the connection is established.
+	bool m_bWantUnordered;
+
+	/// Size of the reliable header at the front of m_pData
+	uint8 m_cbReliableHdr;
 };
 
 struct SSNPSendMessageList
@@ -191,8 +281,177 @@ struct SSNPSendMessageList
 
 };
 
+/// What we learned from an ack frame, for congestion control.  The delivery
+/// rate sample is computed in the manner of draft-cheng-iccrg-delivery-rate-estimation,
+/// based on the most recently sent packet that was acked.
+struct SNPRateSample_t
+{
+	/// Total bytes delivered to the peer over the life of the connection,
+	/// including this ack
+	int64 m_nDelivered;
+
+	/// Value of m_nDelivered when the most recently sent packet that was
+	/// acked by this frame was sent
+	int64 m_nPriorDelivered;
+
+	/// Bytes delivered over the sampling interval, and the length of the interval.
+	/// The interval is zero if we don't have a valid sample
+	int64 m_nIntervalDelivered;
+	SteamNetworkingMicroseconds m_usecInterval;
+
+	/// Was the sample taken while the app wasn't giving us enough data to
+	/// keep the pipe full?  If so, it's a lower bound on the bandwidth.
+	bool m_bAppLimited;
+
+	/// Number of packets newly acked by this frame, and the bytes they contained
+	int m_nPktsAcked;
+	int m_cbAcked;
+
+	/// Bytes still in flight after processing the ack
+	int m_cbInFlight;
+
+	/// How long the peer says it held the ack before sending it,
+	/// or 0 if it didn't report a delay in this frame
+	SteamNetworkingMicroseconds m_usecAckDelay;
+
+	/// Delivery rate, in bytes/sec, or 0 if we don't have a sample
+	inline int DeliveryRate() const
+	{
+		if ( m_usecInterval <= 0 )
+			return 0;
+		return (int)Min( m_nIntervalDelivered * k_nMillion / m_usecInterval, (int64)INT_MAX );
+	}
+};
+
+/// Interface to the algorithm that decides how fast we send.  It is fed
+/// ack and loss events and RTT samples, and produces a send rate.
+class ISNPCongestionControl
+{
+public:
+	virtual ~ISNPCongestionControl() {}
+
+	virtual ESteamNetworkingCongestionControl GetType() const = 0;
+	virtual const char *GetName() const = 0;
+
+	/// sizeof the object, for memory accounting
+	virtual int GetObjectSize() const = 0;
+
+	/// Start things off (or take over from another controller), given
+	/// the rate we should start at and the current RTT estimate
+	virtual void Init( int nInitialRate, SteamNetworkingMicroseconds usecRTT, SteamNetworkingMicroseconds usecNow ) = 0;
+
+	/// Called when we put a packet on the wire
+	virtual void OnPacketSent( int cbPkt, int cbInFlight, SteamNetworkingMicroseconds usecNow ) = 0;
+
+	/// Called once for each ack frame that acks at least one new packet
+	virtual void OnAck( const SNPRateSample_t &rs, SteamNetworkingMicroseconds usecNow ) = 0;
+
+	/// Called when a packet is declared lost, either because the peer
+	/// nacked it or because we timed out waiting for the ack
+	virtual void OnPacketLost( int64 nPktNum, SteamNetworkingMicroseconds usecWhenSent, SteamNetworkingMicroseconds usecNow ) = 0;
+
+	/// Called with each RTT sample, after subtracting the time the peer
+	/// says that it held the ack
+	virtual void OnRTTSample( SteamNetworkingMicroseconds usecRTT, SteamNetworkingMicroseconds usecNow ) = 0;
+
+	/// Service any timers, and return the rate we should send at, in bytes/sec.
+	/// The caller will clamp the rate to the given limits.  The controller should
+	/// apply the same clamp to its own state, so that it doesn't wander off
+	/// somewhere we aren't actually sending at.
+	virtual int CalcSendRate( int nMinRate, int nMaxRate, SteamNetworkingMicroseconds usecNow ) = 0;
+};
+
+/// Create a congestion controller of the specified type.  Returns nullptr
+/// if the type isn't valid.
+extern ISNPCongestionControl *CreateSNPCongestionControl( int eType );
+
+/// Sender state for a lane.  Each lane is an independent stream of messages,
+/// with its own message numbers and reliable stream.
+struct SSNPSendLane
+{
+	/// Lanes with lower numbers are always serviced first
+	int m_nPriority = 0;
+
+	/// Share of the bandwidth, relative to other lanes with the same priority
+	int m_nWeight = 1;
+
+	/// Weighted fair queueing virtual clock.  See k_nLaneVirtualTimeScale.
+	/// Only meaningful relative to other lanes with the same priority that
+	/// have data queued.
+	int64 m_nVirtualTime = 0;
+
+	/// Charge the lane for bytes we are sending
+	inline void AdvanceVirtualTime( int cbBytes )
+	{
+		m_nVirtualTime += cbBytes * k_nLaneVirtualTimeScale / m_nWeight;
+	}
+
+	// Current message number, we ++ when adding a message
+	int64 m_nReliableStreamPos = 1;
+	int64 m_nLastSentMsgNum = 0; // Will increment to 1 with first message
+	int64 m_nLastSendMsgNumReliable = 0;
+
+	/// List of messages that we have not yet finished putting on the wire the first time.
+	/// The Nagle timer may be active on one or more, but if so, it is only on messages
+	/// at the END of the list.  The first message may be partially sent.
+	SSNPSendMessageList m_messagesQueued;
+
+	/// How many bytes into the first message in the queue have we put on the wire?
+	int m_cbCurrentSendMessageSent = 0;
+
+	/// List of reliable messages that have been fully placed on the wire at least once,
+	/// but we're hanging onto because of the potential need to retry.  (Note that if we get
+	/// packet loss, it's possible that we hang onto a message even after it's been fully
+	/// acked, because a prior message is still needed.  We always operate on this list
+	/// like a queue, rather than seeking into the middle of the list and removing messages
+	/// as soon as they are no longer needed.)
+	SSNPSendMessageList m_unackedReliableMessages;
+
+	/// Ordered list of reliable ranges that we have recently sent
+	/// in a packet.  These should be non-overlapping, and furthermore
+	/// should not overlap with with any range in m_listReadyReliableRange
+	///
+	/// The "value" portion of the map is the message that has the first bit of
+	/// reliable data we need for this message
+	SNPMap<SNPRange_t,SNPSendMessage_t*,SNPRange_t::NonOverlappingLess> m_listInFlightReliableRange;
+
+	/// Ordered list of ranges that have been put on the wire,
+	/// but have been detected as dropped, and now need to be retried.
+	SNPMap<SNPRange_t,SNPSendMessage_t*,SNPRange_t::NonOverlappingLess> m_listReadyRetryReliableRange;
+
+	// Remove messages from m_unackedReliableMessages that have been fully acked.
+	void RemoveAckedReliableMessageFromUnackedList();
+};
+
 struct SSNPSenderState
 {
+	SSNPSenderState()
+	{
+		// Lane 0 always exists
+		m_vecLanes.resize( 1 );
+	}
+	~SSNPSenderState()
+	{
+		delete m_pCongestionControl;
+
+		// Free messages we never finished sending, or that were never acked
+		for ( SSNPSendLane &lane: m_vecLanes )
+		{
+			while ( SNPSendMessage_t *pMsg = lane.m_messagesQueued.pop_front() )
+				delete pMsg;
+			while ( SNPSendMessage_t *pMsg = lane.m_unackedReliableMessages.pop_front() )
+				delete pMsg;
+		}
+	}
+	SSNPSenderState( const SSNPSenderState & ) = delete;
+	SSNPSenderState &operator=( const SSNPSenderState & ) = delete;
+
+	/// Congestion control algorithm, which sets m_n_x.  This is created
+	/// when the connection is established.
+	ISNPCongestionControl *m_pCongestionControl = nullptr;
+
+	/// Algorithm requested for this connection.  0 means use the global default
+	int m_eCongestionControl = 0;
 
 	// Sender TFRC control values and timers
 
@@ -204,18 +463,20 @@ struct SSNPSenderState
 
 	int m_n_minRate = 0; // Minimum send rate, if 0 defaults to using the global config setting
 	int m_n_maxRate = 0; // Maximum send rate, if 0 defaults to using the global config setting
-	//int m_n_x_recv = 0; // Received rate transmitted by receiver
-	int m_n_x_calc = 0;	// Calculated rate in bytes per second
-	//uint32 m_un_p = 0;		// Current loss event rate (0-1) scaled to 0-UINT_MAX
-	int m_n_tx_s = k_cbSteamNetworkingSocketsMaxEncryptedPayloadSend;	// Average packet size in bytes
-	//SteamNetworkingMicroseconds m_usec_rto = 0; // RTO calc
-	//SteamNetworkingMicroseconds m_usec_nfb = 0; // Nofeedback Timer
-	//bool m_bSentPacketSinceNFB = false; // Set to false whenever we update nfb to detect sender idle periods
+
+	// Delivery rate estimation.  Total bytes acked, time of the most recent
+	// ack, and the send time of the most recently sent packet that was acked.
+	int64 m_nDelivered = 0;
+	SteamNetworkingMicroseconds m_usecDeliveredTime = 0;
+	SteamNetworkingMicroseconds m_usecFirstSentTime = 0;
+
+	/// Bytes in packets that we have sent, and that have not been acked or declared lost
+	int m_cbInFlight = 0;
 
 	/// If >=0, then we can send a full packet right now.  We allow ourselves to "store up"
-	/// about 1 packet worth of "reserve".  In other words, if we have not sent any packets
-	/// for a while, basically we allow ourselves to send two packets in rapid succession,
-	/// thus "bursting" over the limit by 1 packet.  That long term rate will be clamped by
+	/// a reserve of m_cbPacingQuantum bytes.  In other words, if we have not sent any packets
+	/// for a while, basically we allow ourselves to send a quantum's worth of packets in rapid
+	/// succession, thus "bursting" over the limit.  That long term rate will be clamped by
 	/// the send rate.
 	///
 	/// If <0, then we are currently "over" our rate limit and need to wait before we can
@@ -228,10 +489,72 @@ struct SSNPSenderState
 	/// Last time that we added tokens to m_flTokenBucket
 	SteamNetworkingMicroseconds m_usecTokenBucketTime = 0;
 
+	/// Max reserve we allow in the token bucket, in bytes.  (The largest
+	/// burst we will send at line rate.)  Set from steamdatagram_snp_pacing_quantum
+	float m_flPacingQuantum = k_cbSteamNetworkingSocketsMaxEncryptedPayloadSend;
+
+	/// Rate we last asked the kernel to pace at.  0 if we haven't
+	/// asked, -1 if the transport doesn't support it.
+	int m_nKernelPacingRate = 0;
+
+	//
+	// Path MTU discovery.  All sizes are of the encrypted SNP payload,
+	// not the whole datagram.
+	//
+
+	/// Largest payload we know will get through.  We start with a size that
+	/// should work on basically any path and grow it by probing.
+	int m_cbMaxEncryptedPayloadSend = k_cbSteamNetworkingSocketsMaxEncryptedPayloadSend;
+
+	/// Upper bound of the current search.  Sizes above this are known (or
+	/// assumed) to not work.
+	int m_cbPMTUSearchHigh = k_cbSteamNetworkingSocketsMaxEncryptedPayloadSend;
+
+	/// Size of the next probe to send.  0 if we are not searching
+	int m_cbPMTUProbe = 0;
+
+	/// Packet number of the probe in flight, or 0 if none
+	int64 m_nPMTUProbePktNum = 0;
+
+	/// Number of probes of size m_cbPMTUProbe that have been lost
+	int m_nPMTUProbeFailures = 0;
+
+	/// When to send the next probe, or start the next search
+	SteamNetworkingMicroseconds m_usecPMTUNextProbe = INT64_MAX;
+
+	/// Number of consecutive packets larger than the base size that have
+	/// been lost, and when the first one was sent.  See k_nPMTUBlackHoleLosses
+	int m_nPMTUBlackHoleLosses = 0;
+	SteamNetworkingMicroseconds m_usecPMTUBlackHoleFirstLoss = 0;
+
+	//
+	// Ack frequency we have asked the peer to use.  We keep sending
+	// the request until a packet carrying it is acked.  Initialized
+	// to what the peer uses if we never ask for anything.
+	//
+
+	int m_nAckPacketToleranceSent = 0;
+	SteamNetworkingMicroseconds m_usecMaxAckDelaySent = k_usecMaxDataAckDelay;
+
+	/// Packet number of the latest request, and when we sent it.  0 if we haven't sent one.
+	int64 m_nAckFrequencyPktNum = 0;
+	SteamNetworkingMicroseconds m_usecAckFrequencySent = 0;
+	bool m_bAckFrequencyAcked = true;
+
+	/// Did the last packet we sent with data leave more data waiting to be sent?
+	bool m_bBacklogged = false;
+
+	/// When did we last ask the peer to ack a packet immediately?
+	SteamNetworkingMicroseconds m_usecLastImmediateAckRequest = 0;
+
+	/// Have we ever queued a reliable message marked as a chunk of a larger
+	/// stream?  (Only newer peers understand the marker.)
+	bool m_bSentStreamChunks = false;
+
 	void TokenBucket_Init( SteamNetworkingMicroseconds usecNow )
 	{
 		m_usecTokenBucketTime = usecNow;
-		m_flTokenBucket = k_flSendRateBurstOverageAllowance;
+		m_flTokenBucket = m_flPacingQuantum;
 	}
 
 	/// Accumulate "tokens" into our bucket base on the current calculated send rate
@@ -258,9 +581,15 @@ struct SSNPSenderState
 	/// Other - Nagle timer of next packet
 	inline SteamNetworkingMicroseconds TimeWhenWantToSendNextPacket() const
 	{
-		if ( !m_listReadyRetryReliableRange.empty() )
-			return 0;
-		if ( m_messagesQueued.empty() )
+		SteamNetworkingMicroseconds usecNagle = INT64_MAX;
+		for ( const SSNPSendLane &lane: m_vecLanes )
+		{
+			if ( !lane.m_listReadyRetryReliableRange.empty() )
+				return 0;
+			if ( !lane.m_messagesQueued.empty() )
+				usecNagle = std::min( usecNagle, lane.m_messagesQueued.m_pFirst->m_usecNagle );
+		}
+		if ( usecNagle == INT64_MAX )
 		{
 			Assert( PendingBytesTotal() == 0 );
 			return INT64_MAX;
@@ -275,14 +604,14 @@ struct SSNPSenderState
 
 		// We have less than a full packet's worth of data.  Wait until
 		// the Nagle time, if we have one
-		return m_messagesQueued.m_pFirst->m_usecNagle;
+		return usecNagle;
 	}
 
 	/// Limit our token bucket to the max reserve amount
 	void TokenBucket_Limit()
 	{
-		if ( m_flTokenBucket > k_flSendRateBurstOverageAllowance )
-			m_flTokenBucket = k_flSendRateBurstOverageAllowance;
+		if ( m_flTokenBucket > m_flPacingQuantum )
+			m_flTokenBucket = m_flPacingQuantum;
 	}
 
 	/// Calculate time until we could send our next packet, checking our token
@@ -299,34 +628,27 @@ struct SSNPSenderState
 	/// Nagle timer on all pending messages
 	void ClearNagleTimers()
 	{
-		SNPSendMessage_t *pMsg = m_messagesQueued.m_pLast;
-		while ( pMsg && pMsg->m_usecNagle )
+		for ( SSNPSendLane &lane: m_vecLanes )
 		{
-			pMsg->m_usecNagle = 0;
-			pMsg = pMsg->m_pPrev;
+			SNPSendMessage_t *pMsg = lane.m_messagesQueued.m_pLast;
+			while ( pMsg && pMsg->m_usecNagle )
+			{
+				pMsg->m_usecNagle = 0;
+				pMsg = pMsg->m_pPrev;
+			}
 		}
 	}
 
-	// Current message number, we ++ when adding a message
-	int64 m_nReliableStreamPos = 1;
-	int64 m_nLastSentMsgNum = 0; // Will increment to 1 with first message
-	int64 m_nLastSendMsgNumReliable = 0;
+	/// Lanes.  There is always at least one
+	std::vector<SSNPSendLane> m_vecLanes;
 
-	/// List of messages that we have not yet finished putting on the wire the first time.
-	/// The Nagle timer may be active on one or more, but if so, it is only on messages
-	/// at the END of the list.  The first message may be partially sent.
-	SSNPSendMessageList m_messagesQueued;
+	/// Choose the lane that should send the next segment of new data.
+	/// Returns -1 if no lane has anything queued
+	int ChooseLaneToSend() const;
 
-	/// How many bytes into the first message in the queue have we put on the wire?
-	int m_cbCurrentSendMessageSent = 0;
-
-	/// List of reliable messages that have been fully placed on the wire at least once,
-	/// but we're hanging onto because of the potential need to retry.  (Note that if we get
-	/// packet loss, it's possible that we hang onto a message even after it's been fully
-	/// acked, because a prior message is still needed.  We always operate on this list
-	/// like a queue, rather than seeking into the middle of the list and removing messages
-	/// as soon as they are no longer needed.)
-	SSNPSendMessageList m_unackedReliableMessages;
+	/// Choose the highest priority lane that has reliable data that needs
+	/// to be retransmitted.  Returns -1 if there isn't any
+	int ChooseLaneToRetry() const;
 
 	// Buffered data counters.  See SteamNetworkingQuickConnectionStatus for more info
 	int m_cbPendingUnreliable = 0;
@@ -341,24 +663,12 @@ struct SSNPSenderState
 	/// List of packets that we have sent but don't know whether they were received or not.
 	/// We keep a dummy sentinel at the head of the list, with a negative packet number.
 	/// This vastly simplifies the processing.
-	std::map<int64,SNPInFlightPacket_t> m_mapInFlightPacketsByPktNum;
+	SNPMap<int64,SNPInFlightPacket_t> m_mapInFlightPacketsByPktNum;
 
 	/// The next unacked packet that should be timed out and implicitly NACKed,
 	/// if we don't receive an ACK in time.  Will be m_mapInFlightPacketsByPktNum.end()
 	/// if we don't have any in flight packets that we are waiting on.
-	std::map<int64,SNPInFlightPacket_t>::iterator m_itNextInFlightPacketToTimeout;
-
-	/// Ordered list of reliable ranges that we have recently sent
-	/// in a packet.  These should be non-overlapping, and furthermore
-	/// should not overlap with with any range in m_listReadyReliableRange
-	///
-	/// The "value" portion of the map is the message that has the first bit of
-	/// reliable data we need for this message
-	std::map<SNPRange_t,SNPSendMessage_t*,SNPRange_t::NonOverlappingLess> m_listInFlightReliableRange;
-
-	/// Ordered list of ranges that have been put on the wire,
-	/// but have been detected as dropped, and now need to be retried.
-	std::map<SNPRange_t,SNPSendMessage_t*,SNPRange_t::NonOverlappingLess> m_listReadyRetryReliableRange;
+	SNPMap<int64,SNPInFlightPacket_t>::iterator m_itNextInFlightPacketToTimeout;
 
 	/// Oldest packet sequence number that we are still asking peer
 	/// to send acks for.
@@ -366,68 +676,88 @@ struct SSNPSenderState
 
 	/// Time when this was updated
 	//SteamNetworkingMicroseconds m_usecWhenAdvancedMinPktWaitingOnAck = 0;
+};
 
-	/* TFRC sender states */
-	enum ETFRCSenderStates {
-		TFRC_SSTATE_NO_SENT = 1,
-		TFRC_SSTATE_NO_FBACK,
-		TFRC_SSTATE_FBACK,
-	};
-	ETFRCSenderStates m_e_tx_state = TFRC_SSTATE_NO_SENT; // Sender state
-	SteamNetworkingMicroseconds m_usec_no_feedback_timer = 0; // No feedback timer
-	SteamNetworkingMicroseconds m_usec_ld = 0; // Time last doubled during slow start
-
-//	// Set when receiver determines we need to send a feedback packet
-//	/* TFRC feedback sender states */
-//	enum ETFRCSenderFeedbackStates {
-//		TFRC_SSTATE_FBACK_NONE = 0, //
-//		TFRC_SSTATE_FBACK_REQ = 1, // Set if we should send a feedback without data (parm change)
-//		TFRC_SSTATE_FBACK_PERODIC = 2, // When periodic feedback is set, we piggy pack on a data packet
-//	};
-//	ETFRCSenderFeedbackStates m_sendFeedbackState = TFRC_SSTATE_FBACK_NONE;
-
-	// Remove messages from m_unackedReliableMessages that have been fully acked.
-	void RemoveAckedReliableMessageFromUnackedList();
-
-	void SetNoFeedbackTimer( SteamNetworkingMicroseconds usecNow )
+/// Ring buffer of bytes, used to hold reliable stream data that we have
+/// received but have not yet decoded into messages.  The capacity is
+/// always a power of two, so wrapping is just a mask.  Data is added at
+/// the end and consumed from the front without moving anything else.
+class CSNPRecvRingBuffer
+{
+public:
+	CSNPRecvRingBuffer() {}
+	~CSNPRecvRingBuffer() { TaggedFree( m_pBuf, k_ESteamNetworkingAllocTag_SNP ); }
+	CSNPRecvRingBuffer( CSNPRecvRingBuffer &&x ) noexcept
+	: m_pBuf( x.m_pBuf ), m_cbCapacity( x.m_cbCapacity ), m_nHead( x.m_nHead ), m_cbSize( x.m_cbSize )
 	{
-		// FIXME
-		//if ( m_usec_rto == 0 )
-		//{
-		//	m_usec_nfb = usecNow + TFRC_INITIAL_TIMEOUT;
-		//}
-		//else
-		//{
-		//	// Calculate inter-packet-interval ("ipi")
-		//	SteamNetworkingMicroseconds ipi = k_nMillion * (int64)m_n_tx_s / (int64)m_n_x;
-		//
-		//	// Expect feedback within the RTO timeout, or 2 sent packets,
-		//	// whichever is greater
-		//	//
-		//	// Hm, this isn't what the RFC said to do.  I wonder where this logic came from.
-		//	m_usec_nfb = usecNow + Max( m_usec_rto, 2 * ipi );
-		//}
+		x.m_pBuf = nullptr;
+		x.m_cbCapacity = x.m_nHead = x.m_cbSize = 0;
 	}
-};
 
-struct SSNPRecvUnreliableSegmentKey
-{
-	int64 m_nMsgNum;
-	int m_nOffset;
+	inline int size() const { return m_cbSize; }
+	inline bool empty() const { return m_cbSize == 0; }
+	inline int capacity() const { return m_cbCapacity; }
+
+	/// Set the number of valid bytes.  Existing data is preserved.
+	/// If growing, the new bytes are not initialized.
+	void resize( int cbNewSize );
 
-	inline bool operator<(const SSNPRecvUnreliableSegmentKey &x) const
+	/// Copy data into the buffer at the specified offset from the front.
+	/// The range must be within size()
+	void Write( int nOffset, const void *pData, int cbData );
+
+	/// Add data to the end
+	inline void Append( const void *pData, int cbData )
 	{
-		if ( m_nMsgNum < x.m_nMsgNum ) return true;
-		if ( m_nMsgNum > x.m_nMsgNum ) return false;
-		return m_nOffset < x.m_nOffset;
+		int nOffset = m_cbSize;
+		resize( m_cbSize + cbData );
+		Write( nOffset, pData, cbData );
 	}
+
+	/// Discard data from the front
+	void PopFront( int cbData );
+
+	/// Locate cbData bytes, starting at the specified offset from the front.
+	/// They are in at most two contiguous spans; cb2 is 0 if the data doesn't wrap.
+	void GetSpans( int nOffset, int cbData, const uint8 *&p1, int &cb1, const uint8 *&p2, int &cb2 ) const;
+
+private:
+	uint8 *m_pBuf = nullptr;
+	int m_cbCapacity = 0; // Zero, or a power of two
+	int m_nHead = 0; // Index of the first valid byte
+	int m_cbSize = 0; // Number of valid bytes
+
+	CSNPRecvRingBuffer( const CSNPRecvRingBuffer & ) = delete;
+	CSNPRecvRingBuffer &operator=( const CSNPRecvRingBuffer & ) = delete;
 };
 
-struct SSNPRecvUnreliableSegmentData
+/// An unreliable message that was fragmented, and that we are in the process
+/// of reassembling.  Segments are written directly into the payload of the
+/// message that we will deliver to the app, so that completing the message
+/// doesn't require any further allocation or copying.
+struct SSNPRecvUnreliableMsg
 {
-	int m_cbSize = -1;
-	bool m_bLast = false;
-	char m_buf[ k_cbSteamNetworkingSocketsMaxPlaintextPayloadRecv ];
+	STEAMNETWORKINGSOCKETS_DECLARE_TAGGED_ALLOC( k_ESteamNetworkingAllocTag_SNP )
+
+	/// Message being reassembled.  nullptr if this slot is not in use
+	CSteamNetworkingMessage *m_pMsg = nullptr;
+
+	/// Lane and message number
+	int m_idxLane = 0;
+	int64 m_nMsgNum = 0;
+
+	/// When we received the first segment.  Used to expire stale messages
+	SteamNetworkingMicroseconds m_usecFirstSegment = 0;
+
+	/// Total size of the message.  -1 until we receive the last segment
+	int m_cbTotal = -1;
+
+	/// Sorted, non-overlapping, non-adjacent list of byte ranges we have received
+	int m_nRanges = 0;
+	struct Range_t { int m_nBegin, m_nEnd; } m_arRanges[ k_nMaxUnreliableReassemblyRanges ];
+
+	/// Discard the message being reassembled and mark the slot as free
+	void Reset();
 };
 
 struct SSNPPacketGap
@@ -436,14 +766,9 @@ struct SSNPPacketGap
 	SteamNetworkingMicroseconds m_usecWhenReceivedPktBefore;
 };
 
-struct SSNPReceiverState
+/// Receiver state for a lane
+struct SSNPRecvLane
 {
-	/// Unreliable message segments that we have received.  When an unreliable message
-	/// needs to be fragmented, we store the pieces here.  NOTE: it might be more efficient
-	/// to use a simpler container, with worse O(), since this should ordinarily be
-	/// a pretty small list.
-	std::map<SSNPRecvUnreliableSegmentKey,SSNPRecvUnreliableSegmentData> m_mapUnreliableSegments;
-
 	/// Stream position of the first byte in m_bufReliableData.  Remember that the first byte
 	/// in the reliable stream is actually at position 1, not 0
 	int64 m_nReliableStreamPos = 1;
@@ -455,7 +780,7 @@ struct SSNPReceiverState
 	int64 m_nLastRecvReliableMsgNum = 0;
 
 	/// Reliable data stream that we have received.  This might have gaps in it!
-	std::vector<byte> m_bufReliableStream;
+	CSNPRecvRingBuffer m_bufReliableStream;
 
 	/// Gaps in the reliable data.  These are created when we receive reliable data that
 	/// is beyond what we expect next.  Since these must never overlap, we store them
@@ -464,7 +789,33 @@ struct SSNPReceiverState
 	/// !SPEED! We should probably use a small fixed-sized, sorted vector here,
 	/// since in most cases the list will be small, and the cost of dynamic memory
 	/// allocation will be way worse than O(n) insertion/removal.
-	std::map<int64,int64> m_mapReliableStreamGaps;
+	SNPMap<int64,int64> m_mapReliableStreamGaps;
+
+	/// Reliable messages beyond a gap that the sender said we could deliver out of
+	/// order.  The key is the stream position of the message header.  The value is
+	/// the stream position of the end of the message if we have delivered it, or 0
+	/// if we haven't received all of it yet.  When the stream catches up to a message
+	/// that was already delivered, we skip it.
+	SNPMap<int64,int64> m_mapUnorderedMsgs;
+};
+
+struct SSNPReceiverState
+{
+	SSNPReceiverState()
+	{
+		// Lane 0 always exists.  Others are added when the peer first uses them
+		m_vecLanes.resize( 1 );
+	}
+	~SSNPReceiverState();
+
+	/// Fragmented unreliable messages that we are reassembling.
+	/// This is a small fixed-size table of k_nMaxUnreliableReassemblyMsgs
+	/// entries, searched linearly.  Most connections never receive a
+	/// fragmented unreliable message, so it isn't allocated until we need it.
+	SSNPRecvUnreliableMsg *m_pUnreliableReassembly = nullptr;
+
+	/// Lanes
+	std::vector<SSNPRecvLane> m_vecLanes;
 
 	/// List of gaps in the packet sequence numbers we have received.
 	/// Since these must never overlap, we store them using begin as the
@@ -473,7 +824,7 @@ struct SSNPReceiverState
 	/// !SPEED! We should probably use a small fixed-sized, sorted vector here,
 	/// since in most cases the list will be small, and the cost of dynamic memory
 	/// allocation will be way worse than O(n) insertion/removal.
-	std::map<int64,SSNPPacketGap> m_mapPacketGaps;
+	SNPMap<int64,SSNPPacketGap> m_mapPacketGaps;
 
 	/// Oldest packet sequence number we need to ack to our peer
 	int64 m_nMinPktNumToSendAcks = 0;
@@ -485,14 +836,46 @@ struct SSNPReceiverState
 	/// comes along (piggy on top of outbound data packet) to do this.
 	SteamNetworkingMicroseconds m_usecWhenFlushAck = INT64_MAX;
 
+	/// Ack frequency the peer asked us to use.  Until they tell us otherwise,
+	/// we only send acks on the timer.
+	int m_nAckPacketTolerance = 0;
+	SteamNetworkingMicroseconds m_usecMaxAckDelay = k_usecMaxDataAckDelay;
+
+	/// Packet number that carried the ack frequency we are using, so we can
+	/// ignore an older request that arrives out of order.
+	int64 m_nAckFrequencyPktNum = 0;
+
+	/// Number of packets we have received that need to be acked, since
+	/// we last sent all of our acks.
+	int m_nAckElicitingPktsSinceFlush = 0;
+
 	inline void MarkNeedToSendAck( SteamNetworkingMicroseconds usecNow )
 	{
-		m_usecWhenFlushAck = std::min( m_usecWhenFlushAck, usecNow + k_usecMaxDataAckDelay );
+		m_usecWhenFlushAck = std::min( m_usecWhenFlushAck, usecNow + m_usecMaxAckDelay );
+	}
+
+	/// Called once for each packet that needs to be acked.  Returns true
+	/// if we have received enough of them that we should ack right away.
+	inline bool ReceivedAckElicitingPacket( SteamNetworkingMicroseconds usecNow )
+	{
+		++m_nPktsRecvAckEliciting;
+		MarkNeedToSendAck( usecNow );
+		return m_nAckPacketTolerance > 0 && ++m_nAckElicitingPktsSinceFlush >= m_nAckPacketTolerance;
+	}
+
+	/// Called when we have sent all the acks we need to
+	inline void ClearNeedToSendAck()
+	{
+		m_usecWhenFlushAck = INT64_MAX;
+		m_nAckElicitingPktsSinceFlush = 0;
 	}
 
 	// Stats.  FIXME - move to LinkStatsEndToEnd and track rate counters
 	int64 m_nMessagesRecvReliable = 0;
 	int64 m_nMessagesRecvUnreliable = 0;
+	int64 m_nPktsRecvAckEliciting = 0;
+	int64 m_nPktsSentWithAck = 0;
+	int64 m_nPktsSentAckOnly = 0;
 
 
 
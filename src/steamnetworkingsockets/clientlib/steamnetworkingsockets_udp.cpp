@@ -4,6 +4,7 @@
 #include "steamnetworkingconfig.h"
 #include "csteamnetworkingsockets.h"
 #include "crypto.h"
+#include "steamnetworkingsockets_metrics.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -27,6 +28,7 @@ struct UDPDataMsgHdr
 	enum
 	{
 		kFlag_ProtobufBlob  = 0x01, // Protobuf-encoded message is inline (CMsgSteamSockets_UDP_Stats)
+		kFlag_InlineStats   = 0x02, // Compact inline stats.  Only sent to peers with k_nMinPeerProtocolVersionCompactInlineStats
 	};
 
 	uint8 m_unMsgFlags;
@@ -34,6 +36,7 @@ struct UDPDataMsgHdr
 	uint16 m_unSeqNum;
 
 	// [optional, if flags&kFlag_ProtobufBlob]  varint-encoded protobuf blob size, followed by blob
+	// [optional, if flags&kFlag_InlineStats]  compact inline stats.  See SerializeCompactInlineStats
 	// Data frame(s)
 	// End of packet
 };
@@ -72,18 +75,21 @@ void ReallyReportBadPacket( const netadr_t &adrFrom, const char *pszMsgType, con
 	SpewMsg( "Ignored bad %s from %s.  %s\n", pszMsgType, CUtlNetAdrRender( adrFrom ).String(), buf );
 }
 
-#define ReportBadPacketFrom( adrFrom, pszMsgType, /* fmt */ ... ) \
-	( BCheckRateLimitReportBadPacket( usecNow ) ? ReallyReportBadPacket( adrFrom, pszMsgType, __VA_ARGS__ ) : (void)0 )
+// The reason is the suffix of a ESteamNetworkingBadPacketReason value.  We
+// always count the packet, even if we don't print anything.
+#define ReportBadPacketFrom( adrFrom, eReason, pszMsgType, /* fmt */ ... ) \
+	( MetricsIncrement( g_metrics.m_nBadPackets[ k_ESteamNetworkingBadPacket_ ## eReason ] ), \
+	BCheckRateLimitReportBadPacket( usecNow ) ? ReallyReportBadPacket( adrFrom, pszMsgType, __VA_ARGS__ ) : (void)0 )
 
-#define ReportBadPacket( pszMsgType, /* fmt */ ... ) \
-	ReportBadPacketFrom( adrFrom, pszMsgType, __VA_ARGS__ )
+#define ReportBadPacket( eReason, pszMsgType, /* fmt */ ... ) \
+	ReportBadPacketFrom( adrFrom, eReason, pszMsgType, __VA_ARGS__ )
 
 
 #define ParseProtobufBody( pvMsg, cbMsg, CMsgCls, msgVar ) \
 	CMsgCls msgVar; \
 	if ( !msgVar.ParseFromArray( pvMsg, cbMsg ) ) \
 	{ \
-		ReportBadPacket( # CMsgCls, "Protobuf parse failed." ); \
+		ReportBadPacket( Malformed, # CMsgCls, "Protobuf parse failed." ); \
 		return; \
 	}
 
@@ -92,19 +98,19 @@ void ReallyReportBadPacket( const netadr_t &adrFrom, const char *pszMsgType, con
 	{ \
 		if ( cbPkt < k_cbSteamNetworkingMinPaddedPacketSize ) \
 		{ \
-			ReportBadPacket( # CMsgCls, "Packet is %d bytes, must be padded to at least %d bytes.", cbPkt, k_cbSteamNetworkingMinPaddedPacketSize ); \
+			ReportBadPacket( Malformed, # CMsgCls, "Packet is %d bytes, must be padded to at least %d bytes.", cbPkt, k_cbSteamNetworkingMinPaddedPacketSize ); \
 			return; \
 		} \
 		const UDPPaddedMessageHdr *hdr = static_cast< const UDPPaddedMessageHdr * >( pvPkt ); \
 		int nMsgLength = LittleWord( hdr->m_nMsgLength ); \
 		if ( nMsgLength <= 0 || int(nMsgLength+sizeof(UDPPaddedMessageHdr)) > cbPkt ) \
 		{ \
-			ReportBadPacket( # CMsgCls, "Invalid encoded message length %d.  Packet is %d bytes.", nMsgLength, cbPkt ); \
+			ReportBadPacket( Malformed, # CMsgCls, "Invalid encoded message length %d.  Packet is %d bytes.", nMsgLength, cbPkt ); \
 			return; \
 		} \
 		if ( !msgVar.ParseFromArray( hdr+1, nMsgLength ) ) \
 		{ \
-			ReportBadPacket( # CMsgCls, "Protobuf parse failed." ); \
+			ReportBadPacket( Malformed, # CMsgCls, "Protobuf parse failed." ); \
 			return; \
 		} \
 	}
@@ -184,7 +190,7 @@ void CSteamNetworkListenSocketDirectUDP::ReceivedFromUnknownHost( const void *pv
 
 	if ( cbPkt < 5 )
 	{
-		ReportBadPacket( "packet", "%d byte packet is too small", cbPkt );
+		ReportBadPacket( Malformed, "packet", "%d byte packet is too small", cbPkt );
 		return;
 	}
 
@@ -204,7 +210,7 @@ void CSteamNetworkListenSocketDirectUDP::ReceivedFromUnknownHost( const void *pv
 			// But since we don't have that connection in our table anymore, either this guy
 			// never had a connection, or else we believe he knows that the connection was closed,
 			// or the FinWait state has timed out.
-			ReportBadPacket( "Data", "Stray data packet from host with no connection.  Ignoring." );
+			ReportBadPacket( ConnectionID, "Data", "Stray data packet from host with no connection.  Ignoring." );
 		}
 	}
 	else if ( *pPkt == k_ESteamNetworkingUDPMsg_ChallengeRequest )
@@ -239,7 +245,7 @@ void CSteamNetworkListenSocketDirectUDP::ReceivedFromUnknownHost( const void *pv
 		// We are not initiating connections, so we shouldn't ever get
 		// those sorts of replies.
 
-		ReportBadPacket( "packet", "Invalid lead byte 0x%02x", *pPkt );
+		ReportBadPacket( Malformed, "packet", "Invalid lead byte 0x%02x", *pPkt );
 	}
 }
 
@@ -269,13 +275,13 @@ void CSteamNetworkListenSocketDirectUDP::Received_ChallengeRequest( const CMsgSt
 {
 	if ( msg.connection_id() == 0 )
 	{
-		ReportBadPacket( "ChallengeRequest", "Missing connection_id." );
+		ReportBadPacket( ConnectionID, "ChallengeRequest", "Missing connection_id." );
 		return;
 	}
 	//CSteamID steamIDClient( uint64( msg.client_steam_id() ) );
 	//if ( !steamIDClient.IsValid() )
 	//{
-	//	ReportBadPacket( "ChallengeRequest", "Missing/invalid SteamID.", cbPkt );
+	//	ReportBadPacket( Auth, "ChallengeRequest", "Missing/invalid SteamID.", cbPkt );
 	//	return;
 	//}
 
@@ -303,21 +309,21 @@ void CSteamNetworkListenSocketDirectUDP::Received_ConnectRequest( const CMsgStea
 	uint16 nElapsed = GetChallengeTime( usecNow ) - nTimeThen;
 	if ( nElapsed > GetChallengeTime( 4*k_nMillion ) )
 	{
-		ReportBadPacket( "ConnectRequest", "Challenge too old." );
+		ReportBadPacket( Challenge, "ConnectRequest", "Challenge too old." );
 		return;
 	}
 
 	// Assuming we sent them this time value, re-create the challenge we would have sent them.
 	if ( GenerateChallenge( nTimeThen, adrFrom ) != msg.challenge() )
 	{
-		ReportBadPacket( "ConnectRequest", "Incorrect challenge.  Could be spoofed." );
+		ReportBadPacket( Challenge, "ConnectRequest", "Incorrect challenge.  Could be spoofed." );
 		return;
 	}
 
 	uint32 unClientConnectionID = msg.client_connection_id();
 	if ( unClientConnectionID == 0 )
 	{
-		ReportBadPacket( "ConnectRequest", "Missing connection ID" );
+		ReportBadPacket( ConnectionID, "ConnectRequest", "Missing connection ID" );
 		return;
 	}
 
@@ -331,7 +337,7 @@ void CSteamNetworkListenSocketDirectUDP::Received_ConnectRequest( const CMsgStea
 		int r = SteamNetworkingIdentityFromSignedCert( identityRemote, msg.cert(), errMsg );
 		if ( r < 0 )
 		{
-			ReportBadPacket( "ConnectRequest", "Bad identity in cert.  %s", errMsg );
+			ReportBadPacket( Auth, "ConnectRequest", "Bad identity in cert.  %s", errMsg );
 			return;
 		}
 		if ( r == 0 )
@@ -341,7 +347,7 @@ void CSteamNetworkListenSocketDirectUDP::Received_ConnectRequest( const CMsgStea
 			r = SteamNetworkingIdentityFromProtobuf( identityRemote, msg, identity, legacy_client_steam_id, errMsg );
 			if ( r < 0 )
 			{
-				ReportBadPacket( "ConnectRequest", "Bad identity.  %s", errMsg );
+				ReportBadPacket( Auth, "ConnectRequest", "Bad identity.  %s", errMsg );
 				return;
 			}
 			if ( r == 0 )
@@ -365,7 +371,7 @@ void CSteamNetworkListenSocketDirectUDP::Received_ConnectRequest( const CMsgStea
 			if ( steamdatagram_ip_allow_connections_without_auth == 0 )
 			{
 				// Should we send an explicit rejection here?
-				ReportBadPacket( "ConnectRequest", "Unauthenticated connections not allowed." );
+				ReportBadPacket( Auth, "ConnectRequest", "Unauthenticated connections not allowed." );
 				return;
 			}
 
@@ -379,7 +385,7 @@ void CSteamNetworkListenSocketDirectUDP::Received_ConnectRequest( const CMsgStea
 			//if ( memcmp( addr.m_ipv6, identityRemote.m_ip.m_ipv6, sizeof(addr.m_ipv6) ) != 0
 			//	|| ( identityRemote.m_ip.m_port != 0 && identityRemote.m_ip.m_port != addr.m_port ) ) // Allow 0 port in the identity to mean "any port"
 			//{
-			//	ReportBadPacket( "ConnectRequest", "Identity in request is %s, but packet is coming from %s." );
+			//	ReportBadPacket( Auth, "ConnectRequest", "Identity in request is %s, but packet is coming from %s." );
 			//	return;
 			//}
 
@@ -392,7 +398,7 @@ void CSteamNetworkListenSocketDirectUDP::Received_ConnectRequest( const CMsgStea
 			if ( !bIdentityInCert )
 			{
 				// Should we send an explicit rejection here?
-				ReportBadPacket( "ConnectRequest", "Cannot use specific IP address." );
+				ReportBadPacket( Auth, "ConnectRequest", "Cannot use specific IP address." );
 				return;
 			}
 		}
@@ -409,7 +415,7 @@ void CSteamNetworkListenSocketDirectUDP::Received_ConnectRequest( const CMsgStea
 		// NOTE: We cannot just destroy the object.  The API semantics
 		// are that all connections, once accepted and made visible
 		// to the API, must be closed by the application.
-		ReportBadPacket( "ConnectRequest", "Rejecting connection request from %s at %s, connection ID %u.  That steamID/ConnectionID pair already has a connection from %s\n",
+		ReportBadPacket( Unexpected, "ConnectRequest", "Rejecting connection request from %s at %s, connection ID %u.  That steamID/ConnectionID pair already has a connection from %s\n",
 			SteamNetworkingIdentityRender( identityRemote ).c_str(), CUtlNetAdrRender( adrFrom ).String(), unClientConnectionID, CUtlNetAdrRender( pOldConn->GetRemoteAddr() ).String()
 		);
 
@@ -505,11 +511,116 @@ void CSteamNetworkListenSocketDirectUDP::SendPaddedMsg( uint8 nMsgID, const goog
 //
 /////////////////////////////////////////////////////////////////////////////
 
+// Compact inline stats flags byte.  The low bits are the same as
+// CMsgSteamSockets_UDP_Stats::Flags.  The high bits say what stats follow
+const uint8 k_nCompactInlineStatsFlag_Instantaneous = 0x40;
+const uint8 k_nCompactInlineStatsFlag_Lifetime = 0x80;
+const uint8 k_nCompactInlineStatsFlags_AckRequest = CMsgSteamSockets_UDP_Stats::ACK_REQUEST_E2E | CMsgSteamSockets_UDP_Stats::ACK_REQUEST_IMMEDIATE;
+
+static int CompactInlineStatsSize( const UDPInlineStats_t &stats )
+{
+	int cbResult = 1;
+	if ( stats.m_stats.m_bHasInstantaneous )
+		cbResult += k_cbLinkStatsInstantaneousWire;
+	if ( stats.m_stats.m_bHasLifetime )
+		cbResult += k_cbLinkStatsLifetimeWire;
+	return cbResult;
+}
+
+// Compact inline stats layout:
+//   uint8 flags
+//   [optional, if flags&k_nCompactInlineStatsFlag_Instantaneous] LinkStatsInstantaneousStructToWire
+//   [optional, if flags&k_nCompactInlineStatsFlag_Lifetime] LinkStatsLifetimeStructToWire
+static byte *SerializeCompactInlineStats( const UDPInlineStats_t &stats, byte *p )
+{
+	Assert( ( stats.m_nFlags & ~k_nCompactInlineStatsFlags_AckRequest ) == 0 );
+	uint8 nFlags = uint8( stats.m_nFlags & k_nCompactInlineStatsFlags_AckRequest );
+	if ( stats.m_stats.m_bHasInstantaneous )
+		nFlags |= k_nCompactInlineStatsFlag_Instantaneous;
+	if ( stats.m_stats.m_bHasLifetime )
+		nFlags |= k_nCompactInlineStatsFlag_Lifetime;
+	*(p++) = nFlags;
+
+	if ( stats.m_stats.m_bHasInstantaneous )
+		p = LinkStatsInstantaneousStructToWire( stats.m_stats.m_instantaneous, p );
+	if ( stats.m_stats.m_bHasLifetime )
+		p = LinkStatsLifetimeStructToWire( stats.m_stats.m_lifetime, p );
+	return p;
+}
+
+// Returns pointer to the next byte, or NULL if the data is malformed
+static const byte *DeserializeCompactInlineStats( const byte *p, const byte *pEnd, UDPInlineStats_t &stats )
+{
+	if ( p >= pEnd )
+		return nullptr;
+	uint8 nFlags = *(p++);
+	if ( nFlags & ~( k_nCompactInlineStatsFlags_AckRequest | k_nCompactInlineStatsFlag_Instantaneous | k_nCompactInlineStatsFlag_Lifetime ) )
+		return nullptr;
+	stats.m_nFlags = nFlags & k_nCompactInlineStatsFlags_AckRequest;
+
+	stats.m_stats.m_bHasInstantaneous = ( nFlags & k_nCompactInlineStatsFlag_Instantaneous ) != 0;
+	if ( stats.m_stats.m_bHasInstantaneous )
+	{
+		if ( pEnd - p < k_cbLinkStatsInstantaneousWire )
+			return nullptr;
+		p = LinkStatsInstantaneousWireToStruct( p, stats.m_stats.m_instantaneous );
+	}
+
+	stats.m_stats.m_bHasLifetime = ( nFlags & k_nCompactInlineStatsFlag_Lifetime ) != 0;
+	if ( stats.m_stats.m_bHasLifetime )
+	{
+		if ( pEnd - p < k_cbLinkStatsLifetimeWire )
+			return nullptr;
+		p = LinkStatsLifetimeWireToStruct( p, stats.m_stats.m_lifetime );
+	}
+
+	return p;
+}
+
+// Fill in protobuf message, for peers that don't understand the compact
+// format.  Returns the number of bytes needed in the header, including the
+// varint-encoded size.
+static int InlineStatsToProtobuf( const UDPInlineStats_t &stats, CMsgSteamSockets_UDP_Stats &msg )
+{
+	msg.Clear();
+	if ( stats.m_stats.m_bHasInstantaneous )
+		LinkStatsInstantaneousStructToMsg( stats.m_stats.m_instantaneous, *msg.mutable_stats()->mutable_instantaneous() );
+	if ( stats.m_stats.m_bHasLifetime )
+		LinkStatsLifetimeStructToMsg( stats.m_stats.m_lifetime, *msg.mutable_stats()->mutable_lifetime() );
+
+	// Don't send flags if they are implied by the stats we are sending.
+	uint32 nImpliedFlags = 0;
+	if ( msg.has_stats() ) nImpliedFlags |= msg.ACK_REQUEST_E2E;
+	if ( stats.m_nFlags != nImpliedFlags )
+		msg.set_flags( stats.m_nFlags );
+
+	// Cache size.  Note that if the size requires 3 bytes varint encoded, it
+	// won't fit in a packet anyway, so we don't need to handle that case.
+	int cbMsg = msg.ByteSize();
+	return cbMsg + ( cbMsg >= 0x80 ? 2 : 1 );
+}
+
+static void InlineStatsFromProtobuf( const CMsgSteamSockets_UDP_Stats &msg, UDPInlineStats_t &stats )
+{
+	// Fields that aren't on the wire should be zero, same as the compact format
+	memset( &stats, 0, sizeof(stats) );
+	stats.m_nFlags = msg.flags();
+	if ( msg.stats().has_instantaneous() )
+	{
+		stats.m_stats.m_bHasInstantaneous = true;
+		LinkStatsInstantaneousMsgToStruct( msg.stats().instantaneous(), stats.m_stats.m_instantaneous );
+	}
+	if ( msg.stats().has_lifetime() )
+	{
+		stats.m_stats.m_bHasLifetime = true;
+		LinkStatsLifetimeMsgToStruct( msg.stats().lifetime(), stats.m_stats.m_lifetime );
+	}
+}
+
 struct IPv4InlineStatsContext_t
 {
-	CMsgSteamSockets_UDP_Stats msg;
-	int cbSize;
-	//char data[ k_cbSteamNetworkingSocketsMaxPlaintextPayloadSend ];
+	UDPInlineStats_t stats;
+	int cbHdrSpaceNeeded;
 };
 
 CSteamNetworkConnectionUDP::CSteamNetworkConnectionUDP( CSteamNetworkingSockets *pSteamNetworkingSocketsInterface )
@@ -548,6 +659,28 @@ void CSteamNetworkConnectionUDP::FreeResources()
 	CSteamNetworkConnectionBase::FreeResources();
 }
 
+int CSteamNetworkConnectionUDP::GetMaxEncryptedPayloadSendToProbe() const
+{
+	int cbMaxUDPMsg = Clamp( steamdatagram_snp_pathmtu_max, k_cbSteamNetworkingSocketsMaxUDPMsgLen, k_cbSteamNetworkingSocketsMaxUDPMsgLenJumbo );
+	int cbMaxEncryptedPayload = ( cbMaxUDPMsg - (int)sizeof(UDPDataMsgHdr) ) & ~( k_cbSteamNetworkingSocketsEncryptionBlockSize-1 );
+	return Clamp( cbMaxEncryptedPayload, k_cbSteamNetworkingSocketsMaxEncryptedPayloadSend, k_cbSteamNetworkingSocketsMaxEncryptedPayloadSendJumbo );
+}
+
+int CSteamNetworkConnectionUDP::GetTransportMemoryUsage() const
+{
+	int cbResult = int( sizeof(*this) - sizeof(CSteamNetworkConnectionBase) );
+	if ( m_pSocket )
+		cbResult += m_pSocket->GetMemoryUsage();
+	return cbResult;
+}
+
+bool CSteamNetworkConnectionUDP::BSetTransportPacingRate( int nBytesPerSec )
+{
+	if ( !m_pSocket )
+		return false;
+	return m_pSocket->BSetMaxPacingRate( nBytesPerSec );
+}
+
 int CSteamNetworkConnectionUDP::SendEncryptedDataChunk( const void *pChunk, int cbChunk, SteamNetworkingMicroseconds usecNow, void *pConnectionContext )
 {
 	if ( !m_pSocket )
@@ -556,7 +689,7 @@ int CSteamNetworkConnectionUDP::SendEncryptedDataChunk( const void *pChunk, int
 		return 0;
 	}
 
-	uint8 pkt[ k_cbSteamNetworkingSocketsMaxUDPMsgLen ];
+	uint8 pkt[ k_cbSteamNetworkingSocketsMaxUDPMsgLenJumbo ];
 	UDPDataMsgHdr *hdr = (UDPDataMsgHdr *)pkt;
 	hdr->m_unMsgFlags = 0x80;
 	Assert( m_unConnectionIDRemote != 0 );
@@ -566,31 +699,39 @@ int CSteamNetworkConnectionUDP::SendEncryptedDataChunk( const void *pChunk, int
 	byte *p = (byte*)( hdr + 1 );
 
 	// Check how much bigger we could grow the header
-	// and still fit in a packet
-	int cbHdrOutSpaceRemaining = pkt + sizeof(pkt) - p - cbChunk;
+	// and still fit in a packet.  Our buffer is big enough for
+	// the largest packet we could ever send, but don't exceed what
+	// path MTU discovery has confirmed will actually get through.
+	// (Probes don't reserve any room for inline stats.)
+	int cbMaxPkt = std::max( m_senderState.m_cbMaxEncryptedPayloadSend, cbChunk ) + (int)sizeof(UDPDataMsgHdr);
+	cbMaxPkt = std::max( cbMaxPkt, k_cbSteamNetworkingSocketsMaxUDPMsgLen );
+	Assert( cbMaxPkt <= (int)sizeof(pkt) );
+	int cbHdrOutSpaceRemaining = pkt + cbMaxPkt - p - cbChunk;
 	if ( cbHdrOutSpaceRemaining < 0 )
 	{
 		AssertMsg( false, "MTU / header size problem!" );
 		return 0;
 	}
 
-	// Assume no inline blob
-	CMsgSteamSockets_UDP_Stats *pStatsMsg = nullptr;
-	int cbStatsMsg = 0;
+	// Older peers need the inline stats as a protobuf blob
+	const bool bProtobufStats = m_statsEndToEnd.m_nPeerProtocolVersion < k_nMinPeerProtocolVersionCompactInlineStats;
+	static CMsgSteamSockets_UDP_Stats msgStatsOut;
+
+	// Assume no inline stats
+	const UDPInlineStats_t *pStats = nullptr;
 	int cbHdrSpaceNeeded = 0;
 
 	// Did we initiate this packet?
 	if ( pConnectionContext )
 	{
 		IPv4InlineStatsContext_t &context = *(IPv4InlineStatsContext_t *)pConnectionContext;
-		pStatsMsg = &context.msg;
-		cbStatsMsg = context.cbSize;
-		cbHdrSpaceNeeded = cbStatsMsg + 1;
-		if ( cbStatsMsg >= 0x80 )
-			++cbHdrSpaceNeeded;
+		pStats = &context.stats;
+		cbHdrSpaceNeeded = context.cbHdrSpaceNeeded;
+		if ( bProtobufStats )
+			InlineStatsToProtobuf( *pStats, msgStatsOut );
 		if ( cbHdrOutSpaceRemaining < cbHdrSpaceNeeded )
 		{
-			AssertMsg( false, "We didn't make enough room for CMsgSteamSockets_UDP_Stats!" );
+			AssertMsg( false, "We didn't make enough room for inline stats!" );
 			return 0;
 		}
 	}
@@ -613,42 +754,29 @@ int CSteamNetworkConnectionUDP::SendEncryptedDataChunk( const void *pChunk, int
 		// Check if we should send connection stats inline.
 		bool bTrySendEndToEndStats = m_statsEndToEnd.BReadyToSendStats( usecNow );
 
-		// Do we actually want to send anything in the protobuf blob at all?
+		// Do we actually want to send any inline stats at all?
 		// The goal is that we should only do this every couple of seconds or so.
 		if ( bTrySendEndToEndStats || nFlags != 0 )
 		{
-			// Populate a message with everything we'd like to send
-			static CMsgSteamSockets_UDP_Stats msgStatsOut;
-			pStatsMsg = &msgStatsOut;
-			msgStatsOut.Clear();
+			// Populate with everything we'd like to send
+			static UDPInlineStats_t statsOut;
+			pStats = &statsOut;
+			statsOut.m_nFlags = nFlags;
 			if ( bTrySendEndToEndStats )
-				m_statsEndToEnd.PopulateMessage( *msgStatsOut.mutable_stats(), usecNow );
+				m_statsEndToEnd.PopulateStats( statsOut.m_stats, usecNow );
+			else
+				statsOut.m_stats.Clear();
 
-			// We'll try to fit what we can.  If we try to serialize a message
-			// and it won't fit, we'll remove some stuff and see if that fits.
+			// We'll try to fit what we can.  If it won't fit, we'll
+			// remove some stuff and see if that fits.
 			for (;;)
 			{
 
-				// Slam flags based on what we are actually going to send.  Don't send flags
-				// if they are implied by the stats we are sending.
-				uint32 nImpliedFlags = 0;
-				if ( msgStatsOut.has_stats() ) nImpliedFlags |= msgStatsOut.ACK_REQUEST_E2E;
-				if ( nFlags != nImpliedFlags )
-					msgStatsOut.set_flags( nFlags );
+				// Check how big it would be
+				if ( bProtobufStats )
+					cbHdrSpaceNeeded = InlineStatsToProtobuf( statsOut, msgStatsOut );
 				else
-					msgStatsOut.clear_flags();
-
-				// Cache size, check how big it would be
-				cbStatsMsg = msgStatsOut.ByteSize();
-
-				// Include varint-encoded message size.
-				// Note that if the size requires 3 bytes varint encoded, it won't fit in
-				// a packet anyway, so we don't need to handle that case.  But it is totally
-				// possible that we might want to send more than 128 bytes of stats, and have
-				// an opportunity to send it all in the same packet.
-				cbHdrSpaceNeeded = cbStatsMsg + 1;
-				if ( cbStatsMsg >= 0x80 )
-					++cbHdrSpaceNeeded;
+					cbHdrSpaceNeeded = CompactInlineStatsSize( statsOut );
 
 				// Will it fit inline with this data packet?
 				if ( cbHdrSpaceNeeded <= cbHdrOutSpaceRemaining )
@@ -657,43 +785,45 @@ int CSteamNetworkConnectionUDP::SendEncryptedDataChunk( const void *pChunk, int
 				// Rats.  We want to send some stuff, but it won't fit.
 				// Strip off stuff, in no particular order.
 
-				if ( msgStatsOut.has_stats() )
+				if ( !statsOut.m_stats.IsEmpty() )
 				{
-					Assert( bTrySendEndToEndStats );
-					if ( msgStatsOut.stats().has_instantaneous() && msgStatsOut.stats().has_lifetime() )
+					if ( statsOut.m_stats.m_bHasInstantaneous && statsOut.m_stats.m_bHasLifetime )
 					{
 						// Trying to send both - clear instantaneous
-						msgStatsOut.mutable_stats()->clear_instantaneous();
+						statsOut.m_stats.m_bHasInstantaneous = false;
 					}
 					else
 					{
-						// Trying to send just one or the other.  Clear the whole container.
-						msgStatsOut.clear_stats();
-						bTrySendEndToEndStats = false;
+						// Trying to send just one or the other.  Clear them both.
+						statsOut.m_stats.Clear();
 					}
 					continue;
 				}
-				Assert( !bTrySendEndToEndStats );
 
 				// FIXME - we could try to send without acks.
 
 				// Nothing left to clear!?  We shouldn't get here!
-				AssertMsg( false, "Serialized stats message still won't fit, ever after clearing everything?" );
-				cbStatsMsg = -1;
+				AssertMsg( false, "Inline stats still won't fit, ever after clearing everything?" );
+				pStats = nullptr;
 				break;
 			}
 		}
 	}
 
 	// Did we actually end up sending anything?
-	if ( cbStatsMsg > 0 && pStatsMsg )
+	if ( pStats )
 	{
-
-		// Serialize the stats size, var-int encoded
-		byte *pStatsOut = SerializeVarInt( (byte*)p, uint32( cbStatsMsg ) );
-
-		// Serialize the actual message
-		pStatsOut = pStatsMsg->SerializeWithCachedSizesToArray( pStatsOut );
+		byte *pStatsOut;
+		if ( bProtobufStats )
+		{
+			// Serialize the stats size, var-int encoded, followed by the message
+			pStatsOut = SerializeVarInt( (byte*)p, uint32( msgStatsOut.GetCachedSize() ) );
+			pStatsOut = msgStatsOut.SerializeWithCachedSizesToArray( pStatsOut );
+		}
+		else
+		{
+			pStatsOut = SerializeCompactInlineStats( *pStats, p );
+		}
 
 		// Make sure we wrote the number of bytes we expected
 		if ( pStatsOut != p + cbHdrSpaceNeeded )
@@ -705,10 +835,10 @@ int CSteamNetworkConnectionUDP::SendEncryptedDataChunk( const void *pChunk, int
 		{
 
 			// Update bookkeeping with the stuff we are actually sending
-			TrackSentStats( *pStatsMsg, true, usecNow );
+			TrackSentStats( *pStats, true, usecNow );
 
 			// Mark header with the flag
-			hdr->m_unMsgFlags |= hdr->kFlag_ProtobufBlob;
+			hdr->m_unMsgFlags |= bProtobufStats ? hdr->kFlag_ProtobufBlob : hdr->kFlag_InlineStats;
 
 			// Advance pointer
 			p = pStatsOut;
@@ -978,7 +1108,7 @@ void CSteamNetworkConnectionUDP::SendPacketGather( int nChunks, const iovec *pCh
 	m_statsEndToEnd.TrackSentPacket( cbSendTotal );
 
 	// Hand over to operating system
-	m_pSocket->BSendRawPacketGather( nChunks, pChunks );
+	m_pSocket->BSendRawPacketGather( nChunks, pChunks, &m_fakeLagSend );
 }
 
 void CSteamNetworkConnectionUDP::ConnectionStateChanged( ESteamNetworkingConnectionState eOldState )
@@ -1009,8 +1139,8 @@ void CSteamNetworkConnectionUDP::ConnectionStateChanged( ESteamNetworkingConnect
 	}
 }
 
-#define ReportBadPacketIPv4( pszMsgType, /* fmt */ ... ) \
-	ReportBadPacketFrom( m_pSocket->GetRemoteHostAddr(), pszMsgType, __VA_ARGS__ )
+#define ReportBadPacketIPv4( eReason, pszMsgType, /* fmt */ ... ) \
+	ReportBadPacketFrom( m_pSocket->GetRemoteHostAddr(), eReason, pszMsgType, __VA_ARGS__ )
 
 void CSteamNetworkConnectionUDP::PacketReceived( const void *pvPkt, int cbPkt, const netadr_t &adrFrom, CSteamNetworkConnectionUDP *pSelf )
 {
@@ -1021,7 +1151,7 @@ void CSteamNetworkConnectionUDP::PacketReceived( const void *pvPkt, int cbPkt, c
 
 	if ( cbPkt < 5 )
 	{
-		ReportBadPacket( "packet", "%d byte packet is too small", cbPkt );
+		ReportBadPacket( Malformed, "packet", "%d byte packet is too small", cbPkt );
 		return;
 	}
 
@@ -1061,36 +1191,36 @@ void CSteamNetworkConnectionUDP::PacketReceived( const void *pvPkt, int cbPkt, c
 	}
 	else
 	{
-		ReportBadPacket( "packet", "Lead byte 0x%02x not a known message ID", *pPkt );
+		ReportBadPacket( Malformed, "packet", "Lead byte 0x%02x not a known message ID", *pPkt );
 	}
 }
 
-std::string DescribeStatsContents( const CMsgSteamSockets_UDP_Stats &msg )
+std::string DescribeStatsContents( const UDPInlineStats_t &stats )
 {
 	std::string sWhat;
-	if ( msg.flags() & msg.ACK_REQUEST_E2E )
+	if ( stats.m_nFlags & CMsgSteamSockets_UDP_Stats::ACK_REQUEST_E2E )
 		sWhat += " request_ack";
-	if ( msg.flags() & msg.ACK_REQUEST_IMMEDIATE )
+	if ( stats.m_nFlags & CMsgSteamSockets_UDP_Stats::ACK_REQUEST_IMMEDIATE )
 		sWhat += " request_ack_immediate";
-	if ( msg.stats().has_lifetime() )
+	if ( stats.m_stats.m_bHasLifetime )
 		sWhat += " stats.life";
-	if ( msg.stats().has_instantaneous() )
+	if ( stats.m_stats.m_bHasInstantaneous )
 		sWhat += " stats.rate";
 	return sWhat;
 }
 
-void CSteamNetworkConnectionUDP::RecvStats( const CMsgSteamSockets_UDP_Stats &msgStatsIn, bool bInline, SteamNetworkingMicroseconds usecNow )
+void CSteamNetworkConnectionUDP::RecvStats( const UDPInlineStats_t &statsIn, bool bInline, SteamNetworkingMicroseconds usecNow )
 {
 
 	// Connection quality stats?
-	if ( msgStatsIn.has_stats() )
-		m_statsEndToEnd.ProcessMessage( msgStatsIn.stats(), usecNow );
+	if ( !statsIn.m_stats.IsEmpty() )
+		m_statsEndToEnd.ProcessStats( statsIn.m_stats, usecNow );
 
 	// Spew appropriately
 	SpewVerbose( "[%s] Recv %s stats:%s\n",
 		GetDescription(),
 		bInline ? "inline" : "standalone",
-		DescribeStatsContents( msgStatsIn ).c_str()
+		DescribeStatsContents( statsIn ).c_str()
 	);
 
 	// Check if we need to reply, either now or later
@@ -1098,8 +1228,8 @@ void CSteamNetworkConnectionUDP::RecvStats( const CMsgSteamSockets_UDP_Stats &ms
 	{
 
 		// Check for queuing outgoing acks
-		bool bImmediate = ( msgStatsIn.flags() & msgStatsIn.ACK_REQUEST_IMMEDIATE ) != 0;
-		if ( ( msgStatsIn.flags() & msgStatsIn.ACK_REQUEST_E2E ) || msgStatsIn.has_stats() )
+		bool bImmediate = ( statsIn.m_nFlags & CMsgSteamSockets_UDP_Stats::ACK_REQUEST_IMMEDIATE ) != 0;
+		if ( ( statsIn.m_nFlags & CMsgSteamSockets_UDP_Stats::ACK_REQUEST_E2E ) || !statsIn.m_stats.IsEmpty() )
 		{
 			QueueEndToEndAck( bImmediate, usecNow );
 		}
@@ -1115,23 +1245,23 @@ void CSteamNetworkConnectionUDP::RecvStats( const CMsgSteamSockets_UDP_Stats &ms
 	}
 }
 
-void CSteamNetworkConnectionUDP::TrackSentStats( const CMsgSteamSockets_UDP_Stats &msgStatsOut, bool bInline, SteamNetworkingMicroseconds usecNow )
+void CSteamNetworkConnectionUDP::TrackSentStats( const UDPInlineStats_t &statsOut, bool bInline, SteamNetworkingMicroseconds usecNow )
 {
 
 	// What effective flags will be received?
-	uint32 nSentFlags = msgStatsOut.flags();
-	if ( msgStatsOut.has_stats() )
-		nSentFlags |= msgStatsOut.ACK_REQUEST_E2E;
-	if ( nSentFlags & msgStatsOut.ACK_REQUEST_E2E )
+	uint32 nSentFlags = statsOut.m_nFlags;
+	if ( !statsOut.m_stats.IsEmpty() )
+		nSentFlags |= CMsgSteamSockets_UDP_Stats::ACK_REQUEST_E2E;
+	if ( nSentFlags & CMsgSteamSockets_UDP_Stats::ACK_REQUEST_E2E )
 	{
-		bool bAllowDelayedReply = ( nSentFlags & msgStatsOut.ACK_REQUEST_IMMEDIATE ) == 0;
+		bool bAllowDelayedReply = ( nSentFlags & CMsgSteamSockets_UDP_Stats::ACK_REQUEST_IMMEDIATE ) == 0;
 
 		// Record that we sent stats and are waiting for peer to ack
-		if ( msgStatsOut.has_stats() )
+		if ( !statsOut.m_stats.IsEmpty() )
 		{
-			m_statsEndToEnd.TrackSentStats( msgStatsOut.stats(), usecNow, bAllowDelayedReply );
+			m_statsEndToEnd.TrackSentStats( statsOut.m_stats, usecNow, bAllowDelayedReply );
 		}
-		else if ( ( nSentFlags & msgStatsOut.ACK_REQUEST_E2E ) )
+		else if ( ( nSentFlags & CMsgSteamSockets_UDP_Stats::ACK_REQUEST_E2E ) )
 		{
 			m_statsEndToEnd.TrackSentMessageExpectingSeqNumAck( usecNow, bAllowDelayedReply );
 		}
@@ -1141,45 +1271,47 @@ void CSteamNetworkConnectionUDP::TrackSentStats( const CMsgSteamSockets_UDP_Stat
 	SpewVerbose( "[%s] Sent %s stats:%s\n",
 		GetDescription(),
 		bInline ? "inline" : "standalone",
-		DescribeStatsContents( msgStatsOut ).c_str()
+		DescribeStatsContents( statsOut ).c_str()
 	);
 }
 
 void CSteamNetworkConnectionUDP::SendStatsMsg( EStatsReplyRequest eReplyRequested, SteamNetworkingMicroseconds usecNow )
 {
 	IPv4InlineStatsContext_t context;
-	CMsgSteamSockets_UDP_Stats &msg = context.msg;
-
-//	if ( m_unConnectionIDRemote )
-//		msg.set_to_connection_id( m_unConnectionIDRemote );
-//	msg.set_from_connection_id( m_unConnectionIDLocal );
-//	msg.set_seq_num( m_statsEndToEnd.GetNextSendSequenceNumber( usecNow ) );
+	UDPInlineStats_t &stats = context.stats;
 
 	// What flags should we set?
-	uint32 nFlags = 0;
+	stats.m_nFlags = 0;
 	if ( eReplyRequested == k_EStatsReplyRequest_Immediate || m_statsEndToEnd.BNeedToSendPingImmediate( usecNow ) )
-		nFlags |= msg.ACK_REQUEST_E2E | msg.ACK_REQUEST_IMMEDIATE;
+		stats.m_nFlags |= CMsgSteamSockets_UDP_Stats::ACK_REQUEST_E2E | CMsgSteamSockets_UDP_Stats::ACK_REQUEST_IMMEDIATE;
 	else if ( eReplyRequested == k_EStatsReplyRequest_DelayedOK || m_statsEndToEnd.BNeedToSendKeepalive( usecNow ) || m_statsEndToEnd.BReadyToSendTracerPing( usecNow ) )
-		nFlags |= msg.ACK_REQUEST_E2E;
+		stats.m_nFlags |= CMsgSteamSockets_UDP_Stats::ACK_REQUEST_E2E;
 
 	// Need to send any connection stats stats?
 	if ( m_statsEndToEnd.BReadyToSendStats( usecNow ) )
-		m_statsEndToEnd.PopulateMessage( *msg.mutable_stats(), usecNow );
-
-	// Always set flags into message, even if they can be implied by the presence of stats
-	msg.set_flags( nFlags );
+		m_statsEndToEnd.PopulateStats( stats.m_stats, usecNow );
+	else
+		stats.m_stats.Clear();
 
-	context.cbSize = msg.ByteSize();
-	if ( context.cbSize > k_cbSteamNetworkingSocketsMaxEncryptedPayloadSend )
+	if ( m_statsEndToEnd.m_nPeerProtocolVersion < k_nMinPeerProtocolVersionCompactInlineStats )
 	{
-		AssertMsg1( false, "Serialized CMsgSteamSockets_UDP_Stats is %d bytes!", context.cbSize );
+		CMsgSteamSockets_UDP_Stats msg;
+		context.cbHdrSpaceNeeded = InlineStatsToProtobuf( stats, msg );
+	}
+	else
+	{
+		context.cbHdrSpaceNeeded = CompactInlineStatsSize( stats );
+	}
+	if ( context.cbHdrSpaceNeeded > k_cbSteamNetworkingSocketsMaxEncryptedPayloadSend )
+	{
+		AssertMsg1( false, "Inline stats are %d bytes!", context.cbHdrSpaceNeeded );
 		return;
 	}
 
 	// Ask SNP to send a packet, with this data piggybacked on.
 	// FIXME we can probably do better that this, although this is
 	// not too bad.
-	int cbMaxEncryptedPayload = k_cbSteamNetworkingSocketsMaxEncryptedPayloadSend - context.cbSize;
+	int cbMaxEncryptedPayload = k_cbSteamNetworkingSocketsMaxEncryptedPayloadSend - context.cbHdrSpaceNeeded;
 	SNP_SendPacket( usecNow, cbMaxEncryptedPayload, &context );
 }
 
@@ -1188,7 +1320,7 @@ void CSteamNetworkConnectionUDP::Received_Data( const uint8 *pPkt, int cbPkt, St
 
 	if ( cbPkt < sizeof(UDPDataMsgHdr) )
 	{
-		ReportBadPacketIPv4( "DataPacket", "Packet of size %d is too small.", cbPkt );
+		ReportBadPacketIPv4( Malformed, "DataPacket", "Packet of size %d is too small.", cbPkt );
 		return;
 	}
 
@@ -1198,7 +1330,7 @@ void CSteamNetworkConnectionUDP::Received_Data( const uint8 *pPkt, int cbPkt, St
 	{
 
 		// Wrong session.  It could be an old session, or it could be spoofed.
-		ReportBadPacketIPv4( "DataPacket", "Incorrect connection ID" );
+		ReportBadPacketIPv4( ConnectionID, "DataPacket", "Incorrect connection ID" );
 		if ( BCheckGlobalSpamReplyRateLimit( usecNow ) )
 		{
 			SendNoConnection( LittleDWord( hdr->m_unToConnectionID ), 0 );
@@ -1246,34 +1378,44 @@ void CSteamNetworkConnectionUDP::Received_Data( const uint8 *pPkt, int cbPkt, St
 	const uint8 *pPktEnd = pPkt + cbPkt;
 
 	// Inline stats?
-	static CMsgSteamSockets_UDP_Stats msgStats;
-	CMsgSteamSockets_UDP_Stats *pMsgStatsIn = nullptr;
-	uint32 cbStatsMsgIn = 0;
-	if ( hdr->m_unMsgFlags & hdr->kFlag_ProtobufBlob )
+	static UDPInlineStats_t statsIn;
+	const UDPInlineStats_t *pStatsIn = nullptr;
+	if ( hdr->m_unMsgFlags & hdr->kFlag_InlineStats )
 	{
+		pIn = DeserializeCompactInlineStats( pIn, pPktEnd, statsIn );
+		if ( pIn == NULL )
+		{
+			ReportBadPacketIPv4( Malformed, "DataPacket", "Failed to decode inline stats" );
+			return;
+		}
+		pStatsIn = &statsIn;
+	}
+	else if ( hdr->m_unMsgFlags & hdr->kFlag_ProtobufBlob )
+	{
+		static CMsgSteamSockets_UDP_Stats msgStats;
+		uint32 cbStatsMsgIn = 0;
 		//Msg_Verbose( "Received inline stats from %s", server.m_szName );
 
 		pIn = DeserializeVarInt( pIn, pPktEnd, cbStatsMsgIn );
 		if ( pIn == NULL )
 		{
-			ReportBadPacketIPv4( "DataPacket", "Failed to varint decode size of stats blob" );
+			ReportBadPacketIPv4( Malformed, "DataPacket", "Failed to varint decode size of stats blob" );
 			return;
 		}
 		if ( pIn + cbStatsMsgIn > pPktEnd )
 		{
-			ReportBadPacketIPv4( "DataPacket", "stats message size doesn't make sense.  Stats message size %d, packet size %d", cbStatsMsgIn, cbPkt );
+			ReportBadPacketIPv4( Malformed, "DataPacket", "stats message size doesn't make sense.  Stats message size %d, packet size %d", cbStatsMsgIn, cbPkt );
 			return;
 		}
 
 		if ( !msgStats.ParseFromArray( pIn, cbStatsMsgIn ) )
 		{
-			ReportBadPacketIPv4( "DataPacket", "protobuf failed to parse inline stats message" );
+			ReportBadPacketIPv4( Malformed, "DataPacket", "protobuf failed to parse inline stats message" );
 			return;
 		}
 
-		// Shove sequence number so we know what acks to pend, etc
-		msgStats.set_seq_num( nWirePktNumber );
-		pMsgStatsIn = &msgStats;
+		InlineStatsFromProtobuf( msgStats, statsIn );
+		pStatsIn = &statsIn;
 
 		// Advance pointer
 		pIn += cbStatsMsgIn;
@@ -1283,8 +1425,8 @@ void CSteamNetworkConnectionUDP::Received_Data( const uint8 *pPkt, int cbPkt, St
 	{
 
 		// Process the stats, if any
-		if ( pMsgStatsIn )
-			RecvStats( *pMsgStatsIn, true, usecNow );
+		if ( pStatsIn )
+			RecvStats( *pStatsIn, true, usecNow );
 	}
 }
 
@@ -1293,7 +1435,7 @@ void CSteamNetworkConnectionUDP::Received_ChallengeReply( const CMsgSteamSockets
 	// We should only be getting this if we are the "client"
 	if ( m_pParentListenSocket )
 	{
-		ReportBadPacketIPv4( "ChallengeReply", "Shouldn't be receiving this unless on accepted connections, only connections initiated locally." );
+		ReportBadPacketIPv4( Unexpected, "ChallengeReply", "Shouldn't be receiving this unless on accepted connections, only connections initiated locally." );
 		return;
 	}
 
@@ -1304,7 +1446,7 @@ void CSteamNetworkConnectionUDP::Received_ChallengeReply( const CMsgSteamSockets
 	// Check session ID to make sure they aren't spoofing.
 	if ( msg.connection_id() != m_unConnectionIDLocal )
 	{
-		ReportBadPacketIPv4( "ChallengeReply", "Incorrect connection ID.  Message is stale or could be spoofed, ignoring." );
+		ReportBadPacketIPv4( ConnectionID, "ChallengeReply", "Incorrect connection ID.  Message is stale or could be spoofed, ignoring." );
 		return;
 	}
 	if ( msg.protocol_version() < k_nMinRequiredProtocolVersion )
@@ -1329,7 +1471,7 @@ void CSteamNetworkConnectionUDP::Received_ChallengeReply( const CMsgSteamSockets
 	}
 
 	// Make sure we have the crypt info that we need
-	if ( !m_msgSignedCertLocal.has_cert() || !m_msgSignedCryptLocal.has_info() )
+	if ( !BHasLocalCert() || !m_pCryptoHandshake->m_msgSignedCryptLocal.has_info() )
 	{
 		ConnectionState_ProblemDetectedLocally( k_ESteamNetConnectionEnd_Misc_InternalError, "Tried to connect request, but crypt not ready" );
 		return;
@@ -1346,8 +1488,8 @@ void CSteamNetworkConnectionUDP::Received_ChallengeReply( const CMsgSteamSockets
 	msgConnectRequest.set_my_timestamp( usecNow );
 	if ( m_statsEndToEnd.m_ping.m_nSmoothedPing >= 0 )
 		msgConnectRequest.set_ping_est_ms( m_statsEndToEnd.m_ping.m_nSmoothedPing );
-	*msgConnectRequest.mutable_cert() = m_msgSignedCertLocal;
-	*msgConnectRequest.mutable_crypt() = m_msgSignedCryptLocal;
+	*msgConnectRequest.mutable_cert() = m_pCryptoHandshake->m_msgSignedCertLocal;
+	*msgConnectRequest.mutable_crypt() = m_pCryptoHandshake->m_msgSignedCryptLocal;
 	msgConnectRequest.set_protocol_version( k_nCurrentProtocolVersion );
 
 	// If the cert is generic, then we need to specify our identity
@@ -1383,14 +1525,14 @@ void CSteamNetworkConnectionUDP::Received_ConnectOK( const CMsgSteamSockets_UDP_
 	// We should only be getting this if we are the "client"
 	if ( m_pParentListenSocket )
 	{
-		ReportBadPacketIPv4( "ConnectOK", "Shouldn't be receiving this unless on accepted connections, only connections initiated locally." );
+		ReportBadPacketIPv4( Unexpected, "ConnectOK", "Shouldn't be receiving this unless on accepted connections, only connections initiated locally." );
 		return;
 	}
 
 	// Check connection ID to make sure they aren't spoofing and it's the same connection we think it is
 	if ( msg.client_connection_id() != m_unConnectionIDLocal )
 	{
-		ReportBadPacketIPv4( "ConnectOK", "Incorrect connection ID.  Message is stale or could be spoofed, ignoring." );
+		ReportBadPacketIPv4( ConnectionID, "ConnectOK", "Incorrect connection ID.  Message is stale or could be spoofed, ignoring." );
 		return;
 	}
 
@@ -1404,7 +1546,7 @@ void CSteamNetworkConnectionUDP::Received_ConnectOK( const CMsgSteamSockets_UDP_
 		int r = SteamNetworkingIdentityFromSignedCert( identityRemote, msg.cert(), errMsg );
 		if ( r < 0 )
 		{
-			ReportBadPacketIPv4( "ConnectRequest", "Bad identity in cert.  %s", errMsg );
+			ReportBadPacketIPv4( Auth, "ConnectRequest", "Bad identity in cert.  %s", errMsg );
 			return;
 		}
 		if ( r == 0 )
@@ -1414,7 +1556,7 @@ void CSteamNetworkConnectionUDP::Received_ConnectOK( const CMsgSteamSockets_UDP_
 			r = SteamNetworkingIdentityFromProtobuf( identityRemote, msg, identity, legacy_server_steam_id, errMsg );
 			if ( r < 0 )
 			{
-				ReportBadPacketIPv4( "ConnectRequest", "Bad identity.  %s", errMsg );
+				ReportBadPacketIPv4( Auth, "ConnectRequest", "Bad identity.  %s", errMsg );
 				return;
 			}
 			if ( r == 0 )
@@ -1439,7 +1581,7 @@ void CSteamNetworkConnectionUDP::Received_ConnectOK( const CMsgSteamSockets_UDP_
 			if ( steamdatagram_ip_allow_connections_without_auth == 0 )
 			{
 				// Should we send an explicit rejection here?
-				ReportBadPacketIPv4( "ConnectOK", "Unauthenticated connections not allowed." );
+				ReportBadPacketIPv4( Auth, "ConnectOK", "Unauthenticated connections not allowed." );
 				return;
 			}
 
@@ -1453,7 +1595,7 @@ void CSteamNetworkConnectionUDP::Received_ConnectOK( const CMsgSteamSockets_UDP_
 			//if ( memcmp( addr.m_ipv6, identityRemote.m_ip.m_ipv6, sizeof(addr.m_ipv6) ) != 0
 			//	|| ( identityRemote.m_ip.m_port != 0 && identityRemote.m_ip.m_port != addr.m_port ) ) // Allow 0 port in the identity to mean "any port"
 			//{
-			//	ReportBadPacket( "ConnectRequest", "Identity in request is %s, but packet is coming from %s." );
+			//	ReportBadPacket( Auth, "ConnectRequest", "Identity in request is %s, but packet is coming from %s." );
 			//	return;
 			//}
 
@@ -1466,7 +1608,7 @@ void CSteamNetworkConnectionUDP::Received_ConnectOK( const CMsgSteamSockets_UDP_
 			if ( !bIdentityInCert )
 			{
 				// Should we send an explicit rejection here?
-				ReportBadPacket( "ConnectOK", "Cannot use specific IP address." );
+				ReportBadPacket( Auth, "ConnectOK", "Cannot use specific IP address." );
 				return;
 			}
 		}
@@ -1475,7 +1617,7 @@ void CSteamNetworkConnectionUDP::Received_ConnectOK( const CMsgSteamSockets_UDP_
 	// Make sure they are still who we think they are
 	if ( !m_identityRemote.IsInvalid() && !( m_identityRemote == identityRemote ) )
 	{
-		ReportBadPacketIPv4( "ConnectOK", "server_steam_id doesn't match who we expect to be connecting to!" );
+		ReportBadPacketIPv4( Auth, "ConnectOK", "server_steam_id doesn't match who we expect to be connecting to!" );
 		return;
 	}
 
@@ -1541,7 +1683,7 @@ void CSteamNetworkConnectionUDP::Received_ConnectOK( const CMsgSteamSockets_UDP_
 	if ( !BRecvCryptoHandshake( msg.cert(), msg.crypt(), false ) )
 	{
 		Assert( GetState() == k_ESteamNetworkingConnectionState_ProblemDetectedLocally );
-		ReportBadPacketIPv4( "ConnectOK", "Failed crypto init.  %s", m_szEndDebug );
+		ReportBadPacketIPv4( Auth, "ConnectOK", "Failed crypto init.  %s", m_szEndDebug );
 		return;
 	}
 
@@ -1586,7 +1728,7 @@ void CSteamNetworkConnectionUDP::Received_NoConnection( const CMsgSteamSockets_U
 	// Make sure it's an ack of something we would have sent
 	if ( msg.to_connection_id() != m_unConnectionIDLocal || msg.from_connection_id() != m_unConnectionIDRemote )
 	{
-		ReportBadPacketIPv4( "NoConnection", "Old/incorrect connection ID.  Message is for a stale connection, or is spoofed.  Ignoring." );
+		ReportBadPacketIPv4( ConnectionID, "NoConnection", "Old/incorrect connection ID.  Message is for a stale connection, or is spoofed.  Ignoring." );
 		return;
 	}
 
@@ -1599,7 +1741,7 @@ void CSteamNetworkConnectionUDP::Received_ChallengeOrConnectRequest( const char
 	// If wrong connection ID, then check for sending a generic reply and bail
 	if ( unPacketConnectionID != m_unConnectionIDRemote )
 	{
-		ReportBadPacketIPv4( pszDebugPacketType, "Incorrect connection ID, when we do have a connection for this address.  Could be spoofed, ignoring." );
+		ReportBadPacketIPv4( ConnectionID, pszDebugPacketType, "Incorrect connection ID, when we do have a connection for this address.  Could be spoofed, ignoring." );
 		// Let's not send a reply in this case
 		//if ( BCheckGlobalSpamReplyRateLimit( usecNow ) )
 		//	SendNoConnection( unPacketConnectionID );
@@ -1631,10 +1773,15 @@ void CSteamNetworkConnectionUDP::Received_ChallengeOrConnectRequest( const char
 			if ( !m_pParentListenSocket )
 			{
 				// WAT?  We initiated this connection, so why are they requesting to connect?
-				ReportBadPacketIPv4( pszDebugPacketType, "We are the 'client' who initiated the connection, so 'server' shouldn't be sending us this!" );
+				ReportBadPacketIPv4( Unexpected, pszDebugPacketType, "We are the 'client' who initiated the connection, so 'server' shouldn't be sending us this!" );
 				return;
 			}
 
+			// If they have already sent us data, then they got our earlier reply, and
+			// this is just a stale duplicate.  (We've discarded the handshake state.)
+			if ( !m_pCryptoHandshake )
+				return;
+
 			// This is totally legit and possible.  Our earlier reply might have dropped, and they are re-sending
 			SendConnectOK( usecNow );
 			return;
@@ -1684,14 +1831,14 @@ void CSteamNetworkConnectionUDP::SendConnectOK( SteamNetworkingMicroseconds usec
 	Assert( m_unConnectionIDRemote );
 	Assert( m_pParentListenSocket );
 
-	Assert( m_msgSignedCertLocal.has_cert() );
-	Assert( m_msgSignedCryptLocal.has_info() );
+	Assert( BHasLocalCert() );
+	Assert( m_pCryptoHandshake->m_msgSignedCryptLocal.has_info() );
 
 	CMsgSteamSockets_UDP_ConnectOK msg;
 	msg.set_client_connection_id( m_unConnectionIDRemote );
 	msg.set_server_connection_id( m_unConnectionIDLocal );
-	*msg.mutable_cert() = m_msgSignedCertLocal;
-	*msg.mutable_crypt() = m_msgSignedCryptLocal;
+	*msg.mutable_cert() = m_pCryptoHandshake->m_msgSignedCertLocal;
+	*msg.mutable_crypt() = m_pCryptoHandshake->m_msgSignedCryptLocal;
 	msg.set_protocol_version( k_nCurrentProtocolVersion );
 
 	// If the cert is generic, then we need to specify our identity
@@ -1816,7 +1963,7 @@ failed:
 		p->m_identityRemote = q->m_identityLocal;
 		p->m_unConnectionIDRemote = q->m_unConnectionIDLocal;
 		p->m_statsEndToEnd.m_usecTimeLastRecv = usecNow; // Act like we just now received something
-		if ( !p->BRecvCryptoHandshake( q->m_msgSignedCertLocal, q->m_msgSignedCryptLocal, i==0 ) )
+		if ( !p->BRecvCryptoHandshake( q->CryptoHandshake().m_msgSignedCertLocal, q->CryptoHandshake().m_msgSignedCryptLocal, i==0 ) )
 		{
 			AssertMsg( false, "BRecvCryptoHandshake failed creating localhost socket pair" );
 			goto failed;
@@ -1824,6 +1971,10 @@ failed:
 		p->ConnectionState_Connected( usecNow );
 	}
 
+	// Both sides have their keys, we won't need the handshake state again
+	pConn[0]->FreeCryptoHandshake();
+	pConn[1]->FreeCryptoHandshake();
+
 	return true;
 }
 
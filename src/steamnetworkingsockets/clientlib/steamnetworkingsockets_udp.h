@@ -55,6 +55,13 @@ private:
 //
 /////////////////////////////////////////////////////////////////////////////
 
+/// Connection quality stats and ack request flags, sent inline in a data packet
+struct UDPInlineStats_t
+{
+	uint32 m_nFlags; // CMsgSteamSockets_UDP_Stats::Flags
+	ConnectionQualityStats_t m_stats;
+};
+
 /// A connection over raw UDP
 class CSteamNetworkConnectionUDP : public CSteamNetworkConnectionBase
 {
@@ -70,6 +77,9 @@ public:
 
 	/// Implements CSteamNetworkConnectionBase
 	virtual int SendEncryptedDataChunk( const void *pChunk, int cbChunk, SteamNetworkingMicroseconds usecNow, void *pConnectionContext ) OVERRIDE;
+	virtual bool BSetTransportPacingRate( int nBytesPerSec ) OVERRIDE;
+	virtual int GetMaxEncryptedPayloadSendToProbe() const OVERRIDE;
+	virtual int GetTransportMemoryUsage() const OVERRIDE;
 	virtual EResult APIAcceptConnection() OVERRIDE;
 	virtual bool BCanSendEndToEndConnectRequest() const OVERRIDE;
 	virtual bool BCanSendEndToEndData() const OVERRIDE;
@@ -122,9 +132,9 @@ protected:
 	void SendNoConnection( uint32 unFromConnectionID, uint32 unToConnectionID );
 
 	/// Process stats message, either inline or standalone
-	void RecvStats( const CMsgSteamSockets_UDP_Stats &msgStatsIn, bool bInline, SteamNetworkingMicroseconds usecNow );
+	void RecvStats( const UDPInlineStats_t &statsIn, bool bInline, SteamNetworkingMicroseconds usecNow );
 	void SendStatsMsg( EStatsReplyRequest eReplyRequested, SteamNetworkingMicroseconds usecNow );
-	void TrackSentStats( const CMsgSteamSockets_UDP_Stats &msgStatsOut, bool bInline, SteamNetworkingMicroseconds usecNow );
+	void TrackSentStats( const UDPInlineStats_t &statsOut, bool bInline, SteamNetworkingMicroseconds usecNow );
 };
 
 /// A connection over loopback
@@ -0,0 +1,185 @@
+//====== Copyright Valve Corporation, All rights reserved. ====================
+
+#ifndef PERCENTILE_SKETCH_H
+#define PERCENTILE_SKETCH_H
+#pragma once
+
+#include <string.h>
+#include <tier0/dbg.h>
+
+/// Fixed size, mergeable sketch used to get a percentile breakdown of a stream
+/// of non-negative integer samples.
+///
+/// Samples are counted in a log-linear histogram.  Values less than
+/// 2^SUB_BUCKET_BITS get their own bucket and are exact.  Above that, each
+/// power of two is divided into 2^SUB_BUCKET_BITS buckets, so the relative
+/// error is at most 2^-SUB_BUCKET_BITS.  Values of 2^MAX_BITS or more are
+/// clamped into the last bucket.
+///
+/// The memory used is constant no matter how many samples are added, and
+/// querying a percentile is a single pass over the buckets.  When a bucket
+/// count would overflow, all the counts are halved, which preserves the shape
+/// of the distribution.
+///
+/// The sketch is a plain struct, and an all-zero sketch is empty, so it can be
+/// memset, copied around, and sketches from different connections (with the
+/// same template parameters) can be combined with Merge.
+template < typename T, int MAX_BITS, int SUB_BUCKET_BITS >
+class PercentileSketch
+{
+public:
+	COMPILE_TIME_ASSERT( SUB_BUCKET_BITS < MAX_BITS && MAX_BITS < 32 );
+
+	enum
+	{
+		k_nSubBuckets = 1 << SUB_BUCKET_BITS,
+		k_nBuckets = k_nSubBuckets * ( MAX_BITS - SUB_BUCKET_BITS + 1 )
+	};
+
+	PercentileSketch() { Clear(); }
+
+	/// Throw away all samples and restart histogram collection
+	void Clear() { memset( this, 0, sizeof(*this) ); }
+
+	/// Add a sample to the histogram
+	void AddSample( T x );
+
+	/// Add all the samples from another sketch.
+	void Merge( const PercentileSketch &x );
+
+	/// Return number of samples that are currently represented in the sketch.
+	/// This is usually the same as NumSamplesTotal, unless the counts have been
+	/// scaled down to avoid overflow.
+	int NumSamples() const { return m_nSamples; }
+
+	/// Total number samples we have ever received
+	int NumSamplesTotal() const { return m_nSamplesTotal; }
+
+	/// Fetch an estimate of the Nth percentile.
+	/// The percentile should in the range (0,1).  (exclusive)
+	///
+	/// Before using this blindly, you should ensure that you have a
+	/// sufficient number of samples for the percentile you are asking for.
+	T GetPercentile( float flPct ) const;
+
+	/// Bucket lookup, and the smallest value in a bucket
+	static int BucketForValue( uint32 x );
+	static uint32 BucketMinValue( int idxBucket );
+
+private:
+	int m_nSamples;
+	int m_nSamplesTotal;
+	uint16 m_arCount[ k_nBuckets ];
+
+	void HalveCounts();
+};
+
+template < typename T, int MAX_BITS, int SUB_BUCKET_BITS >
+int PercentileSketch<T,MAX_BITS,SUB_BUCKET_BITS>::BucketForValue( uint32 x )
+{
+	if ( x < (uint32)k_nSubBuckets )
+		return (int)x;
+	if ( x >= ( 1u << MAX_BITS ) )
+		return k_nBuckets-1;
+
+	// Find the highest bit, then use the next SUB_BUCKET_BITS bits
+	// below it to select the bucket within this power of two
+	int nBit = SUB_BUCKET_BITS;
+	while ( ( x >> ( nBit+1 ) ) != 0 )
+		++nBit;
+	int nSub = int( x >> ( nBit - SUB_BUCKET_BITS ) ) & ( k_nSubBuckets-1 );
+	return ( nBit - SUB_BUCKET_BITS + 1 ) * k_nSubBuckets + nSub;
+}
+
+template < typename T, int MAX_BITS, int SUB_BUCKET_BITS >
+uint32 PercentileSketch<T,MAX_BITS,SUB_BUCKET_BITS>::BucketMinValue( int idxBucket )
+{
+	if ( idxBucket < k_nSubBuckets )
+		return (uint32)idxBucket;
+	int nBit = idxBucket / k_nSubBuckets + SUB_BUCKET_BITS - 1;
+	uint32 nSub = (uint32)( idxBucket % k_nSubBuckets );
+	return ( 1u << nBit ) + ( nSub << ( nBit - SUB_BUCKET_BITS ) );
+}
+
+template < typename T, int MAX_BITS, int SUB_BUCKET_BITS >
+void PercentileSketch<T,MAX_BITS,SUB_BUCKET_BITS>::HalveCounts()
+{
+	m_nSamples = 0;
+	for ( uint16 &n: m_arCount )
+	{
+		n >>= 1;
+		m_nSamples += n;
+	}
+}
+
+template < typename T, int MAX_BITS, int SUB_BUCKET_BITS >
+void PercentileSketch<T,MAX_BITS,SUB_BUCKET_BITS>::AddSample( T x )
+{
+	uint16 &n = m_arCount[ BucketForValue( x > T(0) ? (uint32)x : 0u ) ];
+	if ( n == 0xffff )
+		HalveCounts();
+	++n;
+	++m_nSamples;
+	++m_nSamplesTotal;
+}
+
+template < typename T, int MAX_BITS, int SUB_BUCKET_BITS >
+void PercentileSketch<T,MAX_BITS,SUB_BUCKET_BITS>::Merge( const PercentileSketch &x )
+{
+	// If any bucket would overflow, scale both sketches down
+	// by the same amount, until they fit
+	int nShift = 0;
+	for ( int i = 0 ; i < k_nBuckets ; ++i )
+	{
+		while ( ( ( (uint32)m_arCount[i] + x.m_arCount[i] ) >> nShift ) > 0xffff )
+			++nShift;
+	}
+
+	m_nSamples = 0;
+	for ( int i = 0 ; i < k_nBuckets ; ++i )
+	{
+		m_arCount[i] = uint16( ( m_arCount[i] >> nShift ) + ( x.m_arCount[i] >> nShift ) );
+		m_nSamples += m_arCount[i];
+	}
+	m_nSamplesTotal += x.m_nSamplesTotal;
+}
+
+template < typename T, int MAX_BITS, int SUB_BUCKET_BITS >
+T PercentileSketch<T,MAX_BITS,SUB_BUCKET_BITS>::GetPercentile( float flPct ) const
+{
+	// Make sure percentile is reasonable.  If you want the min or
+	// max, don't use this method.
+	Assert( 0 < flPct && flPct < 1.0f );
+
+	// We have to have collected at least one sample!
+	if ( m_nSamples < 1 )
+	{
+		Assert( m_nSamples > 0 );
+		return T();
+	}
+
+	// Locate the bucket containing the sample with the desired rank
+	float flRank = flPct * float(m_nSamples);
+	int nBelow = 0;
+	int idxBucket = 0;
+	for (;;)
+	{
+		int n = m_arCount[idxBucket];
+		if ( nBelow + n > flRank || idxBucket == k_nBuckets-1 )
+			break;
+		nBelow += n;
+		++idxBucket;
+	}
+
+	// Exact buckets only contain one value
+	uint32 nMin = BucketMinValue( idxBucket );
+	if ( idxBucket < k_nSubBuckets || idxBucket == k_nBuckets-1 )
+		return T( nMin );
+
+	// Interpolate, assuming samples are evenly spread across the bucket
+	float flWidth = float( BucketMinValue( idxBucket+1 ) - nMin );
+	float flFrac = ( flRank - nBelow ) / float( m_arCount[idxBucket] );
+	return T( nMin + flWidth*flFrac );
+}
+
+#endif // #ifndef PERCENTILE_SKETCH_H
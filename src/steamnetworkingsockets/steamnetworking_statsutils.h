@@ -10,8 +10,8 @@
 
 #include <tier0/basetypes.h>
 #include <tier0/t0constants.h>
-#include "percentile_generator.h"
-#include "steamnetworking_stats.h"
+#include "percentile_sketch.h"
+#include <steam/steamnetworking_stats.h>
 #include "steamnetworkingsockets_internal.h"
 
 //#include <google/protobuf/repeated_field.h> // FIXME - should only need this!
@@ -174,9 +174,9 @@ struct PingTracker
 	int m_nHistogram300;
 	int m_nHistogramMax;
 
-	/// Track sample of pings received so we can generate a histogram.
+	/// Distribution of pings received (in ms), so we can generate percentiles.
 	/// Also tracks how many pings we have received total
-	PercentileGenerator<uint16> m_sample;
+	PercentileSketch<uint16,16,4> m_sample;
 };
 
 /// Token bucket rate limiter
@@ -226,6 +226,23 @@ private:
 	float m_flTokenDeficitFromFull;
 };
 
+/// Same information as CMsgSteamDatagramConnectionQuality, as a plain struct,
+/// so that we can exchange stats on the data path without protobuf.
+struct ConnectionQualityStats_t
+{
+	bool m_bHasInstantaneous;
+	bool m_bHasLifetime;
+	SteamDatagramLinkInstantaneousStats m_instantaneous;
+	SteamDatagramLinkLifetimeStats m_lifetime;
+
+	inline void Clear()
+	{
+		m_bHasInstantaneous = false;
+		m_bHasLifetime = false;
+	}
+	inline bool IsEmpty() const { return !m_bHasInstantaneous && !m_bHasLifetime; }
+};
+
 /// Class used to handle link quality calculations.
 struct LinkStatsTrackerBase
 {
@@ -326,7 +343,7 @@ struct LinkStatsTrackerBase
 	int64 m_nPktsRecvSequenceNumberLurch; // sequence number had a really large discontinuity
 
 	/// Lifetime quality statistics
-	PercentileGenerator<uint8> m_qualitySample;
+	PercentileSketch<uint8,7,6> m_qualitySample; // Exact for 0...100
 
 	/// Histogram of quality intervals
 	int m_nQualityHistogram100;
@@ -402,6 +419,7 @@ struct LinkStatsTrackerBase
 	/// actually send it.  (We might be looking for a good opportunity, and the data we want
 	/// to send doesn't fit.)
 	void PopulateMessage( CMsgSteamDatagramConnectionQuality &msg, SteamNetworkingMicroseconds usecNow );
+	void PopulateStats( ConnectionQualityStats_t &stats, SteamNetworkingMicroseconds usecNow );
 
 	/// Called when we send a packet for which we expect a reply and
 	/// for which we expect to get latency info.
@@ -417,6 +435,7 @@ struct LinkStatsTrackerBase
 
 	/// Called when we receive stats from remote host
 	void ProcessMessage( const CMsgSteamDatagramConnectionQuality &msg, SteamNetworkingMicroseconds usecNow );
+	void ProcessStats( const ConnectionQualityStats_t &stats, SteamNetworkingMicroseconds usecNow );
 
 	/// Received from remote host
 	SteamDatagramLinkInstantaneousStats m_latestRemote;
@@ -585,7 +604,7 @@ struct LinkStatsTrackerEndToEnd : public LinkStatsTrackerBase
 	/// TX Speed, should match CMsgSteamDatagramLinkLifetimeStats 
 	int m_nTXSpeed; 
 	int m_nTXSpeedMax; 
-	PercentileGenerator<int> m_TXSpeedSample;
+	PercentileSketch<int,24,3> m_TXSpeedSample;
 	int m_nTXSpeedHistogram16; // Speed at kb/s
 	int m_nTXSpeedHistogram32; 
 	int m_nTXSpeedHistogram64;
@@ -598,7 +617,7 @@ struct LinkStatsTrackerEndToEnd : public LinkStatsTrackerBase
 	/// RX Speed, should match CMsgSteamDatagramLinkLifetimeStats 
 	int m_nRXSpeed;
 	int m_nRXSpeedMax;
-	PercentileGenerator<int> m_RXSpeedSample;
+	PercentileSketch<int,24,3> m_RXSpeedSample;
 	int m_nRXSpeedHistogram16; // Speed at kb/s
 	int m_nRXSpeedHistogram32; 
 	int m_nRXSpeedHistogram64;
@@ -645,15 +664,23 @@ struct LinkStatsTracker : public TLinkStatsTracker
 
 	/// Called after we actually send connection data.  Note that we must have consumed the outgoing sequence
 	/// for that packet (using GetNextSendSequenceNumber), but must *NOT* have consumed any more!
-	void TrackSentStats( const CMsgSteamDatagramConnectionQuality &msg, SteamNetworkingMicroseconds usecNow, bool bAllowDelayedReply )
+	inline void TrackSentStats( const CMsgSteamDatagramConnectionQuality &msg, SteamNetworkingMicroseconds usecNow, bool bAllowDelayedReply )
+	{
+		TrackSentStats( msg.has_instantaneous(), msg.has_lifetime(), usecNow, bAllowDelayedReply );
+	}
+	inline void TrackSentStats( const ConnectionQualityStats_t &stats, SteamNetworkingMicroseconds usecNow, bool bAllowDelayedReply )
+	{
+		TrackSentStats( stats.m_bHasInstantaneous, stats.m_bHasLifetime, usecNow, bAllowDelayedReply );
+	}
+	void TrackSentStats( bool bInstantaneous, bool bLifetime, SteamNetworkingMicroseconds usecNow, bool bAllowDelayedReply )
 	{
 
 		// Check if we expect our peer to know how to acknowledge this
 		if ( !TLinkStatsTracker::m_bDisconnected )
 		{
 			TLinkStatsTracker::m_pktNumInFlight = TLinkStatsTracker::m_nNextSendSequenceNumber-1;
-			TLinkStatsTracker::m_bInFlightInstantaneous = msg.has_instantaneous();
-			TLinkStatsTracker::m_bInFlightLifetime = msg.has_lifetime();
+			TLinkStatsTracker::m_bInFlightInstantaneous = bInstantaneous;
+			TLinkStatsTracker::m_bInFlightLifetime = bLifetime;
 
 			// They should ack.  Make a note of the sequence number that we used,
 			// so that we can measure latency when they reply, setup timeout bookkeeping, etc
@@ -666,9 +693,9 @@ struct LinkStatsTracker : public TLinkStatsTracker
 			TLinkStatsTracker::m_pktNumInFlight = 0;
 			TLinkStatsTracker::m_bInFlightInstantaneous = false;
 			TLinkStatsTracker::m_bInFlightLifetime = false;
-			if ( msg.has_instantaneous() )
+			if ( bInstantaneous )
 				TLinkStatsTracker::PeerAckedInstantaneous( usecNow );
-			if ( msg.has_lifetime() )
+			if ( bLifetime )
 				TLinkStatsTracker::PeerAckedLifetime( usecNow );
 		}
 	}
@@ -694,6 +721,19 @@ extern void LinkStatsInstantaneousMsgToStruct( const CMsgSteamDatagramLinkInstan
 extern void LinkStatsLifetimeStructToMsg( const SteamDatagramLinkLifetimeStats &s, CMsgSteamDatagramLinkLifetimeStats &msg );
 extern void LinkStatsLifetimeMsgToStruct( const CMsgSteamDatagramLinkLifetimeStats &msg, SteamDatagramLinkLifetimeStats &s );
 
+//
+// Pack/unpack C struct <-> compact wire format.  This is a fixed layout,
+// little endian, with the same precision as the protobuf messages.  It's
+// used for stats sent inline in data packets, where we don't want to touch
+// protobuf.  The caller is responsible for making sure there is room.
+//
+const int k_cbLinkStatsInstantaneousWire = 24;
+const int k_cbLinkStatsLifetimeWire = 298;
+extern uint8 *LinkStatsInstantaneousStructToWire( const SteamDatagramLinkInstantaneousStats &s, uint8 *p );
+extern const uint8 *LinkStatsInstantaneousWireToStruct( const uint8 *p, SteamDatagramLinkInstantaneousStats &s );
+extern uint8 *LinkStatsLifetimeStructToWire( const SteamDatagramLinkLifetimeStats &s, uint8 *p );
+extern const uint8 *LinkStatsLifetimeWireToStruct( const uint8 *p, SteamDatagramLinkLifetimeStats &s );
+
 } // namespace SteamNetworkingSocketsLib
 
 #endif // STEAMNETWORKING_STATSUTILS_H
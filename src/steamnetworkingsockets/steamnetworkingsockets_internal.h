@@ -165,9 +165,23 @@ COMPILE_TIME_ASSERT( k_cbSteamNetworkingSocketsMaxEncryptedPayloadSend % k_cbSte
 /// ideal?  For some reason I'd like to use a more round number.  That might be misguided, but it feels right.
 const int k_cbSteamNetworkingSocketsMaxPlaintextPayloadSend = k_cbSteamNetworkingSocketsMaxEncryptedPayloadSend-4;
 
-/// Use larger limits for what we are willing to receive.
-const int k_cbSteamNetworkingSocketsMaxEncryptedPayloadRecv = k_cbSteamNetworkingSocketsMaxUDPMsgLen;
-const int k_cbSteamNetworkingSocketsMaxPlaintextPayloadRecv = k_cbSteamNetworkingSocketsMaxUDPMsgLen;
+/// Largest UDP payload we will ever send or receive.  The sizes above are
+/// what we use until path MTU discovery tells us that a bigger packet
+/// will get through.  This is a 9000 byte jumbo frame, less the IPv6 and
+/// UDP headers.
+const int k_cbSteamNetworkingSocketsMaxUDPMsgLenJumbo = 9000 - 48;
+
+/// Largest encrypted payload that path MTU discovery will try to use.
+/// Leaves the same amount of room for headers as the regular size.
+const int k_cbSteamNetworkingSocketsMaxEncryptedPayloadSendJumbo = 8896;
+COMPILE_TIME_ASSERT( k_cbSteamNetworkingSocketsMaxEncryptedPayloadSendJumbo % k_cbSteamNetworkingSocketsEncryptionBlockSize == 0 );
+COMPILE_TIME_ASSERT( k_cbSteamNetworkingSocketsMaxEncryptedPayloadSendJumbo + 50 < k_cbSteamNetworkingSocketsMaxUDPMsgLenJumbo );
+const int k_cbSteamNetworkingSocketsMaxPlaintextPayloadSendJumbo = k_cbSteamNetworkingSocketsMaxEncryptedPayloadSendJumbo-4;
+
+/// Use larger limits for what we are willing to receive.  The peer might
+/// have discovered a path MTU larger than the one we are using to send
+const int k_cbSteamNetworkingSocketsMaxEncryptedPayloadRecv = k_cbSteamNetworkingSocketsMaxUDPMsgLenJumbo;
+const int k_cbSteamNetworkingSocketsMaxPlaintextPayloadRecv = k_cbSteamNetworkingSocketsMaxUDPMsgLenJumbo;
 
 /// Make sure we have enough room for our headers and occasional inline pings and stats and such
 COMPILE_TIME_ASSERT( k_cbSteamNetworkingSocketsMaxEncryptedPayloadSend + 50 < k_cbSteamNetworkingSocketsMaxUDPMsgLen );
@@ -249,9 +263,32 @@ COMPILE_TIME_ASSERT( ( k_usecTimeSinceLastPacketMinReasonable >> k_usecTimeSince
 extern EUniverse g_eUniverse;
 
 /// Protocol version of this code
-const uint32 k_nCurrentProtocolVersion = 5;
+const uint32 k_nCurrentProtocolVersion = 11;
 const uint32 k_nMinRequiredProtocolVersion = 5;
 
+/// Peers older than this don't understand the padding frame, and so
+/// we cannot send them path MTU probes
+const uint32 k_nMinPeerProtocolVersionPMTUProbe = 6;
+
+/// Peers older than this don't understand the select lane frame, and so
+/// we can only use one lane with them
+const uint32 k_nMinPeerProtocolVersionLanes = 7;
+
+/// Peers older than this cannot receive reliable messages out of order
+const uint32 k_nMinPeerProtocolVersionUnordered = 8;
+
+/// Peers older than this don't understand the ack frequency and immediate
+/// ack frames, and always delay acks by k_usecMaxDataAckDelay
+const uint32 k_nMinPeerProtocolVersionAckFrequency = 9;
+
+/// Peers older than this don't understand the marker for a reliable message
+/// that is one chunk of a larger stream
+const uint32 k_nMinPeerProtocolVersionStreams = 10;
+
+/// Peers older than this expect stats inline in UDP data packets to be
+/// a protobuf blob, rather than the compact fixed layout
+const uint32 k_nMinPeerProtocolVersionCompactInlineStats = 11;
+
 // Serialize an UNSIGNED quantity.  Returns pointer to the next byte.
 // https://developers.google.com/protocol-buffers/docs/encoding
 template <typename T>
@@ -729,6 +766,7 @@ namespace vstd
 		reserve( x.size_ );
 		size_ = x.size_;
 		vstd::copy_construct_elements( begin(), x.begin(), size_ );
+		return *this;
 	}
 
 	template<typename T, int N>
@@ -748,6 +786,7 @@ namespace vstd
 		{
 			vstd::move_construct_elements<T>( (T*)fixed_, (T*)x.fixed_, size_ );
 		}
+		return *this;
 	}
 
 	template< typename T, int N >
@@ -866,6 +905,44 @@ namespace vstd
 
 } // namespace vstd
 
+//
+// Rough estimates of heap memory used, for memory accounting.  These
+// include the typical allocator overhead (a size word, rounded up to
+// 16 bytes), so they are only approximate.
+//
+
+inline int MemoryUsageOfAllocation( size_t cb )
+{
+	if ( cb == 0 )
+		return 0;
+	return (int)std::max( ( cb + sizeof(size_t) + 15 ) & ~size_t(15), size_t(32) );
+}
+
+inline int MemoryUsageOfHeap( const std::string &str )
+{
+	// Assume small string optimization
+	return str.capacity() > 15 ? MemoryUsageOfAllocation( str.capacity()+1 ) : 0;
+}
+
+template <typename T, typename A>
+inline int MemoryUsageOfHeap( const std::vector<T,A> &vec )
+{
+	return MemoryUsageOfAllocation( vec.capacity() * sizeof(T) );
+}
+
+template <typename T, int N>
+inline int MemoryUsageOfHeap( const vstd::small_vector<T,N> &vec )
+{
+	return vec.capacity() > N ? MemoryUsageOfAllocation( vec.capacity() * sizeof(T) ) : 0;
+}
+
+template <typename K, typename V, typename L, typename A>
+inline int MemoryUsageOfHeap( const std::map<K,V,L,A> &map )
+{
+	// Each node has the value, plus color, parent, left, and right
+	return len( map ) * MemoryUsageOfAllocation( sizeof( typename std::map<K,V,L,A>::value_type ) + 4*sizeof(void*) );
+}
+
 
 #include <tier0/memdbgon.h>
 
@@ -551,31 +551,39 @@ bool LinkStatsTrackerBase::BNeedToSendStatsInternal( SteamNetworkingMicroseconds
 	return bNeedToSendInstantaneous || bNeedToSendLifetime;
 }
 
-void LinkStatsTrackerBase::PopulateMessage( CMsgSteamDatagramConnectionQuality &msg, SteamNetworkingMicroseconds usecNow )
+void LinkStatsTrackerBase::PopulateStats( ConnectionQualityStats_t &stats, SteamNetworkingMicroseconds usecNow )
 {
+	stats.Clear();
 	if ( m_pktNumInFlight == 0 && !m_bDisconnected )
 	{
 
 		// Ready to send instantaneous stats?
 		if ( m_usecPeerAckedInstaneous + k_usecLinkStatsInstantaneousReportMinInterval < usecNow && BCheckHaveDataToSendInstantaneous( usecNow ) )
 		{
-			// !KLUDGE! Go through public struct as intermediary to keep code simple.
-			SteamDatagramLinkInstantaneousStats sInstant;
-			GetInstantaneousStats( sInstant );
-			LinkStatsInstantaneousStructToMsg( sInstant, *msg.mutable_instantaneous() );
+			GetInstantaneousStats( stats.m_instantaneous );
+			stats.m_bHasInstantaneous = true;
 		}
 
 		// Ready to send lifetime stats?
 		if ( m_usecPeerAckedLifetime + k_usecLinkStatsLifetimeReportMinInterval < usecNow && BCheckHaveDataToSendLifetime( usecNow ) )
 		{
-			// !KLUDGE! Go through public struct as intermediary to keep code simple.
-			SteamDatagramLinkLifetimeStats sLifetime;
-			GetLifetimeStats( sLifetime );
-			LinkStatsLifetimeStructToMsg( sLifetime, *msg.mutable_lifetime() );
+			GetLifetimeStats( stats.m_lifetime );
+			stats.m_bHasLifetime = true;
 		}
 	}
 }
 
+void LinkStatsTrackerBase::PopulateMessage( CMsgSteamDatagramConnectionQuality &msg, SteamNetworkingMicroseconds usecNow )
+{
+	// !KLUDGE! Go through public struct as intermediary to keep code simple.
+	ConnectionQualityStats_t stats;
+	PopulateStats( stats, usecNow );
+	if ( stats.m_bHasInstantaneous )
+		LinkStatsInstantaneousStructToMsg( stats.m_instantaneous, *msg.mutable_instantaneous() );
+	if ( stats.m_bHasLifetime )
+		LinkStatsLifetimeStructToMsg( stats.m_lifetime, *msg.mutable_lifetime() );
+}
+
 void LinkStatsTrackerBase::TrackSentMessageExpectingReply( SteamNetworkingMicroseconds usecNow, bool bAllowDelayedReply )
 {
 	if ( m_usecInFlightReplyTimeout == 0 )
@@ -602,6 +610,20 @@ void LinkStatsTrackerBase::ProcessMessage( const CMsgSteamDatagramConnectionQual
 	}
 }
 
+void LinkStatsTrackerBase::ProcessStats( const ConnectionQualityStats_t &stats, SteamNetworkingMicroseconds usecNow )
+{
+	if ( stats.m_bHasInstantaneous )
+	{
+		m_latestRemote = stats.m_instantaneous;
+		m_usecTimeRecvLatestRemote = usecNow;
+	}
+	if ( stats.m_bHasLifetime )
+	{
+		m_lifetimeRemote = stats.m_lifetime;
+		m_usecTimeRecvLifetimeRemote = usecNow;
+	}
+}
+
 void LinkStatsTrackerBase::GetInstantaneousStats( SteamDatagramLinkInstantaneousStats &s ) const
 {
 	s.m_flOutPacketsPerSec = m_sent.m_packets.m_flRate;
@@ -1087,6 +1109,134 @@ void LinkStatsLifetimeMsgToStruct( const CMsgSteamDatagramLinkLifetimeStats &msg
 	#undef SET_NTILE
 }
 
+#define PUT_WIRE_U8( x ) { *p = uint8( x ); p += 1; }
+#define PUT_WIRE_U16( x ) { *(uint16 *)p = LittleWord( uint16( x ) ); p += 2; }
+#define PUT_WIRE_U32( x ) { *(uint32 *)p = LittleDWord( uint32( x ) ); p += 4; }
+#define PUT_WIRE_U64( x ) { *(uint64 *)p = LittleQWord( uint64( x ) ); p += 8; }
+#define GET_WIRE_U8( x ) { x = *p; p += 1; }
+#define GET_WIRE_U16( x ) { x = LittleWord( *(const uint16 *)p ); p += 2; }
+#define GET_WIRE_U32( x ) { x = LittleDWord( *(const uint32 *)p ); p += 4; }
+#define GET_WIRE_U64( x ) { x = LittleQWord( *(const uint64 *)p ); p += 8; }
+
+uint8 *LinkStatsInstantaneousStructToWire( const SteamDatagramLinkInstantaneousStats &s, uint8 *p )
+{
+	uint8 *pStart = p;
+	PUT_WIRE_U32( s.m_flOutPacketsPerSec * 10.0f );
+	PUT_WIRE_U32( s.m_flOutBytesPerSec );
+	PUT_WIRE_U32( s.m_flInPacketsPerSec * 10.0f );
+	PUT_WIRE_U32( s.m_flInBytesPerSec );
+
+	// Unknown values are all bits set
+	PUT_WIRE_U16( s.m_nPingMS >= 0 ? Min( s.m_nPingMS, 0xfffe ) : 0xffff );
+	PUT_WIRE_U8( s.m_flPacketsDroppedPct >= 0.0f ? uint8( s.m_flPacketsDroppedPct * 100.0f ) : 0xff );
+	PUT_WIRE_U8( s.m_flPacketsWeirdSequenceNumberPct >= 0.0f ? uint8( s.m_flPacketsWeirdSequenceNumberPct * 100.0f ) : 0xff );
+	PUT_WIRE_U32( s.m_usecMaxJitter >= 0 ? uint32( s.m_usecMaxJitter ) : 0xffffffffu );
+
+	Assert( p == pStart + k_cbLinkStatsInstantaneousWire ); (void)pStart;
+	return p;
+}
+
+const uint8 *LinkStatsInstantaneousWireToStruct( const uint8 *p, SteamDatagramLinkInstantaneousStats &s )
+{
+	// Same as what you'd get from LinkStatsInstantaneousMsgToStruct
+	// on a zeroed struct
+	memset( &s, 0, sizeof(s) );
+
+	uint32 x;
+	GET_WIRE_U32( x ); s.m_flOutPacketsPerSec = x * .1f;
+	GET_WIRE_U32( x ); s.m_flOutBytesPerSec = x;
+	GET_WIRE_U32( x ); s.m_flInPacketsPerSec = x * .1f;
+	GET_WIRE_U32( x ); s.m_flInBytesPerSec = x;
+
+	uint16 nPing; GET_WIRE_U16( nPing );
+	s.m_nPingMS = ( nPing == 0xffff ) ? -1 : nPing;
+	uint8 nPct;
+	GET_WIRE_U8( nPct ); s.m_flPacketsDroppedPct = ( nPct == 0xff ) ? -1.0f : nPct * .01f;
+	GET_WIRE_U8( nPct ); s.m_flPacketsWeirdSequenceNumberPct = ( nPct == 0xff ) ? -1.0f : nPct * .01f;
+	GET_WIRE_U32( x ); s.m_usecMaxJitter = ( x == 0xffffffffu ) ? -1 : int( x );
+
+	return p;
+}
+
+// The rest of the lifetime stats, in wire order.  Ntiles are -1 if unknown,
+// which is sent as all bits set.  Ping and quality ntiles are 16-bit
+#define LINKSTATS_LIFETIME_WIRE_INT_FIELDS( FIELD, FIELD16 ) \
+	FIELD( m_nQualityHistogram100 ) FIELD( m_nQualityHistogram99 ) FIELD( m_nQualityHistogram97 ) \
+	FIELD( m_nQualityHistogram95 ) FIELD( m_nQualityHistogram90 ) FIELD( m_nQualityHistogram75 ) \
+	FIELD( m_nQualityHistogram50 ) FIELD( m_nQualityHistogram1 ) FIELD( m_nQualityHistogramDead ) \
+	FIELD16( m_nQualityNtile50th ) FIELD16( m_nQualityNtile25th ) FIELD16( m_nQualityNtile5th ) FIELD16( m_nQualityNtile2nd ) \
+	FIELD( m_nPingHistogram25 ) FIELD( m_nPingHistogram50 ) FIELD( m_nPingHistogram75 ) \
+	FIELD( m_nPingHistogram100 ) FIELD( m_nPingHistogram125 ) FIELD( m_nPingHistogram150 ) \
+	FIELD( m_nPingHistogram200 ) FIELD( m_nPingHistogram300 ) FIELD( m_nPingHistogramMax ) \
+	FIELD16( m_nPingNtile5th ) FIELD16( m_nPingNtile50th ) FIELD16( m_nPingNtile75th ) FIELD16( m_nPingNtile95th ) FIELD16( m_nPingNtile98th ) \
+	FIELD( m_nJitterHistogramNegligible ) FIELD( m_nJitterHistogram1 ) FIELD( m_nJitterHistogram2 ) \
+	FIELD( m_nJitterHistogram5 ) FIELD( m_nJitterHistogram10 ) FIELD( m_nJitterHistogram20 ) \
+	FIELD( m_nTXSpeedMax ) \
+	FIELD( m_nTXSpeedHistogram16 ) FIELD( m_nTXSpeedHistogram32 ) FIELD( m_nTXSpeedHistogram64 ) FIELD( m_nTXSpeedHistogram128 ) \
+	FIELD( m_nTXSpeedHistogram256 ) FIELD( m_nTXSpeedHistogram512 ) FIELD( m_nTXSpeedHistogram1024 ) FIELD( m_nTXSpeedHistogramMax ) \
+	FIELD( m_nTXSpeedNtile5th ) FIELD( m_nTXSpeedNtile50th ) FIELD( m_nTXSpeedNtile75th ) FIELD( m_nTXSpeedNtile95th ) FIELD( m_nTXSpeedNtile98th ) \
+	FIELD( m_nRXSpeedMax ) \
+	FIELD( m_nRXSpeedHistogram16 ) FIELD( m_nRXSpeedHistogram32 ) FIELD( m_nRXSpeedHistogram64 ) FIELD( m_nRXSpeedHistogram128 ) \
+	FIELD( m_nRXSpeedHistogram256 ) FIELD( m_nRXSpeedHistogram512 ) FIELD( m_nRXSpeedHistogram1024 ) FIELD( m_nRXSpeedHistogramMax ) \
+	FIELD( m_nRXSpeedNtile5th ) FIELD( m_nRXSpeedNtile50th ) FIELD( m_nRXSpeedNtile75th ) FIELD( m_nRXSpeedNtile95th ) FIELD( m_nRXSpeedNtile98th )
+
+uint8 *LinkStatsLifetimeStructToWire( const SteamDatagramLinkLifetimeStats &s, uint8 *p )
+{
+	uint8 *pStart = p;
+	PUT_WIRE_U64( s.m_nPacketsSent );
+	PUT_WIRE_U64( ( s.m_nBytesSent + 512 ) / 1024 );
+	PUT_WIRE_U64( s.m_nPacketsRecv );
+	PUT_WIRE_U64( ( s.m_nBytesRecv + 512 ) / 1024 );
+	PUT_WIRE_U64( s.m_nPktsRecvSequenced );
+	PUT_WIRE_U64( s.m_nPktsRecvDropped );
+	PUT_WIRE_U64( s.m_nPktsRecvOutOfOrder );
+	PUT_WIRE_U64( s.m_nPktsRecvDuplicate );
+	PUT_WIRE_U64( s.m_nPktsRecvSequenceNumberLurch );
+
+	#define PUT_FIELD( mbr ) PUT_WIRE_U32( s.mbr )
+	#define PUT_FIELD16( mbr ) PUT_WIRE_U16( s.mbr >= 0 ? Min( int( s.mbr ), 0xfffe ) : 0xffff )
+	LINKSTATS_LIFETIME_WIRE_INT_FIELDS( PUT_FIELD, PUT_FIELD16 )
+	#undef PUT_FIELD
+	#undef PUT_FIELD16
+
+	Assert( p == pStart + k_cbLinkStatsLifetimeWire ); (void)pStart;
+	return p;
+}
+
+const uint8 *LinkStatsLifetimeWireToStruct( const uint8 *p, SteamDatagramLinkLifetimeStats &s )
+{
+	memset( &s, 0, sizeof(s) );
+
+	GET_WIRE_U64( s.m_nPacketsSent );
+	GET_WIRE_U64( s.m_nBytesSent ); s.m_nBytesSent *= 1024;
+	GET_WIRE_U64( s.m_nPacketsRecv );
+	GET_WIRE_U64( s.m_nBytesRecv ); s.m_nBytesRecv *= 1024;
+	GET_WIRE_U64( s.m_nPktsRecvSequenced );
+	GET_WIRE_U64( s.m_nPktsRecvDropped );
+	GET_WIRE_U64( s.m_nPktsRecvOutOfOrder );
+	GET_WIRE_U64( s.m_nPktsRecvDuplicate );
+	GET_WIRE_U64( s.m_nPktsRecvSequenceNumberLurch );
+
+	#define GET_FIELD( mbr ) GET_WIRE_U32( s.mbr )
+	uint16 x16;
+	#define GET_FIELD16( mbr ) { GET_WIRE_U16( x16 ); s.mbr = ( x16 == 0xffff ) ? -1 : x16; }
+	LINKSTATS_LIFETIME_WIRE_INT_FIELDS( GET_FIELD, GET_FIELD16 )
+	#undef GET_FIELD
+	#undef GET_FIELD16
+
+	return p;
+}
+
+#undef LINKSTATS_LIFETIME_WIRE_INT_FIELDS
+#undef PUT_WIRE_U8
+#undef PUT_WIRE_U16
+#undef PUT_WIRE_U32
+#undef PUT_WIRE_U64
+#undef GET_WIRE_U8
+#undef GET_WIRE_U16
+#undef GET_WIRE_U32
+#undef GET_WIRE_U64
+
 static void PrintPct( char (&szBuf)[32], float flPct )
 {
 	flPct *= 100.0f;
@@ -1155,6 +1305,13 @@ void LinkStatsPrintLifetimeToBuf( const char *pszLeader, const SteamDatagramLink
 		buf.Printf( "%s    Duplicate :%11s pkts%7.2f%%\n", pszLeader, NumberPrettyPrinter( stats.m_nPktsRecvDuplicate ).String(), stats.m_nPktsRecvDuplicate * flToPct );
 		buf.Printf( "%s    SeqLurch  :%11s pkts%7.2f%%\n", pszLeader, NumberPrettyPrinter( stats.m_nPktsRecvSequenceNumberLurch ).String(), stats.m_nPktsRecvSequenceNumberLurch * flToPct );
 	}
+	if ( stats.m_nPktsRecvAckEliciting > 0 && stats.m_nPktsSentWithAck > 0 )
+	{
+		buf.Printf( "%sAcks\n", pszLeader );
+		buf.Printf( "%s    Recv data :%11s pkts\n", pszLeader, NumberPrettyPrinter( stats.m_nPktsRecvAckEliciting ).String() );
+		buf.Printf( "%s    Sent acks :%11s pkts (%.2f per data pkt)\n", pszLeader, NumberPrettyPrinter( stats.m_nPktsSentWithAck ).String(), (float)stats.m_nPktsSentWithAck / (float)stats.m_nPktsRecvAckEliciting );
+		buf.Printf( "%s    Ack only  :%11s pkts\n", pszLeader, NumberPrettyPrinter( stats.m_nPktsSentAckOnly ).String() );
+	}
 
 	// Do we have enough ping samples such that the distribution might be interesting
 	{
@@ -1476,6 +1633,46 @@ void SteamNetworkingDetailedConnectionStatus::Clear()
 	m_nBackupRouterBackPing = -1;
 }
 
+static void LockHistogramPrintToBuf( const char *pszLabel, const int64 *pHist, CUtlBuffer &buf )
+{
+	int64 nTotal = 0;
+	int nMaxBucket = 0;
+	for ( int i = 0 ; i < k_nSteamNetworkingMetricsHistogramBuckets ; ++i )
+	{
+		nTotal += pHist[i];
+		if ( pHist[i] > 0 )
+			nMaxBucket = i;
+	}
+
+	// Print the upper bound of the bucket
+	auto PrintBucket = [&buf]( const char *pszStat, int nBucket )
+	{
+		if ( nBucket >= k_nSteamNetworkingMetricsHistogramBuckets-1 )
+			buf.Printf( " %s>=%dus", pszStat, 1 << ( k_nSteamNetworkingMetricsHistogramBuckets-2 ) );
+		else
+			buf.Printf( " %s<%dus", pszStat, 1 << nBucket );
+	};
+
+	buf.Printf( "  %s", pszLabel );
+	static const int k_arPct[] = { 50, 99 };
+	for ( int nPct: k_arPct )
+	{
+		int64 nCumulative = 0;
+		int nBucket = 0;
+		while ( nBucket < nMaxBucket )
+		{
+			nCumulative += pHist[nBucket];
+			if ( nCumulative*100 >= nTotal*nPct )
+				break;
+			++nBucket;
+		}
+		char szStat[ 8 ];
+		V_sprintf_safe( szStat, "p%d", nPct );
+		PrintBucket( szStat, nBucket );
+	}
+	PrintBucket( "max", nMaxBucket );
+}
+
 int SteamNetworkingDetailedConnectionStatus::Print( char *pszBuf, int cbBuf )
 {
 	CUtlBuffer buf( 0, 8*1024, CUtlBuffer::TEXT_BUFFER );
@@ -1568,6 +1765,25 @@ int SteamNetworkingDetailedConnectionStatus::Print( char *pszBuf, int cbBuf )
 		buf.Printf( "Communicating via relay in '%s'\n", szRelayPOP );
 	}
 
+	// Global lock contention, by caller
+	static const char *const k_arLockCallerNames[ k_ESteamNetworkingLockCaller__Count ] = { "other", "send", "receive", "callbacks", "service thread" };
+	bool bPrintedLockHeader = false;
+	for ( int i = 0 ; i < k_ESteamNetworkingLockCaller__Count ; ++i )
+	{
+		const SteamNetworkingLockMetrics_t &lock = m_lock[i];
+		if ( lock.m_nAcquired <= 0 )
+			continue;
+		if ( !bPrintedLockHeader )
+		{
+			buf.Printf( "Global lock (all connections):\n" );
+			bPrintedLockHeader = true;
+		}
+		buf.Printf( "    %-14s %10lld acquired", k_arLockCallerNames[i], (long long)lock.m_nAcquired );
+		LockHistogramPrintToBuf( "wait", lock.m_histWaitUsec, buf );
+		LockHistogramPrintToBuf( "hold", lock.m_histHoldUsec, buf );
+		buf.Printf( "\n" );
+	}
+
 	int sz = buf.TellPut()+1;
 	if ( pszBuf && cbBuf > 0 )
 	{
@@ -0,0 +1,191 @@
+//====== Copyright Valve Corporation, All rights reserved. ====================
+//
+// Hot path profiler.  See tier0/vprof.h
+//
+//=============================================================================
+
+#include <tier0/platform.h>
+#include <tier0/vprof.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#ifdef VPROF_ENABLED
+
+thread_local CVProfScope *CVProfScope::s_pCurrent = nullptr;
+
+static std::atomic<CVProfNode *> s_pFirstNode( nullptr );
+static std::atomic<CVProfCounter *> s_pFirstCounter( nullptr );
+
+// When the current measurement period began, in both tick
+// and wall clock units, so we can convert ticks to time
+static std::atomic<uint64> s_nTicksReset( VProf_Ticks() );
+static std::atomic<uint64> s_usecReset( Plat_USTime() );
+
+template <typename T>
+static void LinkIntoList( std::atomic<T *> &head, T *pItem )
+{
+	T *pFirst = head.load( std::memory_order_relaxed );
+	do
+	{
+		pItem->m_pNext = pFirst;
+	} while ( !head.compare_exchange_weak( pFirst, pItem, std::memory_order_release, std::memory_order_relaxed ) );
+}
+
+CVProfNode::CVProfNode( const char *pszName, const char *pszGroup )
+: m_pszName( pszName )
+, m_pszGroup( pszGroup )
+, m_nCalls( 0 )
+, m_nTicksInclusive( 0 )
+, m_nTicksExclusive( 0 )
+, m_nTicksMax( 0 )
+, m_pNext( nullptr )
+{
+	LinkIntoList( s_pFirstNode, this );
+}
+
+CVProfCounter::CVProfCounter( const char *pszName, const char *pszGroup )
+: m_pszName( pszName )
+, m_pszGroup( pszGroup )
+, m_nValue( 0 )
+, m_pNext( nullptr )
+{
+	LinkIntoList( s_pFirstCounter, this );
+}
+
+static void AppendF( std::string &s, const char *pszFmt, ... ) FMTFUNCTION( 2, 3 );
+static void AppendF( std::string &s, const char *pszFmt, ... )
+{
+	char buf[ 512 ];
+	va_list ap;
+	va_start( ap, pszFmt );
+	vsnprintf( buf, sizeof(buf), pszFmt, ap );
+	va_end( ap );
+	s += buf;
+}
+
+static std::string VProf_FormatReport()
+{
+	uint64 nTicksNow = VProf_Ticks();
+	uint64 usecNow = Plat_USTime();
+	uint64 usecElapsed = usecNow - s_usecReset.load( std::memory_order_relaxed );
+	uint64 nTicksElapsed = nTicksNow - s_nTicksReset.load( std::memory_order_relaxed );
+	double flUsecPerTick = ( usecElapsed > 0 && nTicksElapsed > 0 ) ? (double)usecElapsed / (double)nTicksElapsed : 0.0;
+
+	// Snapshot the nodes.  We don't stop anybody from updating them while we
+	// do this, so the numbers might be very slightly inconsistent.
+	struct NodeSnapshot
+	{
+		const CVProfNode *m_pNode;
+		uint64 m_nCalls, m_nTicksInclusive, m_nTicksExclusive, m_nTicksMax;
+	};
+	std::vector<NodeSnapshot> vecNodes;
+	for ( const CVProfNode *p = s_pFirstNode.load( std::memory_order_acquire ) ; p ; p = p->m_pNext )
+	{
+		NodeSnapshot snap;
+		snap.m_pNode = p;
+		snap.m_nCalls = p->m_nCalls.load( std::memory_order_relaxed );
+		snap.m_nTicksInclusive = p->m_nTicksInclusive.load( std::memory_order_relaxed );
+		snap.m_nTicksExclusive = p->m_nTicksExclusive.load( std::memory_order_relaxed );
+		snap.m_nTicksMax = p->m_nTicksMax.load( std::memory_order_relaxed );
+		if ( snap.m_nCalls > 0 )
+			vecNodes.push_back( snap );
+	}
+	std::sort( vecNodes.begin(), vecNodes.end(), []( const NodeSnapshot &a, const NodeSnapshot &b ) { return a.m_nTicksExclusive > b.m_nTicksExclusive; } );
+
+	std::string s;
+	AppendF( s, "VPROF: %.3fs elapsed\n", usecElapsed * 1e-6 );
+	AppendF( s, "  %10s %10s %10s %9s %9s  %-12s %s\n", "calls", "incl ms", "excl ms", "avg us", "max us", "group", "scope" );
+	for ( const NodeSnapshot &n: vecNodes )
+	{
+		AppendF( s, "  %10llu %10.3f %10.3f %9.2f %9.1f  %-12s %s\n",
+			(unsigned long long)n.m_nCalls,
+			n.m_nTicksInclusive * flUsecPerTick * 1e-3,
+			n.m_nTicksExclusive * flUsecPerTick * 1e-3,
+			n.m_nTicksInclusive * flUsecPerTick / n.m_nCalls,
+			n.m_nTicksMax * flUsecPerTick,
+			n.m_pNode->m_pszGroup, n.m_pNode->m_pszName );
+	}
+
+	// Group totals.  Use exclusive time, so nested scopes aren't double counted
+	std::vector< std::pair< const char *, uint64 > > vecGroups;
+	for ( const NodeSnapshot &n: vecNodes )
+	{
+		auto it = std::find_if( vecGroups.begin(), vecGroups.end(), [&n]( const std::pair< const char *, uint64 > &g ) { return strcmp( g.first, n.m_pNode->m_pszGroup ) == 0; } );
+		if ( it == vecGroups.end() )
+			vecGroups.push_back( std::make_pair( n.m_pNode->m_pszGroup, n.m_nTicksExclusive ) );
+		else
+			it->second += n.m_nTicksExclusive;
+	}
+	if ( !vecGroups.empty() )
+	{
+		AppendF( s, "Budget groups:\n" );
+		for ( const auto &g: vecGroups )
+		{
+			double flMS = g.second * flUsecPerTick * 1e-3;
+			AppendF( s, "  %-12s %10.3f ms %6.2f%%\n", g.first, flMS, usecElapsed > 0 ? flMS * 1e5 / usecElapsed : 0.0 );
+		}
+	}
+
+	bool bPrintedHeader = false;
+	for ( const CVProfCounter *p = s_pFirstCounter.load( std::memory_order_acquire ) ; p ; p = p->m_pNext )
+	{
+		int64 nValue = p->m_nValue.load( std::memory_order_relaxed );
+		if ( nValue == 0 )
+			continue;
+		if ( !bPrintedHeader )
+		{
+			AppendF( s, "Counters:\n" );
+			bPrintedHeader = true;
+		}
+		AppendF( s, "  %-12s %-40s %lld\n", p->m_pszGroup, p->m_pszName, (long long)nValue );
+	}
+
+	return s;
+}
+
+void VProf_Reset()
+{
+	for ( CVProfNode *p = s_pFirstNode.load( std::memory_order_acquire ) ; p ; p = p->m_pNext )
+	{
+		p->m_nCalls.store( 0, std::memory_order_relaxed );
+		p->m_nTicksInclusive.store( 0, std::memory_order_relaxed );
+		p->m_nTicksExclusive.store( 0, std::memory_order_relaxed );
+		p->m_nTicksMax.store( 0, std::memory_order_relaxed );
+	}
+	for ( CVProfCounter *p = s_pFirstCounter.load( std::memory_order_acquire ) ; p ; p = p->m_pNext )
+		p->m_nValue.store( 0, std::memory_order_relaxed );
+	s_nTicksReset.store( VProf_Ticks(), std::memory_order_relaxed );
+	s_usecReset.store( Plat_USTime(), std::memory_order_relaxed );
+}
+
+#else
+
+static std::string VProf_FormatReport()
+{
+	return "VPROF not enabled in this build.  (Build with ENABLE_VPROF.)\n";
+}
+
+void VProf_Reset()
+{
+}
+
+#endif // #ifdef VPROF_ENABLED
+
+int VProf_GetReport( char *pszOut, int cbOut )
+{
+	std::string s = VProf_FormatReport();
+	int cbNeeded = (int)s.length() + 1;
+	if ( pszOut && cbOut > 0 )
+	{
+		int cbCopy = std::min( cbNeeded, cbOut );
+		memcpy( pszOut, s.c_str(), cbCopy-1 );
+		pszOut[ cbCopy-1 ] = '\0';
+		if ( cbCopy == cbNeeded )
+			return 0;
+	}
+	return cbNeeded;
+}
@@ -0,0 +1,540 @@
+// Throughput and latency benchmark for SNP.
+//
+// Pushes messages through a connection as fast as it will accept them, for each
+// combination of transport, traffic type, and message size, and reports the
+// results as JSON.
+//
+// With -bottleneck, instead runs each congestion control algorithm over a
+// simulated bottleneck link on the in-process virtual network, and reports
+// goodput versus the queueing delay it induces.  Usage:
+//
+//   bench_snp [-seconds N] [-transport pipe|loopback|udp] [-bottleneck] [-o file]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include <steam/steamnetworkingsockets.h>
+#include <steam/isteamnetworkingutils.h>
+
+#define PORT_SERVER			27201	// First port to use for the UDP benchmarks.  Each run uses the next one
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Allocation counting.  The message path allocates through the hooks
+// installed with SteamNetworkingSockets_SetAllocator, not operator new, so
+// that's where we count.  A realloc might have to move the block, so it
+// counts too.
+//
+/////////////////////////////////////////////////////////////////////////////
+
+static std::atomic<long long> g_nAllocs( 0 );
+
+static void *BenchAlloc( size_t cb, ESteamNetworkingAllocTag eTag )
+{
+	++g_nAllocs;
+	void *p = malloc( cb );
+	if ( !p )
+		abort();
+	return p;
+}
+
+static void *BenchRealloc( void *p, size_t cb, ESteamNetworkingAllocTag eTag )
+{
+	++g_nAllocs;
+	p = realloc( p, cb );
+	if ( !p )
+		abort();
+	return p;
+}
+
+static void BenchFree( void *p, ESteamNetworkingAllocTag eTag )
+{
+	free( p );
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Setup
+//
+/////////////////////////////////////////////////////////////////////////////
+
+static SteamNetworkingMicroseconds g_usecBenchDuration = 1000000;
+static const char *g_pszOnlyTransport = nullptr;
+static bool g_bVirtualNetwork = false;
+
+/// Give the library a chance to do some work.  On the virtual network,
+/// nothing happens unless we make time pass.
+static void WaitABit()
+{
+	if ( g_bVirtualNetwork )
+		SteamNetworkingSockets_VirtualNetwork_RunFor( 1000 );
+	else
+		std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+}
+
+struct BenchCallbacks : public ISteamNetworkingSocketsCallbacks
+{
+	HSteamListenSocket m_hListenSock = k_HSteamListenSocket_Invalid;
+	HSteamNetConnection m_hAccepted = k_HSteamNetConnection_Invalid;
+
+	virtual void OnSteamNetConnectionStatusChanged( SteamNetConnectionStatusChangedCallback_t *pInfo ) override
+	{
+		if ( pInfo->m_info.m_eState == k_ESteamNetworkingConnectionState_Connecting && pInfo->m_info.m_hListenSocket == m_hListenSock )
+		{
+			SteamNetworkingSockets()->AcceptConnection( pInfo->m_hConn );
+			m_hAccepted = pInfo->m_hConn;
+		}
+	}
+};
+static BenchCallbacks g_callbacks;
+
+static void DebugOutput( int eType, const char *pszMsg )
+{
+	if ( eType <= k_ESteamNetworkingSocketsDebugOutputType_Error )
+		fprintf( stderr, "%s\n", pszMsg );
+}
+
+static bool BWaitConnected( HSteamNetConnection hConn )
+{
+	for ( int i = 0 ; i < 5000 ; ++i )
+	{
+		SteamNetworkingSockets()->RunCallbacks( &g_callbacks );
+		SteamNetworkingQuickConnectionStatus status;
+		if ( !SteamNetworkingSockets()->GetQuickConnectionStatus( hConn, &status ) )
+			return false;
+		if ( status.m_eState == k_ESteamNetworkingConnectionState_Connected )
+			return true;
+		WaitABit();
+	}
+	return false;
+}
+
+/// Create a connected pair using the given transport.  hSend is the
+/// side that will send the messages.
+static bool CreatePair( const char *pszTransport, HSteamNetConnection *phSend, HSteamNetConnection *phRecv )
+{
+	ISteamNetworkingSockets *pSockets = SteamNetworkingSockets();
+	*phSend = *phRecv = k_HSteamNetConnection_Invalid;
+	if ( !strcmp( pszTransport, "pipe" ) || !strcmp( pszTransport, "loopback" ) )
+	{
+		if ( !pSockets->CreateSocketPair( phSend, phRecv, !strcmp( pszTransport, "loopback" ), nullptr, nullptr ) )
+			return false;
+	}
+	else
+	{
+		// Closing a listen socket doesn't immediately free the port, so use a new one each time
+		static int s_nPort = PORT_SERVER;
+		SteamNetworkingIPAddr addr;
+		addr.SetIPv4( 0x7f000001, (uint16)s_nPort++ );
+		g_callbacks.m_hListenSock = pSockets->CreateListenSocketIP( addr );
+		g_callbacks.m_hAccepted = k_HSteamNetConnection_Invalid;
+		*phSend = pSockets->ConnectByIPAddress( addr );
+		for ( int i = 0 ; i < 5000 && g_callbacks.m_hAccepted == k_HSteamNetConnection_Invalid ; ++i )
+		{
+			pSockets->RunCallbacks( &g_callbacks );
+			WaitABit();
+		}
+		*phRecv = g_callbacks.m_hAccepted;
+		if ( *phRecv == k_HSteamNetConnection_Invalid )
+			return false;
+	}
+	return BWaitConnected( *phSend ) && BWaitConnected( *phRecv );
+}
+
+static void DestroyPair( HSteamNetConnection hSend, HSteamNetConnection hRecv )
+{
+	ISteamNetworkingSockets *pSockets = SteamNetworkingSockets();
+	pSockets->CloseConnection( hSend, 0, nullptr, false );
+	pSockets->CloseConnection( hRecv, 0, nullptr, false );
+	if ( g_callbacks.m_hListenSock != k_HSteamListenSocket_Invalid )
+	{
+		pSockets->CloseListenSocket( g_callbacks.m_hListenSock );
+		g_callbacks.m_hListenSock = k_HSteamListenSocket_Invalid;
+	}
+	pSockets->RunCallbacks( &g_callbacks );
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// The actual benchmark
+//
+/////////////////////////////////////////////////////////////////////////////
+
+struct BenchResult
+{
+	const char *m_pszTransport;
+	const char *m_pszTraffic;
+	int m_cbMsg;
+	double m_flSeconds;
+	long long m_nMsgs;
+	long long m_nBytes;
+	double m_flMsgsPerSec;
+	double m_flBytesPerSec;
+	int m_usecLatencyP50;
+	int m_usecLatencyP99;
+	double m_flCPUSecPerMB;
+	double m_flAllocsPerMsg;
+};
+
+/// Header that we put at the start of every message, so the
+/// receiver can tell how long it took to arrive
+struct MsgHeader
+{
+	SteamNetworkingMicroseconds m_usecSent;
+};
+
+static bool RunBench( const char *pszTransport, const char *pszTraffic, int cbMsg, BenchResult &result )
+{
+	ISteamNetworkingSockets *pSockets = SteamNetworkingSockets();
+	HSteamNetConnection hSend, hRecv;
+	if ( !CreatePair( pszTransport, &hSend, &hRecv ) )
+	{
+		fprintf( stderr, "Failed to create %s connection\n", pszTransport );
+		return false;
+	}
+
+	// Latency samples.  Reserve space up front so we don't count our own allocations.
+	const size_t k_nMaxSamples = 1<<20;
+	std::vector<int> vecLatency;
+	vecLatency.reserve( k_nMaxSamples );
+
+	std::vector<char> msg( std::max( cbMsg, (int)sizeof(MsgHeader) ), 'x' );
+	const int k_nMaxRecvBatch = 256;
+	SteamNetworkingMessage_t *arRecv[ k_nMaxRecvBatch ];
+
+	const int k_cbMaxPending = 64*1024;
+	long long nMsgs = 0;
+	long long nBytes = 0;
+	int nSent = 0;
+	clock_t cpuStart = clock();
+	long long nAllocsStart = g_nAllocs;
+	SteamNetworkingMicroseconds usecStart = SteamNetworkingUtils()->GetLocalTimestamp();
+	SteamNetworkingMicroseconds usecEnd = usecStart + g_usecBenchDuration;
+	SteamNetworkingMicroseconds usecNow = usecStart;
+	while ( usecNow < usecEnd )
+	{
+		// Send until the connection won't take any more.  Don't let the queue
+		// get too deep, or we'll just be measuring how long messages sit in it.
+		SteamNetworkingQuickConnectionStatus status;
+		pSockets->GetQuickConnectionStatus( hSend, &status );
+		bool bBlocked = ( status.m_cbPendingReliable + status.m_cbPendingUnreliable >= k_cbMaxPending );
+		for ( int i = 0 ; i < 64 && !bBlocked ; ++i )
+		{
+			ESteamNetworkingSendType eSendType;
+			if ( !strcmp( pszTraffic, "reliable" ) )
+				eSendType = k_ESteamNetworkingSendType_Reliable;
+			else if ( !strcmp( pszTraffic, "unreliable" ) )
+				eSendType = k_ESteamNetworkingSendType_Unreliable;
+			else
+				eSendType = ( nSent & 1 ) ? k_ESteamNetworkingSendType_Reliable : k_ESteamNetworkingSendType_Unreliable;
+
+			MsgHeader hdr;
+			hdr.m_usecSent = SteamNetworkingUtils()->GetLocalTimestamp();
+			memcpy( msg.data(), &hdr, sizeof(hdr) );
+			if ( pSockets->SendMessageToConnection( hSend, msg.data(), cbMsg, eSendType ) != k_EResultOK )
+			{
+				bBlocked = true;
+				break;
+			}
+			++nSent;
+		}
+
+		// Drain the receive side
+		bool bGotAny = false;
+		for (;;)
+		{
+			int n = pSockets->ReceiveMessagesOnConnection( hRecv, arRecv, k_nMaxRecvBatch );
+			if ( n <= 0 )
+				break;
+			bGotAny = true;
+			usecNow = SteamNetworkingUtils()->GetLocalTimestamp();
+			for ( int i = 0 ; i < n ; ++i )
+			{
+				MsgHeader hdr;
+				memcpy( &hdr, arRecv[i]->GetData(), sizeof(hdr) );
+				if ( vecLatency.size() < k_nMaxSamples )
+					vecLatency.push_back( int( usecNow - hdr.m_usecSent ) );
+				++nMsgs;
+				nBytes += arRecv[i]->GetSize();
+				arRecv[i]->Release();
+			}
+		}
+
+		// If we are just waiting on the service thread, give it some time
+		if ( bBlocked && !bGotAny )
+			std::this_thread::sleep_for( std::chrono::microseconds( 100 ) );
+		usecNow = SteamNetworkingUtils()->GetLocalTimestamp();
+	}
+	double flSeconds = ( usecNow - usecStart ) * 1e-6;
+	double flCPUSeconds = double( clock() - cpuStart ) / CLOCKS_PER_SEC;
+	long long nAllocs = g_nAllocs - nAllocsStart;
+
+	DestroyPair( hSend, hRecv );
+
+	std::sort( vecLatency.begin(), vecLatency.end() );
+	result.m_pszTransport = pszTransport;
+	result.m_pszTraffic = pszTraffic;
+	result.m_cbMsg = cbMsg;
+	result.m_flSeconds = flSeconds;
+	result.m_nMsgs = nMsgs;
+	result.m_nBytes = nBytes;
+	result.m_flMsgsPerSec = nMsgs / flSeconds;
+	result.m_flBytesPerSec = nBytes / flSeconds;
+	result.m_usecLatencyP50 = vecLatency.empty() ? -1 : vecLatency[ vecLatency.size()/2 ];
+	result.m_usecLatencyP99 = vecLatency.empty() ? -1 : vecLatency[ vecLatency.size()*99/100 ];
+	result.m_flCPUSecPerMB = nBytes > 0 ? flCPUSeconds / ( nBytes / ( 1024.0*1024.0 ) ) : 0.0;
+	result.m_flAllocsPerMsg = nMsgs > 0 ? double( nAllocs ) / nMsgs : 0.0;
+
+	fprintf( stderr, "%-8s %-10s %6d bytes: %10.0f msg/sec %12.0f bytes/sec  p50 %6dus  p99 %6dus  %.3f cpu sec/MB  %.2f allocs/msg\n",
+		pszTransport, pszTraffic, cbMsg, result.m_flMsgsPerSec, result.m_flBytesPerSec,
+		result.m_usecLatencyP50, result.m_usecLatencyP99, result.m_flCPUSecPerMB, result.m_flAllocsPerMsg );
+	return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Congestion control over a simulated bottleneck
+//
+/////////////////////////////////////////////////////////////////////////////
+
+static const SteamNetworkingMicroseconds k_usecBottleneckLatency = 20000; // One way
+static const SteamNetworkingMicroseconds k_usecBottleneckWarmup = 2000000; // Don't measure slow start
+
+struct BottleneckResult
+{
+	const char *m_pszCongestionControl;
+	int m_nBottleneckRate;
+	double m_flGoodput;
+	double m_flUtilization;
+	int m_usecQueueDelayP50;
+	int m_usecQueueDelayP99;
+};
+
+static bool RunBottleneckBench( const char *pszCongestionControl, int eCongestionControl, int nBottleneckRate, BottleneckResult &result )
+{
+	ISteamNetworkingSockets *pSockets = SteamNetworkingSockets();
+	pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_FakePacketBandwidth_Send, nBottleneckRate );
+	pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_FakeNetwork_Seed, 1 );
+
+	HSteamNetConnection hSend, hRecv;
+	if ( !CreatePair( "udp", &hSend, &hRecv ) )
+	{
+		fprintf( stderr, "Failed to create connection on virtual network\n" );
+		return false;
+	}
+	pSockets->SetConnectionConfigurationValue( hSend, k_ESteamNetworkingConnectionConfigurationValue_CongestionControl, eCongestionControl );
+
+	// Always have plenty queued, so that the rate is set by congestion
+	// control and not by us.  The queueing delay we measure is the RTT
+	// above the propagation delay.  (Which is not affected by how much
+	// we have queued on the sender.)
+	std::vector<char> msg( 1200, 'x' );
+	const int k_cbQueue = 256*1024;
+	std::vector<int> vecQueueDelay;
+	SteamNetworkingMessage_t *arRecv[ 256 ];
+	long long nBytes = 0;
+	SteamNetworkingMicroseconds usecStart = SteamNetworkingUtils()->GetLocalTimestamp();
+	SteamNetworkingMicroseconds usecMeasureStart = usecStart + k_usecBottleneckWarmup;
+	SteamNetworkingMicroseconds usecEnd = usecMeasureStart + g_usecBenchDuration;
+	for (;;)
+	{
+		SteamNetworkingMicroseconds usecNow = SteamNetworkingUtils()->GetLocalTimestamp();
+		if ( usecNow >= usecEnd )
+			break;
+
+		SteamNetworkingQuickConnectionStatus status;
+		pSockets->GetQuickConnectionStatus( hSend, &status );
+		while ( status.m_cbPendingReliable < k_cbQueue )
+		{
+			pSockets->SendMessageToConnection( hSend, msg.data(), (uint32)msg.size(), k_ESteamNetworkingSendType_Reliable );
+			status.m_cbPendingReliable += (int)msg.size();
+		}
+		if ( usecNow >= usecMeasureStart && status.m_nPing >= 0 )
+			vecQueueDelay.push_back( std::max( 0, status.m_nPing*1000 - int( 2*k_usecBottleneckLatency ) ) );
+
+		for (;;)
+		{
+			int n = pSockets->ReceiveMessagesOnConnection( hRecv, arRecv, 256 );
+			if ( n <= 0 )
+				break;
+			for ( int i = 0 ; i < n ; ++i )
+			{
+				if ( usecNow >= usecMeasureStart )
+					nBytes += arRecv[i]->GetSize();
+				arRecv[i]->Release();
+			}
+		}
+
+		SteamNetworkingSockets_VirtualNetwork_RunFor( 1000 );
+	}
+
+	DestroyPair( hSend, hRecv );
+	pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_FakePacketBandwidth_Send, 0 );
+
+	std::sort( vecQueueDelay.begin(), vecQueueDelay.end() );
+	result.m_pszCongestionControl = pszCongestionControl;
+	result.m_nBottleneckRate = nBottleneckRate;
+	result.m_flGoodput = nBytes / ( g_usecBenchDuration*1e-6 );
+	result.m_flUtilization = result.m_flGoodput / nBottleneckRate;
+	result.m_usecQueueDelayP50 = vecQueueDelay.empty() ? -1 : vecQueueDelay[ vecQueueDelay.size()/2 ];
+	result.m_usecQueueDelayP99 = vecQueueDelay.empty() ? -1 : vecQueueDelay[ vecQueueDelay.size()*99/100 ];
+
+	fprintf( stderr, "%-6s bottleneck %8d bytes/sec: goodput %10.0f bytes/sec (%5.1f%%)  queue delay p50 %7dus  p99 %7dus\n",
+		pszCongestionControl, nBottleneckRate, result.m_flGoodput, result.m_flUtilization*100.0,
+		result.m_usecQueueDelayP50, result.m_usecQueueDelayP99 );
+	return true;
+}
+
+static void WriteJSON( FILE *f, const std::vector<BenchResult> &vecResults, const std::vector<BottleneckResult> &vecBottleneckResults )
+{
+	fprintf( f, "{\n\t\"benchmark\": \"bench_snp\",\n\t\"duration_sec\": %.3f,\n", g_usecBenchDuration*1e-6 );
+	if ( !vecBottleneckResults.empty() )
+	{
+		fprintf( f, "\t\"bottleneck_latency_usec\": %d,\n\t\"bottleneck_results\": [\n", (int)k_usecBottleneckLatency );
+		for ( size_t i = 0 ; i < vecBottleneckResults.size() ; ++i )
+		{
+			const BottleneckResult &r = vecBottleneckResults[i];
+			fprintf( f,
+				"\t\t{ \"congestion_control\": \"%s\", \"bottleneck_bytes_per_sec\": %d, \"goodput_bytes_per_sec\": %.1f, "
+				"\"utilization\": %.4f, \"queue_delay_usec_p50\": %d, \"queue_delay_usec_p99\": %d }%s\n",
+				r.m_pszCongestionControl, r.m_nBottleneckRate, r.m_flGoodput,
+				r.m_flUtilization, r.m_usecQueueDelayP50, r.m_usecQueueDelayP99,
+				( i+1 < vecBottleneckResults.size() ) ? "," : "" );
+		}
+		fprintf( f, "\t]\n}\n" );
+		return;
+	}
+	fprintf( f, "\t\"results\": [\n" );
+	for ( size_t i = 0 ; i < vecResults.size() ; ++i )
+	{
+		const BenchResult &r = vecResults[i];
+		fprintf( f,
+			"\t\t{ \"transport\": \"%s\", \"traffic\": \"%s\", \"msg_size\": %d, \"seconds\": %.3f, "
+			"\"msgs\": %lld, \"bytes\": %lld, \"msgs_per_sec\": %.1f, \"bytes_per_sec\": %.1f, "
+			"\"latency_usec_p50\": %d, \"latency_usec_p99\": %d, \"cpu_sec_per_mb\": %.5f, \"allocs_per_msg\": %.3f }%s\n",
+			r.m_pszTransport, r.m_pszTraffic, r.m_cbMsg, r.m_flSeconds,
+			r.m_nMsgs, r.m_nBytes, r.m_flMsgsPerSec, r.m_flBytesPerSec,
+			r.m_usecLatencyP50, r.m_usecLatencyP99, r.m_flCPUSecPerMB, r.m_flAllocsPerMsg,
+			( i+1 < vecResults.size() ) ? "," : "" );
+	}
+	fprintf( f, "\t]\n}\n" );
+}
+
+int main( int argc, char **argv )
+{
+	const char *pszOutput = nullptr;
+	bool bSecondsSpecified = false;
+	for ( int i = 1 ; i < argc ; ++i )
+	{
+		if ( !strcmp( argv[i], "-seconds" ) && i+1 < argc )
+		{
+			g_usecBenchDuration = (SteamNetworkingMicroseconds)( atof( argv[++i] ) * 1e6 );
+			bSecondsSpecified = true;
+		}
+		else if ( !strcmp( argv[i], "-transport" ) && i+1 < argc )
+			g_pszOnlyTransport = argv[++i];
+		else if ( !strcmp( argv[i], "-bottleneck" ) )
+			g_bVirtualNetwork = true;
+		else if ( !strcmp( argv[i], "-o" ) && i+1 < argc )
+			pszOutput = argv[++i];
+		else
+		{
+			fprintf( stderr, "Usage: %s [-seconds N] [-transport pipe|loopback|udp] [-bottleneck] [-o file]\n", argv[0] );
+			return 1;
+		}
+	}
+
+	// Simulated time is cheap, so run the bottleneck tests for longer by default
+	if ( g_bVirtualNetwork )
+	{
+		if ( !bSecondsSpecified )
+			g_usecBenchDuration = 20*1000000;
+		SteamNetworkingSockets_VirtualNetwork_Enable( k_usecBottleneckLatency );
+	}
+
+	SteamNetworkingSockets_SetDebugOutputFunction( k_ESteamNetworkingSocketsDebugOutputType_Error, DebugOutput );
+	SteamNetworkingSockets_SetAllocator( BenchAlloc, BenchRealloc, BenchFree );
+	SteamNetworkingErrMsg errMsg;
+	if ( !GameNetworkingSockets_Init( nullptr, errMsg ) )
+	{
+		fprintf( stderr, "GameNetworkingSockets_Init failed.  %s\n", errMsg );
+		return 1;
+	}
+
+	// Run at the max rate the library allows
+	ISteamNetworkingSockets *pSockets = SteamNetworkingSockets();
+	pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_IP_Allow_Without_Auth, 1 );
+	pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_MinRate, 4000000 );
+	pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_MaxRate, 4000000 );
+	pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_SendBufferSize, 4*1024*1024 );
+
+	static const char *k_arTransports[] = { "pipe", "loopback", "udp" };
+	static const char *k_arTraffic[] = { "reliable", "unreliable", "mixed" };
+	static const int k_arMsgSizes[] = { 32, 256, 1200, 8192 };
+
+	std::vector<BenchResult> vecResults;
+	std::vector<BottleneckResult> vecBottleneckResults;
+	if ( g_bVirtualNetwork )
+	{
+		struct CongestionControl_t { const char *m_pszName; int m_eType; };
+		static const CongestionControl_t k_arCongestionControl[] = {
+			{ "fixed", k_ESteamNetworkingCongestionControl_Fixed },
+			{ "tfrc", k_ESteamNetworkingCongestionControl_TFRC },
+			{ "bbr", k_ESteamNetworkingCongestionControl_BBR },
+		};
+		static const int k_arBottleneckRates[] = { 250000, 1000000, 3000000 };
+
+		// Let congestion control go wherever it wants
+		pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_MinRate, 0 );
+		pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_MaxRate, 4000000 );
+		for ( const CongestionControl_t &cc: k_arCongestionControl )
+		{
+			for ( int nRate: k_arBottleneckRates )
+			{
+				BottleneckResult result;
+				if ( RunBottleneckBench( cc.m_pszName, cc.m_eType, nRate, result ) )
+					vecBottleneckResults.push_back( result );
+			}
+		}
+	}
+	for ( const char *pszTransport: k_arTransports )
+	{
+		if ( g_bVirtualNetwork )
+			break;
+		if ( g_pszOnlyTransport && strcmp( g_pszOnlyTransport, pszTransport ) )
+			continue;
+		for ( const char *pszTraffic: k_arTraffic )
+		{
+			for ( int cbMsg: k_arMsgSizes )
+			{
+				BenchResult result;
+				if ( RunBench( pszTransport, pszTraffic, cbMsg, result ) )
+					vecResults.push_back( result );
+			}
+		}
+	}
+
+	GameNetworkingSockets_Kill();
+
+	FILE *f = stdout;
+	if ( pszOutput )
+	{
+		f = fopen( pszOutput, "wt" );
+		if ( !f )
+		{
+			fprintf( stderr, "Can't open %s\n", pszOutput );
+			return 1;
+		}
+	}
+	WriteJSON( f, vecResults, vecBottleneckResults );
+	if ( f != stdout )
+		fclose( f );
+	return 0;
+}
@@ -6,6 +6,7 @@
 #include <random>
 #include <chrono>
 #include <thread>
+#include <atomic>
 
 #include <steam/steamnetworkingsockets.h>
 #include <steam/isteamnetworkingutils.h>
@@ -15,6 +16,10 @@
 
 #define PORT_SERVER			27200	// Default server port, UDP/TCP
 
+// Budget for allocations per message sent or received, in the steady state.
+// Currently this is about 3-5 with no loss, and up to 9 with 20% loss.
+static const float k_flMaxAllocationsPerMessage = 12.0f;
+
 static std::default_random_engine g_rand;
 static SteamNetworkingMicroseconds g_usecTestElapsed;
 
@@ -62,8 +67,42 @@ static void Printf( const char *fmt, ... )
 	DebugOutput( k_ESteamNetworkingSocketsDebugOutputType_Msg, text );
 }
 
+// Allocator hooks that count allocations by tag, so we can check that the
+// number of allocations per message doesn't creep up
+static std::atomic<int64> g_nAllocations[ k_ESteamNetworkingAllocTag__Count ];
+
+static void *CountingAlloc( size_t cb, ESteamNetworkingAllocTag eTag )
+{
+	++g_nAllocations[ eTag ];
+	return malloc( cb );
+}
+
+static void *CountingRealloc( void *p, size_t cb, ESteamNetworkingAllocTag eTag )
+{
+	return realloc( p, cb );
+}
+
+static void CountingFree( void *p, ESteamNetworkingAllocTag eTag )
+{
+	free( p );
+}
+
+static int64 GetTotalAllocations()
+{
+	int64 nTotal = 0;
+	for ( const std::atomic<int64> &n: g_nAllocations )
+		nTotal += n;
+	return nTotal;
+}
+
 static void InitSteamDatagramConnectionSockets()
 {
+	if ( !SteamNetworkingSockets_SetAllocator( CountingAlloc, CountingRealloc, CountingFree ) )
+	{
+		fprintf( stderr, "SteamNetworkingSockets_SetAllocator failed" );
+		exit(1);
+	}
+
 	#ifdef STEAMNETWORKINGSOCKETS_OPENSOURCE
 		SteamDatagramErrMsg errMsg;
 		if ( !GameNetworkingSockets_Init( nullptr, errMsg ) )
@@ -121,6 +160,7 @@ struct SFakePeer
 	std::string m_sName;
 	int64 m_nReliableSendMsgCount = 0;
 	int64 m_nSendMsgCount = 0;
+	int64 m_nRecvMsgCount = 0;
 	int64 m_nReliableExpectedRecvMsg = 1;
 	int64 m_nExpectedRecvMsg = 1;
 	float m_flReliableMsgDelay = 0.0f;
@@ -228,6 +268,29 @@ struct SFakePeer
 static SFakePeer g_peerServer( "Server" );
 static SFakePeer g_peerClient( "Client" );
 
+// Total messages sent and received by both peers
+static int64 GetTotalMessages()
+{
+	int64 nTotal = 0;
+	for ( const SFakePeer *pPeer: { &g_peerServer, &g_peerClient } )
+		nTotal += pPeer->m_nReliableSendMsgCount + pPeer->m_nSendMsgCount + pPeer->m_nRecvMsgCount;
+	return nTotal;
+}
+
+// Make sure the allocations per message sent or received, since the given
+// starting point, are within budget.  Each message needs a copy in the send
+// queue and an object and buffer on the receive side.  The bookkeeping for
+// packets in flight, reliable ranges, and gaps is extra.
+static void CheckAllocationsPerMessage( int64 nAllocationsStart, int64 nMessagesStart )
+{
+	int64 nMessages = GetTotalMessages() - nMessagesStart;
+	if ( nMessages <= 0 )
+		return;
+	float flAllocationsPerMessage = float( GetTotalAllocations() - nAllocationsStart ) / float( nMessages );
+	Printf( "Allocations per message: %.2f  (%lld messages)\n", flAllocationsPerMessage, (long long)nMessages );
+	assert( flAllocationsPerMessage <= k_flMaxAllocationsPerMessage );
+}
+
 static void Recv( ISteamNetworkingSockets *pSteamSocketNetworking )
 {
 
@@ -279,6 +342,7 @@ static void Recv( ISteamNetworkingSockets *pSteamSocketNetworking )
 		}
 
 		nExpectedMsgNum = pTestMsg->m_nMsgNum + 1;
+		++pConnection->m_nRecvMsgCount;
 		pIncomingMsg->Release();
 	}
 }
@@ -384,6 +448,8 @@ static void TestNetworkConditions( int rate, int loss, int lag, int reorderPct,
 	Printf( "Loss . . . . . . : %d%%\n", loss );
 	Printf( "Ping . . . . . . : %d\n", lag*2 );
 	Printf( "Reorder. . . . . : %d%% @ %dms\n", reorderPct, reorderLag );
+	Printf( "Bottleneck . . . : %d Bps\n", pSteamSocketNetworking->GetConfigurationValue( k_ESteamNetworkingConfigurationValue_FakePacketBandwidth_Send ) );
+	Printf( "Burst loss . . . : %d%%\n", pSteamSocketNetworking->GetConfigurationValue( k_ESteamNetworkingConfigurationValue_FakePacketBurstLoss_Send ) );
 	Printf( "Act like game. . : %d\n", (int)bActLikeGame );
 	Printf( "---------------------------------------------------\n" );
 
@@ -397,6 +463,9 @@ static void TestNetworkConditions( int rate, int loss, int lag, int reorderPct,
 	pSteamSocketNetworking->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_FakePacketReorder_Send, reorderPct );
 	pSteamSocketNetworking->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_FakePacketReorder_Time, reorderLag );
 
+	// Use the same sequence of fake network decisions every run
+	pSteamSocketNetworking->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_FakeNetwork_Seed, 12345 );
+
 	SteamNetworkingMicroseconds usecWhenStarted = SteamNetworkingUtils()->GetLocalTimestamp();
 
 	// Loop!
@@ -408,6 +477,8 @@ static void TestNetworkConditions( int rate, int loss, int lag, int reorderPct,
 	bool bQuiet = true;
 	SteamNetworkingMicroseconds usecWhenStateEnd = 0;
 	int nIterations = 5;
+	int64 nAllocationsCycleStart = -1;
+	int64 nMessagesCycleStart = -1;
 	SteamNetworkingMicroseconds usecLastPrint = SteamNetworkingUtils()->GetLocalTimestamp();
 
 	while ( true )
@@ -436,6 +507,12 @@ static void TestNetworkConditions( int rate, int loss, int lag, int reorderPct,
 			{
 				if ( nServerPending == 0 &&  nClientPending == 0 )
 				{
+					// Everything queued during the last active period has gone out
+					if ( nMessagesCycleStart >= 0 )
+						CheckAllocationsPerMessage( nAllocationsCycleStart, nMessagesCycleStart );
+					nAllocationsCycleStart = GetTotalAllocations();
+					nMessagesCycleStart = GetTotalMessages();
+
 					bQuiet = false;
 					usecWhenStateEnd = g_usecTestElapsed + ( bQuiet ? usecQuietDuration : usecActiveDuration );
 					if ( nIterations-- <= 0 )
@@ -556,6 +633,17 @@ static void RunSteamDatagramConnectionTest()
 	Test( 128000, 20, 100, 4, 40 );
 	Test( 500000, 20, 100, 4, 30 );
 	Test( 1000000, 20, 100, 4, 10 );
+
+	// Bottleneck that is narrower than the send rate, so the queue
+	// fills up and overflows, plus some bursty loss
+	pSteamSocketNetworking->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_FakePacketBandwidth_Send, 100000 );
+	pSteamSocketNetworking->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_FakePacketBurstLoss_Send, 2 );
+	Test( 128000, 0, 25, 0, 0 );
+	pSteamSocketNetworking->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_FakePacketQueue_Discipline, k_ESteamNetworkingFakePacketQueue_RED );
+	Test( 128000, 0, 25, 0, 0 );
+	pSteamSocketNetworking->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_FakePacketQueue_Discipline, k_ESteamNetworkingFakePacketQueue_DropTail );
+	pSteamSocketNetworking->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_FakePacketBurstLoss_Send, 0 );
+	pSteamSocketNetworking->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_FakePacketBandwidth_Send, 0 );
 }
 
 int main(  )
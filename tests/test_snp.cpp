@@ -0,0 +1,1650 @@
+// Tests for SNP and the layers right underneath it.
+//
+// Everything runs on the in-process virtual network, so the tests don't
+// depend on the speed of the machine, and with a fixed FakeNetwork_Seed a
+// run is exactly reproducible.  Returns nonzero if anything failed.
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+#include <steam/steamnetworkingsockets.h>
+#include <steam/isteamnetworkingutils.h>
+#include <steam/steamnetworking_stats.h>
+#include "steamnetworkingsockets_snp.h"
+#include "steamnetworking_statsutils.h"
+#include "steamnetworkingsockets_connections.h"
+
+using namespace SteamNetworkingSocketsLib;
+
+#define PORT_SERVER			27300	// First port to use.  Each connection uses the next one
+
+/// One-way latency of the virtual wire
+static const SteamNetworkingMicroseconds k_usecVirtualLatency = 10000;
+
+static int g_nFailures = 0;
+
+static void DebugOutput( int eType, const char *pszMsg )
+{
+	if ( eType <= k_ESteamNetworkingSocketsDebugOutputType_Warning )
+		fprintf( stderr, "%s\n", pszMsg );
+	if ( eType == k_ESteamNetworkingSocketsDebugOutputType_Bug )
+		++g_nFailures;
+}
+
+static void Printf( const char *fmt, ... )
+{
+	va_list ap;
+	va_start( ap, fmt );
+	vprintf( fmt, ap );
+	va_end( ap );
+	fflush( stdout );
+}
+
+#define CHECK( expr ) \
+	do { \
+		if ( !( expr ) ) \
+		{ \
+			Printf( "%s(%d): CHECK FAILED: %s\n", __FILE__, __LINE__, #expr ); \
+			++g_nFailures; \
+		} \
+	} while (0)
+
+#define CHECK_EQUAL( a, b ) \
+	do { \
+		long long _a = (long long)( a ), _b = (long long)( b ); \
+		if ( _a != _b ) \
+		{ \
+			Printf( "%s(%d): CHECK FAILED: %s == %s  (%lld != %lld)\n", __FILE__, __LINE__, #a, #b, _a, _b ); \
+			++g_nFailures; \
+		} \
+	} while (0)
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Connection helpers
+//
+/////////////////////////////////////////////////////////////////////////////
+
+struct TestCallbacks : public ISteamNetworkingSocketsCallbacks
+{
+	HSteamListenSocket m_hListenSock = k_HSteamListenSocket_Invalid;
+	HSteamNetConnection m_hAccepted = k_HSteamNetConnection_Invalid;
+
+	virtual void OnSteamNetConnectionStatusChanged( SteamNetConnectionStatusChangedCallback_t *pInfo ) override
+	{
+		if ( pInfo->m_info.m_eState == k_ESteamNetworkingConnectionState_Connecting && pInfo->m_info.m_hListenSocket == m_hListenSock )
+		{
+			SteamNetworkingSockets()->AcceptConnection( pInfo->m_hConn );
+			m_hAccepted = pInfo->m_hConn;
+		}
+	}
+};
+static TestCallbacks g_callbacks;
+
+/// Advance the virtual clock, and dispatch any callbacks
+static void RunFor( SteamNetworkingMicroseconds usec )
+{
+	SteamNetworkingSockets_VirtualNetwork_RunFor( usec );
+	SteamNetworkingSockets()->RunCallbacks( &g_callbacks );
+}
+
+static bool BIsConnected( HSteamNetConnection hConn )
+{
+	SteamNetworkingQuickConnectionStatus status;
+	return SteamNetworkingSockets()->GetQuickConnectionStatus( hConn, &status )
+		&& status.m_eState == k_ESteamNetworkingConnectionState_Connected;
+}
+
+/// Start connecting a client to a server over the virtual network
+static HSteamNetConnection BeginConnect()
+{
+	ISteamNetworkingSockets *pSockets = SteamNetworkingSockets();
+
+	static int s_nPort = PORT_SERVER;
+	SteamNetworkingIPAddr addr;
+	addr.SetIPv4( 0x7f000001, (uint16)s_nPort++ );
+	g_callbacks.m_hListenSock = pSockets->CreateListenSocketIP( addr );
+	g_callbacks.m_hAccepted = k_HSteamNetConnection_Invalid;
+	return pSockets->ConnectByIPAddress( addr );
+}
+
+/// Wait until both ends of a connection started with BeginConnect are connected
+static bool FinishConnect( HSteamNetConnection *phClient, HSteamNetConnection *phServer )
+{
+	for ( int i = 0 ; i < 5000 ; ++i )
+	{
+		*phServer = g_callbacks.m_hAccepted;
+		if ( *phServer != k_HSteamNetConnection_Invalid && BIsConnected( *phClient ) && BIsConnected( *phServer ) )
+			return true;
+		RunFor( 1000 );
+	}
+	return false;
+}
+
+/// Connect a client to a server over the virtual network, and wait
+/// until both ends are connected.
+static bool CreateConnectedPair( HSteamNetConnection *phClient, HSteamNetConnection *phServer )
+{
+	*phClient = BeginConnect();
+	return FinishConnect( phClient, phServer );
+}
+
+static void DestroyPair( HSteamNetConnection hClient, HSteamNetConnection hServer )
+{
+	ISteamNetworkingSockets *pSockets = SteamNetworkingSockets();
+	pSockets->CloseConnection( hClient, 0, nullptr, false );
+	pSockets->CloseConnection( hServer, 0, nullptr, false );
+	if ( g_callbacks.m_hListenSock != k_HSteamListenSocket_Invalid )
+	{
+		pSockets->CloseListenSocket( g_callbacks.m_hListenSock );
+		g_callbacks.m_hListenSock = k_HSteamListenSocket_Invalid;
+	}
+	RunFor( 1000 );
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Virtual network
+//
+/////////////////////////////////////////////////////////////////////////////
+
+/// Push a mix of reliable and unreliable traffic through a lossy,
+/// jittery link, and record when (relative to the start) each message
+/// arrived, and what it was.
+static void RunLossyScenario( std::vector<long long> &vecTrace )
+{
+	ISteamNetworkingSockets *pSockets = SteamNetworkingSockets();
+	pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_FakePacketLoss_Send, 10 );
+	pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_FakePacketLag_Send, 20 );
+	pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_FakePacketJitter_Send, 5 );
+	pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_FakePacketReorder_Send, 5 );
+	pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_FakeNetwork_Seed, 1234 );
+
+	HSteamNetConnection hClient, hServer;
+	CHECK( CreateConnectedPair( &hClient, &hServer ) );
+
+	char msg[ 700 ];
+	memset( msg, 0, sizeof(msg) );
+	const SteamNetworkingMicroseconds usecStart = SteamNetworkingUtils()->GetLocalTimestamp();
+	for ( int nStep = 0 ; nStep < 2000 ; ++nStep )
+	{
+		if ( nStep < 1000 )
+		{
+			int nMsg = nStep;
+			memcpy( msg, &nMsg, sizeof(nMsg) );
+			int cbMsg = 100 + ( nStep*37 ) % 600;
+			pSockets->SendMessageToConnection( hClient, msg, cbMsg, ( nStep % 3 ) ? k_ESteamNetworkingSendType_Unreliable : k_ESteamNetworkingSendType_Reliable );
+		}
+
+		SteamNetworkingMessage_t *arMsg[ 64 ];
+		int n;
+		while ( ( n = pSockets->ReceiveMessagesOnConnection( hServer, arMsg, 64 ) ) > 0 )
+		{
+			for ( int i = 0 ; i < n ; ++i )
+			{
+				int nMsg;
+				memcpy( &nMsg, arMsg[i]->GetData(), sizeof(nMsg) );
+				vecTrace.push_back( SteamNetworkingUtils()->GetLocalTimestamp() - usecStart );
+				vecTrace.push_back( nMsg );
+				vecTrace.push_back( arMsg[i]->GetSize() );
+				arMsg[i]->Release();
+			}
+		}
+
+		RunFor( 1000 );
+	}
+
+	SteamNetworkingQuickConnectionStatus status;
+	CHECK( pSockets->GetQuickConnectionStatus( hClient, &status ) );
+	vecTrace.push_back( status.m_nPing );
+	vecTrace.push_back( status.m_cbPendingReliable );
+
+	DestroyPair( hClient, hServer );
+	pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_FakePacketLoss_Send, 0 );
+	pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_FakePacketLag_Send, 0 );
+	pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_FakePacketJitter_Send, 0 );
+	pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_FakePacketReorder_Send, 0 );
+}
+
+/// With the same seed, the virtual network must reproduce a run exactly
+static void TestVirtualNetworkDeterminism()
+{
+	Printf( "TestVirtualNetworkDeterminism\n" );
+
+	std::vector<long long> vecTrace1, vecTrace2;
+	RunLossyScenario( vecTrace1 );
+	RunLossyScenario( vecTrace2 );
+
+	// Make sure the scenario actually did something interesting:
+	// some messages got through, and some unreliable ones got lost
+	CHECK( vecTrace1.size() > 3*500 );
+	CHECK( vecTrace1.size() < 3*1000 );
+
+	CHECK_EQUAL( vecTrace1.size(), vecTrace2.size() );
+	size_t nFirstMismatch = 0;
+	while ( nFirstMismatch < vecTrace1.size() && nFirstMismatch < vecTrace2.size() && vecTrace1[nFirstMismatch] == vecTrace2[nFirstMismatch] )
+		++nFirstMismatch;
+	CHECK_EQUAL( nFirstMismatch, vecTrace1.size() );
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Pacing
+//
+/////////////////////////////////////////////////////////////////////////////
+
+static const int k_cbPacingTestMsg = 1000;
+
+/// Let the connection go idle, then dump a bunch of messages on it all at
+/// once.  Returns the arrival times of the messages, relative to when they
+/// were queued.
+static void SendBurstAfterIdle( int nSendRate, int cbQuantum, std::vector<SteamNetworkingMicroseconds> &vecArrival )
+{
+	ISteamNetworkingSockets *pSockets = SteamNetworkingSockets();
+	const int32 cbOldQuantum = pSockets->GetConfigurationValue( k_ESteamNetworkingConfigurationValue_SendPacingQuantum );
+	pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_SendPacingQuantum, cbQuantum );
+
+	HSteamNetConnection hClient, hServer;
+	CHECK( CreateConnectedPair( &hClient, &hServer ) );
+	pSockets->SetConnectionConfigurationValue( hClient, k_ESteamNetworkingConnectionConfigurationValue_SNP_MinRate, nSendRate );
+	pSockets->SetConnectionConfigurationValue( hClient, k_ESteamNetworkingConnectionConfigurationValue_SNP_MaxRate, nSendRate );
+
+	// Go idle long enough for the token bucket to fill
+	RunFor( 500000 );
+
+	const int k_nMsgs = 20;
+	char msg[ k_cbPacingTestMsg ];
+	memset( msg, 0, sizeof(msg) );
+	const SteamNetworkingMicroseconds usecStart = SteamNetworkingUtils()->GetLocalTimestamp();
+	for ( int i = 0 ; i < k_nMsgs ; ++i )
+		CHECK_EQUAL( pSockets->SendMessageToConnection( hClient, msg, sizeof(msg), k_ESteamNetworkingSendType_UnreliableNoNagle ), k_EResultOK );
+
+	vecArrival.clear();
+	for ( int nStep = 0 ; nStep < 10000 && (int)vecArrival.size() < k_nMsgs ; ++nStep )
+	{
+		RunFor( 100 );
+		SteamNetworkingMessage_t *arMsg[ k_nMsgs ];
+		int n = pSockets->ReceiveMessagesOnConnection( hServer, arMsg, k_nMsgs );
+		for ( int i = 0 ; i < n ; ++i )
+		{
+			vecArrival.push_back( SteamNetworkingUtils()->GetLocalTimestamp() - usecStart );
+			arMsg[i]->Release();
+		}
+	}
+	CHECK_EQUAL( vecArrival.size(), k_nMsgs );
+
+	DestroyPair( hClient, hServer );
+	pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_SendPacingQuantum, cbOldQuantum );
+}
+
+/// The pacing quantum sets how much goes out back to back after an idle
+/// period, and after that packets are spaced out at the send rate.
+static void TestPacingQuantum()
+{
+	Printf( "TestPacingQuantum\n" );
+
+	// Slow enough that each packet takes about 30ms to send
+	const int k_nSendRate = 50000;
+	const int k_cbMsg = k_cbPacingTestMsg;
+	const int k_cbMaxPacket = 1500;
+	for ( int cbQuantum: { 1200, 8000 } )
+	{
+		std::vector<SteamNetworkingMicroseconds> vecArrival;
+		SendBurstAfterIdle( k_nSendRate, cbQuantum, vecArrival );
+		if ( vecArrival.empty() )
+			continue;
+
+		// How many made it across in the initial burst?  We can spend
+		// tokens until we go negative, so we might send one more (full
+		// size) packet than what fits in the quantum.  And messages are
+		// split across packets, so the last one might not make it.
+		int nBurst = 0;
+		while ( nBurst < (int)vecArrival.size() && vecArrival[nBurst] <= vecArrival[0] + 1000 )
+			++nBurst;
+		CHECK( nBurst >= ( cbQuantum - k_cbMsg ) / k_cbMsg );
+		CHECK( nBurst <= ( cbQuantum + 2*k_cbMaxPacket ) / k_cbMsg );
+
+		// Everything after that is paced at the send rate.  Skip the first
+		// one, part of which might have been sent in the burst.  Messages
+		// straddle packets, so over this short a run we can only expect to
+		// be roughly on the mark.
+		if ( nBurst+1 < (int)vecArrival.size() )
+		{
+			SteamNetworkingMicroseconds usecPaced = vecArrival.back() - vecArrival[nBurst];
+			int nPacedRate = int( ( vecArrival.size() - nBurst - 1 ) * k_cbMsg * 1000000 / usecPaced );
+			Printf( "  Quantum %d: burst %d msgs, then paced at %d bytes/sec\n", cbQuantum, nBurst, nPacedRate );
+			CHECK( nPacedRate > k_nSendRate*85/100 );
+			CHECK( nPacedRate < k_nSendRate*115/100 );
+		}
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Path MTU discovery
+//
+/////////////////////////////////////////////////////////////////////////////
+
+/// Fetch the max encrypted payload size the connection is currently using
+static int GetPathMTU( HSteamNetConnection hConn )
+{
+	char szText[ 2048 ];
+	if ( !SteamNetworkingSockets()->GetConnectionDebugText( hConn, szText, sizeof(szText) ) )
+		return -1;
+	const char *p = strstr( szText, " pmtu." );
+	int cbPMTU;
+	if ( !p || sscanf( p + strcspn( p, "0123456789" ), "%d", &cbPMTU ) != 1 )
+		return -1;
+	return cbPMTU;
+}
+
+/// Keep some reliable traffic flowing, and make sure it all arrives, in order.
+static void RunWithReliableTraffic( HSteamNetConnection hClient, HSteamNetConnection hServer, SteamNetworkingMicroseconds usecDuration, int &nNextMsgSend, int &nNextMsgRecv )
+{
+	ISteamNetworkingSockets *pSockets = SteamNetworkingSockets();
+	char msg[ 3000 ];
+	memset( msg, 0, sizeof(msg) );
+	for ( SteamNetworkingMicroseconds usecElapsed = 0 ; usecElapsed < usecDuration ; usecElapsed += 10000 )
+	{
+		SteamNetworkingQuickConnectionStatus status;
+		pSockets->GetQuickConnectionStatus( hClient, &status );
+		if ( status.m_cbPendingReliable < 20000 )
+		{
+			memcpy( msg, &nNextMsgSend, sizeof(nNextMsgSend) );
+			CHECK_EQUAL( pSockets->SendMessageToConnection( hClient, msg, sizeof(msg), k_ESteamNetworkingSendType_Reliable ), k_EResultOK );
+			++nNextMsgSend;
+		}
+
+		SteamNetworkingMessage_t *arMsg[ 16 ];
+		int n;
+		while ( ( n = pSockets->ReceiveMessagesOnConnection( hServer, arMsg, 16 ) ) > 0 )
+		{
+			for ( int i = 0 ; i < n ; ++i )
+			{
+				int nMsg;
+				memcpy( &nMsg, arMsg[i]->GetData(), sizeof(nMsg) );
+				CHECK_EQUAL( nMsg, nNextMsgRecv );
+				nNextMsgRecv = nMsg+1;
+				arMsg[i]->Release();
+			}
+		}
+
+		RunFor( 10000 );
+	}
+	CHECK( BIsConnected( hClient ) );
+}
+
+/// Packets grow to the largest size that gets through.  If the path
+/// starts dropping big packets, we fall back and search again, and when
+/// it gets better we eventually notice.
+static void TestPathMTUDiscovery()
+{
+	Printf( "TestPathMTUDiscovery\n" );
+	ISteamNetworkingSockets *pSockets = SteamNetworkingSockets();
+	const int k_cbMaxUDPMsg = 1472; // Default PathMTU_Max
+	const int k_cbBaseMTU = 1248; // k_cbSteamNetworkingSocketsMaxEncryptedPayloadSend
+	const int k_cbSmallPath = 1400;
+	const int k_cbSearchSlop = 32 + 16 + 32; // Search granularity, encryption block, plus UDP header
+
+	HSteamNetConnection hClient, hServer;
+	CHECK( CreateConnectedPair( &hClient, &hServer ) );
+	int nNextMsgSend = 0, nNextMsgRecv = 0;
+
+	// Nothing in the way, so we should get all the way to the max
+	RunWithReliableTraffic( hClient, hServer, 10000000, nNextMsgSend, nNextMsgRecv );
+	int cbPMTU = GetPathMTU( hClient );
+	Printf( "  Unrestricted path: pmtu %d\n", cbPMTU );
+	CHECK( cbPMTU > k_cbMaxUDPMsg - k_cbSearchSlop );
+	CHECK( cbPMTU < k_cbMaxUDPMsg );
+
+	// Now the path shrinks.  Big packets get dropped, until we detect
+	// the black hole, fall back to the base size, and search again.
+	pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_FakePacketMTU_Send, k_cbSmallPath );
+	RunWithReliableTraffic( hClient, hServer, 30000000, nNextMsgSend, nNextMsgRecv );
+	cbPMTU = GetPathMTU( hClient );
+	Printf( "  Path shrunk to %d: pmtu %d\n", k_cbSmallPath, cbPMTU );
+	CHECK( cbPMTU > k_cbBaseMTU );
+	CHECK( cbPMTU > k_cbSmallPath - k_cbSearchSlop );
+	CHECK( cbPMTU < k_cbSmallPath );
+
+	// The path recovers.  We don't notice until we search again
+	pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_FakePacketMTU_Send, 0 );
+	RunWithReliableTraffic( hClient, hServer, 10000000, nNextMsgSend, nNextMsgRecv );
+	CHECK_EQUAL( GetPathMTU( hClient ), cbPMTU );
+	RunFor( 600000000 );
+	RunWithReliableTraffic( hClient, hServer, 10000000, nNextMsgSend, nNextMsgRecv );
+	cbPMTU = GetPathMTU( hClient );
+	Printf( "  Path recovered: pmtu %d\n", cbPMTU );
+	CHECK( cbPMTU > k_cbMaxUDPMsg - k_cbSearchSlop );
+
+	// Make sure everything got through
+	RunWithReliableTraffic( hClient, hServer, 1000000, nNextMsgSend, nNextMsgRecv );
+	CHECK( nNextMsgRecv > 100 );
+	CHECK( nNextMsgSend - nNextMsgRecv < 10 );
+
+	DestroyPair( hClient, hServer );
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Receive ring buffer
+//
+/////////////////////////////////////////////////////////////////////////////
+
+/// Gather cbData bytes at nOffset out of the ring buffer, checking the spans
+static std::vector<uint8> GatherSpans( const CSNPRecvRingBuffer &buf, int nOffset, int cbData, bool bExpectWrap )
+{
+	const uint8 *p1, *p2;
+	int cb1, cb2;
+	buf.GetSpans( nOffset, cbData, p1, cb1, p2, cb2 );
+	CHECK( cb1 >= 0 && cb2 >= 0 );
+	CHECK_EQUAL( cb1 + cb2, cbData );
+	CHECK_EQUAL( cb2 > 0, bExpectWrap );
+	if ( bExpectWrap )
+		CHECK( cb1 > 0 );
+	std::vector<uint8> result( p1, p1 + cb1 );
+	result.insert( result.end(), p2, p2 + cb2 );
+	return result;
+}
+
+static void TestRecvRingBuffer()
+{
+	Printf( "TestRecvRingBuffer\n" );
+
+	// Reference copy of what should be in the buffer
+	std::vector<uint8> expected;
+	uint8 nNextByte = 0;
+	auto Append = [&]( CSNPRecvRingBuffer &buf, int cbData ) {
+		std::vector<uint8> data( cbData );
+		for ( uint8 &x: data )
+			x = nNextByte++;
+		buf.Append( data.data(), cbData );
+		expected.insert( expected.end(), data.begin(), data.end() );
+	};
+	auto PopFront = [&]( CSNPRecvRingBuffer &buf, int cbData ) {
+		buf.PopFront( cbData );
+		expected.erase( expected.begin(), expected.begin() + cbData );
+	};
+
+	CSNPRecvRingBuffer buf;
+	CHECK( buf.empty() );
+
+	// Fill it up, then move the head near the end, without growing
+	Append( buf, 100 );
+	const int cbCapacity = buf.capacity();
+	CHECK( cbCapacity >= 100 );
+	Append( buf, cbCapacity - 100 - 10 );
+	PopFront( buf, cbCapacity - 50 );
+	CHECK_EQUAL( buf.size(), 40 );
+
+	// Append past the end of the storage, so the data wraps
+	Append( buf, 200 );
+	CHECK_EQUAL( buf.capacity(), cbCapacity );
+	CHECK_EQUAL( buf.size(), 240 );
+	CHECK( GatherSpans( buf, 0, 240, true ) == expected );
+
+	// Ranges entirely before the wrap point, entirely after it, ending
+	// exactly on it, starting exactly on it, and empty
+	CHECK( GatherSpans( buf, 5, 30, false ) == std::vector<uint8>( expected.begin() + 5, expected.begin() + 35 ) );
+	CHECK( GatherSpans( buf, 100, 50, false ) == std::vector<uint8>( expected.begin() + 100, expected.begin() + 150 ) );
+	CHECK( GatherSpans( buf, 0, 50, false ) == std::vector<uint8>( expected.begin(), expected.begin() + 50 ) );
+	CHECK( GatherSpans( buf, 50, 190, false ) == std::vector<uint8>( expected.begin() + 50, expected.end() ) );
+	CHECK( GatherSpans( buf, 49, 2, true ) == std::vector<uint8>( expected.begin() + 49, expected.begin() + 51 ) );
+	CHECK( GatherSpans( buf, 60, 0, false ).empty() );
+
+	// Overwrite a range that straddles the wrap point
+	uint8 patch[ 20 ];
+	for ( int i = 0 ; i < 20 ; ++i )
+		patch[i] = uint8( 0xa0 + i );
+	buf.Write( 40, patch, 20 );
+	memcpy( &expected[40], patch, 20 );
+	CHECK( GatherSpans( buf, 0, 240, true ) == expected );
+
+	// Growing while wrapped must unwrap the data into the new storage
+	Append( buf, cbCapacity );
+	CHECK( buf.capacity() > cbCapacity );
+	CHECK( GatherSpans( buf, 0, buf.size(), false ) == expected );
+
+	// Draining it completely resets the head
+	PopFront( buf, buf.size() );
+	CHECK( buf.empty() );
+	Append( buf, 10 );
+	CHECK( GatherSpans( buf, 0, 10, false ) == expected );
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Reliable stream decoding
+//
+/////////////////////////////////////////////////////////////////////////////
+
+/// Size and contents of test message N.  Sizes are all over the place, so
+/// that message boundaries (and headers) land at every possible spot in
+/// a packet: many small messages in one packet, a message (or just its
+/// header) split across the end of a packet, and messages that span
+/// several packets.
+static int GetTestMessageSize( int nMsg )
+{
+	switch ( nMsg % 4 )
+	{
+		case 0: return 1 + nMsg % 7;
+		case 1: return 20 + ( nMsg*37 ) % 300;
+		case 2: return 500 + ( nMsg*131 ) % 1500;
+	}
+	return 3000 + ( nMsg*997 ) % 6000;
+}
+
+static void FillTestMessage( int nMsg, uint8 *pData, int cbData )
+{
+	for ( int i = 0 ; i < cbData ; ++i )
+		pData[i] = uint8( nMsg*31 + i*7 );
+}
+
+static bool BCheckTestMessage( int nMsg, const SteamNetworkingMessage_t *pMsg )
+{
+	if ( (int)pMsg->GetSize() != GetTestMessageSize( nMsg ) )
+		return false;
+	const uint8 *pData = (const uint8 *)pMsg->GetData();
+	for ( int i = 0 ; i < (int)pMsg->GetSize() ; ++i )
+	{
+		if ( pData[i] != uint8( nMsg*31 + i*7 ) )
+			return false;
+	}
+	return true;
+}
+
+/// Send a stream of reliable messages of all different sizes, and make
+/// sure they arrive intact and in order.
+static void SendReliableTestMessages( HSteamNetConnection hSend, HSteamNetConnection hRecv, int nMsgs )
+{
+	ISteamNetworkingSockets *pSockets = SteamNetworkingSockets();
+	std::vector<uint8> buf;
+	int nNextMsgSend = 0, nNextMsgRecv = 0;
+	for ( int nStep = 0 ; nStep < 100000 && nNextMsgRecv < nMsgs ; ++nStep )
+	{
+		SteamNetworkingQuickConnectionStatus status;
+		pSockets->GetQuickConnectionStatus( hSend, &status );
+		while ( nNextMsgSend < nMsgs && status.m_cbPendingReliable < 50000 )
+		{
+			int cbMsg = GetTestMessageSize( nNextMsgSend );
+			buf.resize( cbMsg );
+			FillTestMessage( nNextMsgSend, buf.data(), cbMsg );
+			CHECK_EQUAL( pSockets->SendMessageToConnection( hSend, buf.data(), cbMsg, k_ESteamNetworkingSendType_Reliable ), k_EResultOK );
+			status.m_cbPendingReliable += cbMsg;
+			++nNextMsgSend;
+		}
+
+		SteamNetworkingMessage_t *arMsg[ 64 ];
+		int n;
+		while ( ( n = pSockets->ReceiveMessagesOnConnection( hRecv, arMsg, 64 ) ) > 0 )
+		{
+			for ( int i = 0 ; i < n ; ++i )
+			{
+				if ( !BCheckTestMessage( nNextMsgRecv, arMsg[i] ) )
+				{
+					Printf( "  Message %d (size %d) is corrupt\n", nNextMsgRecv, (int)arMsg[i]->GetSize() );
+					++g_nFailures;
+				}
+				++nNextMsgRecv;
+				arMsg[i]->Release();
+			}
+		}
+
+		RunFor( 1000 );
+	}
+	CHECK_EQUAL( nNextMsgRecv, nMsgs );
+}
+
+/// Reliable messages are decoded straight out of the packet when the
+/// stream has no gaps, and only a message that is cut off by the end of
+/// the packet gets buffered.  Exercise that both on a clean link, where
+/// we should always be on the fast path, and a lossy one, where we keep
+/// switching between it and filling gaps.
+static void TestReliableStreamDecode()
+{
+	Printf( "TestReliableStreamDecode\n" );
+	ISteamNetworkingSockets *pSockets = SteamNetworkingSockets();
+
+	HSteamNetConnection hClient, hServer;
+	CHECK( CreateConnectedPair( &hClient, &hServer ) );
+	SendReliableTestMessages( hClient, hServer, 2000 );
+
+	pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_FakePacketLoss_Send, 10 );
+	pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_FakePacketReorder_Send, 10 );
+	pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_FakePacketDup_Send, 5 );
+	SendReliableTestMessages( hServer, hClient, 2000 );
+	pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_FakePacketLoss_Send, 0 );
+	pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_FakePacketReorder_Send, 0 );
+	pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_FakePacketDup_Send, 0 );
+
+	DestroyPair( hClient, hServer );
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Unreliable reassembly
+//
+/////////////////////////////////////////////////////////////////////////////
+
+/// Unreliable test messages are big enough to be split into several
+/// segments, up to close to the max unreliable message size.  The
+/// message number is in the first 4 bytes, so we can tell which one
+/// arrived.
+static int GetUnreliableTestMessageSize( int nMsg )
+{
+	return 1500 + ( nMsg*2749 ) % 14000;
+}
+
+static bool BCheckUnreliableTestMessage( const SteamNetworkingMessage_t *pMsg, int nMsgs, int *pnMsg )
+{
+	if ( pMsg->GetSize() < sizeof(int) )
+		return false;
+	int nMsg;
+	memcpy( &nMsg, pMsg->GetData(), sizeof(nMsg) );
+	if ( nMsg < 0 || nMsg >= nMsgs || (int)pMsg->GetSize() != GetUnreliableTestMessageSize( nMsg ) )
+		return false;
+	const uint8 *pData = (const uint8 *)pMsg->GetData();
+	for ( int i = sizeof(int) ; i < (int)pMsg->GetSize() ; ++i )
+	{
+		if ( pData[i] != uint8( nMsg*31 + i*7 ) )
+			return false;
+	}
+	*pnMsg = nMsg;
+	return true;
+}
+
+/// Send a stream of fragmented unreliable messages.  Check that every
+/// message that arrives is intact, and that none arrives twice.  Returns
+/// the number of messages received.
+static int SendUnreliableTestMessages( HSteamNetConnection hSend, HSteamNetConnection hRecv, int nMsgs )
+{
+	ISteamNetworkingSockets *pSockets = SteamNetworkingSockets();
+	std::vector<uint8> buf;
+	std::vector<bool> vecReceived( nMsgs, false );
+	int nNextMsgSend = 0, nReceived = 0;
+	auto Receive = [&]() {
+		SteamNetworkingMessage_t *arMsg[ 64 ];
+		int n;
+		while ( ( n = pSockets->ReceiveMessagesOnConnection( hRecv, arMsg, 64 ) ) > 0 )
+		{
+			for ( int i = 0 ; i < n ; ++i )
+			{
+				int nMsg;
+				if ( !BCheckUnreliableTestMessage( arMsg[i], nMsgs, &nMsg ) )
+				{
+					Printf( "  Unreliable message (size %d) is corrupt\n", (int)arMsg[i]->GetSize() );
+					++g_nFailures;
+				}
+				else if ( vecReceived[ nMsg ] )
+				{
+					Printf( "  Unreliable message %d delivered twice\n", nMsg );
+					++g_nFailures;
+				}
+				else
+				{
+					vecReceived[ nMsg ] = true;
+					++nReceived;
+				}
+				arMsg[i]->Release();
+			}
+		}
+	};
+	for ( int nStep = 0 ; nStep < 20000 && nReceived < nMsgs ; ++nStep )
+	{
+		SteamNetworkingQuickConnectionStatus status;
+		pSockets->GetQuickConnectionStatus( hSend, &status );
+		while ( nNextMsgSend < nMsgs && status.m_cbPendingUnreliable < 50000 )
+		{
+			int cbMsg = GetUnreliableTestMessageSize( nNextMsgSend );
+			buf.resize( cbMsg );
+			for ( int i = 0 ; i < cbMsg ; ++i )
+				buf[i] = uint8( nNextMsgSend*31 + i*7 );
+			memcpy( buf.data(), &nNextMsgSend, sizeof(nNextMsgSend) );
+			CHECK_EQUAL( pSockets->SendMessageToConnection( hSend, buf.data(), cbMsg, k_ESteamNetworkingSendType_Unreliable ), k_EResultOK );
+			status.m_cbPendingUnreliable += cbMsg;
+			++nNextMsgSend;
+		}
+
+		Receive();
+
+		// Once everything is sent, give the stragglers time to
+		// show up, then stop
+		if ( nNextMsgSend == nMsgs && status.m_cbPendingUnreliable == 0 )
+		{
+			RunFor( 500000 );
+			Receive();
+			break;
+		}
+
+		RunFor( 1000 );
+	}
+	return nReceived;
+}
+
+/// Fragmented unreliable messages are reassembled in place, even when the
+/// segments arrive out of order, or more than once.
+static void TestUnreliableReassembly()
+{
+	Printf( "TestUnreliableReassembly\n" );
+	ISteamNetworkingSockets *pSockets = SteamNetworkingSockets();
+	const int nMsgs = 500;
+
+	HSteamNetConnection hClient, hServer;
+	CHECK( CreateConnectedPair( &hClient, &hServer ) );
+
+	// Slow enough that a reordered packet only falls behind a message or
+	// so.  Any more than that, and we would run out of reassembly slots.
+	pSockets->SetConnectionConfigurationValue( hClient, k_ESteamNetworkingConnectionConfigurationValue_SNP_MinRate, 500000 );
+	pSockets->SetConnectionConfigurationValue( hClient, k_ESteamNetworkingConnectionConfigurationValue_SNP_MaxRate, 500000 );
+
+	// Clean link
+	CHECK_EQUAL( SendUnreliableTestMessages( hClient, hServer, nMsgs ), nMsgs );
+
+	// Reordering and duplication.  Nothing is lost, so every message
+	// must come through, exactly once.
+	pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_FakePacketReorder_Send, 20 );
+	pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_FakePacketDup_Send, 10 );
+	CHECK_EQUAL( SendUnreliableTestMessages( hClient, hServer, nMsgs ), nMsgs );
+
+	// With loss too, partial messages are left behind in the table, and
+	// must be evicted or expired without corrupting the others
+	pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_FakePacketLoss_Send, 5 );
+	int nReceived = SendUnreliableTestMessages( hClient, hServer, nMsgs );
+	Printf( "  5%% loss: %d of %d messages received\n", nReceived, nMsgs );
+	CHECK( nReceived > nMsgs/2 && nReceived < nMsgs );
+	pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_FakePacketLoss_Send, 0 );
+	pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_FakePacketReorder_Send, 0 );
+	pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_FakePacketDup_Send, 0 );
+
+	// The stragglers from the lossy run have expired by now.  A clean run
+	// must still get everything.
+	CHECK_EQUAL( SendUnreliableTestMessages( hClient, hServer, nMsgs ), nMsgs );
+
+	DestroyPair( hClient, hServer );
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Lanes
+//
+/////////////////////////////////////////////////////////////////////////////
+
+static const int k_cbLaneTestMsg = 1000;
+
+/// Receive whatever has arrived, and add up the bytes per lane.  If
+/// pvecLaneOrder is not null, the lane of each message is appended to it.
+static void ReceiveLaneTraffic( HSteamNetConnection hConn, int *pcbPerLane, std::vector<int> *pvecLaneOrder )
+{
+	SteamNetworkingMessage_t *arMsg[ 64 ];
+	int n;
+	while ( ( n = SteamNetworkingSockets()->ReceiveMessagesOnConnection( hConn, arMsg, 64 ) ) > 0 )
+	{
+		for ( int i = 0 ; i < n ; ++i )
+		{
+			pcbPerLane[ arMsg[i]->GetLane() ] += arMsg[i]->GetSize();
+			if ( pvecLaneOrder )
+				pvecLaneOrder->push_back( arMsg[i]->GetLane() );
+			arMsg[i]->Release();
+		}
+	}
+}
+
+/// Lanes with the same priority share the bandwidth according to their
+/// weights, and a lane with a lower priority number goes ahead of everybody
+static void TestLaneScheduling()
+{
+	Printf( "TestLaneScheduling\n" );
+	ISteamNetworkingSockets *pSockets = SteamNetworkingSockets();
+
+	HSteamNetConnection hClient, hServer;
+	CHECK( CreateConnectedPair( &hClient, &hServer ) );
+	const int k_nSendRate = 100000;
+	pSockets->SetConnectionConfigurationValue( hClient, k_ESteamNetworkingConnectionConfigurationValue_SNP_MinRate, k_nSendRate );
+	pSockets->SetConnectionConfigurationValue( hClient, k_ESteamNetworkingConnectionConfigurationValue_SNP_MaxRate, k_nSendRate );
+
+	const int arPriorities[ 3 ] = { 0, 1, 1 };
+	const uint16 arWeights[ 3 ] = { 1, 1, 3 };
+	CHECK_EQUAL( pSockets->ConfigureConnectionLanes( hClient, 3, arPriorities, arWeights ), k_EResultOK );
+
+	// Queue up a few seconds worth of data on lanes 1 and 2
+	char msg[ k_cbLaneTestMsg ];
+	memset( msg, 0, sizeof(msg) );
+	for ( int i = 0 ; i < 150 ; ++i )
+	{
+		CHECK_EQUAL( pSockets->SendMessageToConnectionOnLane( hClient, msg, sizeof(msg), k_ESteamNetworkingSendType_Reliable, 1 ), k_EResultOK );
+		CHECK_EQUAL( pSockets->SendMessageToConnectionOnLane( hClient, msg, sizeof(msg), k_ESteamNetworkingSendType_Reliable, 2 ), k_EResultOK );
+	}
+
+	// They should split the bandwidth 1:3
+	int arcbPerLane[ 3 ] = { 0, 0, 0 };
+	for ( int nStep = 0 ; nStep < 1000 ; ++nStep )
+	{
+		RunFor( 1000 );
+		ReceiveLaneTraffic( hServer, arcbPerLane, nullptr );
+	}
+	Printf( "  Weights 1:3, received %d and %d bytes\n", arcbPerLane[1], arcbPerLane[2] );
+	CHECK_EQUAL( arcbPerLane[0], 0 );
+	CHECK( arcbPerLane[1] > 0 );
+	CHECK( arcbPerLane[2] > arcbPerLane[1]*5/2 && arcbPerLane[2] < arcbPerLane[1]*7/2 );
+
+	// Now queue some data on lane 0.  Once it starts arriving, nothing
+	// else should get through until it is all delivered.
+	const int k_nPriorityMsgs = 20;
+	for ( int i = 0 ; i < k_nPriorityMsgs ; ++i )
+		CHECK_EQUAL( pSockets->SendMessageToConnectionOnLane( hClient, msg, sizeof(msg), k_ESteamNetworkingSendType_Reliable, 0 ), k_EResultOK );
+	std::vector<int> vecLaneOrder;
+	memset( arcbPerLane, 0, sizeof(arcbPerLane) );
+	for ( int nStep = 0 ; nStep < 2000 && arcbPerLane[0] < k_nPriorityMsgs*k_cbLaneTestMsg ; ++nStep )
+	{
+		RunFor( 1000 );
+		ReceiveLaneTraffic( hServer, arcbPerLane, &vecLaneOrder );
+	}
+	CHECK_EQUAL( arcbPerLane[0], k_nPriorityMsgs*k_cbLaneTestMsg );
+
+	// Allow for a message that was already partly sent when lane 0 got
+	// its data.  (Only one per lane.)
+	int nFirst = 0;
+	while ( nFirst < (int)vecLaneOrder.size() && vecLaneOrder[nFirst] != 0 )
+		++nFirst;
+	CHECK( nFirst <= 4 );
+	int nInterleaved = 0;
+	for ( int i = nFirst ; i < (int)vecLaneOrder.size() ; ++i )
+	{
+		if ( vecLaneOrder[i] != 0 )
+			++nInterleaved;
+	}
+	CHECK( nInterleaved <= 2 );
+
+	DestroyPair( hClient, hServer );
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Unordered reliable messages
+//
+/////////////////////////////////////////////////////////////////////////////
+
+static const int k_nUnorderedTestMsgs = 300;
+
+/// Every 10th test message is ordinary reliable, the rest are unordered
+static void QueueUnorderedTestMessages( HSteamNetConnection hConn )
+{
+	char msg[ 200 ];
+	memset( msg, 0, sizeof(msg) );
+	for ( int i = 0 ; i < k_nUnorderedTestMsgs ; ++i )
+	{
+		memcpy( msg, &i, sizeof(i) );
+		ESteamNetworkingSendType eSendType = ( i % 10 == 0 ) ? k_ESteamNetworkingSendType_Reliable : k_ESteamNetworkingSendType_ReliableUnordered;
+		CHECK_EQUAL( SteamNetworkingSockets()->SendMessageToConnection( hConn, msg, sizeof(msg), eSendType ), k_EResultOK );
+	}
+}
+
+/// Receive the test messages, and check that each one arrives exactly
+/// once, and the ordered ones arrive in order.  Returns the number of
+/// messages that arrived ahead of a message that was sent before them.
+static int ReceiveUnorderedTestMessages( HSteamNetConnection hConn )
+{
+	std::vector<bool> vecReceived( k_nUnorderedTestMsgs, false );
+	int nReceived = 0, nLastOrdered = -1, nHighest = -1, nOutOfOrder = 0;
+	for ( int nStep = 0 ; nStep < 20000 && nReceived < k_nUnorderedTestMsgs ; ++nStep )
+	{
+		SteamNetworkingMessage_t *arMsg[ 64 ];
+		int n = SteamNetworkingSockets()->ReceiveMessagesOnConnection( hConn, arMsg, 64 );
+		for ( int i = 0 ; i < n ; ++i )
+		{
+			int nMsg;
+			memcpy( &nMsg, arMsg[i]->GetData(), sizeof(nMsg) );
+			arMsg[i]->Release();
+			CHECK( nMsg >= 0 && nMsg < k_nUnorderedTestMsgs );
+			if ( nMsg < 0 || nMsg >= k_nUnorderedTestMsgs )
+				continue;
+			CHECK( !vecReceived[ nMsg ] );
+			vecReceived[ nMsg ] = true;
+			++nReceived;
+			if ( nMsg % 10 == 0 )
+			{
+				CHECK( nMsg > nLastOrdered );
+				nLastOrdered = nMsg;
+			}
+			if ( nMsg < nHighest )
+				++nOutOfOrder;
+			nHighest = std::max( nHighest, nMsg );
+		}
+		RunFor( 1000 );
+	}
+	CHECK_EQUAL( nReceived, k_nUnorderedTestMsgs );
+	return nOutOfOrder;
+}
+
+/// Unordered messages are delivered as soon as they arrive, even if
+/// earlier messages were lost.  Messages that are queued before we know
+/// whether the peer supports that must still come through correctly.
+static void TestUnorderedDelivery()
+{
+	Printf( "TestUnorderedDelivery\n" );
+	ISteamNetworkingSockets *pSockets = SteamNetworkingSockets();
+	pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_FakeNetwork_Seed, 5678 );
+
+	HSteamNetConnection hClient, hServer;
+	CHECK( CreateConnectedPair( &hClient, &hServer ) );
+	pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_FakePacketLoss_Send, 10 );
+	QueueUnorderedTestMessages( hClient );
+	int nOutOfOrder = ReceiveUnorderedTestMessages( hServer );
+	Printf( "  Connected: %d delivered out of order\n", nOutOfOrder );
+	CHECK( nOutOfOrder > 0 );
+	pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_FakePacketLoss_Send, 0 );
+	DestroyPair( hClient, hServer );
+
+	// Queue them while we are still connecting, so we don't know the
+	// peer's version yet
+	hClient = BeginConnect();
+	QueueUnorderedTestMessages( hClient );
+	CHECK( FinishConnect( &hClient, &hServer ) );
+	pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_FakePacketLoss_Send, 10 );
+	nOutOfOrder = ReceiveUnorderedTestMessages( hServer );
+	Printf( "  Queued while connecting: %d delivered out of order\n", nOutOfOrder );
+	CHECK( nOutOfOrder > 0 );
+	pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_FakePacketLoss_Send, 0 );
+	DestroyPair( hClient, hServer );
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Ack frequency
+//
+/////////////////////////////////////////////////////////////////////////////
+
+struct AckTestResult
+{
+	float m_flAcksPerDataPkt; // Packets the receiver sent with acks, per data packet it received
+	float m_flPctSlow; // Percentage of messages that took more than 50ms to be delivered
+};
+
+/// Send a reliable message at regular intervals for a while with the
+/// specified ack frequency settings, and see how the receiver acks them.
+/// The messages are unordered, so a lost one doesn't hold up the rest,
+/// and we can tell how long each one took to recover.
+static AckTestResult MeasureAcks( int nAckPacketTolerance, int nAckDelayPctRTT, SteamNetworkingMicroseconds usecMsgInterval, int cbMsg )
+{
+	ISteamNetworkingSockets *pSockets = SteamNetworkingSockets();
+	const int32 nOldTolerance = pSockets->GetConfigurationValue( k_ESteamNetworkingConfigurationValue_AckPacketTolerance );
+	pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_AckPacketTolerance, nAckPacketTolerance );
+	pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_AckDelayPctRTT, nAckDelayPctRTT );
+
+	HSteamNetConnection hClient, hServer;
+	CHECK( CreateConnectedPair( &hClient, &hServer ) );
+	pSockets->SetConnectionConfigurationValue( hClient, k_ESteamNetworkingConnectionConfigurationValue_SNP_MinRate, 2000000 );
+	pSockets->SetConnectionConfigurationValue( hClient, k_ESteamNetworkingConnectionConfigurationValue_SNP_MaxRate, 2000000 );
+
+	// Let the ping settle, so a delay based on the RTT is accurate
+	RunFor( 2000000 );
+
+	SteamDatagramLinkStats statsBefore, statsAfter;
+	CHECK( pSockets->GetConnectionLinkStats( hServer, &statsBefore ) );
+
+	AckTestResult result;
+	int nMsgs = 0, nSlow = 0;
+	std::vector<char> msg( cbMsg, 0 );
+	SteamNetworkingMicroseconds usecNextSend = SteamNetworkingUtils()->GetLocalTimestamp();
+	const SteamNetworkingMicroseconds usecStop = usecNextSend + 2000000;
+	for (;;)
+	{
+		SteamNetworkingMicroseconds usecNow = SteamNetworkingUtils()->GetLocalTimestamp();
+		if ( usecNow >= usecStop )
+			break;
+		if ( usecNow >= usecNextSend )
+		{
+			memcpy( msg.data(), &usecNow, sizeof(usecNow) );
+			CHECK_EQUAL( pSockets->SendMessageToConnection( hClient, msg.data(), cbMsg, k_ESteamNetworkingSendType_ReliableUnorderedNoNagle ), k_EResultOK );
+			usecNextSend += usecMsgInterval;
+		}
+
+		SteamNetworkingMessage_t *arMsg[ 64 ];
+		int n = pSockets->ReceiveMessagesOnConnection( hServer, arMsg, 64 );
+		for ( int i = 0 ; i < n ; ++i )
+		{
+			SteamNetworkingMicroseconds usecSent;
+			memcpy( &usecSent, arMsg[i]->GetData(), sizeof(usecSent) );
+			++nMsgs;
+			if ( usecNow - usecSent > 50000 )
+				++nSlow;
+			arMsg[i]->Release();
+		}
+
+		RunFor( 500 );
+	}
+
+	CHECK( pSockets->GetConnectionLinkStats( hServer, &statsAfter ) );
+	int64 nDataPkts = statsAfter.m_lifetime.m_nPktsRecvAckEliciting - statsBefore.m_lifetime.m_nPktsRecvAckEliciting;
+	int64 nAckPkts = statsAfter.m_lifetime.m_nPktsSentWithAck - statsBefore.m_lifetime.m_nPktsSentWithAck;
+	CHECK( nDataPkts > 0 );
+	result.m_flAcksPerDataPkt = nDataPkts > 0 ? (float)nAckPkts / (float)nDataPkts : 0.0f;
+	result.m_flPctSlow = nMsgs > 0 ? nSlow * 100.0f / nMsgs : 0.0f;
+
+	DestroyPair( hClient, hServer );
+	pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_AckPacketTolerance, nOldTolerance );
+	pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_AckDelayPctRTT, 0 );
+	return result;
+}
+
+/// The sender tells the receiver how often it wants acks, and the receiver
+/// acks a gap in the packet numbers right away, rather than waiting
+static void TestAckFrequency()
+{
+	Printf( "TestAckFrequency\n" );
+	ISteamNetworkingSockets *pSockets = SteamNetworkingSockets();
+
+	// Lots of packets.  By default we only ack on the timer, and
+	// the packet tolerance should make the receiver ack more often.
+	AckTestResult timerOnly = MeasureAcks( 0, 0, 1000, 1000 );
+	AckTestResult everyOther = MeasureAcks( 2, 0, 1000, 1000 );
+	Printf( "  1 pkt/ms, tolerance 0: %.3f acks/pkt.  Tolerance 2: %.3f acks/pkt\n", timerOnly.m_flAcksPerDataPkt, everyOther.m_flAcksPerDataPkt );
+	CHECK( timerOnly.m_flAcksPerDataPkt < 0.1f );
+	CHECK( everyOther.m_flAcksPerDataPkt > 0.45f && everyOther.m_flAcksPerDataPkt < 0.6f );
+
+	// A packet every 20ms.  With the default 50ms max delay, several
+	// share an ack.  Asking for acks within a quarter of the RTT should
+	// get each one acked on its own.
+	AckTestResult maxDelay = MeasureAcks( 0, 0, 20000, 100 );
+	AckTestResult rttDelay = MeasureAcks( 0, 25, 20000, 100 );
+	Printf( "  1 pkt/20ms, max delay: %.3f acks/pkt.  25%% of RTT: %.3f acks/pkt\n", maxDelay.m_flAcksPerDataPkt, rttDelay.m_flAcksPerDataPkt );
+	CHECK( maxDelay.m_flAcksPerDataPkt < 0.6f );
+	CHECK( rttDelay.m_flAcksPerDataPkt > 0.9f );
+
+	// A lost packet is acked (well, nacked) as soon as the next one arrives,
+	// so it is retransmitted promptly, not after waiting on the ack timer.
+	// Only if the nack or the retransmission is also lost (about 2% of
+	// messages) should it take longer than the 50ms ack delay.
+	pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_FakePacketLoss_Send, 10 );
+	AckTestResult lossy = MeasureAcks( 0, 0, 5000, 100 );
+	pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_FakePacketLoss_Send, 0 );
+	Printf( "  10%% loss, %.1f%% of messages took more than 50ms\n", lossy.m_flPctSlow );
+	CHECK( lossy.m_flPctSlow < 5.0f );
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Streams
+//
+/////////////////////////////////////////////////////////////////////////////
+
+static inline uint8 StreamTestByte( int nOffset )
+{
+	return uint8( nOffset ^ ( nOffset >> 8 ) ^ ( nOffset >> 16 ) );
+}
+
+/// Send a payload in chunks, retrying when the send buffer is full, and
+/// check that it comes out the other end intact.  Returns the number of
+/// times the sender was told to back off.
+static int StreamPayload( HSteamNetConnection hSend, HSteamNetConnection hRecv, int cbPayload, int cbChunk )
+{
+	ISteamNetworkingSockets *pSockets = SteamNetworkingSockets();
+	std::vector<uint8> chunk;
+	int nSendOffset = 0, nRecvOffset = 0, nBackoffs = 0;
+	bool bRecvDone = false;
+	for ( int nStep = 0 ; nStep < 100000 && !bRecvDone ; ++nStep )
+	{
+		// Send as many chunks as we can
+		while ( nSendOffset < cbPayload )
+		{
+			int cbThisChunk = std::min( cbChunk, cbPayload - nSendOffset );
+			chunk.resize( cbThisChunk );
+			for ( int i = 0 ; i < cbThisChunk ; ++i )
+				chunk[i] = StreamTestByte( nSendOffset + i );
+			int nSendType = k_ESteamNetworkingSendType_Reliable;
+			if ( nSendOffset + cbThisChunk < cbPayload )
+				nSendType |= k_nSteamNetworkingSendFlags_StreamContinues;
+			EResult eResult = pSockets->SendMessageToConnection( hSend, chunk.data(), cbThisChunk, (ESteamNetworkingSendType)nSendType );
+			if ( eResult == k_EResultLimitExceeded )
+			{
+				++nBackoffs;
+				break;
+			}
+			CHECK_EQUAL( eResult, k_EResultOK );
+			if ( eResult != k_EResultOK )
+				return nBackoffs;
+			nSendOffset += cbThisChunk;
+		}
+
+		// Receive what has arrived.  Chunks must arrive in order, and all
+		// but the last one are flagged.
+		SteamNetworkingMessage_t *arMsg[ 16 ];
+		int n = pSockets->ReceiveMessagesOnConnection( hRecv, arMsg, 16 );
+		for ( int i = 0 ; i < n ; ++i )
+		{
+			const uint8 *pData = (const uint8 *)arMsg[i]->GetData();
+			int cbData = (int)arMsg[i]->GetSize();
+			CHECK( !bRecvDone );
+			CHECK( nRecvOffset + cbData <= cbPayload );
+			bool bContents = nRecvOffset + cbData <= cbPayload;
+			for ( int j = 0 ; bContents && j < cbData ; ++j )
+				bContents = pData[j] == StreamTestByte( nRecvOffset + j );
+			CHECK( bContents );
+			nRecvOffset += cbData;
+			bool bContinues = ( arMsg[i]->m_nFlags & k_nSteamNetworkingMessageFlags_StreamContinues ) != 0;
+			CHECK_EQUAL( bContinues, nRecvOffset < cbPayload );
+			if ( !bContinues )
+				bRecvDone = true;
+			arMsg[i]->Release();
+		}
+
+		RunFor( 1000 );
+	}
+	CHECK( bRecvDone );
+	CHECK_EQUAL( nRecvOffset, cbPayload );
+	return nBackoffs;
+}
+
+/// A payload bigger than the send buffer (and bigger than the max message
+/// size) can be sent as a stream of chunks
+static void TestStreaming()
+{
+	Printf( "TestStreaming\n" );
+	ISteamNetworkingSockets *pSockets = SteamNetworkingSockets();
+	const int cbSendBuffer = pSockets->GetConfigurationValue( k_ESteamNetworkingConfigurationValue_SendBufferSize );
+	const int cbPayload = 4*cbSendBuffer + 12345;
+	CHECK( cbPayload > k_cbMaxSteamNetworkingSocketsMessageSizeSend );
+
+	// Pipe pair.  Chunks are handed straight to the other side
+	HSteamNetConnection hConn1, hConn2;
+	CHECK( pSockets->CreateSocketPair( &hConn1, &hConn2, false, nullptr, nullptr ) );
+	StreamPayload( hConn1, hConn2, cbPayload, 100000 );
+	pSockets->CloseConnection( hConn1, 0, nullptr, false );
+	pSockets->CloseConnection( hConn2, 0, nullptr, false );
+
+	// Over the network, the sender fills the send buffer and has to wait
+	HSteamNetConnection hClient, hServer;
+	CHECK( CreateConnectedPair( &hClient, &hServer ) );
+	pSockets->SetConnectionConfigurationValue( hClient, k_ESteamNetworkingConnectionConfigurationValue_SNP_MinRate, 2000000 );
+	pSockets->SetConnectionConfigurationValue( hClient, k_ESteamNetworkingConnectionConfigurationValue_SNP_MaxRate, 2000000 );
+	int nBackoffs = StreamPayload( hClient, hServer, cbPayload, 100000 );
+	CHECK( nBackoffs > 0 );
+	DestroyPair( hClient, hServer );
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Congestion control
+//
+/////////////////////////////////////////////////////////////////////////////
+
+/// BBR should fill a bottleneck link without building much of a standing
+/// queue in front of it.  We keep plenty queued, so the rate is up to
+/// congestion control, and measure the RTT above the propagation delay.
+static void TestBBRQueueDelay()
+{
+	Printf( "TestBBRQueueDelay\n" );
+	ISteamNetworkingSockets *pSockets = SteamNetworkingSockets();
+	const int nBottleneckRate = 1000000;
+	const SteamNetworkingMicroseconds usecMinRTT = 2*k_usecVirtualLatency;
+	pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_FakePacketBandwidth_Send, nBottleneckRate );
+
+	HSteamNetConnection hClient, hServer;
+	CHECK( CreateConnectedPair( &hClient, &hServer ) );
+	pSockets->SetConnectionConfigurationValue( hClient, k_ESteamNetworkingConnectionConfigurationValue_CongestionControl, k_ESteamNetworkingCongestionControl_BBR );
+	pSockets->SetConnectionConfigurationValue( hClient, k_ESteamNetworkingConnectionConfigurationValue_SNP_MinRate, 0 );
+	pSockets->SetConnectionConfigurationValue( hClient, k_ESteamNetworkingConnectionConfigurationValue_SNP_MaxRate, 4*nBottleneckRate );
+
+	// Give it a couple of seconds to get out of startup before measuring
+	std::vector<char> msg( 1200, 'x' );
+	std::vector<int> vecQueueDelay;
+	int64 cbReceived = 0;
+	const int nWarmupSteps = 2000, nMeasureSteps = 5000;
+	for ( int nStep = 0 ; nStep < nWarmupSteps + nMeasureSteps ; ++nStep )
+	{
+		SteamNetworkingQuickConnectionStatus status;
+		pSockets->GetQuickConnectionStatus( hClient, &status );
+		while ( status.m_cbPendingReliable < 256*1024 )
+		{
+			pSockets->SendMessageToConnection( hClient, msg.data(), (uint32)msg.size(), k_ESteamNetworkingSendType_Reliable );
+			status.m_cbPendingReliable += (int)msg.size();
+		}
+		bool bMeasuring = nStep >= nWarmupSteps;
+		if ( bMeasuring && status.m_nPing >= 0 )
+			vecQueueDelay.push_back( std::max( 0, status.m_nPing*1000 - (int)usecMinRTT ) );
+
+		SteamNetworkingMessage_t *arMsg[ 64 ];
+		int n;
+		while ( ( n = pSockets->ReceiveMessagesOnConnection( hServer, arMsg, 64 ) ) > 0 )
+		{
+			for ( int i = 0 ; i < n ; ++i )
+			{
+				if ( bMeasuring )
+					cbReceived += arMsg[i]->GetSize();
+				arMsg[i]->Release();
+			}
+		}
+
+		RunFor( 1000 );
+	}
+	DestroyPair( hClient, hServer );
+	pSockets->SetConfigurationValue( k_ESteamNetworkingConfigurationValue_FakePacketBandwidth_Send, 0 );
+
+	// We should be using most of the link, and the typical queue should
+	// be within a small multiple of the min RTT
+	CHECK( !vecQueueDelay.empty() );
+	if ( vecQueueDelay.empty() )
+		return;
+	std::sort( vecQueueDelay.begin(), vecQueueDelay.end() );
+	int usecQueueDelayP50 = vecQueueDelay[ vecQueueDelay.size()/2 ];
+	int nGoodput = (int)( cbReceived * 1000 / nMeasureSteps );
+	Printf( "  goodput %d bytes/sec, queue delay p50 %dus\n", nGoodput, usecQueueDelayP50 );
+	CHECK( nGoodput > nBottleneckRate*8/10 );
+	CHECK( usecQueueDelayP50 <= 2*usecMinRTT );
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Connection handles
+//
+/////////////////////////////////////////////////////////////////////////////
+
+/// The table never dereferences the connection pointer, so any unique
+/// non-null value will do
+static CSteamNetworkConnectionBase *FakeConnection( int i )
+{
+	return reinterpret_cast<CSteamNetworkConnectionBase *>( uintptr_t( i+1 ) * 16 );
+}
+
+/// Slot reuse, stale handle rejection, and the handles that we never hand out
+static void TestConnectionHandleTable()
+{
+	Printf( "TestConnectionHandleTable\n" );
+	const uint32 nSlotMask = CConnectionHandleTable::k_nSlotMask;
+	const int nMinFree = CConnectionHandleTable::k_nMinFreeSlotsBeforeReuse;
+
+	// Freed slots are not reused until enough of them are free.  Until
+	// then, the table grows.
+	{
+		CConnectionHandleTable table;
+		std::vector<HSteamNetConnection> vecHandles;
+		for ( int i = 0 ; i < nMinFree ; ++i )
+			vecHandles.push_back( table.Add( FakeConnection( i ) ) );
+
+		// Free all but one.  That's not enough free slots, so the next
+		// add has to grow the table
+		for ( int i = 0 ; i < nMinFree-1 ; ++i )
+			CHECK( table.Remove( vecHandles[i] ) );
+		CHECK_EQUAL( table.Count(), 1 );
+		int nSlots = table.NumSlots();
+		HSteamNetConnection hGrow = table.Add( FakeConnection( 1000 ) );
+		CHECK( table.NumSlots() > nSlots );
+		for ( HSteamNetConnection h: vecHandles )
+			CHECK( ( uint32( hGrow ) & nSlotMask ) != ( uint32( h ) & nSlotMask ) );
+		CHECK( table.Remove( hGrow ) );
+		CHECK( table.Remove( vecHandles[nMinFree-1] ) );
+
+		// Now there are enough free slots.  The one that has been free the
+		// longest is reused, with a new generation
+		nSlots = table.NumSlots();
+		HSteamNetConnection hStale = vecHandles[0];
+		HSteamNetConnection hReused = table.Add( FakeConnection( 1001 ) );
+		CHECK_EQUAL( table.NumSlots(), nSlots );
+		CHECK_EQUAL( uint32( hReused ) & nSlotMask, uint32( hStale ) & nSlotMask );
+		CHECK( hReused != hStale );
+		CHECK( table.Find( hReused ) == FakeConnection( 1001 ) );
+		CHECK( table.Find( hStale ) == nullptr );
+		CHECK( !table.Remove( hStale ) );
+		CHECK( table.Find( hReused ) == FakeConnection( 1001 ) );
+		CHECK_EQUAL( table.Count(), 1 );
+	}
+
+	// Older peers reject connection IDs where either 16-bit half is zero.
+	// Fill up more than 64K slots, so that at least one scrambled index has
+	// the lower 16 bits clear and must be skipped.
+	{
+		CConnectionHandleTable table;
+		const int nConns = 0x10000 + 100;
+		int nBad = 0;
+		for ( int i = 0 ; i < nConns ; ++i )
+		{
+			HSteamNetConnection h = table.Add( FakeConnection( i ) );
+			if ( h == k_HSteamNetConnection_Invalid || ( uint32( h ) & 0xffff ) == 0 || ( uint32( h ) >> 16 ) == 0 )
+				++nBad;
+		}
+		CHECK_EQUAL( nBad, 0 );
+		CHECK_EQUAL( table.Count(), nConns );
+		CHECK( table.NumSlots() > nConns );
+	}
+}
+
+/// A handle to a closed connection stays invalid through the API, even
+/// after its slot has been given to a new connection
+static void TestStaleConnectionHandle()
+{
+	Printf( "TestStaleConnectionHandle\n" );
+	ISteamNetworkingSockets *pSockets = SteamNetworkingSockets();
+	const uint32 nSlotMask = CConnectionHandleTable::k_nSlotMask;
+
+	// Open and close enough connections that slots will be reused
+	std::vector<HSteamNetConnection> vecClosed;
+	for ( int i = 0 ; i < CConnectionHandleTable::k_nMinFreeSlotsBeforeReuse ; ++i )
+	{
+		HSteamNetConnection hConn1, hConn2;
+		CHECK( pSockets->CreateSocketPair( &hConn1, &hConn2, false, nullptr, nullptr ) );
+		vecClosed.push_back( hConn1 );
+		vecClosed.push_back( hConn2 );
+		pSockets->RunCallbacks( &g_callbacks );
+	}
+	for ( HSteamNetConnection h: vecClosed )
+	{
+		pSockets->CloseConnection( h, 0, nullptr, false );
+		pSockets->RunCallbacks( &g_callbacks );
+	}
+
+	// Closed connections hang around in FinWait for a bit before their
+	// slots are freed
+	RunFor( k_usecFinWaitTimeout + 100000 );
+
+	// Reopen until one of the new connections lands in a slot we used.
+	// Slots freed by earlier tests have been idle longer, so they will be
+	// reused first.
+	std::vector<HSteamNetConnection> vecOpen;
+	int nReused = 0;
+	const int nMaxPairs = g_tableConnections.NumSlots();
+	for ( int i = 0 ; i < nMaxPairs && nReused == 0 ; ++i )
+	{
+		HSteamNetConnection hConn[2];
+		CHECK( pSockets->CreateSocketPair( &hConn[0], &hConn[1], false, nullptr, nullptr ) );
+		pSockets->RunCallbacks( &g_callbacks );
+		for ( HSteamNetConnection hOpen: hConn )
+		{
+			vecOpen.push_back( hOpen );
+			SteamNetConnectionInfo_t info;
+			CHECK( pSockets->GetConnectionInfo( hOpen, &info ) );
+			for ( HSteamNetConnection hClosed: vecClosed )
+			{
+				CHECK( hOpen != hClosed );
+				if ( ( uint32( hOpen ) & nSlotMask ) == ( uint32( hClosed ) & nSlotMask ) )
+					++nReused;
+			}
+		}
+	}
+	CHECK( nReused > 0 );
+
+	// None of the stale handles work
+	int nStaleOK = 0;
+	for ( HSteamNetConnection h: vecClosed )
+	{
+		SteamNetConnectionInfo_t info;
+		if ( pSockets->GetConnectionInfo( h, &info ) )
+			++nStaleOK;
+	}
+	CHECK_EQUAL( nStaleOK, 0 );
+
+	for ( HSteamNetConnection h: vecOpen )
+	{
+		pSockets->CloseConnection( h, 0, nullptr, false );
+		pSockets->RunCallbacks( &g_callbacks );
+	}
+	RunFor( k_usecFinWaitTimeout + 100000 );
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// Stats
+//
+/////////////////////////////////////////////////////////////////////////////
+
+/// Stats survive a trip through the compact wire format, including the
+/// values that mean "unknown"
+static void TestLinkStatsWireRoundTrip()
+{
+	Printf( "TestLinkStatsWireRoundTrip\n" );
+	uint8 buf[ k_cbLinkStatsLifetimeWire ];
+
+	// Instantaneous, with everything known, and then everything unknown.
+	// Send rate and pending bytes are not on the wire
+	SteamDatagramLinkInstantaneousStats inst, inst2;
+	memset( &inst, 0, sizeof(inst) );
+	inst.m_flOutPacketsPerSec = 12.5f;
+	inst.m_flOutBytesPerSec = 15000.0f;
+	inst.m_flInPacketsPerSec = 30.0f;
+	inst.m_flInBytesPerSec = 42000.0f;
+	inst.m_nPingMS = 123;
+	inst.m_flPacketsDroppedPct = 0.25f;
+	inst.m_flPacketsWeirdSequenceNumberPct = 0.05f;
+	inst.m_usecMaxJitter = 4567;
+	CHECK( LinkStatsInstantaneousStructToWire( inst, buf ) == buf + k_cbLinkStatsInstantaneousWire );
+	CHECK( LinkStatsInstantaneousWireToStruct( buf, inst2 ) == buf + k_cbLinkStatsInstantaneousWire );
+	CHECK( inst2.m_flOutPacketsPerSec == inst.m_flOutPacketsPerSec );
+	CHECK( inst2.m_flOutBytesPerSec == inst.m_flOutBytesPerSec );
+	CHECK( inst2.m_flInPacketsPerSec == inst.m_flInPacketsPerSec );
+	CHECK( inst2.m_flInBytesPerSec == inst.m_flInBytesPerSec );
+	CHECK_EQUAL( inst2.m_nPingMS, inst.m_nPingMS );
+	CHECK( fabs( inst2.m_flPacketsDroppedPct - inst.m_flPacketsDroppedPct ) < .001f );
+	CHECK( fabs( inst2.m_flPacketsWeirdSequenceNumberPct - inst.m_flPacketsWeirdSequenceNumberPct ) < .001f );
+	CHECK_EQUAL( inst2.m_usecMaxJitter, inst.m_usecMaxJitter );
+
+	inst.m_nPingMS = -1;
+	inst.m_flPacketsDroppedPct = -1.0f;
+	inst.m_flPacketsWeirdSequenceNumberPct = -1.0f;
+	inst.m_usecMaxJitter = -1;
+	LinkStatsInstantaneousStructToWire( inst, buf );
+	LinkStatsInstantaneousWireToStruct( buf, inst2 );
+	CHECK_EQUAL( inst2.m_nPingMS, -1 );
+	CHECK( inst2.m_flPacketsDroppedPct == -1.0f );
+	CHECK( inst2.m_flPacketsWeirdSequenceNumberPct == -1.0f );
+	CHECK_EQUAL( inst2.m_usecMaxJitter, -1 );
+
+	// Lifetime.  Byte counts are sent in KB, so use whole KB.  Leave
+	// some ntiles unknown.
+	SteamDatagramLinkLifetimeStats life, life2;
+	memset( &life, 0, sizeof(life) );
+	life.m_nPacketsSent = 100000;
+	life.m_nBytesSent = 1024*5000;
+	life.m_nPacketsRecv = 90000;
+	life.m_nBytesRecv = 1024*4000;
+	life.m_nPktsRecvSequenced = 89000;
+	life.m_nPktsRecvDropped = 123;
+	life.m_nPktsRecvOutOfOrder = 45;
+	life.m_nPktsRecvDuplicate = 6;
+	life.m_nPktsRecvSequenceNumberLurch = 7;
+	life.m_nPingHistogram25 = 10; life.m_nPingHistogram50 = 20; life.m_nPingHistogramMax = 3;
+	life.m_nPingNtile5th = 12; life.m_nPingNtile50th = 25; life.m_nPingNtile75th = 31;
+	life.m_nPingNtile95th = -1; life.m_nPingNtile98th = -1;
+	life.m_nQualityHistogram100 = 50; life.m_nQualityHistogram99 = 4; life.m_nQualityHistogramDead = 1;
+	life.m_nQualityNtile2nd = -1; life.m_nQualityNtile5th = 97; life.m_nQualityNtile25th = 99; life.m_nQualityNtile50th = 100;
+	life.m_nJitterHistogramNegligible = 40; life.m_nJitterHistogram20 = 2;
+	life.m_nTXSpeedMax = 2000; life.m_nTXSpeedHistogram1024 = 9;
+	life.m_nTXSpeedNtile5th = 100; life.m_nTXSpeedNtile98th = -1;
+	life.m_nRXSpeedMax = 1500; life.m_nRXSpeedHistogram512 = 8;
+	life.m_nRXSpeedNtile50th = 700; life.m_nRXSpeedNtile98th = -1;
+	CHECK( LinkStatsLifetimeStructToWire( life, buf ) == buf + k_cbLinkStatsLifetimeWire );
+	CHECK( LinkStatsLifetimeWireToStruct( buf, life2 ) == buf + k_cbLinkStatsLifetimeWire );
+	CHECK( memcmp( &life, &life2, sizeof(life) ) == 0 );
+	CHECK_EQUAL( life2.m_nPingNtile95th, -1 );
+	CHECK_EQUAL( life2.m_nQualityNtile2nd, -1 );
+}
+
+/// Check the bucket boundaries of a sketch type against the error bound it
+/// promises, at every power of two
+template <typename TSketch, int MAX_BITS, int SUB_BUCKET_BITS>
+static void CheckSketchBuckets()
+{
+	// Small values are exact
+	for ( uint32 x = 0 ; x < TSketch::k_nSubBuckets ; ++x )
+	{
+		CHECK_EQUAL( TSketch::BucketForValue( x ), x );
+		CHECK_EQUAL( TSketch::BucketMinValue( x ), x );
+	}
+
+	// Each power of two starts a new bucket, and every value lands in a
+	// bucket no wider than the relative error allows
+	int idxPrev = TSketch::k_nSubBuckets-1;
+	for ( int nBit = SUB_BUCKET_BITS ; nBit < MAX_BITS ; ++nBit )
+	{
+		const uint32 nPow = 1u << nBit;
+		CHECK_EQUAL( TSketch::BucketMinValue( TSketch::BucketForValue( nPow ) ), nPow );
+		CHECK_EQUAL( TSketch::BucketForValue( nPow ), TSketch::BucketForValue( nPow-1 ) + 1 );
+		const uint32 arX[] = { nPow, nPow+1, nPow + nPow/2 - 1, nPow + nPow/2, 2*nPow - 1 };
+		for ( uint32 x: arX )
+		{
+			int idx = TSketch::BucketForValue( x );
+			CHECK( idx >= idxPrev );
+			idxPrev = idx;
+			uint32 nMin = TSketch::BucketMinValue( idx );
+			CHECK( nMin <= x );
+			CHECK( ( x - nMin ) <= ( x >> SUB_BUCKET_BITS ) );
+			if ( idx+1 < TSketch::k_nBuckets )
+				CHECK( x < TSketch::BucketMinValue( idx+1 ) );
+
+			// A sketch full of one value reports it within the error bound
+			TSketch s;
+			for ( int i = 0 ; i < 100 ; ++i )
+				s.AddSample( x );
+			uint32 nEst = (uint32)s.GetPercentile( .5f );
+			uint32 nErr = nEst > x ? nEst - x : x - nEst;
+			CHECK( nErr <= ( x >> SUB_BUCKET_BITS ) );
+		}
+	}
+
+	// Anything too big is clamped into the last bucket
+	CHECK_EQUAL( TSketch::BucketForValue( ( 1u << MAX_BITS ) - 1 ), TSketch::k_nBuckets-1 );
+	CHECK_EQUAL( TSketch::BucketForValue( 1u << MAX_BITS ), TSketch::k_nBuckets-1 );
+	CHECK_EQUAL( TSketch::BucketForValue( 0xffffffffu ), TSketch::k_nBuckets-1 );
+}
+
+static void TestPercentileSketch()
+{
+	Printf( "TestPercentileSketch\n" );
+	typedef PercentileSketch<int,16,4> Sketch;
+
+	CheckSketchBuckets<Sketch,16,4>();
+	CheckSketchBuckets< PercentileSketch<int,24,3>, 24, 3 >();
+	CheckSketchBuckets< PercentileSketch<uint8,7,6>, 7, 6 >();
+
+	// Percentiles in the exact range are exact.  Negative values count as zero
+	{
+		Sketch s;
+		for ( int x = 0 ; x < 10 ; ++x )
+			for ( int i = 0 ; i < 10 ; ++i )
+				s.AddSample( x );
+		CHECK_EQUAL( s.NumSamples(), 100 );
+		CHECK_EQUAL( s.GetPercentile( .05f ), 0 );
+		CHECK_EQUAL( s.GetPercentile( .5f ), 5 );
+		CHECK_EQUAL( s.GetPercentile( .95f ), 9 );
+		s.Clear();
+		s.AddSample( -5 );
+		CHECK_EQUAL( s.GetPercentile( .5f ), 0 );
+	}
+
+	// Within a bucket, we interpolate as if the samples were spread evenly
+	{
+		Sketch s;
+		const int nMin = 1024;
+		const int nWidth = (int)Sketch::BucketMinValue( Sketch::BucketForValue( nMin ) + 1 ) - nMin;
+		CHECK_EQUAL( nWidth, 64 );
+		for ( int x = nMin ; x < nMin+nWidth ; ++x )
+			s.AddSample( x );
+		CHECK_EQUAL( s.GetPercentile( .25f ), nMin + 16 );
+		CHECK_EQUAL( s.GetPercentile( .5f ), nMin + 32 );
+		CHECK_EQUAL( s.GetPercentile( .75f ), nMin + 48 );
+	}
+
+	// When a bucket would overflow, all the counts are halved, so the
+	// shape of the distribution is kept
+	{
+		Sketch s;
+		for ( int i = 0 ; i < 1000 ; ++i )
+			s.AddSample( 10 );
+		for ( int i = 0 ; i < 0xffff ; ++i )
+			s.AddSample( 3 );
+		CHECK_EQUAL( s.NumSamples(), 1000 + 0xffff );
+		s.AddSample( 3 );
+		CHECK_EQUAL( s.NumSamples(), 500 + 0x8000 );
+		CHECK_EQUAL( s.NumSamplesTotal(), 1000 + 0x10000 );
+		CHECK_EQUAL( s.GetPercentile( .5f ), 3 );
+		CHECK_EQUAL( s.GetPercentile( .99f ), 10 );
+	}
+
+	// Merging gives the same result as adding all the samples to one sketch
+	{
+		Sketch a, b, all;
+		for ( int i = 0 ; i < 5000 ; ++i )
+		{
+			int x = ( i * 7919 ) % 3000;
+			a.AddSample( x );
+			all.AddSample( x );
+			int y = 2000 + ( i * 104729 ) % 40000;
+			b.AddSample( y );
+			all.AddSample( y );
+		}
+		Sketch merged = a;
+		merged.Merge( b );
+		CHECK( memcmp( &merged, &all, sizeof(all) ) == 0 );
+		CHECK_EQUAL( merged.NumSamples(), 10000 );
+		CHECK_EQUAL( merged.NumSamplesTotal(), 10000 );
+		CHECK_EQUAL( merged.GetPercentile( .5f ), all.GetPercentile( .5f ) );
+	}
+
+	// If the merged counts would overflow, both sides are scaled down
+	{
+		Sketch a, b;
+		for ( int i = 0 ; i < 40000 ; ++i )
+		{
+			a.AddSample( 100 );
+			b.AddSample( 100 );
+		}
+		for ( int i = 0 ; i < 1000 ; ++i )
+			b.AddSample( 5000 );
+		a.Merge( b );
+		CHECK_EQUAL( a.NumSamples(), 40000 + 500 );
+		CHECK_EQUAL( a.NumSamplesTotal(), 81000 );
+		CHECK_EQUAL( Sketch::BucketForValue( a.GetPercentile( .5f ) ), Sketch::BucketForValue( 100 ) );
+		CHECK_EQUAL( Sketch::BucketForValue( a.GetPercentile( .999f ) ), Sketch::BucketForValue( 5000 ) );
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////
+//
+// main
+//
+/////////////////////////////////////////////////////////////////////////////
+
+int main()
+{
+	if ( !SteamNetworkingSockets_VirtualNetwork_Enable( k_usecVirtualLatency ) )
+	{
+		fprintf( stderr, "SteamNetworkingSockets_VirtualNetwork_Enable failed\n" );
+		return 1;
+	}
+
+	SteamDatagramErrMsg errMsg;
+	if ( !GameNetworkingSockets_Init( nullptr, errMsg ) )
+	{
+		fprintf( stderr, "GameNetworkingSockets_Init failed.  %s\n", errMsg );
+		return 1;
+	}
+	SteamNetworkingSockets_SetDebugOutputFunction( k_ESteamNetworkingSocketsDebugOutputType_Warning, DebugOutput );
+
+	TestVirtualNetworkDeterminism();
+	TestPacingQuantum();
+	TestPathMTUDiscovery();
+	TestRecvRingBuffer();
+	TestReliableStreamDecode();
+	TestUnreliableReassembly();
+	TestLaneScheduling();
+	TestUnorderedDelivery();
+	TestAckFrequency();
+	TestStreaming();
+	TestBBRQueueDelay();
+	TestConnectionHandleTable();
+	TestStaleConnectionHandle();
+	TestLinkStatsWireRoundTrip();
+	TestPercentileSketch();
+
+	GameNetworkingSockets_Kill();
+
+	if ( g_nFailures )
+	{
+		Printf( "%d check(s) failed\n", g_nFailures );
+		return 1;
+	}
+	Printf( "All tests passed\n" );
+	return 0;
+}
@@ -0,0 +1,120 @@
+// Decode a binary packet trace recorded with SteamNetworkingSockets_StartPacketTrace
+// into CSV (the default) or JSON.  Events are printed oldest first.  Usage:
+//
+//   trace_decode [-json] [-conn handle] tracefile
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#define COMPILE_TIME_ASSERT( x ) static_assert( x, #x )
+#define PACKETTRACE_FORMAT_ONLY
+#include "../src/steamnetworkingsockets/clientlib/steamnetworkingsockets_packettrace.h"
+
+using namespace SteamNetworkingSocketsLib;
+
+static const char *EventTypeName( uint8 eType )
+{
+	switch ( eType )
+	{
+		case k_EPacketTraceEvent_SNPSend: return "send";
+		case k_EPacketTraceEvent_SNPRecv: return "recv";
+		case k_EPacketTraceEvent_SNPLoss: return "loss";
+		case k_EPacketTraceEvent_RawSend: return "rawsend";
+		case k_EPacketTraceEvent_RawRecv: return "rawrecv";
+	}
+	return "unknown";
+}
+
+int main( int argc, const char **argv )
+{
+	bool bJSON = false;
+	uint32 hConnFilter = 0;
+	const char *pszFilename = nullptr;
+	for ( int i = 1 ; i < argc ; ++i )
+	{
+		if ( !strcmp( argv[i], "-json" ) )
+			bJSON = true;
+		else if ( !strcmp( argv[i], "-conn" ) && i+1 < argc )
+			hConnFilter = (uint32)strtoul( argv[++i], nullptr, 0 );
+		else if ( argv[i][0] != '-' && !pszFilename )
+			pszFilename = argv[i];
+		else
+		{
+			pszFilename = nullptr;
+			break;
+		}
+	}
+	if ( !pszFilename )
+	{
+		fprintf( stderr, "Usage: trace_decode [-json] [-conn handle] tracefile\n" );
+		return 1;
+	}
+
+	FILE *f = fopen( pszFilename, "rb" );
+	if ( !f )
+	{
+		fprintf( stderr, "Can't open %s\n", pszFilename );
+		return 1;
+	}
+
+	PacketTraceFileHeader_t hdr;
+	if ( fread( &hdr, sizeof(hdr), 1, f ) != 1
+		|| memcmp( hdr.m_szMagic, PACKETTRACE_FILE_MAGIC, sizeof(hdr.m_szMagic) ) != 0 )
+	{
+		fprintf( stderr, "%s is not a packet trace file\n", pszFilename );
+		return 1;
+	}
+	if ( hdr.m_nVersion != k_nPacketTraceFileVersion || hdr.m_cbEvent != sizeof(PacketTraceEvent_t) || hdr.m_nCapacity == 0 )
+	{
+		fprintf( stderr, "%s has unsupported version %u (event size %u)\n", pszFilename, hdr.m_nVersion, hdr.m_cbEvent );
+		return 1;
+	}
+
+	std::vector<PacketTraceEvent_t> vecEvents( (size_t)hdr.m_nCapacity );
+	size_t nRead = fread( vecEvents.data(), sizeof(PacketTraceEvent_t), vecEvents.size(), f );
+	fclose( f );
+	if ( nRead < vecEvents.size() )
+	{
+		fprintf( stderr, "%s is truncated\n", pszFilename );
+		return 1;
+	}
+
+	// Figure out which events are present.  If the ring wrapped, the oldest
+	// ones have been overwritten
+	uint64 nEnd = hdr.m_nEventsWritten;
+	uint64 nBegin = nEnd > hdr.m_nCapacity ? nEnd - hdr.m_nCapacity : 0;
+
+	if ( bJSON )
+		printf( "{\n\t\"conn_filter\": %u,\n\t\"events_written\": %llu,\n\t\"events\": [", hdr.m_hConnFilter, (unsigned long long)hdr.m_nEventsWritten );
+	else
+		printf( "time_ms,event,conn,pkt_num,size,segments,ack_blocks,ack_pkt_num,rtt_usec,token_bucket,send_rate,remote_port\n" );
+
+	bool bFirst = true;
+	for ( uint64 n = nBegin ; n < nEnd ; ++n )
+	{
+		const PacketTraceEvent_t &e = vecEvents[ n % hdr.m_nCapacity ];
+		if ( hConnFilter != 0 && e.m_hConn != hConnFilter )
+			continue;
+		double flTimeMS = ( e.m_usecTime - hdr.m_usecStart ) * 1e-3;
+		if ( bJSON )
+		{
+			printf( "%s\n\t\t{ \"time_ms\": %.3f, \"event\": \"%s\", \"conn\": %u, \"pkt_num\": %lld, \"size\": %u, \"segments\": %u, \"ack_blocks\": %d, \"ack_pkt_num\": %lld, \"rtt_usec\": %d, \"token_bucket\": %d, \"send_rate\": %d, \"remote_port\": %u }",
+				bFirst ? "" : ",",
+				flTimeMS, EventTypeName( e.m_eType ), e.m_hConn, (long long)e.m_nPktNum, e.m_cbSize, e.m_nSegments,
+				e.m_nAckBlocks, (long long)e.m_nAckPktNum, e.m_usecRTT, e.m_nTokenBucket, e.m_nSendRate, e.m_nRemotePort );
+		}
+		else
+		{
+			printf( "%.3f,%s,%u,%lld,%u,%u,%d,%lld,%d,%d,%d,%u\n",
+				flTimeMS, EventTypeName( e.m_eType ), e.m_hConn, (long long)e.m_nPktNum, e.m_cbSize, e.m_nSegments,
+				e.m_nAckBlocks, (long long)e.m_nAckPktNum, e.m_usecRTT, e.m_nTokenBucket, e.m_nSendRate, e.m_nRemotePort );
+		}
+		bFirst = false;
+	}
+
+	if ( bJSON )
+		printf( "\n\t]\n}\n" );
+	return 0;
+}